@@ -1,9 +1,76 @@
 #ifndef COMMANDS_H_
 #define COMMANDS_H_
 
-#include "xim.h"
+#include "structures/piece_table.h"
+#include "structures/vector.h"
+#include "text/regex.h"
 #define MAX_COMMAND_LEN 256
 
-enum SIGNALS parseCommandFromBuffer(Vector *buffer);
+// Ex commands ("3,5d", "%j", "'a,'bm0"). Names are found in a table sorted
+// by name where every command has the shortest abbreviation it answers to,
+// like vim's: "d", "del" and "delete" are the same command, "m" is move
+// while "ma" is mark. Handlers only see the document and the parsed line
+// range, the editor turns what they did into a cursor move and a redraw.
 
-#endif
\ No newline at end of file
+#define EX_MARKS 26
+#define EX_NO_MARK ((size_t) -1)
+
+enum EX_COMMAND_FLAGS {
+    EX_RANGE = 1, // takes a range, the current line when none is typed
+    EX_BANG = 2, // "q!"
+    EX_ADDRESS = 4, // the argument is one more address, "co$" "m0"
+    EX_MARK = 8, // the argument is a mark name
+    EX_TEXT = 16 // the rest of the command is its argument, "\|" does not end it
+};
+
+// Lines [first, last], zero based
+typedef struct {
+    size_t first;
+    size_t last;
+    int given; // how many addresses were typed: 0, 1 or 2
+} ExRange;
+
+typedef struct {
+    PieceTable *document;
+    size_t cursor; // byte offset, where the command leaves the cursor when done
+    size_t *marks; // EX_MARKS offsets in their lines, EX_NO_MARK when not set
+    // The last search or substitute pattern and :s replacement: an empty
+    // pattern reuses the one, ":s" alone both. A new pattern takes the
+    // place of the last. NULL when the caller keeps none.
+    Regex **lastPattern;
+    char **lastReplacement;
+    ExRange range;
+    int bang;
+    size_t address; // EX_ADDRESS: one based, 0 is above the first line
+    const char *argument; // what is left after the name, not NUL terminated
+    size_t argumentLength;
+    int quit; // set by :q
+    // :w hands the file name (empty for the document's own) to the editor,
+    // which writes the file and tells what it wrote or why it could not.
+    // NULL when there is nowhere to write.
+    const char *(*write)(const char *path, size_t length, const char **message);
+    const char *message; // what the last command that worked has to say, if anything
+    const char *error; // why the command failed, NULL when it did not
+} ExCall;
+
+typedef int(*ExHandler)(PieceTable *document, ExCall *call);
+
+typedef struct {
+    const char *name;
+    unsigned char abbreviation; // shortest prefix that runs it
+    unsigned char flags;
+    ExHandler handler;
+} ExCommand;
+
+const ExCommand *findExCommand(const char *name, size_t length);
+// Marks are offsets kept up with the document's changes, a mark stays in the
+// line it was set on: length bytes at offset took the place of removed ones,
+// the marks after them move with their text, those in what went to where it was
+void moveExMarks(size_t *marks, size_t offset, size_t removed, size_t length);
+int parseExRange(ExCall *call, const char **text, const char *end);
+int parseExCommand(ExCall *call, const char **text, const char *end, const ExCommand **command);
+int runExCommands(ExCall *call, const char *text, size_t length);
+
+enum SIGNALS parseCommandFromBuffer(Vector *buffer, const char **error);
+
+#endif
@@ -1,34 +1,71 @@
 #ifndef CONSOLE_H_
 #define CONSOLE_H_
-#include <Windows.h>
+#include <stddef.h>
 #include "types.h"
 
 enum WriteType {
-    TEXT = 0,
-    DIGIT,
-    TYPE_FLOAT
+    WRITE_TEXT = 0,
+    WRITE_DIGIT,
+    WRITE_FLOAT
 };
 
+enum CONSOLE_EVENTS {
+    CONSOLE_EVENT_NONE = 0,
+    CONSOLE_EVENT_KEY,
+    CONSOLE_EVENT_RESIZE,
+    CONSOLE_EVENT_CLOSED // no input will ever come again
+};
+
+enum CONSOLE_WAIT {
+    CONSOLE_WAIT_TIMEOUT = 0,
+    CONSOLE_WAIT_INPUT, // readInput has something, a resize or the console closing included
+    CONSOLE_WAIT_WAKEUP // woken through wake, from another thread most likely
+};
+
+// Most events a single read hands over, a paste arrives in chunks of this
+#define CONSOLE_INPUT_BATCH 4096
+
 typedef struct {
-    // hMainConsole:
-    // This is the main console, after the program is done, we go back to it.
-    // That's its only use.
-    HANDLE hOldConsole;
-    HANDLE hInput;
-    HANDLE windowsConsoleHandle;
-    struct {
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-    } Windows;
+    enum CONSOLE_EVENTS event;
+    KeyCode key; // for CONSOLE_EVENT_KEY
+    int pasted; // the key is part of a paste, not something typed
+} ConsoleInput;
+
+// What a platform has to provide to run the editor. The editor only talks to
+// the console through these, the backend is picked when building.
+typedef struct {
+    const char *name;
+    int(*initialize)();
+    int(*kill)();
+    // Current size of the visible window, in cells
+    int(*querySize)(Size2s *size);
+    // size.width x size.height cells, row after row, drawn at where
+    int(*writeCells)(Cell *cells, Vector2d where, Size2s size);
+    int(*setCursor)(Vector2d position);
+    // Sends whatever the backend still holds, called before waiting for input
+    int(*flush)();
+    // Sleeps until there is input, wake is called or timeout milliseconds
+    // pass, -1 waits for as long as it takes
+    enum CONSOLE_WAIT(*wait)(int timeout);
+    // Ends a wait early, safe to call from any thread
+    int(*wake)();
+    // Returns every event that is already waiting, at most capacity of them
+    // and at least one. Blocks only when called without waiting first.
+    size_t(*readInput)(ConsoleInput *events, size_t capacity);
+} ConsoleBackend;
+
+typedef struct {
+    const ConsoleBackend *backend;
 
     struct {
         struct {
-            DWORD lastReadCharsCount;
+            unsigned long lastReadCharsCount;
             wchar_t lastKeyCode;
             wchar_t character;
         } Input;
 
         struct {
-            DWORD lastWrittenCharsCount;
+            unsigned long lastWrittenCharsCount;
         } Output;
 
         struct {
@@ -41,12 +78,24 @@ typedef struct {
 
 extern Console console;
 
+#ifdef XIM_CONSOLE_WIN32
+extern const ConsoleBackend win32ConsoleBackend;
+#endif
+#ifdef XIM_CONSOLE_POSIX
+extern const ConsoleBackend posixConsoleBackend;
+#endif
+// Always built, draws into memory (see console/headless.h)
+extern const ConsoleBackend headlessConsoleBackend;
+
 int initializeConsole();
-int write(enum WriteType type, void *value, COORD where);
+int writeToConsole(enum WriteType type, void *value, Vector2d where);
 int killConsole();
-int writeWindowsBuffer(CHAR_INFO *buffer, COORD where, COORD size);
+int writeConsoleBuffer(Cell *buffer, Vector2d where, Size2s size);
+int flushConsole();
 int rerenderScreen();
 int setCursorPosition(Vector2d start, int next);
-KeyCode pollInputFromConsole();
+enum CONSOLE_WAIT waitForConsole(int timeout);
+int wakeConsole();
+size_t pollInputFromConsole(ConsoleInput *events, size_t capacity);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,37 @@
+#ifndef CONSOLE_ANSI_H_
+#define CONSOLE_ANSI_H_
+#include <stddef.h>
+#include "types.h"
+
+#define ANSI_NO_ATTRIBUTES 0xFFFF
+
+// Turns cells into the ANSI escape sequences a terminal draws them with.
+// The bytes pile up in data until the owner sends them and clears length.
+//
+// The writer keeps a copy of what the terminal shows and where its cursor is,
+// so it can pick the cheapest way to get somewhere (absolute, relative, CR/LF
+// or just printing over what is there), only send colors that change, and
+// clear blank row tails with one erase instead of spaces.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t size;
+    unsigned short attributes; // SGR state of the terminal, ANSI_NO_ATTRIBUTES when unknown
+    Size2s screen;
+    // What the terminal shows, ANSI_NO_ATTRIBUTES marks cells that are not known
+    Cell *shadow;
+    Vector2d cursor;
+    int cursorKnown;
+} AnsiWriter;
+
+void initialize_ansi_writer(AnsiWriter *writer);
+int ansi_append(AnsiWriter *writer, const char *bytes, size_t length);
+int ansi_append_string(AnsiWriter *writer, const char *text);
+int ansi_resize(AnsiWriter *writer, Size2s screen);
+int ansi_clear_screen(AnsiWriter *writer);
+int ansi_move_cursor(AnsiWriter *writer, Vector2d position);
+int ansi_set_attributes(AnsiWriter *writer, unsigned short attributes);
+int ansi_write_cells(AnsiWriter *writer, Cell *cells, Vector2d where, Size2s size);
+void free_ansi_writer(AnsiWriter *writer);
+
+#endif
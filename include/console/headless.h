@@ -0,0 +1,40 @@
+#ifndef CONSOLE_HEADLESS_H_
+#define CONSOLE_HEADLESS_H_
+#include <stddef.h>
+#include "types.h"
+#include "console.h"
+
+// A console with no terminal behind it: frames are drawn into an in-memory
+// grid, input comes from a script queued in advance, and the cost of every
+// frame is counted. Used to benchmark and test the render path.
+//
+//     console.backend = &headlessConsoleBackend;
+//     setHeadlessConsoleSize((Size2s) { 80, 24 });
+//     queueHeadlessText("ihello\x1b:q\r");
+
+typedef struct {
+    size_t frames; // flushes, one per input batch
+    size_t writeCalls; // writeCells calls
+    size_t cellsWritten;
+    size_t bytesWritten; // ANSI bytes a terminal would have received
+    size_t cursorMoves;
+    size_t keys; // keys read, bytesWritten / keys is the cost of a keystroke
+} HeadlessConsoleStats;
+
+void setHeadlessConsoleSize(Size2s size);
+int queueHeadlessKey(KeyCode key);
+int queueHeadlessText(const char *text);
+// Queued like a bracketed paste: delivered in one batch and marked as pasted
+int queueHeadlessPaste(const char *text);
+// How many queued typed events one read hands over, 1 unless set (typing ahead)
+void setHeadlessInputBatch(size_t events);
+int queueHeadlessResize(Size2s size);
+// Totals since the last reset, and the cost of the last and costliest frame
+HeadlessConsoleStats headlessConsoleStats();
+HeadlessConsoleStats headlessConsoleLastFrame();
+HeadlessConsoleStats headlessConsoleMaxFrame();
+void resetHeadlessConsoleStats();
+Cell *headlessConsoleCells();
+Vector2d headlessConsoleCursor();
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+#include <stddef.h>
+
+// The editor's main loop waits in one place for whatever comes first: input,
+// a resize, a timer or a wakeup from another thread. Nothing spins, an idle
+// editor sleeps in the console backend's wait until something happens.
+//
+//     while (running) {
+//         if (waitForEvents()) { ...read and handle the input... }
+//         runDeferredWork();
+//         ...draw the frame...
+//     }
+
+// Timers: returning 1 runs the timer again after the same delay.
+// Deferred work: returning 1 means there is more to do, it runs again on the
+// next turn of the loop, so long jobs are done a slice at a time between keys.
+// Posted callbacks: the return value is ignored.
+typedef int(*EventCallback)(void *data);
+
+int initializeEventLoop();
+void killEventLoop();
+
+// Milliseconds on a clock that only moves forward
+unsigned long long eventLoopTime();
+
+// Runs callback once delay milliseconds have passed, returns an id for
+// cancelTimer, 0 when the timer could not be added
+int addTimer(unsigned long delay, EventCallback callback, void *data);
+int cancelTimer(int id);
+
+// Runs callback after the input being handled, before the next frame.
+// Deferring the same callback and data twice runs it once.
+int deferWork(EventCallback callback, void *data);
+int cancelDeferredWork(EventCallback callback, void *data);
+int runDeferredWork();
+
+// The only calls that are safe from other threads: callback runs on the
+// editor's thread on the next turn of the loop
+int postToEventLoop(EventCallback callback, void *data);
+int wakeEventLoop();
+
+// Flushes the frame, waits for the next event and runs the timers and posted
+// callbacks that are due. Returns 1 when the console has input to read.
+int waitForEvents();
+
+#endif
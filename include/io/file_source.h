@@ -0,0 +1,42 @@
+#ifndef FILE_SOURCE_H_
+#define FILE_SOURCE_H_
+#include <stddef.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+// A read-only view of a file's bytes. The file is memory mapped, so only the
+// pages that are actually touched (usually what is on screen) get read in.
+typedef struct {
+    const char *data;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} FileSource;
+
+// Bytes of a file mapped on their own, from anywhere in it: a file that
+// grew after it was opened is read a region at a time, the part it grew by
+typedef struct {
+    const char *data;
+    size_t length;
+    void *view; // what is mapped, from the page boundary at or before data
+    size_t viewLength;
+} FileRegion;
+
+FileSource *open_file_source(const char *path);
+void close_file_source(FileSource *source);
+// The size of the source's file now, which may be past source->length
+int file_source_size(FileSource *source, size_t *size);
+// Maps [offset, offset + length) of the source's file, all of it has to be in the file
+int map_file_region(FileSource *source, size_t offset, size_t length, FileRegion *region);
+void unmap_file_region(FileRegion *region);
+
+// ".name<suffix>" in the directory of path, for the caller to free. Files
+// that go with another one (journal, a save being written) live there.
+char *hidden_sibling_path(const char *path, const char *suffix);
+
+#endif
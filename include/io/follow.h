@@ -0,0 +1,59 @@
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+#include "io/file_source.h"
+
+// Milliseconds between two looks at the file's size where nothing tells us
+// that it changed
+#define FOLLOW_POLL_DELAY 250
+
+// Brings what is appended to a document's file into the document, the way
+// "less +F" does. Only the bytes the file grew by are mapped and indexed:
+// they are one more buffer of the table, mapped again a little longer each
+// time the file grows, so taking an append in costs what was appended
+// whatever the size of the file. On Linux inotify says when the file
+// changed or went away, elsewhere a timer looks at its size.
+typedef struct FileFollower FileFollower;
+
+enum FOLLOW_EVENTS {
+    FOLLOW_GREW = 0, // length bytes at offset came in
+    // The file got shorter (truncated, rewritten): the document could point
+    // into bytes that are gone, it was emptied unread and holds the file as
+    // it is now, length bytes from offset 0. Its history went too, what
+    // journals it starts over (journal_rebase).
+    FOLLOW_RELOADED,
+    // The file was moved, deleted or lost its last name: what it grew by
+    // until then came in, the following stopped. offset and length are 0.
+    FOLLOW_GONE
+};
+
+// Told on the editor's thread what happened to the file
+typedef void (*FollowCallback)(void *data, enum FOLLOW_EVENTS event, size_t offset, size_t length);
+
+// table was made from source, the file's bytes past source->length are the
+// ones to come in
+FileFollower *open_follower(PieceTable *table, FileSource *source);
+// Unmaps what came in: after the table is freed, or once nothing reads it
+void close_follower(FileFollower *follower);
+// Before the document is written over its file, while nothing is followed:
+// the follower lets go of the file, what came in stays in the table. If
+// the write failed the old file is followed again from where it was.
+int follower_release(FileFollower *follower);
+// The document was written over its file, length bytes: the file is
+// followed from there, opened again once the following starts
+void follower_written(FileFollower *follower, size_t length);
+// Watches the file at path, what it grew by since the last look comes in at once
+int start_following(FileFollower *follower, const char *path, FollowCallback callback, void *data);
+// What came in stays in the document
+void stop_following(FileFollower *follower);
+int follower_watching(FileFollower *follower);
+// Takes in what the file grew by since the last look, or all of it again
+// when it got shorter. Returns 1 when the bytes could not be mapped.
+int follower_catch_up(FileFollower *follower);
+// What came in since the last call (or since the file was read again), as a
+// span of the table's buffer at the document's end, for journal_extend_base.
+// Returns 0 when nothing did.
+int follower_take_appended(FileFollower *follower, unsigned int *buffer, size_t *start, size_t *length);
+
+#endif
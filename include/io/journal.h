@@ -0,0 +1,62 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+
+// Bytes of journal past which it is rewritten as one snapshot of the document
+#define JOURNAL_COMPACT_SIZE ((size_t) 1 << 20)
+// Milliseconds a written change may wait for its fsync
+#define JOURNAL_SYNC_DELAY 1000
+
+// An append-only log of a document's changes, kept next to its file so they
+// can be replayed onto it after a crash. Every change is one checksummed
+// record holding only the text it put in, text the file already has as
+// where the file has it: the cost of journaling is the edit's, never the
+// document's. Records are written once per turn of the
+// event loop, fsync'd on a timer, and when the log grows too long it is
+// rewritten as a snapshot (the document as edits to the file) on a
+// background thread.
+typedef struct Journal Journal;
+
+// One editor at a time journals a file, any other leaves the journal alone:
+// neither replays it nor writes over it. The lock is a file beside the
+// journal (its path with this after it) holding the editor's process id.
+#define JOURNAL_LOCK_SUFFIX ".lock"
+typedef struct JournalLock JournalLock;
+
+// ".name.swp" in the file's directory, for the caller to free
+char *journal_path(const char *path);
+
+// Locks the journal at path for this editor, before it is replayed. NULL
+// when it can't: holder is then the id of the process holding it, 0 when
+// nobody does (the lock could not be made).
+JournalLock *lock_journal(const char *path, long *holder);
+void unlock_journal(JournalLock *lock);
+
+// Starts a journal of table at path, replacing what was there with a
+// snapshot of the table. From then on the journal follows every change, the
+// table's observer (if any) still hears of them after it. It holds lock,
+// from lock_journal or NULL, until it is closed.
+Journal *open_journal(const char *path, PieceTable *table, JournalLock *lock);
+// discard removes the file as well, when there is nothing left to recover
+void close_journal(Journal *journal, int discard);
+// The document was just saved: the journal starts over from the saved file
+int journal_rebase(Journal *journal);
+// The file grew by what the table holds as [start, start + length) of
+// buffer at the document's end (a followed file): replay starts from the
+// longer file
+int journal_extend_base(Journal *journal, unsigned int buffer, size_t start, size_t length);
+
+void set_journal_compact_size(Journal *journal, size_t bytes);
+size_t journal_size(Journal *journal);
+int journal_compacting(Journal *journal);
+int journal_flush(Journal *journal);
+int journal_sync(Journal *journal);
+
+// Replays the journal at path onto table, which has to hold its original
+// untouched, and counts the changes it made. Stops at the first torn or
+// damaged record. Returns 1 when there is no journal or it is not of this
+// original.
+int replay_journal(const char *path, PieceTable *table, size_t *changes);
+
+#endif
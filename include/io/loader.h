@@ -0,0 +1,24 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+
+// Milliseconds between two looks at how far the count got
+#define LOADER_POLL_DELAY 50
+
+// Counts the lines of a lazily indexed table's original on another thread,
+// chunk after chunk from the top, and hands the counts to the table on the
+// editor's thread as they come. Nothing waits for it: a lookup that needs a
+// chunk before the thread got there has the table count that chunk itself.
+typedef struct DocumentLoader DocumentLoader;
+
+// Told on the editor's thread how many bytes of the original are counted
+typedef void (*LoaderProgress)(void *data, size_t counted, size_t length);
+
+// progress may be NULL
+DocumentLoader *start_loader(PieceTable *table, LoaderProgress progress, void *data);
+// Stops the thread if it still runs, the counts it made so far are kept
+void stop_loader(DocumentLoader *loader);
+int loader_done(DocumentLoader *loader);
+
+#endif
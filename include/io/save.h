@@ -0,0 +1,26 @@
+#ifndef SAVE_H_
+#define SAVE_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+#include "io/file_source.h"
+
+// Spans of the original at least this long are copied file to file
+#define SAVE_COPY_SIZE ((size_t) 1 << 20)
+// Pieces handed to the system in one write
+#define SAVE_BATCH 64
+
+// Writes the document to path piece after piece, straight from the buffers
+// the pieces point into: nothing is flattened into one string first and the
+// memory used does not depend on the document. The text goes to a new file
+// beside path which is synced and then renamed over it, path holds the old
+// file or the new one whatever happens. It keeps the old one's owner and
+// permissions, a symbolic link is followed. A file of more than one link is
+// written in place instead, the table copies the buffers it points into first. source is the file behind the
+// table's original, where the system can its long spans are copied from it
+// without going through the editor at all. Windows can't replace a mapped
+// file: saving over the source's file copies the original into the table
+// and leaves the source on the new file, unmapped. Nothing may read the
+// original on another thread while it saves.
+int save_piece_table(PieceTable *table, const char *path, FileSource *source);
+
+#endif
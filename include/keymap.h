@@ -0,0 +1,86 @@
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+#include <stddef.h>
+#include "types.h"
+#include "structures/vector.h"
+
+// Key bindings compiled into a trie. Every node of every keymap lives in one
+// array and the edges are kept in a hash table keyed by (node, key), so each
+// key typed is one lookup whatever the number of bindings.
+//
+// Sequences are written like vim's: "dd", "gg", "<Esc>", "<CR>", "<C-r>". Counts
+// ("3dw") are not part of the bindings, the dispatcher collects the digits
+// in front of a command on its own.
+
+enum KEYMAP_BINDINGS {
+    KEYMAP_NONE = 0, // a prefix of other bindings only
+    KEYMAP_COMMAND, // runs on its own
+    KEYMAP_MOTION, // moves the cursor, or gives the range of a pending operator
+    KEYMAP_OPERATOR // waits for a motion, "dd" (the key doubled) means whole lines
+};
+
+enum KEYMAP_RESULTS {
+    KEYMAP_HANDLED = 0,
+    KEYMAP_PENDING, // the key started or continued a sequence, a count or an operator
+    KEYMAP_UNBOUND // nothing is bound to it, the caller may treat it as text
+};
+
+typedef struct KeymapCall KeymapCall;
+
+// Where a motion lands when started at from
+typedef size_t(*KeymapMotion)(size_t from, KeymapCall *call);
+typedef int(*KeymapHandler)(KeymapCall *call);
+
+struct KeymapCall {
+    size_t count; // 1 when no count was typed
+    int hasCount;
+    KeyCode key; // the last key of the sequence
+    // Operators only: the motion typed after them, NULL for a doubled operator
+    KeymapMotion motion;
+    int linewise; // the motion works on whole lines (j, k, gg, dd...)
+};
+
+typedef struct {
+    enum KEYMAP_BINDINGS kind;
+    KeymapHandler handler; // commands and operators
+    KeymapMotion motion;
+    int linewise; // motions only
+    unsigned short symbol; // operators: the key that doubles them
+    int children;
+} KeymapNode;
+
+typedef struct Keymap {
+    int root; // node index in the shared trie
+    // A motion typed with no operator pending is handed to this, it moves the cursor
+    KeymapHandler move;
+    // Looked in while an operator waits for its motion, NULL for no operators
+    struct Keymap *operatorPending;
+    int counts; // digits in front of a command are a count
+} Keymap;
+
+// Where a dispatcher is in the middle of a sequence
+typedef struct {
+    Keymap *keymap; // the table the pending keys were looked up in
+    int node; // -1 when no sequence is pending
+    size_t count;
+    int hasCount;
+    // An operator waiting for its motion
+    KeymapHandler operator;
+    unsigned short operatorSymbol;
+    size_t operatorCount;
+    int operatorHasCount;
+} KeymapState;
+
+int initializeKeymaps();
+void killKeymaps();
+Keymap *createKeymap(KeymapHandler move, int counts);
+
+unsigned short keymapSymbol(KeyCode key);
+int bindCommand(Keymap *keymap, const char *sequence, KeymapHandler handler);
+int bindMotion(Keymap *keymap, const char *sequence, KeymapMotion motion, int linewise);
+int bindOperator(Keymap *keymap, const char *sequence, KeymapHandler handler);
+
+void resetKeymapState(KeymapState *state);
+enum KEYMAP_RESULTS dispatchKey(KeymapState *state, Keymap *keymap, KeyCode key);
+
+#endif
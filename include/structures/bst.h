@@ -5,6 +5,13 @@
 #include <string.h>
 #include "types.h"
 #include "structures/vector.h"
+#include "structures/pool.h"
+
+enum BINARY_TREE_NODE_DIRECTION {
+    BINARY_TREE_NODE_LEFT = 0,
+    BINARY_TREE_NODE_RIGHT,
+    BINARY_TREE_NODE_NONE
+};
 
 typedef struct BinaryTreeNode BinaryTreeNode;
 struct BinaryTreeNode {
@@ -15,12 +22,6 @@ struct BinaryTreeNode {
     enum BINARY_TREE_NODE_DIRECTION direction_from_parent;
 };
 
-enum BINARY_TREE_NODE_DIRECTION {
-    BINARY_TREE_NODE_LEFT = 0,
-    BINARY_TREE_NODE_RIGHT,
-    BINARY_TREE_NODE_NONE
-};
-
 typedef struct {
     BinaryTreeNode *node;
     enum BINARY_TREE_NODE_DIRECTION direction;
@@ -31,6 +32,7 @@ typedef struct {
     size_t type_size;
     size_t size;
     short(*compare)(void *a, void *b);
+    NodePool *pool; // nodes and their values, allocated together
     BinaryTreeNode *root;
 } BinaryTree;
 
@@ -0,0 +1,122 @@
+#ifndef PIECE_TABLE_H_
+#define PIECE_TABLE_H_
+#include "types.h"
+#include "structures/vector.h"
+#include "structures/rbt.h"
+
+enum PIECE_BUFFERS {
+    PIECE_BUFFER_ORIGINAL = 0,
+    PIECE_BUFFER_ADDED
+};
+
+// A lazily indexed buffer is indexed a chunk at a time, when something first
+// needs that chunk: its newlines counted, its line starts scanned
+#define PIECE_BUFFER_CHUNK_SIZE ((size_t) 1 << 20)
+#define PIECE_BUFFER_UNCOUNTED ((size_t) -1)
+
+typedef struct {
+    size_t newlines; // PIECE_BUFFER_UNCOUNTED until counted
+    Vector *lineStarts; // size_t offsets in the buffer, NULL until scanned
+} PieceBufferChunk;
+
+typedef struct {
+    char *base;
+    size_t len;
+    size_t size; // allocated bytes, 0 when the table does not own the memory
+    // size_t offsets of every line start in the buffer, the first one is 0.
+    // NULL when the buffer is lazily indexed, chunks has them instead.
+    Vector *lineStartsOffsets;
+    PieceBufferChunk *chunks;
+} PieceBuffer;
+
+// A span of one of the table's buffers, the document is all pieces in order.
+typedef struct {
+    unsigned int buffer;
+    // A whole chunk nobody counted yet, newlines is 0 until it is: line
+    // lookups count the pending pieces ahead of what they look for first
+    unsigned int pending;
+    size_t start;
+    size_t length;
+    size_t newlines; // kept in sync with start/length by set_piece_span
+} Piece;
+
+typedef struct PieceTableHistory PieceTableHistory;
+
+// Told of every change once it is made: length bytes at offset took the
+// place of removed ones. A change of several edits reports each in turn.
+typedef void (*PieceTableObserver)(void *data, size_t offset, size_t removed, size_t length);
+
+typedef struct {
+    RedBlackTree *pieces;
+    Vector *buffers; // PieceBuffer, indexed by enum PIECE_BUFFERS, then those piece_table_add_buffer adds
+    // Typing right where the last insert ended grows its piece in place
+    RedBlackTreeNode *last_insert;
+    size_t last_insert_end;
+    PieceTableHistory *history; // NULL unless piece_table_enable_history was called
+    PieceTableObserver observer; // NULL when nobody follows the changes
+    void *observer_data;
+} PieceTable;
+
+// Walks the document one contiguous chunk (part of a piece) at a time
+typedef struct {
+    PieceTable *table;
+    RedBlackTreeIterator pieces;
+    const char *text; // NULL past the end
+    size_t length;
+    size_t offset; // document offset of text[0]
+} PieceTableIterator;
+
+// length bytes at offset become text, for piece_table_replace. Without a
+// text they become [start, start + textLength) of buffer, nothing is copied.
+typedef struct {
+    size_t offset;
+    size_t length;
+    const char *text;
+    size_t textLength;
+    unsigned int buffer;
+    size_t start;
+} PieceTableEdit;
+
+PieceTable *initialize_piece_table(const char *original, size_t length);
+PieceTable *initialize_lazy_piece_table(const char *original, size_t length);
+// Newline counts of original chunks [first, first + count), counted elsewhere
+void piece_table_set_chunk_newlines(PieceTable *table, size_t first, const size_t *newlines, size_t count);
+size_t piece_table_pending(PieceTable *table);
+int piece_table_add_buffer(PieceTable *table, const char *base, size_t length, unsigned int *buffer);
+int piece_table_grow_buffer(PieceTable *table, unsigned int buffer, const char *base, size_t length);
+// Copies a buffer the table only points into, it can't be grown after
+int piece_table_own_buffer(PieceTable *table, unsigned int buffer);
+int piece_table_append(PieceTable *table, unsigned int buffer, size_t start, size_t length);
+int piece_table_clear(PieceTable *table);
+int piece_table_insert(PieceTable *table, size_t offset, const char *text, size_t length);
+int piece_table_delete(PieceTable *table, size_t offset, size_t length);
+RedBlackTree *piece_table_cut(PieceTable *table, size_t offset, size_t length);
+int piece_table_paste(PieceTable *table, size_t offset, RedBlackTree *pieces);
+int piece_table_replace(PieceTable *table, const PieceTableEdit *edits, size_t count);
+size_t piece_table_length(PieceTable *table);
+size_t piece_table_read(PieceTable *table, size_t offset, char *out, size_t length);
+size_t piece_table_chunk_at(PieceTable *table, size_t offset, const char **text);
+PieceBuffer *piece_table_buffer(PieceTable *table, unsigned int buffer);
+size_t piece_table_count_newlines(PieceTable *table, Piece *piece);
+size_t piece_table_line_count(PieceTable *table);
+size_t piece_table_line_at(PieceTable *table, size_t offset);
+size_t piece_table_line_start(PieceTable *table, size_t line);
+int piece_table_iterator_seek(PieceTableIterator *iterator, PieceTable *table, size_t offset);
+int piece_table_iterator_next(PieceTableIterator *iterator);
+int piece_table_iterator_prev(PieceTableIterator *iterator);
+void free_piece_table(PieceTable *table);
+
+// Undo history. Inserts, deletes and replaces are recorded into the open
+// transaction, commit closes it. Undo and redo take a whole transaction back
+// or forward again and give the offset where its changes start.
+int piece_table_enable_history(PieceTable *table);
+void piece_table_commit(PieceTable *table);
+int piece_table_undo(PieceTable *table, size_t *offset);
+int piece_table_redo(PieceTable *table, size_t *offset);
+// Whether the text differs from what it was at the last piece_table_mark_saved
+// (or when the history was enabled), by where the history stands: undoing
+// back to it is unmodified again. Without a history nothing is modified.
+void piece_table_mark_saved(PieceTable *table);
+int piece_table_modified(PieceTable *table);
+
+#endif
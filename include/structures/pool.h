@@ -0,0 +1,31 @@
+#ifndef POOL_H_
+#define POOL_H_
+#include <stddef.h>
+
+#define NODE_POOL_ALIGNMENT 16
+#define NODE_POOL_ALIGN(SIZE) (((SIZE) + NODE_POOL_ALIGNMENT - 1) & ~((size_t) NODE_POOL_ALIGNMENT - 1))
+
+typedef struct NodePoolSlab NodePoolSlab;
+struct NodePoolSlab {
+    NodePoolSlab *next;
+};
+
+// Hands out fixed size blocks carved from big slabs. Released blocks are
+// recycled, and the whole pool goes away by freeing its few slabs.
+typedef struct {
+    size_t block_size;
+    size_t slab_blocks; // blocks in the next slab, doubles up to a cap
+    NodePoolSlab *slabs;
+    void *free_list;
+    char *cursor;
+    char *end;
+    size_t references; // owners sharing the pool
+} NodePool;
+
+NodePool *initialize_node_pool(size_t block_size);
+void *pool_alloc(NodePool *pool);
+void pool_release(NodePool *pool, void *block);
+NodePool *retain_node_pool(NodePool *pool);
+void free_node_pool(NodePool *pool);
+
+#endif
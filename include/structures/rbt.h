@@ -3,6 +3,7 @@
 #include "types.h"
 #include "structures/vector.h"
 #include "structures/bst.h"
+#include "structures/pool.h"
 
 enum RBT_COLOR {
     RBT_COLOR_RED,
@@ -15,11 +16,23 @@ typedef struct {
     enum BINARY_TREE_NODE_DIRECTION direction;
 } RedBlackTreeNodeDirection;
 
+// Summary of a whole subtree, kept up to date by the tree when it was
+// initialized with a measure function (positional trees, e.g. pieces).
+typedef struct {
+    size_t length;
+    size_t newlines;
+    size_t pending; // measured units not known yet, e.g. pieces not counted
+    size_t nodes; // kept for every tree, measured or not
+} RedBlackTreeAggregate;
+
 typedef struct {
     enum DATA_TYPES type;
     size_t type_size;
     size_t size;
     short(*compare)(void *a, void *b);
+    // Optional: measures a single value, the tree sums it over subtrees
+    void(*measure)(void *value, RedBlackTreeAggregate *aggregate);
+    NodePool *pool; // nodes and their values, allocated together
     RedBlackTreeNode *root;
 } RedBlackTree;
 
@@ -30,13 +43,50 @@ struct RedBlackTreeNode {
     RedBlackTreeNode *right;
     RedBlackTreeNode *parent;
     enum BINARY_TREE_NODE_DIRECTION direction_from_parent;
+    RedBlackTreeAggregate aggregate;
 };
 
+// In-order cursor over a tree. before is the aggregate of every node in
+// front of node, only maintained for measured trees.
+typedef struct {
+    RedBlackTree *tree;
+    RedBlackTreeNode *node; // NULL once walked off either end
+    RedBlackTreeAggregate before;
+} RedBlackTreeIterator;
+
 RedBlackTree *initialize_redblack_tree(char *type, size_t type_size, short(*compare)(void *a, void *b));
 RedBlackTreeNode *push_to_redblack_tree(RedBlackTree *tree, void *value);
 RedBlackTreeNode *iterate_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node, Vector *container);
 RedBlackTreeNode *search_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node, void *value);
 void *remove_by_value_redblack_tree(RedBlackTree *tree, void *value);
 void free_redblack_tree(RedBlackTree *tree);
+RedBlackTree *build_redblack_tree_from_sorted(char *type, size_t type_size, short(*compare)(void *a, void *b), Vector *values);
+int fill_redblack_tree_from_sorted(RedBlackTree *tree, Vector *values);
+
+// Positional trees: order is given by where nodes are inserted, not by compare
+RedBlackTree *initialize_measured_redblack_tree(char *type, size_t type_size, void(*measure)(void *value, RedBlackTreeAggregate *aggregate));
+RedBlackTreeNode *insert_redblack_node_before(RedBlackTree *tree, RedBlackTreeNode *node, void *value);
+RedBlackTreeNode *insert_redblack_node_after(RedBlackTree *tree, RedBlackTreeNode *node, void *value);
+void delete_redblack_node(RedBlackTree *tree, RedBlackTreeNode *node);
+void update_redblack_node_aggregates(RedBlackTree *tree, RedBlackTreeNode *node);
+RedBlackTreeNode *find_redblack_node_by_offset(RedBlackTree *tree, size_t offset, RedBlackTreeAggregate *before);
+RedBlackTreeNode *find_redblack_node_by_newline(RedBlackTree *tree, size_t newline, RedBlackTreeAggregate *before);
+RedBlackTreeNode *find_first_pending_redblack_node(RedBlackTree *tree, RedBlackTreeAggregate *before);
+RedBlackTreeNode *redblack_node_successor(RedBlackTreeNode *node);
+RedBlackTreeNode *redblack_node_predecessor(RedBlackTreeNode *node);
+RedBlackTreeNode *redblack_tree_first(RedBlackTree *tree);
+RedBlackTreeNode *redblack_tree_last(RedBlackTree *tree);
+
+void redblack_iterator_first(RedBlackTreeIterator *iterator, RedBlackTree *tree);
+void redblack_iterator_last(RedBlackTreeIterator *iterator, RedBlackTree *tree);
+void redblack_iterator_seek(RedBlackTreeIterator *iterator, RedBlackTree *tree, void *value);
+void redblack_iterator_seek_offset(RedBlackTreeIterator *iterator, RedBlackTree *tree, size_t offset);
+RedBlackTreeNode *redblack_iterator_next(RedBlackTreeIterator *iterator);
+RedBlackTreeNode *redblack_iterator_prev(RedBlackTreeIterator *iterator);
+
+RedBlackTree *split_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node);
+RedBlackTree *split_redblack_tree_at_offset(RedBlackTree *tree, size_t offset);
+RedBlackTree *split_redblack_tree_at_value(RedBlackTree *tree, void *value);
+void join_redblack_trees(RedBlackTree *left, RedBlackTree *right);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,202 @@
+#ifndef RBT_TEMPLATE_H_
+#define RBT_TEMPLATE_H_
+#include <stddef.h>
+#include <stdlib.h>
+#include "structures/pool.h"
+
+// Type specialized trees and vectors, generated by macros.
+//
+// The generic RedBlackTree and Vector store void* values and reach every
+// compare through a function pointer. The instantiations below store the key
+// inline in the node and compare through an expression the compiler can
+// inline, for hot, compare heavy paths. The generic API stays for the rest.
+//
+//     RBT_DEFINE(OffsetTree, size_t, (a > b) - (a < b))
+//     VECTOR_DEFINE(OffsetVector, size_t)
+//
+// The compare expression sees the two keys as a and b and yields <0, 0 or >0.
+
+enum RBT_LINKS_COLOR {
+    RBT_LINKS_RED,
+    RBT_LINKS_BLACK
+};
+
+// Tree structure shared by every instantiation: the rebalancing never looks
+// at keys, so it is compiled once. It must be the first member of a node.
+typedef struct RbtLinks RbtLinks;
+struct RbtLinks {
+    RbtLinks *left;
+    RbtLinks *right;
+    RbtLinks *parent;
+    enum RBT_LINKS_COLOR color;
+};
+
+void rbt_links_insert(RbtLinks **root, RbtLinks *parent, RbtLinks **link, RbtLinks *node);
+void rbt_links_erase(RbtLinks **root, RbtLinks *node);
+RbtLinks *rbt_links_first(RbtLinks *root);
+RbtLinks *rbt_links_last(RbtLinks *root);
+RbtLinks *rbt_links_next(RbtLinks *node);
+RbtLinks *rbt_links_prev(RbtLinks *node);
+
+#define RBT_DEFINE(NAME, KEY_TYPE, CMP_EXPR)                                          \
+    typedef struct {                                                                  \
+        RbtLinks links;                                                               \
+        KEY_TYPE value;                                                               \
+    } NAME##Node;                                                                     \
+                                                                                      \
+    typedef struct {                                                                  \
+        RbtLinks *root;                                                               \
+        size_t size;                                                                  \
+        NodePool *pool;                                                               \
+    } NAME;                                                                           \
+                                                                                      \
+    static inline int NAME##_compare(KEY_TYPE a, KEY_TYPE b) {                        \
+        return (CMP_EXPR);                                                            \
+    }                                                                                 \
+                                                                                      \
+    static inline int NAME##_initialize(NAME *tree) {                                 \
+        tree->root = NULL;                                                            \
+        tree->size = 0;                                                               \
+        tree->pool = initialize_node_pool(sizeof(NAME##Node));                        \
+        return tree->pool == NULL;                                                    \
+    }                                                                                 \
+                                                                                      \
+    static inline void NAME##_free(NAME *tree) {                                      \
+        free_node_pool(tree->pool);                                                   \
+        tree->pool = NULL;                                                            \
+        tree->root = NULL;                                                            \
+        tree->size = 0;                                                               \
+    }                                                                                 \
+                                                                                      \
+    /* Equal keys go to the right, like push_to_redblack_tree */                      \
+    static inline NAME##Node *NAME##_insert(NAME *tree, KEY_TYPE value) {             \
+        RbtLinks *parent = NULL;                                                      \
+        RbtLinks **link = &tree->root;                                                \
+                                                                                      \
+        while (*link != NULL) {                                                       \
+            parent = *link;                                                           \
+            link = NAME##_compare(value, ((NAME##Node *) parent)->value) < 0          \
+                ? &parent->left                                                       \
+                : &parent->right;                                                     \
+        }                                                                             \
+                                                                                      \
+        NAME##Node *node = pool_alloc(tree->pool);                                    \
+                                                                                      \
+        if (node == NULL) {                                                           \
+            return NULL;                                                              \
+        }                                                                             \
+                                                                                      \
+        node->value = value;                                                          \
+        rbt_links_insert(&tree->root, parent, link, &node->links);                    \
+        tree->size++;                                                                 \
+                                                                                      \
+        return node;                                                                  \
+    }                                                                                 \
+                                                                                      \
+    static inline NAME##Node *NAME##_search(NAME *tree, KEY_TYPE value) {             \
+        RbtLinks *node = tree->root;                                                  \
+                                                                                      \
+        while (node != NULL) {                                                        \
+            int order = NAME##_compare(value, ((NAME##Node *) node)->value);          \
+                                                                                      \
+            if (order == 0) {                                                         \
+                return (NAME##Node *) node;                                           \
+            }                                                                         \
+                                                                                      \
+            node = order < 0 ? node->left : node->right;                              \
+        }                                                                             \
+                                                                                      \
+        return NULL;                                                                  \
+    }                                                                                 \
+                                                                                      \
+    /* First node whose key is not less than value, NULL if there is none */          \
+    static inline NAME##Node *NAME##_lower_bound(NAME *tree, KEY_TYPE value) {        \
+        RbtLinks *node = tree->root;                                                  \
+        RbtLinks *found = NULL;                                                       \
+                                                                                      \
+        while (node != NULL) {                                                        \
+            if (NAME##_compare(((NAME##Node *) node)->value, value) < 0) {            \
+                node = node->right;                                                   \
+            } else {                                                                  \
+                found = node;                                                         \
+                node = node->left;                                                    \
+            }                                                                         \
+        }                                                                             \
+                                                                                      \
+        return (NAME##Node *) found;                                                  \
+    }                                                                                 \
+                                                                                      \
+    static inline void NAME##_remove(NAME *tree, NAME##Node *node) {                  \
+        rbt_links_erase(&tree->root, &node->links);                                   \
+        pool_release(tree->pool, node);                                               \
+        tree->size--;                                                                 \
+    }                                                                                 \
+                                                                                      \
+    static inline NAME##Node *NAME##_first(NAME *tree) {                              \
+        return (NAME##Node *) rbt_links_first(tree->root);                            \
+    }                                                                                 \
+                                                                                      \
+    static inline NAME##Node *NAME##_last(NAME *tree) {                               \
+        return (NAME##Node *) rbt_links_last(tree->root);                             \
+    }                                                                                 \
+                                                                                      \
+    static inline NAME##Node *NAME##_next(NAME##Node *node) {                         \
+        return (NAME##Node *) rbt_links_next(&node->links);                           \
+    }                                                                                 \
+                                                                                      \
+    static inline NAME##Node *NAME##_prev(NAME##Node *node) {                         \
+        return (NAME##Node *) rbt_links_prev(&node->links);                           \
+    }
+
+// A growable array of TYPE, elements are read straight from base
+#define VECTOR_DEFINE(NAME, TYPE)                                                     \
+    typedef struct {                                                                  \
+        TYPE *base;                                                                   \
+        size_t size;                                                                  \
+        size_t len;                                                                   \
+    } NAME;                                                                           \
+                                                                                      \
+    static inline void NAME##_initialize(NAME *vector) {                              \
+        vector->base = NULL;                                                          \
+        vector->size = 0;                                                             \
+        vector->len = 0;                                                              \
+    }                                                                                 \
+                                                                                      \
+    static inline int NAME##_reserve(NAME *vector, size_t size) {                     \
+        if (size <= vector->size) {                                                   \
+            return 0;                                                                 \
+        }                                                                             \
+                                                                                      \
+        TYPE *base = realloc(vector->base, size * sizeof(TYPE));                      \
+                                                                                      \
+        if (base == NULL) {                                                           \
+            return 1;                                                                 \
+        }                                                                             \
+                                                                                      \
+        vector->base = base;                                                          \
+        vector->size = size;                                                          \
+                                                                                      \
+        return 0;                                                                     \
+    }                                                                                 \
+                                                                                      \
+    static inline int NAME##_push_back(NAME *vector, TYPE element) {                  \
+        if (vector->len == vector->size                                               \
+            && NAME##_reserve(vector, vector->size ? vector->size * 2 : 2)) {         \
+            return 1;                                                                 \
+        }                                                                             \
+                                                                                      \
+        vector->base[vector->len++] = element;                                        \
+                                                                                      \
+        return 0;                                                                     \
+    }                                                                                 \
+                                                                                      \
+    static inline void NAME##_clear(NAME *vector) {                                   \
+        vector->len = 0;                                                              \
+    }                                                                                 \
+                                                                                      \
+    static inline void NAME##_free(NAME *vector) {                                    \
+        free(vector->base);                                                           \
+        NAME##_initialize(vector);                                                    \
+    }
+
+#endif
@@ -20,5 +20,6 @@ Vector *initialize_vector(char *type, size_t type_size);
 void vec_push_back(Vector *vector, void *element);
 void free_vector(Vector *vector);
 void vec_clear(Vector *vector);
+void vec_reserve(Vector *vector, size_t size);
 
 #endif
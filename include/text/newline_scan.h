@@ -0,0 +1,20 @@
+#ifndef NEWLINE_SCAN_H_
+#define NEWLINE_SCAN_H_
+#include <stddef.h>
+#include "structures/vector.h"
+
+enum NEWLINE_SCANNERS {
+    NEWLINE_SCANNER_SCALAR = 0,
+    NEWLINE_SCANNER_SSE2,
+    NEWLINE_SCANNER_AVX2
+};
+
+// Appends base + i + 1 to lineStarts (a size_t vector) for every '\n' at text[i].
+// Returns how many line starts were appended.
+size_t scan_line_starts(const char *text, size_t length, size_t base, Vector *lineStarts);
+// How many '\n' are in text
+size_t count_newlines(const char *text, size_t length);
+// Also picks the kernels: call it once before scanning from several threads
+enum NEWLINE_SCANNERS newline_scanner_in_use();
+
+#endif
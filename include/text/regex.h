@@ -0,0 +1,96 @@
+#ifndef REGEX_H_
+#define REGEX_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+#include "structures/vector.h"
+
+// Context byte standing for the edges of the document, where nothing is
+#define REGEX_EDGE (-1)
+// Bytes the states of one automaton may take before they are all dropped
+#define REGEX_CACHE_LIMIT ((size_t) 1 << 20)
+
+typedef struct RegexAutomaton RegexAutomaton;
+
+// A pattern in vim's "magic" syntax, run by two lazily built DFAs: one for
+// the pattern read forwards, one for it read backwards. Matches never span
+// lines and are leftmost-longest.
+typedef struct {
+    RegexAutomaton *forward;
+    RegexAutomaton *reverse;
+    // Plain text patterns are looked for with the substring search instead
+    char *literal;
+    size_t literalLength;
+} Regex;
+
+typedef struct {
+    size_t start;
+    size_t end;
+} RegexMatch;
+
+// Feeds text to an automaton chunk by chunk, e.g. piece after piece. A
+// forward scanner reports where matches end, a reverse one (fed the text
+// before offset, last byte first) where they start.
+typedef struct {
+    RegexAutomaton *automaton;
+    int state;
+    int reverse;
+    size_t flushes; // the cache flushes the state index is valid for
+    size_t offset; // document offset reached
+    size_t match; // where the last match reported is
+    int dead; // nothing can match any more, the rest is taken unread
+} RegexScanner;
+
+// A line's matches, the ones regex_line_matches would list, read straight
+// from a table a bounded amount of work at a time: a line of any length
+// holds up whoever lists it for no longer than a step. Starts are marked in
+// one backwards pass, a bit per byte, then each is tried for its longest match.
+typedef struct {
+    Regex *regex;
+    PieceTable *table;
+    size_t start; // the line is [start, end)
+    size_t end;
+    unsigned char *starts; // bit at - start is set where a match starts
+    int marking; // still marking, backwards from the scanner's offset
+    RegexScanner scanner; // reverse while marking, then forward from probe
+    size_t at; // where the next match may start
+    int probing;
+    size_t probe;
+    long longest; // end of the longest match from probe so far, -1 for none
+    int previous; // a match was listed, it ended at previousEnd
+    size_t previousEnd;
+} RegexLineScan;
+
+Regex *compile_regex(const char *pattern, size_t length, const char **error);
+void free_regex(Regex *regex);
+void set_regex_cache_limit(Regex *regex, size_t bytes);
+size_t regex_cache_flushes(Regex *regex);
+
+// context is the byte before offset (forward) or at it (reverse), REGEX_EDGE
+// at the ends of the document. feed stops right after a match, returns how
+// many bytes it took and whether it stopped on one. finish tells if a match
+// sits at the very end of what was fed, context being the byte after it.
+// Only one scanner per direction can run at a time.
+void regex_scanner_start(RegexScanner *scanner, Regex *regex, int reverse, size_t offset, int context);
+size_t regex_scanner_feed(RegexScanner *scanner, const char *chunk, size_t length, int *matched);
+int regex_scanner_finish(RegexScanner *scanner, int context);
+
+// Matches in one line, left to right and apart, the way :s/x/y/g takes them:
+// an empty match right where the last one ended does not count. before and
+// after are the bytes around the line. Only the first one unless all.
+int regex_line_matches(Regex *regex, const char *line, size_t length, int before, int after, int all, Vector *matches);
+
+// The line [start, end) of table, which must stay as it is until the scan
+// is stopped. The scan runs the regex's scanners:
+// nothing else may scan with it in between steps.
+int regex_line_scan_start(RegexLineScan *scan, Regex *regex, PieceTable *table, size_t start, size_t end);
+// Lists matches into matches for about budget bytes of work, returns the
+// work done. done is set once the whole line is listed.
+size_t regex_line_scan_step(RegexLineScan *scan, size_t budget, Vector *matches, int *done);
+void regex_line_scan_stop(RegexLineScan *scan);
+
+// The leftmost-longest match starting at or after from, or the one starting
+// last before before. Return 1 when there is none.
+int regex_search_piece_table(Regex *regex, PieceTable *table, size_t from, RegexMatch *match);
+int regex_search_piece_table_reverse(Regex *regex, PieceTable *table, size_t before, RegexMatch *match);
+
+#endif
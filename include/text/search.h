@@ -0,0 +1,25 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+#include <stddef.h>
+#include "structures/piece_table.h"
+
+enum SUBSTRING_SEARCHERS {
+    SUBSTRING_SEARCHER_SCALAR = 0,
+    SUBSTRING_SEARCHER_SSE2,
+    SUBSTRING_SEARCHER_AVX2
+};
+
+// First / last place needle occurs in text, NULL when it does not. The
+// vector kernels compare the needle's first and last bytes against a block
+// of positions at once and check the rest only where both match.
+const char *find_substring(const char *text, size_t length, const char *needle, size_t needleLength);
+const char *find_substring_reverse(const char *text, size_t length, const char *needle, size_t needleLength);
+enum SUBSTRING_SEARCHERS substring_searcher_in_use();
+
+// Document offset of the first match starting at or after from, or of the
+// last one starting before before. The pieces are searched where they lie,
+// matches across piece boundaries included. Return 1 when there is none.
+int search_piece_table(PieceTable *table, size_t from, const char *needle, size_t needleLength, size_t *found);
+int search_piece_table_reverse(PieceTable *table, size_t before, const char *needle, size_t needleLength, size_t *found);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef TEXT_SIMD_H_
+#define TEXT_SIMD_H_
+#include <stdint.h>
+
+// What the text scanners share: which vector units the compiler can target,
+// bit scans over the masks the kernels produce and the AVX2 check made once
+// at run time to pick a kernel.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TEXT_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_SIMD_SSE2 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TEXT_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TEXT_SIMD_TARGET_AVX2
+#endif
+
+// Index of the lowest set bit, mask must not be 0
+static inline unsigned trailing_zeros64(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (unsigned) index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long) mask)) {
+        return (unsigned) index;
+    }
+    _BitScanForward(&index, (unsigned long) (mask >> 32));
+    return (unsigned) index + 32;
+#else
+    return (unsigned) __builtin_ctzll(mask);
+#endif
+}
+
+// Index of the highest set bit, mask must not be 0
+static inline unsigned highest_bit64(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return (unsigned) index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanReverse(&index, (unsigned long) (mask >> 32))) {
+        return (unsigned) index + 32;
+    }
+    _BitScanReverse(&index, (unsigned long) mask);
+    return (unsigned) index;
+#else
+    return 63u - (unsigned) __builtin_clzll(mask);
+#endif
+}
+
+#ifdef TEXT_SIMD_X86
+static inline int cpu_supports_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return 0;
+    }
+
+    // The OS has to save the ymm registers too (OSXSAVE + XCR0 bits 1 and 2)
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+        return 0;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#endif
@@ -16,6 +16,41 @@ typedef struct {
   unsigned short character;  
 } KeyCode;
 
+// Key codes of the special keys, the values follow the Win32 virtual keys
+enum XIM_KEYS {
+  XIM_KEY_BACK = 0x08,
+  XIM_KEY_TAB = 0x09,
+  XIM_KEY_RETURN = 0x0D,
+  XIM_KEY_ESCAPE = 0x1B,
+  XIM_KEY_PAGE_UP = 0x21,
+  XIM_KEY_PAGE_DOWN = 0x22,
+  XIM_KEY_END = 0x23,
+  XIM_KEY_HOME = 0x24,
+  XIM_KEY_LEFT = 0x25,
+  XIM_KEY_UP = 0x26,
+  XIM_KEY_RIGHT = 0x27,
+  XIM_KEY_DOWN = 0x28,
+  XIM_KEY_DELETE = 0x2E
+};
+
+// Cell colors, the bits follow the Win32 character attributes
+enum CELL_ATTRIBUTES {
+  CELL_FOREGROUND_BLUE = 0x0001,
+  CELL_FOREGROUND_GREEN = 0x0002,
+  CELL_FOREGROUND_RED = 0x0004,
+  CELL_FOREGROUND_INTENSITY = 0x0008,
+  CELL_BACKGROUND_BLUE = 0x0010,
+  CELL_BACKGROUND_GREEN = 0x0020,
+  CELL_BACKGROUND_RED = 0x0040,
+  CELL_BACKGROUND_INTENSITY = 0x0080
+};
+
+// One character of the screen
+typedef struct {
+  char character;
+  unsigned short attributes;
+} Cell;
+
 enum DATA_TYPES {
   TYPE_INT,
   TYPE_CHAR,
@@ -1,9 +1,17 @@
 #ifndef XIM_H_
 #define XIM_H_
-#include <Windows.h>
+#include <stdlib.h>
 #include <assert.h>
 #include "console.h"
+#include "event_loop.h"
+#include "keymap.h"
 #include "structures/vector.h"
+#include "structures/piece_table.h"
+#include "io/file_source.h"
+#include "io/journal.h"
+#include "io/loader.h"
+#include "io/follow.h"
+#include "text/regex.h"
 #include "commands.h"
 #include "types.h"
 
@@ -26,11 +34,21 @@ enum SIGNALS {
     NOP_SIGNAL = 0,
 };
 
+// Where addTextToDocument puts text when it is not given an offset
+#define AT_DOCUMENT_CURSOR ((size_t) -1)
+
+// Columns [start, end) of a row changed since the last frame, clean when equal
+typedef struct {
+    int start;
+    int end;
+} RowDamage;
+
 typedef struct {
-    CHAR_INFO *cells;
+    Cell *cells; // back grid, what the buffer wants on screen
+    Cell *front; // what the console shows, one cell per cell of the area
+    RowDamage *damage; // one per row of the area
     Size2s size;
     int cursor;
-    short dirty;
 } Buffer;
 
 typedef struct {
@@ -38,24 +56,64 @@ typedef struct {
     Size2s size;
 } Area;
 
-struct {
+typedef struct {
     enum XIM_MODES mode; // default: command mode
+    // The editor buffer is only a view, the text itself lives in the document
+    PieceTable *document;
+    FileSource *source; // backs the document's original buffer, if any
+    char *path; // the document's file, NULL for a new one
+    Journal *journal; // the changes made to the file since it was opened, for recovery
+    DocumentLoader *loader; // counts a big file's lines after it is shown, NULL for others
+    FileFollower *follower; // takes in what is appended to the file, NULL without one
+    size_t documentCursor;
+    size_t viewOffset; // first document byte shown in the editor area
     Buffer editorBuffer;
     Buffer commandBuffer;
     Vector *writtenCommand;
     Area editorArea;
     Area commandArea;
     enum SIGNALS signal;
-} Xim;
+    // One table per mode, the modes with none of their own use the normal one
+    Keymap *keymaps[EX_MODE + 1];
+    KeymapState keys;
+    size_t marks[EX_MARKS]; // where each mark is, EX_NO_MARK when not set
+    char commandPrompt; // ':' for ex commands, '/' or '?' for a search
+    // The last search, n and N repeat it. A pattern an ex command used (":s",
+    // "/pattern/" addresses) is the last search as well.
+    Regex *search;
+    int searchBackward;
+    char *replacement; // the last :s replacement, NULL until there is one
+} XimState;
 
-struct {
-    void(*handler)();
-} WindowsKeyPresses [];
+extern XimState Xim;
 
 int initVirtualBuffer();
 int killVirtualBuffer();
 int renderVirtualBuffer(unsigned short flush);
 int addBufferToBuffer(enum XIM_BUFFER_TYPES type, char *text, int at, unsigned short relocate_cursor);
 int recalculateScreenBuffers();
+int renderDocumentView();
+int openDocument(const char *path);
+const char *writeDocument(const char *path, size_t length, const char **message);
+const char *followDocument();
+int stopFollowing();
+int goToLine(size_t line);
+int deleteBeforeCursor();
+int addTextToDocument(char *text, size_t at, unsigned short relocate_cursor);
+int moveDocumentCursor(size_t offset);
+int deleteDocumentRange(size_t start, size_t end);
+int resetCommandBuffer();
+void damageBufferCells(Buffer *buffer, Area *area, int from, int to);
+size_t findLineStart(size_t offset);
+int initializeXim();
+
+// bindings.c
+int initializeBindings();
+
+// incremental_search.c
+int startIncrementalSearch();
+int updateIncrementalSearch();
+int stopIncrementalSearch();
+Vector *searchHighlights(size_t from, size_t until);
 
 #endif
@@ -1,15 +1,36 @@
 #include <stdio.h>
-#include <Windows.h>
+#include <string.h>
 #include "console.h"
 #include "xim.h"
 
 int main(int argc, char **argv) {
-    initializeConsole();
+    if (initializeConsole()) {
+        fprintf(stderr, "xim: could not set up the %s console\n", console.backend->name);
+        return 1;
+    }
+
+    if (initializeEventLoop()) {
+        killConsole();
+        fprintf(stderr, "xim: could not set up the event loop\n");
+        return 1;
+    }
+
     initVirtualBuffer();
 
+    // "xim +F file" follows the file from the start, as less does
+    int follow = argc > 2 && !strcmp(argv[1], "+F");
+
+    if (argc > 1 && !openDocument(argv[follow ? 2 : 1]) && follow) {
+        const char *message = followDocument();
+
+        resetCommandBuffer();
+        addBufferToBuffer(COMMAND_BUFFER, (char *) message, 0, 0);
+    }
+
     initializeXim();
 
     killVirtualBuffer();
+    killEventLoop();
     killConsole();
 
     return 0;
@@ -0,0 +1,652 @@
+#include <ctype.h>
+#include <stdint.h>
+#include "xim.h"
+#include "text/regex.h"
+
+// The editor's default key bindings: the tables of every mode, the motions
+// and the operators they run. Motions only compute where the cursor goes,
+// the same function moves the cursor in normal mode and gives the range of
+// an operator ("dw", "3dj").
+
+// ---------------------------------------------------------
+// Document helpers
+// ---------------------------------------------------------
+
+static char charAt(size_t offset) {
+    const char *text;
+
+    return piece_table_chunk_at(Xim.document, offset, &text) > 0 ? *text : '\0';
+}
+
+static size_t documentLength() {
+    return piece_table_length(Xim.document);
+}
+
+static size_t lastLine() {
+    return piece_table_line_count(Xim.document) - 1;
+}
+
+// Offset of the newline ending the line holding offset, the document's
+// length for the last line
+static size_t lineEndAt(size_t offset) {
+    size_t line = piece_table_line_at(Xim.document, offset);
+
+    if (line >= lastLine()) {
+        return documentLength();
+    }
+
+    return piece_table_line_start(Xim.document, line + 1) - 1;
+}
+
+static size_t lineEnd(size_t line) {
+    return lineEndAt(piece_table_line_start(Xim.document, line));
+}
+
+enum CHARACTER_CLASSES {
+    CLASS_SPACE = 0,
+    CLASS_WORD,
+    CLASS_PUNCTUATION
+};
+
+static enum CHARACTER_CLASSES characterClass(char character) {
+    if (character == ' ' || character == '\t' || character == '\n' || character == '\r' || character == '\0') {
+        return CLASS_SPACE;
+    }
+
+    if (isalnum((unsigned char) character) || character == '_') {
+        return CLASS_WORD;
+    }
+
+    return CLASS_PUNCTUATION;
+}
+
+// ---------------------------------------------------------
+// Motions
+// ---------------------------------------------------------
+
+static size_t motionLeft(size_t from, KeymapCall *call) {
+    size_t start = findLineStart(from);
+
+    return from - start < call->count ? start : from - call->count;
+}
+
+static size_t motionRight(size_t from, KeymapCall *call) {
+    size_t end = lineEndAt(from);
+
+    return end - from < call->count ? end : from + call->count;
+}
+
+// Same column on another line, or the end of that line when it is shorter
+static size_t lineWithColumn(size_t from, size_t line) {
+    size_t column = from - findLineStart(from);
+    size_t start = piece_table_line_start(Xim.document, line);
+    size_t end = lineEnd(line);
+
+    return end - start < column ? end : start + column;
+}
+
+static size_t motionDown(size_t from, KeymapCall *call) {
+    size_t line = piece_table_line_at(Xim.document, from);
+    size_t last = lastLine();
+
+    return lineWithColumn(from, last - line < call->count ? last : line + call->count);
+}
+
+static size_t motionUp(size_t from, KeymapCall *call) {
+    size_t line = piece_table_line_at(Xim.document, from);
+
+    return lineWithColumn(from, line < call->count ? 0 : line - call->count);
+}
+
+static size_t motionLineStart(size_t from, KeymapCall *call) {
+    (void) call;
+
+    return findLineStart(from);
+}
+
+// "3$" is the end of the line two lines down
+static size_t motionLineEnd(size_t from, KeymapCall *call) {
+    size_t line = piece_table_line_at(Xim.document, from) + call->count - 1;
+
+    return lineEnd(line < lastLine() ? line : lastLine());
+}
+
+static size_t motionWordForward(size_t from, KeymapCall *call) {
+    size_t length = documentLength();
+
+    for (size_t i = 0; i < call->count && from < length; i++) {
+        enum CHARACTER_CLASSES start = characterClass(charAt(from));
+
+        while (from < length && start != CLASS_SPACE && characterClass(charAt(from)) == start) {
+            from++;
+        }
+
+        while (from < length && characterClass(charAt(from)) == CLASS_SPACE) {
+            from++;
+        }
+    }
+
+    return from;
+}
+
+static size_t motionWordBackward(size_t from, KeymapCall *call) {
+    for (size_t i = 0; i < call->count && from > 0; i++) {
+        while (from > 0 && characterClass(charAt(from - 1)) == CLASS_SPACE) {
+            from--;
+        }
+
+        enum CHARACTER_CLASSES word = characterClass(charAt(from - 1));
+
+        while (from > 0 && word != CLASS_SPACE && characterClass(charAt(from - 1)) == word) {
+            from--;
+        }
+    }
+
+    return from;
+}
+
+// "gg" is the first line, "5gg" the fifth
+static size_t motionFirstLine(size_t from, KeymapCall *call) {
+    (void) from;
+
+    return piece_table_line_start(Xim.document, call->hasCount ? call->count - 1 : 0);
+}
+
+// "'a": the line of mark a, nowhere when it is not set
+static size_t motionMark(size_t from, KeymapCall *call) {
+    size_t mark = Xim.marks[call->key.character - 'a'];
+
+    return mark == EX_NO_MARK ? from : findLineStart(mark);
+}
+
+// "G" is the last line, "5G" the fifth
+static size_t motionLastLine(size_t from, KeymapCall *call) {
+    (void) from;
+
+    return piece_table_line_start(Xim.document, call->hasCount ? call->count - 1 : lastLine());
+}
+
+// ---------------------------------------------------------
+// Operators
+// ---------------------------------------------------------
+
+static int moveCursor(KeymapCall *call) {
+    return moveDocumentCursor(call->motion(Xim.documentCursor, call));
+}
+
+// What an operator works on: from the cursor to where the motion lands, or
+// whole lines for linewise motions and doubled operators ("dd", "3cc")
+static void operatorRange(KeymapCall *call, size_t *start, size_t *end) {
+    size_t from = Xim.documentCursor;
+    size_t firstLine, lastLineOfRange;
+
+    if (call->motion == NULL) {
+        firstLine = piece_table_line_at(Xim.document, from);
+        lastLineOfRange = firstLine + call->count - 1;
+    } else {
+        size_t to = call->motion(from, call);
+
+        *start = from < to ? from : to;
+        *end = from < to ? to : from;
+
+        if (!call->linewise) {
+            return;
+        }
+
+        firstLine = piece_table_line_at(Xim.document, *start);
+        lastLineOfRange = piece_table_line_at(Xim.document, *end);
+    }
+
+    if (lastLineOfRange >= lastLine()) {
+        *start = piece_table_line_start(Xim.document, firstLine);
+        *end = documentLength();
+
+        // The last lines take the line break before them, no empty line is left
+        if (*start > 0) {
+            (*start)--;
+        }
+    } else {
+        *start = piece_table_line_start(Xim.document, firstLine);
+        *end = piece_table_line_start(Xim.document, lastLineOfRange + 1);
+    }
+}
+
+static int enterInsertMode() {
+    addBufferToBuffer(COMMAND_BUFFER, "-- INSERT --", 0, 0);
+    Xim.mode = RAW_MODE;
+
+    return 0;
+}
+
+static int deleteOperator(KeymapCall *call) {
+    size_t start, end;
+
+    operatorRange(call, &start, &end);
+    deleteDocumentRange(start, end);
+
+    // Deleting the last lines leaves the cursor on the line break before them
+    if (call->linewise) {
+        moveDocumentCursor(findLineStart(Xim.documentCursor));
+    }
+
+    return 0;
+}
+
+// Like delete, but whole lines keep one empty line to type into
+static int changeOperator(KeymapCall *call) {
+    size_t start, end;
+
+    operatorRange(call, &start, &end);
+
+    if (call->linewise) {
+        if (end > start && charAt(end - 1) == '\n') {
+            end--;
+        } else if (start < end && charAt(start) == '\n') {
+            start++;
+        }
+    }
+
+    deleteDocumentRange(start, end);
+
+    return enterInsertMode();
+}
+
+// ---------------------------------------------------------
+// Commands
+// ---------------------------------------------------------
+
+static int insertAtCursor(KeymapCall *call) {
+    (void) call;
+
+    return enterInsertMode();
+}
+
+static int appendAfterCursor(KeymapCall *call) {
+    (void) call;
+
+    if (Xim.documentCursor < lineEndAt(Xim.documentCursor)) {
+        moveDocumentCursor(Xim.documentCursor + 1);
+    }
+
+    return enterInsertMode();
+}
+
+static int insertAtLineStart(KeymapCall *call) {
+    (void) call;
+    moveDocumentCursor(findLineStart(Xim.documentCursor));
+
+    return enterInsertMode();
+}
+
+static int appendAtLineEnd(KeymapCall *call) {
+    (void) call;
+    moveDocumentCursor(lineEndAt(Xim.documentCursor));
+
+    return enterInsertMode();
+}
+
+static int openLineBelow(KeymapCall *call) {
+    (void) call;
+    addTextToDocument("\n", lineEndAt(Xim.documentCursor), 1);
+
+    return enterInsertMode();
+}
+
+static int openLineAbove(KeymapCall *call) {
+    (void) call;
+    size_t start = findLineStart(Xim.documentCursor);
+
+    addTextToDocument("\n", start, 0);
+    moveDocumentCursor(start);
+
+    return enterInsertMode();
+}
+
+// "x": the characters under the cursor, never the line break
+static int deleteCharacters(KeymapCall *call) {
+    size_t end = lineEndAt(Xim.documentCursor);
+    size_t count = end - Xim.documentCursor < call->count ? end - Xim.documentCursor : call->count;
+
+    return deleteDocumentRange(Xim.documentCursor, Xim.documentCursor + count);
+}
+
+static int substituteCharacters(KeymapCall *call) {
+    deleteCharacters(call);
+
+    return enterInsertMode();
+}
+
+static int deleteToLineEnd(KeymapCall *call) {
+    KeymapCall range = *call;
+
+    range.motion = motionLineEnd;
+    range.linewise = 0;
+
+    return deleteOperator(&range);
+}
+
+static int changeToLineEnd(KeymapCall *call) {
+    KeymapCall range = *call;
+
+    range.motion = motionLineEnd;
+    range.linewise = 0;
+
+    return changeOperator(&range);
+}
+
+static int changeLines(KeymapCall *call) {
+    KeymapCall range = *call;
+
+    range.motion = NULL;
+    range.linewise = 1;
+
+    return changeOperator(&range);
+}
+
+// ":" for a command, "/" and "?" for a search, the key typed is the prompt
+static int enterExMode(KeymapCall *call) {
+    char prompt[2] = { (char) call->key.character, '\0' };
+
+    Xim.mode = EX_MODE;
+    Xim.commandPrompt = prompt[0];
+    // A message left by the last command goes away
+    resetCommandBuffer();
+    addBufferToBuffer(CURRENT, prompt, -1, 1);
+
+    if (prompt[0] != ':') {
+        startIncrementalSearch();
+    }
+
+    return 0;
+}
+
+// Back to normal mode from anywhere, whatever was typed on the command line is dropped
+static int leaveToNormalMode(KeymapCall *call) {
+    (void) call;
+    stopIncrementalSearch();
+    vec_clear(Xim.writtenCommand);
+    resetCommandBuffer();
+    setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
+    Xim.mode = NO_MODE;
+
+    return 0;
+}
+
+// "ma": mark a is the cursor's line, for "'a" and the "'a,'b" ranges. It
+// follows the line through the edits above it.
+static int setMark(KeymapCall *call) {
+    Xim.marks[call->key.character - 'a'] = findLineStart(Xim.documentCursor);
+
+    return 0;
+}
+
+static int deleteBackward(KeymapCall *call) {
+    (void) call;
+
+    return deleteBeforeCursor();
+}
+
+static int insertNewline(KeymapCall *call) {
+    (void) call;
+
+    return addBufferToBuffer(CURRENT, "\n", -1, 1);
+}
+
+static void showMessage(const char *message) {
+    resetCommandBuffer();
+
+    if (message != NULL) {
+        addBufferToBuffer(COMMAND_BUFFER, (char *) message, 0, 0);
+    }
+}
+
+// Moves to the next match of the last search, the other way round for
+// reverse ("N"). Wraps around the ends of the document. Returns what the
+// command line says about it, NULL for nothing.
+static const char *repeatSearch(int reverse) {
+    int backward = Xim.searchBackward != reverse;
+    const char *message = NULL;
+    RegexMatch match;
+
+    if (Xim.search == NULL) {
+        return "E35: No previous regular expression";
+    }
+
+    if (backward) {
+        if (regex_search_piece_table_reverse(Xim.search, Xim.document, Xim.documentCursor, &match)) {
+            message = "search hit TOP, continuing at BOTTOM";
+
+            if (regex_search_piece_table_reverse(Xim.search, Xim.document, documentLength(), &match)) {
+                return "E486: Pattern not found";
+            }
+        }
+    } else {
+        if (regex_search_piece_table(Xim.search, Xim.document, Xim.documentCursor + 1, &match)) {
+            message = "search hit BOTTOM, continuing at TOP";
+
+            if (regex_search_piece_table(Xim.search, Xim.document, 0, &match)) {
+                return "E486: Pattern not found";
+            }
+        }
+    }
+
+    moveDocumentCursor(match.start);
+
+    return message;
+}
+
+static int nextMatch(KeymapCall *call) {
+    const char *message = NULL;
+
+    for (size_t i = 0; i < call->count && message == NULL; i++) {
+        message = repeatSearch(call->key.character == 'N');
+    }
+
+    showMessage(message);
+
+    return 0;
+}
+
+// "u" and "<C-r>": a whole insert or command at a time, the cursor goes
+// where the first change of it was
+static int undoChanges(KeymapCall *call) {
+    int redo = call->key.character != 'u';
+    size_t offset, first = SIZE_MAX;
+    size_t done = 0;
+
+    while (done < call->count &&
+           !(redo ? piece_table_redo(Xim.document, &offset) : piece_table_undo(Xim.document, &offset))) {
+        first = offset < first ? offset : first;
+        done++;
+    }
+
+    if (done == 0) {
+        showMessage(redo ? "Already at newest change" : "Already at oldest change");
+        return 0;
+    }
+
+    showMessage(NULL);
+
+    return moveDocumentCursor(first);
+}
+
+// "F": the view follows the end of the file as it grows, like less does
+static int followFile(KeymapCall *call) {
+    (void) call;
+
+    showMessage(followDocument());
+
+    return 0;
+}
+
+// What was typed after "/" or "?" becomes the search, nothing repeats the last one
+static const char *searchFromCommandLine() {
+    const char *typed = Xim.writtenCommand->len > 0 ? (const char *) Xim.writtenCommand->base : "";
+    size_t length = strlen(typed);
+
+    if (length > 0) {
+        const char *error;
+        Regex *search = compile_regex(typed, length, &error);
+
+        if (search == NULL) {
+            return error;
+        }
+
+        free_regex(Xim.search);
+        Xim.search = search;
+    }
+
+    Xim.searchBackward = Xim.commandPrompt == '?';
+
+    return repeatSearch(0);
+}
+
+static int runExCommand(KeymapCall *call) {
+    const char *error = NULL;
+
+    if (Xim.commandPrompt == ':') {
+        if (parseCommandFromBuffer(Xim.writtenCommand, &error) == EXIT_SIGNAL) {
+            Xim.signal = EXIT_SIGNAL;
+        }
+    } else {
+        // The search starts over from where the cursor was before the prompt
+        stopIncrementalSearch();
+        error = searchFromCommandLine();
+    }
+
+    leaveToNormalMode(call);
+
+    // The message stays on the command line until the next command
+    showMessage(error);
+
+    return 0;
+}
+
+// The command line loses its last character, an empty one is left
+static int eraseExCharacter(KeymapCall *call) {
+    // The vector keeps a NUL after the text, len counts it
+    if (Xim.writtenCommand->len <= 1) {
+        return leaveToNormalMode(call);
+    }
+
+    char *command = (char *) Xim.writtenCommand->base;
+
+    Xim.writtenCommand->len--;
+    command[Xim.writtenCommand->len - 1] = '\0';
+
+    // ':' sits in the first cell, the text after it
+    Xim.commandBuffer.cursor--;
+    Xim.commandBuffer.cells[Xim.commandBuffer.cursor].character = ' ';
+    damageBufferCells(&Xim.commandBuffer, &Xim.commandArea, Xim.commandBuffer.cursor, Xim.commandBuffer.cursor + 1);
+    setCursorPosition(Xim.commandArea.startLoc, Xim.commandBuffer.cursor);
+
+    if (Xim.commandPrompt != ':') {
+        updateIncrementalSearch();
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Tables
+// ---------------------------------------------------------
+
+static const struct {
+    const char *sequence;
+    KeymapMotion motion;
+    int linewise;
+} Motions[] = {
+    { "h", motionLeft, 0 }, { "<Left>", motionLeft, 0 }, { "<BS>", motionLeft, 0 },
+    { "l", motionRight, 0 }, { "<Right>", motionRight, 0 }, { " ", motionRight, 0 },
+    { "j", motionDown, 1 }, { "<Down>", motionDown, 1 },
+    { "k", motionUp, 1 }, { "<Up>", motionUp, 1 },
+    { "0", motionLineStart, 0 }, { "<Home>", motionLineStart, 0 },
+    { "$", motionLineEnd, 0 }, { "<End>", motionLineEnd, 0 },
+    { "w", motionWordForward, 0 },
+    { "b", motionWordBackward, 0 },
+    { "gg", motionFirstLine, 1 },
+    { "G", motionLastLine, 1 },
+};
+
+static const struct {
+    const char *sequence;
+    KeymapHandler handler;
+} NormalCommands[] = {
+    { "i", insertAtCursor }, { "a", appendAfterCursor },
+    { "I", insertAtLineStart }, { "A", appendAtLineEnd },
+    { "o", openLineBelow }, { "O", openLineAbove },
+    { "x", deleteCharacters }, { "<Del>", deleteCharacters },
+    { "s", substituteCharacters }, { "S", changeLines },
+    { "D", deleteToLineEnd }, { "C", changeToLineEnd },
+    { ":", enterExMode }, { "/", enterExMode }, { "?", enterExMode },
+    { "n", nextMatch }, { "N", nextMatch },
+    { "u", undoChanges }, { "<C-r>", undoChanges },
+    { "F", followFile },
+    { "<Esc>", leaveToNormalMode },
+};
+
+int initializeBindings() {
+    if (initializeKeymaps()) {
+        return 1;
+    }
+
+    Keymap *normal = createKeymap(moveCursor, 1);
+    Keymap *pending = createKeymap(NULL, 0);
+    Keymap *insert = createKeymap(moveCursor, 0);
+    Keymap *ex = createKeymap(NULL, 0);
+
+    if (normal == NULL || pending == NULL || insert == NULL || ex == NULL) {
+        return 1;
+    }
+
+    normal->operatorPending = pending;
+
+    for (size_t i = 0; i < sizeof(Motions) / sizeof(Motions[0]); i++) {
+        bindMotion(normal, Motions[i].sequence, Motions[i].motion, Motions[i].linewise);
+        bindMotion(pending, Motions[i].sequence, Motions[i].motion, Motions[i].linewise);
+    }
+
+    for (size_t i = 0; i < sizeof(NormalCommands) / sizeof(NormalCommands[0]); i++) {
+        bindCommand(normal, NormalCommands[i].sequence, NormalCommands[i].handler);
+    }
+
+    for (char mark = 'a'; mark <= 'z'; mark++) {
+        char set[] = { 'm', mark, '\0' };
+        char jump[] = { '\'', mark, '\0' };
+
+        bindCommand(normal, set, setMark);
+        bindMotion(normal, jump, motionMark, 1);
+        bindMotion(pending, jump, motionMark, 1);
+    }
+
+    bindOperator(normal, "d", deleteOperator);
+    bindOperator(normal, "c", changeOperator);
+    bindCommand(pending, "<Esc>", leaveToNormalMode);
+
+    // Insert mode binds special keys only, text goes straight into the document
+    bindCommand(insert, "<Esc>", leaveToNormalMode);
+    bindCommand(insert, "<BS>", deleteBackward);
+    bindCommand(insert, "<CR>", insertNewline);
+    bindMotion(insert, "<Left>", motionLeft, 0);
+    bindMotion(insert, "<Right>", motionRight, 0);
+    bindMotion(insert, "<Up>", motionUp, 1);
+    bindMotion(insert, "<Down>", motionDown, 1);
+    bindMotion(insert, "<Home>", motionLineStart, 0);
+    bindMotion(insert, "<End>", motionLineEnd, 0);
+
+    bindCommand(ex, "<Esc>", leaveToNormalMode);
+    bindCommand(ex, "<CR>", runExCommand);
+    bindCommand(ex, "<BS>", eraseExCharacter);
+
+    for (int mode = 0; mode <= EX_MODE; mode++) {
+        Xim.keymaps[mode] = normal;
+    }
+
+    Xim.keymaps[RAW_MODE] = insert;
+    Xim.keymaps[EX_MODE] = ex;
+
+    Xim.keys.keymap = NULL;
+    resetKeymapState(&Xim.keys);
+
+    return 0;
+}
@@ -1,9 +1,1008 @@
-#include "commands.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xim.h"
+#include "text/regex.h"
 
-enum SIGNALS parseCommandFromBuffer(Vector *buffer) {
-    if (!strcmp((char *) buffer->base, "q")) {
-        return EXIT_SIGNAL;
+// Line numbers are one based while parsing, like the user types them, and
+// zero based in the range handed to the handlers
+
+static const char *const InvalidRange = "E16: Invalid range";
+static const char *const MarkNotSet = "E20: Mark not set";
+static const char *const UnknownMark = "E78: Unknown mark";
+static const char *const PatternNotFound = "E486: Pattern not found";
+static const char *const NoPreviousPattern = "E35: No previous regular expression";
+static const char *const NotACommand = "E492: Not an editor command";
+static const char *const NoBangAllowed = "E477: No ! allowed";
+static const char *const NoRangeAllowed = "E481: No range allowed";
+static const char *const TrailingCharacters = "E488: Trailing characters";
+static const char *const MoveIntoItself = "E134: Cannot move a range of lines into itself";
+static const char *const OutOfMemory = "E342: Out of memory";
+static const char *const BadDelimiter = "E146: Regular expressions can't be delimited by letters";
+static const char *const IllegalBackReference = "E65: Illegal back reference";
+static const char *const NoFileName = "E32: No file name";
+static const char *const NoWriteSinceLastChange = "E37: No write since last change (add ! to override)";
+
+// ---------------------------------------------------------
+// Document helpers
+// ---------------------------------------------------------
+
+static char characterAt(PieceTable *document, size_t offset) {
+    const char *text;
+
+    return piece_table_chunk_at(document, offset, &text) > 0 ? *text : '\0';
+}
+
+// The last line, one based. A line break ending the document does not start
+// another line, as in the "3L" vim shows for a file.
+static size_t lastLine(PieceTable *document) {
+    size_t count = piece_table_line_count(document);
+
+    if (count > 1 && characterAt(document, piece_table_length(document) - 1) == '\n') {
+        count--;
+    }
+
+    return count;
+}
+
+// Bytes of lines [first, last], with the line break after the last one
+static void lineSpan(PieceTable *document, size_t first, size_t last, size_t *start, size_t *end) {
+    *start = piece_table_line_start(document, first);
+    *end = last + 1 < piece_table_line_count(document) ? piece_table_line_start(document, last + 1) : piece_table_length(document);
+}
+
+// Lines [first, last] with a line break at the end, even for the last line
+static char *copyLines(PieceTable *document, size_t first, size_t last, size_t *length) {
+    size_t start, end;
+
+    lineSpan(document, first, last, &start, &end);
+
+    char *text = malloc(end - start + 1);
+
+    if (text == NULL) {
+        return NULL;
+    }
+
+    *length = piece_table_read(document, start, text, end - start);
+
+    if (*length == 0 || text[*length - 1] != '\n') {
+        text[(*length)++] = '\n';
+    }
+
+    return text;
+}
+
+// Inserts whole lines (text ends with a line break) after the one based line
+// after, 0 puts them on top. Returns the offset they start at.
+static int insertLines(PieceTable *document, size_t after, const char *text, size_t length, size_t *at) {
+    if (after < piece_table_line_count(document)) {
+        *at = piece_table_line_start(document, after);
+
+        return piece_table_insert(document, *at, text, length);
+    }
+
+    // Below the last line, which has no line break of its own
+    size_t end = piece_table_length(document);
+
+    *at = end + 1;
+
+    return piece_table_insert(document, end, text, length - 1) || piece_table_insert(document, end, "\n", 1);
+}
+
+// Removes lines [first, last], a last line without a line break of its own
+// takes the one before it along
+static int deleteLines(PieceTable *document, size_t first, size_t last) {
+    size_t start, end;
+
+    lineSpan(document, first, last, &start, &end);
+
+    if (end == piece_table_length(document) && start > 0 && characterAt(document, end - 1) != '\n') {
+        start--;
+    }
+
+    return start < end ? piece_table_delete(document, start, end - start) : 0;
+}
+
+// The line with a match of regex nearest to line, after it or before it,
+// wrapping around the document. Returns 1 when no line has one.
+static int findLineMatching(PieceTable *document, size_t line, int forward, Regex *regex, size_t *found) {
+    size_t length = piece_table_length(document);
+    RegexMatch match;
+
+    if (forward) {
+        size_t from = line + 1 < piece_table_line_count(document) ? piece_table_line_start(document, line + 1) : length;
+
+        if (regex_search_piece_table(regex, document, from, &match) &&
+            regex_search_piece_table(regex, document, 0, &match)) {
+            return 1;
+        }
+    } else {
+        size_t before = piece_table_line_start(document, line);
+
+        if (regex_search_piece_table_reverse(regex, document, before, &match) &&
+            regex_search_piece_table_reverse(regex, document, length, &match)) {
+            return 1;
+        }
+    }
+
+    *found = piece_table_line_at(document, match.start);
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Ranges
+// ---------------------------------------------------------
+
+static void skipBlanks(const char **text, const char *end) {
+    while (*text < end && (**text == ' ' || **text == '\t')) {
+        (*text)++;
+    }
+}
+
+static size_t parseNumber(const char **text, const char *end) {
+    size_t number = 0;
+
+    while (*text < end && isdigit((unsigned char) **text)) {
+        // Absurd numbers are out of range anyway, they only must not wrap
+        if (number < ((size_t) -1) / 20) {
+            number = number * 10 + (size_t) (**text - '0');
+        }
+
+        (*text)++;
+    }
+
+    return number;
+}
+
+static int failCall(ExCall *call, const char *error) {
+    call->error = error;
+
+    return 1;
+}
+
+// Copies text up to the next delimiter into out, a backslash before the
+// delimiter makes it part of the text, other escapes are kept as they are.
+// text is left past the delimiter.
+static size_t copyDelimited(const char **text, const char *end, char delimiter, char *out, size_t size) {
+    size_t length = 0;
+
+    while (*text < end && **text != delimiter) {
+        if (**text == '\\' && *text + 1 < end) {
+            if ((*text)[1] != delimiter && length < size) {
+                out[length++] = '\\';
+            }
+
+            (*text)++;
+        }
+
+        if (length < size) {
+            out[length++] = **text;
+        }
+
+        (*text)++;
+    }
+
+    if (*text < end) {
+        (*text)++;
+    }
+
+    return length;
+}
+
+// An empty pattern is the last one, any other is compiled and becomes it.
+// NULL when the call failed. releasePattern is the end of its use.
+static Regex *takePattern(ExCall *call, const char *pattern, size_t length) {
+    if (length == 0) {
+        if (call->lastPattern == NULL || *call->lastPattern == NULL) {
+            failCall(call, NoPreviousPattern);
+            return NULL;
+        }
+
+        return *call->lastPattern;
+    }
+
+    const char *error;
+    Regex *regex = compile_regex(pattern, length, &error);
+
+    if (regex == NULL) {
+        failCall(call, error);
+        return NULL;
+    }
+
+    if (call->lastPattern != NULL) {
+        free_regex(*call->lastPattern);
+        *call->lastPattern = regex;
+    }
+
+    return regex;
+}
+
+// Only a pattern nobody keeps as the last is freed
+static void releasePattern(ExCall *call, Regex *regex) {
+    if (call->lastPattern == NULL) {
+        free_regex(regex);
+    }
+}
+
+// "/pattern/" or "?pattern?", the closing delimiter may be left out
+static int parsePatternAddress(ExCall *call, const char **text, const char *end, size_t current, size_t *line) {
+    char delimiter = *(*text)++;
+    // Never longer than what it is copied from
+    char *pattern = malloc((size_t) (end - *text) + 1);
+
+    if (pattern == NULL) {
+        return failCall(call, OutOfMemory);
+    }
+
+    size_t length = copyDelimited(text, end, delimiter, pattern, (size_t) (end - *text));
+    Regex *regex = takePattern(call, pattern, length);
+
+    free(pattern);
+
+    if (regex == NULL) {
+        return 1;
+    }
+
+    size_t found;
+    int missing = findLineMatching(call->document, current - 1, delimiter == '/', regex, &found);
+
+    releasePattern(call, regex);
+
+    if (missing) {
+        return failCall(call, PatternNotFound);
+    }
+
+    *line = found + 1;
+
+    return 0;
+}
+
+// One address and the "+N" "-N" after it. found is 0 when there was none,
+// line is left alone then.
+static int parseAddress(ExCall *call, const char **text, const char *end, size_t current, size_t *line, int *found) {
+    size_t count = lastLine(call->document);
+
+    *found = 1;
+    skipBlanks(text, end);
+
+    if (*text >= end) {
+        *found = 0;
+        return 0;
+    }
+
+    char first = **text;
+
+    if (isdigit((unsigned char) first)) {
+        *line = parseNumber(text, end);
+    } else if (first == '.') {
+        *line = current;
+        (*text)++;
+    } else if (first == '$') {
+        *line = count;
+        (*text)++;
+    } else if (first == '\'') {
+        char mark = *text + 1 < end ? (*text)[1] : '\0';
+
+        if (mark < 'a' || mark > 'z' || call->marks == NULL) {
+            return failCall(call, UnknownMark);
+        }
+
+        if (call->marks[mark - 'a'] == EX_NO_MARK) {
+            return failCall(call, MarkNotSet);
+        }
+
+        *line = piece_table_line_at(call->document, call->marks[mark - 'a']) + 1;
+        *text += 2;
+    } else if (first == '/' || first == '?') {
+        if (parsePatternAddress(call, text, end, current, line)) {
+            return 1;
+        }
+    } else if (first == '+' || first == '-') {
+        // "+2" alone is relative to the current line
+        *line = current;
+    } else {
+        *found = 0;
+        return 0;
+    }
+
+    for (skipBlanks(text, end); *text < end && (**text == '+' || **text == '-'); skipBlanks(text, end)) {
+        char sign = *(*text)++;
+        size_t offset = *text < end && isdigit((unsigned char) **text) ? parseNumber(text, end) : 1;
+
+        if (sign == '-' && offset > *line) {
+            return failCall(call, InvalidRange);
+        }
+
+        *line = sign == '+' ? *line + offset : *line - offset;
+    }
+
+    if (*line > count) {
+        return failCall(call, InvalidRange);
+    }
+
+    return 0;
+}
+
+// "%", "3", ".,$", "'a,'b", "/text/;+2". No range at all is the current
+// line, current (one based) is the cursor's.
+static int parseRangeFrom(ExCall *call, const char **text, const char *end, size_t current) {
+    size_t first = current, last = current;
+    int found;
+
+    call->range.given = 0;
+    skipBlanks(text, end);
+
+    if (*text < end && **text == '%') {
+        (*text)++;
+        first = 1;
+        last = lastLine(call->document);
+        call->range.given = 2;
+    } else {
+        if (parseAddress(call, text, end, current, &first, &found)) {
+            return 1;
+        }
+
+        last = first;
+        call->range.given = found;
+        skipBlanks(text, end);
+
+        if (*text < end && (**text == ',' || **text == ';')) {
+            // After ';' the second address counts from the first one
+            if (*(*text)++ == ';') {
+                current = first;
+            }
+
+            last = current;
+
+            if (parseAddress(call, text, end, current, &last, &found)) {
+                return 1;
+            }
+
+            call->range.given = 2;
+        }
+    }
+
+    if (first > last) {
+        size_t swap = first;
+        first = last;
+        last = swap;
+    }
+
+    // Line 0 is only an address ("m0"), as a range it is the first line
+    call->range.first = first > 0 ? first - 1 : 0;
+    call->range.last = last > 0 ? last - 1 : 0;
+
+    return 0;
+}
+
+int parseExRange(ExCall *call, const char **text, const char *end) {
+    return parseRangeFrom(call, text, end, piece_table_line_at(call->document, call->cursor) + 1);
+}
+
+// ---------------------------------------------------------
+// Commands
+// ---------------------------------------------------------
+
+static int exGoto(PieceTable *document, ExCall *call) {
+    if (call->range.given) {
+        call->cursor = piece_table_line_start(document, call->range.last);
+    }
+
+    return 0;
+}
+
+static int exDelete(PieceTable *document, ExCall *call) {
+    if (deleteLines(document, call->range.first, call->range.last)) {
+        return failCall(call, OutOfMemory);
+    }
+
+    call->cursor = piece_table_line_start(document, call->range.first);
+
+    return 0;
+}
+
+// Lines lose their leading blanks and are put together with one space
+static int exJoin(PieceTable *document, ExCall *call) {
+    size_t first = call->range.first;
+    size_t last = call->range.given < 2 ? first + 1 : call->range.last;
+    size_t count = piece_table_line_count(document);
+
+    if (last >= count) {
+        last = count - 1;
+    }
+
+    // From the bottom up, the lines above keep their offsets
+    for (size_t line = last; line > first; line--) {
+        size_t lineBreak = piece_table_line_start(document, line) - 1;
+        size_t next = lineBreak + 1;
+        char character;
+
+        while ((character = characterAt(document, next)) == ' ' || character == '\t') {
+            next++;
+        }
+
+        int space = character != '\n' && character != '\0' &&
+                    lineBreak > 0 && characterAt(document, lineBreak - 1) != '\n';
+
+        if (piece_table_delete(document, lineBreak, next - lineBreak) ||
+            (space && piece_table_insert(document, lineBreak, " ", 1))) {
+            return failCall(call, OutOfMemory);
+        }
+
+        call->cursor = lineBreak;
+    }
+
+    return 0;
+}
+
+static int exCopy(PieceTable *document, ExCall *call) {
+    size_t length, at;
+    char *text = copyLines(document, call->range.first, call->range.last, &length);
+
+    if (text == NULL || insertLines(document, call->address, text, length, &at)) {
+        free(text);
+        return failCall(call, OutOfMemory);
+    }
+
+    free(text);
+    call->cursor = piece_table_line_start(document, call->address + call->range.last - call->range.first);
+
+    return 0;
+}
+
+static int exMove(PieceTable *document, ExCall *call) {
+    size_t first = call->range.first, last = call->range.last;
+    size_t lines = last - first + 1;
+    size_t address = call->address;
+
+    // Below any of its lines but the last one
+    if (address > first && address <= last) {
+        return failCall(call, MoveIntoItself);
+    }
+
+    size_t length, at;
+    char *text = copyLines(document, first, last, &length);
+
+    if (text == NULL || deleteLines(document, first, last)) {
+        free(text);
+        return failCall(call, OutOfMemory);
+    }
+
+    if (address > last) {
+        address -= lines;
+    }
+
+    if (insertLines(document, address, text, length, &at)) {
+        free(text);
+        return failCall(call, OutOfMemory);
+    }
+
+    free(text);
+    call->cursor = piece_table_line_start(document, address + lines - 1);
+
+    return 0;
+}
+
+static int exMark(PieceTable *document, ExCall *call) {
+    call->marks[call->argument[0] - 'a'] = piece_table_line_start(document, call->range.last);
+
+    return 0;
+}
+
+void moveExMarks(size_t *marks, size_t offset, size_t removed, size_t length) {
+    for (int i = 0; i < EX_MARKS; i++) {
+        if (marks[i] == EX_NO_MARK) {
+            continue;
+        }
+
+        if (marks[i] >= offset + removed) {
+            marks[i] = marks[i] - removed + length;
+        } else if (marks[i] > offset) {
+            marks[i] = offset;
+        }
+    }
+}
+
+// Changes that were not written keep the editor open, unless "!" throws them away
+static int exQuit(PieceTable *document, ExCall *call) {
+    if (!call->bang && piece_table_modified(document)) {
+        return failCall(call, NoWriteSinceLastChange);
+    }
+
+    call->quit = 1;
+
+    return 0;
+}
+
+// ":w [file]", the editor does the writing
+static int exWrite(PieceTable *document, ExCall *call) {
+    (void) document;
+    size_t length = call->argumentLength;
+
+    while (length > 0 && (call->argument[length - 1] == ' ' || call->argument[length - 1] == '\t')) {
+        length--;
+    }
+
+    if (call->write == NULL) {
+        return failCall(call, NoFileName);
+    }
+
+    const char *error = call->write(call->argument, length, &call->message);
+
+    return error != NULL ? failCall(call, error) : 0;
+}
+
+static int exWriteQuit(PieceTable *document, ExCall *call) {
+    if (exWrite(document, call)) {
+        return 1;
+    }
+
+    call->quit = 1;
+
+    return 0;
+}
+
+// ":x" is ":wq" that only writes when there is something to write
+static int exExit(PieceTable *document, ExCall *call) {
+    if (piece_table_modified(document)) {
+        return exWriteQuit(document, call);
+    }
+
+    call->quit = 1;
+
+    return 0;
+}
+
+// "&" and "\\0" are the whole match, "\\r" breaks the line, any other
+// escaped byte is itself
+static void expandReplacement(Vector *out, const char *replacement, size_t length, const char *matched, size_t matchedLength) {
+    for (size_t i = 0; i < length; i++) {
+        char character = replacement[i];
+
+        if (character == '&' || (character == '\\' && i + 1 < length && replacement[i + 1] == '0')) {
+            i += character == '\\';
+
+            for (size_t j = 0; j < matchedLength; j++) {
+                vec_push_back(out, (void *) &matched[j]);
+            }
+
+            continue;
+        }
+
+        if (character == '\\' && i + 1 < length) {
+            character = replacement[++i];
+
+            if (character == 'r') {
+                character = '\n';
+            } else if (character == 't') {
+                character = '\t';
+            }
+        }
+
+        vec_push_back(out, &character);
+    }
+}
+
+// The replacements of every line of the range, collected as edits. Their
+// text goes into texts one after the other, the edits get pointers to it
+// once it stops moving. line is the last line changed.
+static int collectSubstitutions(PieceTable *document, ExCall *call, Regex *regex, const char *replacement,
+                                size_t replacementLength, int global, Vector *edits, Vector *texts, size_t *line) {
+    size_t count = piece_table_line_count(document);
+    Vector *matches = initialize_vector("struct", sizeof(RegexMatch));
+    char *text = NULL;
+    int failed = matches == NULL;
+
+    for (size_t number = call->range.first; !failed && number <= call->range.last && number < count; number++) {
+        size_t start = piece_table_line_start(document, number);
+        size_t end = number + 1 < count ? piece_table_line_start(document, number + 1) - 1 : piece_table_length(document);
+        char *grown = realloc(text, end - start + 1);
+
+        if (grown == NULL) {
+            failed = 1;
+            break;
+        }
+
+        text = grown;
+        size_t length = piece_table_read(document, start, text, end - start);
+
+        vec_clear(matches);
+        failed = regex_line_matches(regex, text, length, number > 0 ? '\n' : REGEX_EDGE,
+                                    number + 1 < count ? '\n' : REGEX_EDGE, global, matches);
+
+        for (size_t i = 0; !failed && i < matches->len; i++) {
+            RegexMatch *match = (RegexMatch *) matches->base + i;
+            size_t before = texts->len;
+
+            expandReplacement(texts, replacement, replacementLength, text + match->start, match->end - match->start);
+
+            PieceTableEdit edit = {
+                .offset = start + match->start,
+                .length = match->end - match->start,
+                .textLength = texts->len - before
+            };
+
+            vec_push_back(edits, &edit);
+            *line = number;
+        }
+    }
+
+    free(text);
+    free_vector(matches);
+
+    for (size_t i = 0, at = 0; !failed && i < edits->len; i++) {
+        PieceTableEdit *edit = (PieceTableEdit *) edits->base + i;
+
+        edit->text = (const char *) texts->base + at;
+        at += edit->textLength;
+    }
+
+    return failed;
+}
+
+// ":s/pattern/replacement/g", any punctuation can stand for the "/". "e"
+// keeps quiet when nothing matches, ":s" alone puts the last replacement in
+// for the last pattern, without flags. Every replacement in the range goes into the
+// document as one edit. pattern and replacement have room for the whole
+// argument.
+static int substitute(PieceTable *document, ExCall *call, char *pattern, char *replacement) {
+    const char *text = call->argument;
+    const char *end = call->argument + call->argumentLength;
+    size_t size = call->argumentLength;
+    size_t patternLength = 0, replacementLength = 0;
+    int global = 0, quiet = 0;
+
+    if (text >= end) {
+        if (call->lastReplacement == NULL || *call->lastReplacement == NULL) {
+            return failCall(call, NoPreviousPattern);
+        }
+
+        // The argument has no room for it
+        replacement = *call->lastReplacement;
+        replacementLength = strlen(replacement);
+    } else {
+        char delimiter = *text++;
+
+        if (isalnum((unsigned char) delimiter) || delimiter == '\\' || delimiter == '"' || delimiter == '|') {
+            return failCall(call, BadDelimiter);
+        }
+
+        patternLength = copyDelimited(&text, end, delimiter, pattern, size);
+        replacementLength = copyDelimited(&text, end, delimiter, replacement, size);
+
+        for (; text < end && (*text == 'g' || *text == 'e'); text++) {
+            global |= *text == 'g';
+            quiet |= *text == 'e';
+        }
+
+        skipBlanks(&text, end);
+
+        if (text < end) {
+            return failCall(call, TrailingCharacters);
+        }
+    }
+
+    //! TODO the automata do not track groups, "\\1" to "\\9" have nothing to refer to
+    for (size_t i = 0; i + 1 < replacementLength; i++) {
+        if (replacement[i] == '\\' && replacement[++i] >= '1' && replacement[i] <= '9') {
+            return failCall(call, IllegalBackReference);
+        }
+    }
+
+    Regex *regex = takePattern(call, pattern, patternLength);
+
+    if (regex == NULL) {
+        return 1;
+    }
+
+    if (call->lastReplacement != NULL && replacement != *call->lastReplacement) {
+        char *copy = malloc(replacementLength + 1);
+
+        if (copy == NULL) {
+            releasePattern(call, regex);
+            return failCall(call, OutOfMemory);
+        }
+
+        memcpy(copy, replacement, replacementLength);
+        copy[replacementLength] = '\0';
+        free(*call->lastReplacement);
+        *call->lastReplacement = copy;
+    }
+
+    const char *error;
+    Vector *edits = initialize_vector("struct", sizeof(PieceTableEdit));
+    Vector *texts = initialize_vector("struct", sizeof(char)); // "char" vectors keep a terminator in len
+    size_t line = 0;
+    int failed = edits == NULL || texts == NULL ||
+                 collectSubstitutions(document, call, regex, replacement, replacementLength, global, edits, texts, &line);
+
+    if (failed) {
+        error = OutOfMemory;
+    } else if (edits->len == 0) {
+        failed = !quiet;
+        error = PatternNotFound;
+    } else {
+        // The cursor goes to the last line changed, wherever the edits above moved it
+        size_t lineStart = piece_table_line_start(document, line);
+        size_t cursor = lineStart;
+
+        for (size_t i = 0; i < edits->len; i++) {
+            PieceTableEdit *edit = (PieceTableEdit *) edits->base + i;
+
+            if (edit->offset < lineStart) {
+                cursor += edit->textLength - edit->length;
+            }
+        }
+
+        if (piece_table_replace(document, edits->base, edits->len)) {
+            failed = 1;
+            error = OutOfMemory;
+        } else {
+            call->cursor = cursor;
+        }
+    }
+
+    free_vector(edits);
+    free_vector(texts);
+    releasePattern(call, regex);
+
+    return failed ? failCall(call, error) : 0;
+}
+
+// The pattern and the replacement are never longer than the argument they
+// are copied from, however long it is
+static int exSubstitute(PieceTable *document, ExCall *call) {
+    char *buffer = malloc(2 * call->argumentLength + 1);
+
+    if (buffer == NULL) {
+        return failCall(call, OutOfMemory);
+    }
+
+    int failed = substitute(document, call, buffer, buffer + call->argumentLength);
+
+    free(buffer);
+
+    return failed;
+}
+
+// Sorted by name, findExCommand depends on it
+static const ExCommand ExCommands[] = {
+    { "copy", 2, EX_RANGE | EX_ADDRESS, exCopy },
+    { "delete", 1, EX_RANGE, exDelete },
+    { "join", 1, EX_RANGE, exJoin },
+    { "k", 1, EX_RANGE | EX_MARK, exMark },
+    { "mark", 2, EX_RANGE | EX_MARK, exMark },
+    { "move", 1, EX_RANGE | EX_ADDRESS, exMove },
+    { "qall", 2, EX_BANG, exQuit },
+    { "quit", 1, EX_BANG, exQuit },
+    { "substitute", 1, EX_RANGE | EX_TEXT, exSubstitute },
+    { "t", 1, EX_RANGE | EX_ADDRESS, exCopy },
+    { "wq", 2, EX_BANG | EX_TEXT, exWriteQuit },
+    { "write", 1, EX_BANG | EX_TEXT, exWrite },
+    { "xit", 1, EX_BANG | EX_TEXT, exExit },
+};
+
+// A range with no command after it moves the cursor there
+static const ExCommand GotoCommand = { "", 0, EX_RANGE, exGoto };
+
+// The first command in name order that starts with name and accepts it as
+// an abbreviation, "m" skips "mark" (which wants "ma") and lands on "move"
+const ExCommand *findExCommand(const char *name, size_t length) {
+    size_t low = 0, high = sizeof(ExCommands) / sizeof(ExCommands[0]);
+
+    if (length == 0) {
+        return NULL;
+    }
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+
+        if (strncmp(ExCommands[middle].name, name, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (; low < sizeof(ExCommands) / sizeof(ExCommands[0]); low++) {
+        if (strncmp(ExCommands[low].name, name, length) != 0) {
+            break;
+        }
+
+        if (length >= ExCommands[low].abbreviation) {
+            return &ExCommands[low];
+        }
+    }
+
+    return NULL;
+}
+
+static int isCommandEnd(const char *text, const char *end) {
+    return text >= end || *text == '|' || *text == '\n';
+}
+
+// Skips to the next command of a script, past its '|' or line break
+static void skipCommand(const char **text, const char *end) {
+    while (!isCommandEnd(*text, end)) {
+        (*text)++;
+    }
+
+    if (*text < end) {
+        (*text)++;
+    }
+}
+
+// Parses one command of a script without running it, text is left on the
+// command after it
+int parseExCommand(ExCall *call, const char **text, const char *end, const ExCommand **command) {
+    call->error = NULL;
+    call->bang = 0;
+    call->address = 0;
+    call->argument = NULL;
+    call->argumentLength = 0;
+
+    while (*text < end && (**text == ':' || **text == ' ' || **text == '\t')) {
+        (*text)++;
+    }
+
+    // The cursor's line is looked up once, the range and the address share it
+    size_t current = piece_table_line_at(call->document, call->cursor) + 1;
+
+    if (parseRangeFrom(call, text, end, current)) {
+        skipCommand(text, end);
+        return 1;
+    }
+
+    const char *name = *text;
+
+    while (*text < end && isalpha((unsigned char) **text)) {
+        (*text)++;
+    }
+
+    size_t length = (size_t) (*text - name);
+
+    if (length == 0) {
+        *command = &GotoCommand;
+    } else if ((*command = findExCommand(name, length)) == NULL) {
+        // "ka" is "k a"
+        if (name[0] != 'k') {
+            skipCommand(text, end);
+            return failCall(call, NotACommand);
+        }
+
+        *command = findExCommand("k", 1);
+        *text = name + 1;
+    }
+
+    unsigned char flags = (*command)->flags;
+
+    if (*text < end && **text == '!') {
+        (*text)++;
+
+        if (!(flags & EX_BANG)) {
+            skipCommand(text, end);
+            return failCall(call, NoBangAllowed);
+        }
+
+        call->bang = 1;
+    }
+
+    if (call->range.given && !(flags & EX_RANGE)) {
+        skipCommand(text, end);
+        return failCall(call, NoRangeAllowed);
+    }
+
+    skipBlanks(text, end);
+
+    if (flags & EX_ADDRESS) {
+        int found;
+
+        if (parseAddress(call, text, end, current, &call->address, &found)) {
+            skipCommand(text, end);
+            return 1;
+        }
+
+        if (!found) {
+            skipCommand(text, end);
+            return failCall(call, InvalidRange);
+        }
+    } else if (flags & EX_MARK) {
+        if (*text >= end || **text < 'a' || **text > 'z' || call->marks == NULL) {
+            skipCommand(text, end);
+            return failCall(call, UnknownMark);
+        }
+
+        call->argument = (*text)++;
+        call->argumentLength = 1;
+    } else if (flags & EX_TEXT) {
+        call->argument = *text;
+
+        while (!isCommandEnd(*text, end)) {
+            // "\|" is a "|" of the argument, e.g. in a pattern
+            if (**text == '\\' && *text + 1 < end && (*text)[1] != '\n') {
+                (*text)++;
+            }
+
+            (*text)++;
+        }
+
+        call->argumentLength = (size_t) (*text - call->argument);
+    }
+
+    skipBlanks(text, end);
+
+    // Commands that take no free text must end here
+    if (!isCommandEnd(*text, end)) {
+        skipCommand(text, end);
+        return failCall(call, TrailingCharacters);
+    }
+
+    skipCommand(text, end);
+
+    // Blank lines in a script are not commands
+    if (*command == &GotoCommand && !call->range.given) {
+        *command = NULL;
+    }
+
+    return 0;
+}
+
+// Runs the commands of text one after the other ('|' or a line break between
+// them), the first one that fails stops the rest
+int runExCommands(ExCall *call, const char *text, size_t length) {
+    const char *end = text + length;
+
+    call->quit = 0;
+    call->message = NULL;
+
+    while (text < end && !call->quit) {
+        const ExCommand *command;
+
+        if (parseExCommand(call, &text, end, &command)) {
+            return 1;
+        }
+
+        if (command != NULL && command->handler(call->document, call)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// The editor's command line, what the commands did shows up on screen
+enum SIGNALS parseCommandFromBuffer(Vector *buffer, const char **error) {
+    *error = NULL;
+
+    if (buffer->len == 0) {
+        return NOP_SIGNAL;
+    }
+
+    const char *command = (const char *) buffer->base;
+    ExCall call = {
+        .document = Xim.document,
+        .cursor = Xim.documentCursor,
+        .marks = Xim.marks,
+        .lastPattern = &Xim.search,
+        .lastReplacement = &Xim.replacement,
+        .write = writeDocument,
+    };
+
+    if (runExCommands(&call, command, strlen(command))) {
+        *error = call.error;
+    } else {
+        *error = call.message;
+    }
+
+    moveDocumentCursor(call.cursor);
+
+    // Quitting on purpose leaves nothing to recover, what was not written
+    // was thrown away with "!"
+    if (call.quit) {
+        close_journal(Xim.journal, 1);
+        Xim.journal = NULL;
     }
 
-    return NOP_SIGNAL;
+    return call.quit ? EXIT_SIGNAL : NOP_SIGNAL;
 }
@@ -1,8 +1,15 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include "console.h"
 #include "xim.h"
-#include <assert.h>
 
 Console console = {
+#if defined(XIM_CONSOLE_WIN32)
+    .backend = &win32ConsoleBackend,
+#elif defined(XIM_CONSOLE_POSIX)
+    .backend = &posixConsoleBackend,
+#endif
     .state = {
         .Output = {
             .lastWrittenCharsCount = 0
@@ -13,73 +20,47 @@ Console console = {
     }
 };
 
-inline int write_text(char *buffer, COORD coords);
+int write_text(char *buffer, Vector2d where);
+int update_console_size();
 
-int initializeConsole() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    // alternate buffer
-    HANDLE hAlt = CreateConsoleScreenBuffer(
-        GENERIC_READ | GENERIC_WRITE,
-        0,
-        NULL,
-        CONSOLE_TEXTMODE_BUFFER,
-        NULL
-    );
-
-    if (hAlt == NULL) {
+int update_console_size() {
+    Size2s size;
+
+    if (console.backend->querySize(&size)) {
         return 1;
     }
 
-    SetConsoleActiveScreenBuffer(hAlt);
+    console.state.Size.width = size.width;
+    console.state.Size.height = size.height;
 
-    console.hOldConsole = hConsole;
-    console.windowsConsoleHandle = hAlt;
+    return 0;
+}
 
-    // Get input buffer
-    console.hInput = GetStdHandle(STD_INPUT_HANDLE);
+int initializeConsole() {
+    assert(console.backend != NULL && "NO CONSOLE BACKEND WAS PICKED!");
 
-    if (console.hInput == INVALID_HANDLE_VALUE) {
+    if (console.backend->initialize()) {
         return 1;
     }
 
-    DWORD mode;
-    GetConsoleMode(console.hInput, &mode);
-
-    // disables Enter to get new data, and adding character to screen after writing it
-    mode |= ENABLE_WINDOW_INPUT;
-    mode &= ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT);
-
-    SetConsoleMode(console.hInput, mode);
-    // SetConsoleCtrlHandler(NULL, 1);
-
-    if (!GetConsoleScreenBufferInfo(hAlt, &console.Windows.csbi)) {
+    if (update_console_size()) {
+        console.backend->kill();
         return 1;
     }
 
-    console.state.Size.width = console.Windows.csbi.srWindow.Right - console.Windows.csbi.srWindow.Left + 1;
-    console.state.Size.height = console.Windows.csbi.srWindow.Bottom - console.Windows.csbi.srWindow.Top + 1;
-
     return 0;
 }
 
 int killConsole() {
-    SetConsoleActiveScreenBuffer(console.hOldConsole);
-    CloseHandle(console.windowsConsoleHandle);
-    CloseHandle(console.hOldConsole);
-    CloseHandle(console.hInput);
-
-    // SetConsoleCtrlHandler(NULL, 0);
+    console.backend->flush();
 
-    return 0;
+    return console.backend->kill();
 }
 
 int rerenderScreen() {
-    if (!GetConsoleScreenBufferInfo(console.windowsConsoleHandle, &console.Windows.csbi)) {
+    if (update_console_size()) {
         return 1;
     }
-
-    console.state.Size.width = console.Windows.csbi.srWindow.Right - console.Windows.csbi.srWindow.Left + 1;
-    console.state.Size.height = console.Windows.csbi.srWindow.Bottom - console.Windows.csbi.srWindow.Top + 1;
     // do other stuff
 
     recalculateScreenBuffers();
@@ -95,9 +76,9 @@ int rerenderScreen() {
     return 0;
 }
 
-int write(enum WriteType type, void *value, COORD where) {
+int writeToConsole(enum WriteType type, void *value, Vector2d where) {
     switch(type) {
-        case TEXT:
+        case WRITE_TEXT:
             write_text((char *) value, where);
             break;
         default:
@@ -108,68 +89,81 @@ int write(enum WriteType type, void *value, COORD where) {
     return 0;
 }
 
-inline int write_text(char *buffer, COORD coords) {
-    return WriteConsoleOutputCharacter(
-        console.windowsConsoleHandle,
-        buffer,
-        strlen(buffer),
-        coords,
-        &console.state.Output.lastWrittenCharsCount
-    );
-}
+int write_text(char *buffer, Vector2d where) {
+    size_t length = strlen(buffer);
+    Cell *cells = malloc((length ? length : 1) * sizeof(*cells));
 
-int writeWindowsBuffer(CHAR_INFO *buffer, COORD where, COORD size) {
-    SMALL_RECT rect = {
-        where.X, where.Y,
-        where.X + size.X - 1,
-        where.Y + size.Y - 1,
-    };
+    if (cells == NULL) {
+        return 1;
+    }
 
-    BOOL x = WriteConsoleOutput(
-        console.windowsConsoleHandle,
-        buffer,
-        size,
-        (COORD) {0,0},
-        &rect
-    );
+    for (size_t i = 0; i < length; i++) {
+        cells[i].character = buffer[i];
+        cells[i].attributes = CELL_FOREGROUND_RED | CELL_FOREGROUND_GREEN | CELL_FOREGROUND_BLUE;
+    }
+
+    int result = writeConsoleBuffer(cells, where, (Size2s) { (unsigned short) length, 1 });
+
+    free(cells);
+
+    return result;
+}
 
-    if (!x) {
+int writeConsoleBuffer(Cell *buffer, Vector2d where, Size2s size) {
+    if (size.width == 0 || size.height == 0) {
+        return 0;
+    }
+
+    if (console.backend->writeCells(buffer, where, size)) {
         assert(0 && "Failed to write to console!"); // for now
     }
 
+    console.state.Output.lastWrittenCharsCount = (unsigned long) size.width * size.height;
+
     return 0;
 }
 
+int flushConsole() {
+    return console.backend->flush();
+}
+
 int setCursorPosition(Vector2d start, int next) {
+    if (console.state.Size.width <= 0) {
+        return 1;
+    }
+
     int x = start.x + next;
-    COORD position = {
-        .X = x % console.state.Size.width,
-        .Y = start.y + (x / console.state.Size.width)
+    Vector2d position = {
+        .x = x % console.state.Size.width,
+        .y = start.y + (x / console.state.Size.width)
     };
 
-    return SetConsoleCursorPosition(console.windowsConsoleHandle, position);
+    return console.backend->setCursor(position);
 }
 
-KeyCode pollInputFromConsole() {
-    INPUT_RECORD record;
+enum CONSOLE_WAIT waitForConsole(int timeout) {
+    return console.backend->wait(timeout);
+}
 
-    // read keystrokes
-    ReadConsoleInput(console.hInput, &record, 1, &console.state.Input.lastReadCharsCount);
+int wakeConsole() {
+    return console.backend->wake();
+}
 
-    if (record.EventType == WINDOW_BUFFER_SIZE_EVENT) {
-        rerenderScreen();
+// Hands over everything that came in at once, so a paste or fast typing
+// costs one frame instead of one per key
+size_t pollInputFromConsole(ConsoleInput *events, size_t capacity) {
+    size_t keys = 0;
+    size_t count = console.backend->readInput(events, capacity);
+
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].event == CONSOLE_EVENT_KEY) {
+            console.state.Input.lastKeyCode = events[i].key.keyCode;
+            console.state.Input.character = events[i].key.character;
+            keys++;
+        }
     }
 
-     if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown) {
-        console.state.Input.lastKeyCode = record.Event.KeyEvent.wVirtualKeyCode;
-        console.state.Input.character = record.Event.KeyEvent.uChar.AsciiChar;
-
-        return (KeyCode) {
-            .keyCode = record.Event.KeyEvent.wVirtualKeyCode,
-            .character = record.Event.KeyEvent.uChar.AsciiChar
-        };
-    }
+    console.state.Input.lastReadCharsCount = (unsigned long) keys;
 
-    // Essentially null ?
-    return (KeyCode) {0};
+    return count;
 }
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "console/ansi.h"
+
+// Moves shorter than this are done with backspaces instead of CUB
+#define ANSI_MAX_BACKSPACES 3
+// Right moves up to this long may print the cells already shown instead
+#define ANSI_MAX_OVERWRITE 4
+// Down moves up to this long may use line feeds instead of CUD
+#define ANSI_MAX_LINE_FEEDS 3
+// A blank tail is only erased with EL when it is longer than "\x1b[K"
+#define ANSI_MIN_ERASE 4
+
+void initialize_ansi_writer(AnsiWriter *writer) {
+    writer->data = NULL;
+    writer->length = 0;
+    writer->size = 0;
+    writer->attributes = ANSI_NO_ATTRIBUTES;
+    writer->screen = (Size2s) { 0, 0 };
+    writer->shadow = NULL;
+    writer->cursor = (Vector2d) { 0, 0 };
+    writer->cursorKnown = 0;
+}
+
+int ansi_append(AnsiWriter *writer, const char *bytes, size_t length) {
+    if (writer->length + length > writer->size) {
+        size_t size = writer->size ? writer->size : 4096;
+
+        while (size < writer->length + length) {
+            size *= 2;
+        }
+
+        char *grown = realloc(writer->data, size);
+
+        if (grown == NULL) {
+            return 1;
+        }
+
+        writer->data = grown;
+        writer->size = size;
+    }
+
+    memcpy(writer->data + writer->length, bytes, length);
+    writer->length += length;
+
+    return 0;
+}
+
+int ansi_append_string(AnsiWriter *writer, const char *text) {
+    return ansi_append(writer, text, strlen(text));
+}
+
+static Cell *ansi_shadow_at(AnsiWriter *writer, int x, int y) {
+    if (writer->shadow == NULL || x < 0 || y < 0 || x >= writer->screen.width || y >= writer->screen.height) {
+        return NULL;
+    }
+
+    return &writer->shadow[(size_t) y * writer->screen.width + x];
+}
+
+static void ansi_forget_screen(AnsiWriter *writer) {
+    size_t count = (size_t) writer->screen.width * writer->screen.height;
+
+    for (size_t i = 0; i < count; i++) {
+        writer->shadow[i].character = 0;
+        writer->shadow[i].attributes = ANSI_NO_ATTRIBUTES;
+    }
+
+    writer->cursorKnown = 0;
+}
+
+// The terminal changed size, nothing it shows can be trusted anymore
+int ansi_resize(AnsiWriter *writer, Size2s screen) {
+    size_t count = (size_t) screen.width * screen.height;
+    Cell *shadow = realloc(writer->shadow, (count ? count : 1) * sizeof(*shadow));
+
+    if (shadow == NULL) {
+        return 1;
+    }
+
+    writer->shadow = shadow;
+    writer->screen = screen;
+    ansi_forget_screen(writer);
+
+    return 0;
+}
+
+// Blanks the screen with the default colors, which makes every cell known
+int ansi_clear_screen(AnsiWriter *writer) {
+    if (ansi_set_attributes(writer, 0) || ansi_append_string(writer, "\x1b[2J")) {
+        return 1;
+    }
+
+    size_t count = (size_t) writer->screen.width * writer->screen.height;
+
+    for (size_t i = 0; i < count; i++) {
+        writer->shadow[i].character = ' ';
+        writer->shadow[i].attributes = 0;
+    }
+
+    return 0;
+}
+
+static int ansi_foreground_code(unsigned short attributes) {
+    int color = ((attributes & CELL_FOREGROUND_RED) ? 1 : 0)
+        | ((attributes & CELL_FOREGROUND_GREEN) ? 2 : 0)
+        | ((attributes & CELL_FOREGROUND_BLUE) ? 4 : 0);
+
+    if (attributes & CELL_FOREGROUND_INTENSITY) {
+        return 90 + color;
+    }
+
+    // No foreground bits is the terminal's own text color
+    return color ? 30 + color : 39;
+}
+
+static int ansi_background_code(unsigned short attributes) {
+    int color = ((attributes & CELL_BACKGROUND_RED) ? 1 : 0)
+        | ((attributes & CELL_BACKGROUND_GREEN) ? 2 : 0)
+        | ((attributes & CELL_BACKGROUND_BLUE) ? 4 : 0);
+
+    if (attributes & CELL_BACKGROUND_INTENSITY) {
+        return 100 + color;
+    }
+
+    return color ? 40 + color : 49;
+}
+
+// Maps the Win32 style color bits to SGR: red, green and blue are the bits
+// of the ANSI color index in the other order. Only what changed is sent.
+int ansi_set_attributes(AnsiWriter *writer, unsigned short attributes) {
+    if (attributes == writer->attributes) {
+        return 0;
+    }
+
+    unsigned short previous = writer->attributes;
+    char sequence[32];
+    int length;
+
+    writer->attributes = attributes;
+
+    // No color at all is the terminal's default look, not black on black
+    if (attributes == 0) {
+        return ansi_append_string(writer, "\x1b[m");
+    }
+
+    int foreground = ansi_foreground_code(attributes);
+    int background = ansi_background_code(attributes);
+
+    if (previous == ANSI_NO_ATTRIBUTES) {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[0;%d;%dm", foreground, background);
+    } else if (foreground == ansi_foreground_code(previous)) {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[%dm", background);
+    } else if (background == ansi_background_code(previous)) {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[%dm", foreground);
+    } else {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[%d;%dm", foreground, background);
+    }
+
+    return ansi_append(writer, sequence, (size_t) length);
+}
+
+static int ansi_count(char *out, char final, int count) {
+    // A count of one is the default and can be left out
+    return count == 1 ? sprintf(out, "\x1b[%c", final) : sprintf(out, "\x1b[%d%c", count, final);
+}
+
+// Can the cells between the cursor and column x be printed again as they are
+static int ansi_can_overwrite(AnsiWriter *writer, int x) {
+    for (int column = writer->cursor.x; column < x; column++) {
+        Cell *shown = ansi_shadow_at(writer, column, writer->cursor.y);
+
+        if (shown == NULL || shown->attributes != writer->attributes
+            || (unsigned char) shown->character < ' ' || shown->character == 0x7F) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Horizontal move on the cursor's row, from column `from` to `to`
+static int ansi_horizontal(AnsiWriter *writer, char *out, int from, int to, int overwrite) {
+    int length = 0;
+
+    if (to < from) {
+        if (from - to <= ANSI_MAX_BACKSPACES) {
+            for (int i = 0; i < from - to; i++) {
+                out[length++] = '\b';
+            }
+            return length;
+        }
+        return ansi_count(out, 'D', from - to);
+    }
+
+    if (to > from && overwrite) {
+        for (int column = from; column < to; column++) {
+            out[length++] = ansi_shadow_at(writer, column, writer->cursor.y)->character;
+        }
+        return length;
+    }
+
+    return to > from ? ansi_count(out, 'C', to - from) : 0;
+}
+
+// Vertical move, the column stays where it is
+static int ansi_vertical(AnsiWriter *writer, char *out, int from, int to) {
+    if (to < from) {
+        return ansi_count(out, 'A', from - to);
+    }
+
+    // Line feeds never scroll here: the target row is on screen
+    if (to - from <= ANSI_MAX_LINE_FEEDS && to < writer->screen.height) {
+        for (int i = 0; i < to - from; i++) {
+            out[i] = '\n';
+        }
+        return to - from;
+    }
+
+    return to > from ? ansi_count(out, 'B', to - from) : 0;
+}
+
+// Picks the shortest way to put the cursor at position
+int ansi_move_cursor(AnsiWriter *writer, Vector2d position) {
+    char best[64];
+    char candidate[64];
+    int bestLength;
+
+    if (writer->cursorKnown && writer->cursor.x == position.x && writer->cursor.y == position.y) {
+        return 0;
+    }
+
+    if (position.x == 0 && position.y == 0) {
+        bestLength = sprintf(best, "\x1b[H");
+    } else if (position.x == 0) {
+        bestLength = sprintf(best, "\x1b[%dH", position.y + 1);
+    } else {
+        bestLength = sprintf(best, "\x1b[%d;%dH", position.y + 1, position.x + 1);
+    }
+
+    if (writer->cursorKnown) {
+        int vertical = ansi_vertical(writer, candidate, writer->cursor.y, position.y);
+        int overwrite = position.y == writer->cursor.y
+            && position.x > writer->cursor.x
+            && position.x - writer->cursor.x <= ANSI_MAX_OVERWRITE
+            && ansi_can_overwrite(writer, position.x);
+
+        // Relative: up/down, then left/right from the same column
+        int length = vertical + ansi_horizontal(writer, candidate + vertical, writer->cursor.x, position.x, overwrite);
+
+        if (length < bestLength) {
+            memcpy(best, candidate, (size_t) length);
+            bestLength = length;
+        }
+
+        // CR first, then up/down and right from the first column
+        candidate[0] = '\r';
+        length = 1 + ansi_vertical(writer, candidate + 1, writer->cursor.y, position.y);
+        length += ansi_horizontal(writer, candidate + length, 0, position.x, 0);
+
+        if (length < bestLength) {
+            memcpy(best, candidate, (size_t) length);
+            bestLength = length;
+        }
+    }
+
+    writer->cursor = position;
+    writer->cursorKnown = writer->screen.width > 0;
+
+    return ansi_append(writer, best, (size_t) bestLength);
+}
+
+// Is everything from column x to the end of row y known to be blank
+static int ansi_blank_until_end(AnsiWriter *writer, int x, int y) {
+    for (; x < writer->screen.width; x++) {
+        Cell *shown = ansi_shadow_at(writer, x, y);
+
+        if (shown == NULL || shown->character != ' ' || shown->attributes != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int ansi_print_cell(AnsiWriter *writer, Cell cell) {
+    // Control bytes would move the terminal's cursor on their own
+    if ((unsigned char) cell.character < ' ' || cell.character == 0x7F) {
+        cell.character = ' ';
+    }
+
+    if (ansi_set_attributes(writer, cell.attributes) || ansi_append(writer, &cell.character, 1)) {
+        return 1;
+    }
+
+    Cell *shown = ansi_shadow_at(writer, writer->cursor.x, writer->cursor.y);
+
+    if (shown != NULL) {
+        *shown = cell;
+    }
+
+    writer->cursor.x++;
+
+    // Past the last column the terminal waits to wrap, do not guess where it is
+    if (writer->cursor.x >= writer->screen.width) {
+        writer->cursorKnown = 0;
+    }
+
+    return 0;
+}
+
+int ansi_write_cells(AnsiWriter *writer, Cell *cells, Vector2d where, Size2s size) {
+    for (int row = 0; row < size.height; row++) {
+        Cell *line = cells + (size_t) row * size.width;
+        int y = where.y + row;
+        int end = size.width;
+
+        // A blank tail is erased in one go when nothing after it has to survive
+        while (end > 0 && line[end - 1].character == ' ' && line[end - 1].attributes == 0) {
+            end--;
+        }
+
+        int erase = size.width - end >= ANSI_MIN_ERASE
+            && writer->shadow != NULL
+            && (where.x + size.width >= writer->screen.width || ansi_blank_until_end(writer, where.x + size.width, y));
+
+        if (!erase) {
+            end = size.width;
+        }
+
+        if (end > 0 && ansi_move_cursor(writer, (Vector2d) { where.x, y })) {
+            return 1;
+        }
+
+        for (int column = 0; column < end; column++) {
+            if (ansi_print_cell(writer, line[column])) {
+                return 1;
+            }
+        }
+
+        if (erase) {
+            // EL fills with the current background, so go back to the default first
+            if (ansi_move_cursor(writer, (Vector2d) { where.x + end, y })
+                || ansi_set_attributes(writer, 0)
+                || ansi_append_string(writer, "\x1b[K")) {
+                return 1;
+            }
+
+            for (int x = where.x + end; x < writer->screen.width; x++) {
+                Cell *shown = ansi_shadow_at(writer, x, y);
+
+                if (shown != NULL) {
+                    shown->character = ' ';
+                    shown->attributes = 0;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void free_ansi_writer(AnsiWriter *writer) {
+    free(writer->data);
+    free(writer->shadow);
+    initialize_ansi_writer(writer);
+}
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#include "console/headless.h"
+#include "console/ansi.h"
+#include "structures/vector.h"
+
+typedef struct {
+    enum CONSOLE_EVENTS event;
+    KeyCode key;
+    Size2s size;
+    int pasted;
+} HeadlessInput;
+
+static struct {
+    Size2s size;
+    Cell *cells;
+    Vector2d cursor;
+    int cursorPending;
+    Vector *input; // HeadlessInput
+    size_t nextInput;
+    size_t typedBatch; // typed events handed over per read, a paste goes at once
+    volatile int woken; // set by wake, possibly from another thread
+    // Frames are encoded like a terminal would get them, to count the bytes
+    AnsiWriter encoder;
+    HeadlessConsoleStats total;
+    HeadlessConsoleStats frame;
+    HeadlessConsoleStats lastFrame;
+    HeadlessConsoleStats maxFrame;
+} Headless = { .size = { 80, 24 }, .typedBatch = 1 };
+
+static int headless_resize_grid(Size2s size) {
+    size_t count = (size_t) size.width * size.height;
+    Cell *cells = realloc(Headless.cells, (count ? count : 1) * sizeof(*cells));
+
+    if (cells == NULL) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        cells[i].character = ' ';
+        cells[i].attributes = 0;
+    }
+
+    Headless.cells = cells;
+    Headless.size = size;
+
+    // A terminal would be cleared and drawn from scratch too
+    if (ansi_resize(&Headless.encoder, size) || ansi_clear_screen(&Headless.encoder)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int headless_queue(HeadlessInput input) {
+    if (Headless.input == NULL) {
+        Headless.input = initialize_vector("struct", sizeof(HeadlessInput));
+
+        if (Headless.input == NULL) {
+            return 1;
+        }
+    }
+
+    vec_push_back(Headless.input, &input);
+
+    return 0;
+}
+
+void setHeadlessConsoleSize(Size2s size) {
+    if (Headless.cells != NULL) {
+        headless_resize_grid(size);
+    } else {
+        Headless.size = size;
+    }
+}
+
+int queueHeadlessKey(KeyCode key) {
+    return headless_queue((HeadlessInput) { .event = CONSOLE_EVENT_KEY, .key = key });
+}
+
+void setHeadlessInputBatch(size_t events) {
+    Headless.typedBatch = events ? events : 1;
+}
+
+static int headless_queue_text(const char *text, int pasted) {
+    for (; *text; text++) {
+        KeyCode key = { .keyCode = 0, .character = (unsigned char) *text };
+
+        switch (*text) {
+            case '\r':
+            case '\n':
+                key = (KeyCode) { XIM_KEY_RETURN, '\r' };
+                break;
+            case 0x1B:
+                key = (KeyCode) { XIM_KEY_ESCAPE, 0x1B };
+                break;
+            case 0x08:
+            case 0x7F:
+                key = (KeyCode) { XIM_KEY_BACK, 0x08 };
+                break;
+        }
+
+        if (headless_queue((HeadlessInput) { .event = CONSOLE_EVENT_KEY, .key = key, .pasted = pasted })) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Queues every byte as the key a terminal would report for it
+int queueHeadlessText(const char *text) {
+    return headless_queue_text(text, 0);
+}
+
+int queueHeadlessPaste(const char *text) {
+    return headless_queue_text(text, 1);
+}
+
+int queueHeadlessResize(Size2s size) {
+    return headless_queue((HeadlessInput) { .event = CONSOLE_EVENT_RESIZE, .size = size });
+}
+
+HeadlessConsoleStats headlessConsoleStats() {
+    return Headless.total;
+}
+
+HeadlessConsoleStats headlessConsoleLastFrame() {
+    return Headless.lastFrame;
+}
+
+HeadlessConsoleStats headlessConsoleMaxFrame() {
+    return Headless.maxFrame;
+}
+
+void resetHeadlessConsoleStats() {
+    memset(&Headless.total, 0, sizeof(Headless.total));
+    memset(&Headless.frame, 0, sizeof(Headless.frame));
+    memset(&Headless.lastFrame, 0, sizeof(Headless.lastFrame));
+    memset(&Headless.maxFrame, 0, sizeof(Headless.maxFrame));
+}
+
+Cell *headlessConsoleCells() {
+    return Headless.cells;
+}
+
+Vector2d headlessConsoleCursor() {
+    return Headless.cursor;
+}
+
+static int headless_initialize() {
+    initialize_ansi_writer(&Headless.encoder);
+    Headless.cursor = (Vector2d) { 0, 0 };
+
+    if (headless_resize_grid(Headless.size)) {
+        return 1;
+    }
+
+    // The clear belongs to the first frame
+    Headless.frame.bytesWritten += Headless.encoder.length;
+
+    return 0;
+}
+
+static int headless_kill() {
+    free(Headless.cells);
+    Headless.cells = NULL;
+    free_ansi_writer(&Headless.encoder);
+
+    if (Headless.input != NULL) {
+        free_vector(Headless.input);
+        Headless.input = NULL;
+    }
+    Headless.nextInput = 0;
+
+    return 0;
+}
+
+static int headless_query_size(Size2s *size) {
+    *size = Headless.size;
+
+    return 0;
+}
+
+static int headless_write_cells(Cell *cells, Vector2d where, Size2s size) {
+    size_t before = Headless.encoder.length;
+
+    if (ansi_write_cells(&Headless.encoder, cells, where, size)) {
+        return 1;
+    }
+
+    for (int row = 0; row < size.height; row++) {
+        int y = where.y + row;
+
+        if (y < 0 || y >= Headless.size.height) {
+            continue;
+        }
+
+        for (int column = 0; column < size.width; column++) {
+            int x = where.x + column;
+
+            if (x >= 0 && x < Headless.size.width) {
+                Headless.cells[(size_t) y * Headless.size.width + x] = cells[(size_t) row * size.width + column];
+            }
+        }
+    }
+
+    Headless.frame.writeCalls++;
+    Headless.frame.cellsWritten += (size_t) size.width * size.height;
+    Headless.frame.bytesWritten += Headless.encoder.length - before;
+
+    return 0;
+}
+
+// Like a terminal backend, the cursor is only placed once the frame is drawn
+static int headless_set_cursor(Vector2d position) {
+    Headless.cursor = position;
+    Headless.cursorPending = 1;
+
+    return 0;
+}
+
+// A frame ends every time the editor is about to wait for input
+static int headless_flush() {
+    if (Headless.cursorPending) {
+        size_t before = Headless.encoder.length;
+
+        Headless.cursorPending = 0;
+
+        if (ansi_move_cursor(&Headless.encoder, Headless.cursor)) {
+            return 1;
+        }
+
+        Headless.frame.cursorMoves++;
+        Headless.frame.bytesWritten += Headless.encoder.length - before;
+    }
+
+    Headless.frame.frames = 1;
+
+    Headless.total.frames++;
+    Headless.total.writeCalls += Headless.frame.writeCalls;
+    Headless.total.cellsWritten += Headless.frame.cellsWritten;
+    Headless.total.bytesWritten += Headless.frame.bytesWritten;
+    Headless.total.cursorMoves += Headless.frame.cursorMoves;
+
+    if (Headless.frame.bytesWritten >= Headless.maxFrame.bytesWritten) {
+        Headless.maxFrame = Headless.frame;
+    }
+
+    Headless.lastFrame = Headless.frame;
+    memset(&Headless.frame, 0, sizeof(Headless.frame));
+    Headless.encoder.length = 0;
+
+    return 0;
+}
+
+static void headless_sleep_ms(int milliseconds) {
+#ifdef _WIN32
+    Sleep((DWORD) milliseconds);
+#else
+    struct timespec duration = { milliseconds / 1000, (long) (milliseconds % 1000) * 1000000L };
+
+    nanosleep(&duration, NULL);
+#endif
+}
+
+// The script is input that is always there. Once it is used up, a wait with
+// no timeout has nothing left to wait for and reports the console closing;
+// timers are waited for for real, a millisecond at a time so wake works.
+static enum CONSOLE_WAIT headless_wait(int timeout) {
+    for (int waited = 0;; waited++) {
+        if (Headless.woken) {
+            Headless.woken = 0;
+            return CONSOLE_WAIT_WAKEUP;
+        }
+
+        if (timeout < 0 || (Headless.input != NULL && Headless.nextInput < Headless.input->len)) {
+            return CONSOLE_WAIT_INPUT;
+        }
+
+        if (waited >= timeout) {
+            return CONSOLE_WAIT_TIMEOUT;
+        }
+
+        headless_sleep_ms(1);
+    }
+}
+
+static int headless_wake() {
+    Headless.woken = 1;
+
+    return 0;
+}
+
+// Replays the queued script, the console closes once it is used up
+static size_t headless_read_input(ConsoleInput *events, size_t capacity) {
+    HeadlessInput *queued = Headless.input ? (HeadlessInput *) Headless.input->base : NULL;
+    size_t count = 0;
+
+    if (queued == NULL || Headless.nextInput >= Headless.input->len) {
+        events[0] = (ConsoleInput) { .event = CONSOLE_EVENT_CLOSED };
+        return 1;
+    }
+
+    int pasted = queued[Headless.nextInput].pasted;
+
+    // A paste comes in one go, like a terminal hands it over; typing comes
+    // typedBatch events at a time
+    while (count < capacity && Headless.nextInput < Headless.input->len) {
+        HeadlessInput *input = &queued[Headless.nextInput];
+
+        if (input->pasted != pasted || (!pasted && count >= Headless.typedBatch)) {
+            break;
+        }
+
+        Headless.nextInput++;
+
+        if (input->event == CONSOLE_EVENT_RESIZE) {
+            size_t before = Headless.encoder.length;
+
+            headless_resize_grid(input->size);
+            Headless.frame.bytesWritten += Headless.encoder.length - before;
+        } else if (input->event == CONSOLE_EVENT_KEY) {
+            Headless.total.keys++;
+        }
+
+        events[count++] = (ConsoleInput) { .event = input->event, .key = input->key, .pasted = input->pasted };
+    }
+
+    return count;
+}
+
+const ConsoleBackend headlessConsoleBackend = {
+    .name = "headless",
+    .initialize = headless_initialize,
+    .kill = headless_kill,
+    .querySize = headless_query_size,
+    .writeCells = headless_write_cells,
+    .setCursor = headless_set_cursor,
+    .flush = headless_flush,
+    .wait = headless_wait,
+    .wake = headless_wake,
+    .readInput = headless_read_input,
+};
@@ -0,0 +1,476 @@
+#ifdef XIM_CONSOLE_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "console.h"
+#include "console/ansi.h"
+
+// POSIX terminal backend: raw mode through termios, drawing with ANSI escape
+// sequences on the alternate screen. Output is collected in one buffer and a
+// whole frame leaves in a single write() when the editor waits for input.
+
+// How long a lone ESC waits for the rest of an escape sequence
+#define POSIX_ESCAPE_TIMEOUT_MS 25
+// Frames bigger than this hide the cursor while they are drawn
+#define POSIX_HIDE_CURSOR_BYTES 256
+// Bytes taken from the terminal per read(), a paste is decoded a chunk at a time
+#define POSIX_INPUT_BYTES 4096
+// What the escape decoder returns for the markers around a bracketed paste
+#define POSIX_PASTE_BEGIN 0xF200
+#define POSIX_PASTE_END 0xF201
+
+static struct {
+    struct termios original;
+    int rawMode;
+    AnsiWriter output;
+    // Where the editor wants the cursor, it goes there at the end of a frame
+    Vector2d cursor;
+    int cursorPending;
+    // Bytes read but not decoded yet
+    unsigned char input[POSIX_INPUT_BYTES];
+    size_t inputStart;
+    size_t inputEnd;
+    int pasting; // between the paste begin and end markers
+    int pastedReturn; // the last pasted byte was \r, a \n after it is the same line break
+    // Self-pipe: a byte written to [1] ends the poll() in posix_wait
+    int wakePipe[2];
+} Posix = { .wakePipe = { -1, -1 } };
+
+static volatile sig_atomic_t posixResized = 0;
+
+static void posix_on_resize(int signal) {
+    int error = errno;
+
+    (void) signal;
+    posixResized = 1;
+
+    // Wakes the wait even when the signal came just before poll() started
+    if (Posix.wakePipe[1] != -1) {
+        ssize_t ignored = write(Posix.wakePipe[1], "r", 1);
+        (void) ignored;
+    }
+
+    errno = error;
+}
+
+static int posix_open_wake_pipe() {
+    if (pipe(Posix.wakePipe) == -1) {
+        Posix.wakePipe[0] = Posix.wakePipe[1] = -1;
+        return 1;
+    }
+
+    // A full pipe is already a pending wakeup, writers must never block on it
+    for (int i = 0; i < 2; i++) {
+        fcntl(Posix.wakePipe[i], F_SETFL, fcntl(Posix.wakePipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(Posix.wakePipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 0;
+}
+
+static int posix_write_all(const char *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, bytes, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+
+        bytes += written;
+        length -= (size_t) written;
+    }
+
+    return 0;
+}
+
+static int posix_initialize() {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &Posix.original) == -1) {
+        return 1;
+    }
+
+    struct termios raw = Posix.original;
+
+    // No echo, no line buffering, no signal keys, bytes as they come
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+        return 1;
+    }
+
+    Posix.rawMode = 1;
+    initialize_ansi_writer(&Posix.output);
+
+    if (posix_open_wake_pipe()) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &Posix.original);
+        Posix.rawMode = 0;
+        return 1;
+    }
+
+    // No SA_RESTART: a resize has to interrupt the read waiting for a key
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = posix_on_resize;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, NULL);
+
+    // alternate screen, it is cleared once its size is known, and bracketed
+    // paste so pasted text can be told apart from typing
+    return ansi_append_string(&Posix.output, "\x1b[?1049h\x1b[?2004h");
+}
+
+// The frame goes out in one write. Big ones hide the cursor while they are
+// drawn, for a few bytes of typing that would more than double the cost.
+static int posix_flush() {
+    // Drawing moves the terminal's cursor around, put it back where it belongs
+    if (Posix.cursorPending) {
+        Posix.cursorPending = 0;
+
+        if (ansi_move_cursor(&Posix.output, Posix.cursor)) {
+            return 1;
+        }
+    }
+
+    if (Posix.output.length == 0) {
+        return 0;
+    }
+
+    if (Posix.output.length <= POSIX_HIDE_CURSOR_BYTES) {
+        int result = posix_write_all(Posix.output.data, Posix.output.length);
+
+        Posix.output.length = 0;
+        return result;
+    }
+
+    const char *hide = "\x1b[?25l";
+    size_t hideLength = strlen(hide);
+    size_t frameLength = Posix.output.length;
+    int result = ansi_append(&Posix.output, hide, hideLength) || ansi_append_string(&Posix.output, "\x1b[?25h");
+
+    if (result == 0) {
+        // Shift the frame over the appended hide sequence to put it in front
+        memmove(Posix.output.data + hideLength, Posix.output.data, frameLength);
+        memcpy(Posix.output.data, hide, hideLength);
+        memcpy(Posix.output.data + hideLength + frameLength, "\x1b[?25h", strlen("\x1b[?25h"));
+        result = posix_write_all(Posix.output.data, Posix.output.length);
+    }
+
+    Posix.output.length = 0;
+
+    return result;
+}
+
+static int posix_kill() {
+    posix_flush();
+    posix_write_all("\x1b[?2004l\x1b[0m\x1b[?25h\x1b[?1049l", strlen("\x1b[?2004l\x1b[0m\x1b[?25h\x1b[?1049l"));
+
+    if (Posix.rawMode) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &Posix.original);
+        Posix.rawMode = 0;
+    }
+
+    signal(SIGWINCH, SIG_DFL);
+    free_ansi_writer(&Posix.output);
+
+    for (int i = 0; i < 2; i++) {
+        if (Posix.wakePipe[i] != -1) {
+            close(Posix.wakePipe[i]);
+            Posix.wakePipe[i] = -1;
+        }
+    }
+
+    return 0;
+}
+
+static int posix_query_size(Size2s *size) {
+    struct winsize window;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == -1 || window.ws_col == 0) {
+        return 1;
+    }
+
+    size->width = window.ws_col;
+    size->height = window.ws_row;
+
+    // A new size leaves the screen in an unknown state, start from a blank one
+    if (size->width != Posix.output.screen.width || size->height != Posix.output.screen.height) {
+        if (ansi_resize(&Posix.output, *size) || ansi_clear_screen(&Posix.output)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int posix_write_cells(Cell *cells, Vector2d where, Size2s size) {
+    return ansi_write_cells(&Posix.output, cells, where, size);
+}
+
+static int posix_set_cursor(Vector2d position) {
+    Posix.cursor = position;
+    Posix.cursorPending = 1;
+
+    return 0;
+}
+
+// Takes the next byte read from the terminal. Once those run out, waits up to
+// timeout milliseconds for more, 0 when none came.
+static int posix_read_byte(unsigned char *byte, int timeout) {
+    if (Posix.inputStart == Posix.inputEnd) {
+        struct pollfd descriptor = { .fd = STDIN_FILENO, .events = POLLIN };
+
+        if (poll(&descriptor, 1, timeout) <= 0) {
+            return 0;
+        }
+
+        ssize_t count = read(STDIN_FILENO, Posix.input, sizeof(Posix.input));
+
+        if (count <= 0) {
+            return 0;
+        }
+
+        Posix.inputStart = 0;
+        Posix.inputEnd = (size_t) count;
+    }
+
+    *byte = Posix.input[Posix.inputStart++];
+
+    return 1;
+}
+
+// Decodes what follows ESC: CSI (ESC [) and SS3 (ESC O) keys, or a lone ESC
+static unsigned short posix_read_escape() {
+    unsigned char byte;
+
+    if (!posix_read_byte(&byte, POSIX_ESCAPE_TIMEOUT_MS)) {
+        return XIM_KEY_ESCAPE;
+    }
+
+    if (byte != '[' && byte != 'O') {
+        //! TODO: Alt + key arrives as ESC + key, for now it is ESC and the key
+        // The byte is still in the buffer, it is the next key typed after ESC
+        Posix.inputStart--;
+        return XIM_KEY_ESCAPE;
+    }
+
+    int parameter = 0;
+
+    while (posix_read_byte(&byte, POSIX_ESCAPE_TIMEOUT_MS)) {
+        if (byte >= '0' && byte <= '9') {
+            parameter = parameter * 10 + (byte - '0');
+            continue;
+        }
+
+        if (byte == ';') {
+            parameter = 0; // modifiers are ignored
+            continue;
+        }
+
+        switch (byte) {
+            case 'A': return XIM_KEY_UP;
+            case 'B': return XIM_KEY_DOWN;
+            case 'C': return XIM_KEY_RIGHT;
+            case 'D': return XIM_KEY_LEFT;
+            case 'H': return XIM_KEY_HOME;
+            case 'F': return XIM_KEY_END;
+            case '~': {
+                switch (parameter) {
+                    case 1: case 7: return XIM_KEY_HOME;
+                    case 4: case 8: return XIM_KEY_END;
+                    case 3: return XIM_KEY_DELETE;
+                    case 5: return XIM_KEY_PAGE_UP;
+                    case 6: return XIM_KEY_PAGE_DOWN;
+                    case 200: return POSIX_PASTE_BEGIN;
+                    case 201: return POSIX_PASTE_END;
+                }
+            } return 0;
+            default: return 0;
+        }
+    }
+
+    return 0;
+}
+
+// Turns the next bytes into a key, 0 when they were not one
+static int posix_decode_key(ConsoleInput *input) {
+    KeyCode *key = &input->key;
+    unsigned char byte;
+    int pastedReturn = Posix.pastedReturn;
+
+    if (!posix_read_byte(&byte, 0)) {
+        return 0;
+    }
+
+    Posix.pastedReturn = 0;
+
+    // Same key codes and characters as the Win32 console reports
+    switch (byte) {
+        case 0x1B: {
+            key->keyCode = posix_read_escape();
+            key->character = key->keyCode == XIM_KEY_ESCAPE ? 0x1B : 0;
+
+            if (key->keyCode == POSIX_PASTE_BEGIN || key->keyCode == POSIX_PASTE_END) {
+                Posix.pasting = key->keyCode == POSIX_PASTE_BEGIN;
+                return 0;
+            }
+
+            // A pasted escape must not leave insert mode
+            if (Posix.pasting) {
+                return 0;
+            }
+        } break;
+        case '\r':
+        case '\n': {
+            if (Posix.pasting && byte == '\n' && pastedReturn) {
+                return 0;
+            }
+
+            Posix.pastedReturn = Posix.pasting && byte == '\r';
+            key->keyCode = XIM_KEY_RETURN;
+            key->character = '\r';
+        } break;
+        case 0x7F:
+        case 0x08: {
+            key->keyCode = XIM_KEY_BACK;
+            key->character = 0x08;
+        } break;
+        case '\t': {
+            key->keyCode = XIM_KEY_TAB;
+            key->character = '\t';
+        } break;
+        default: {
+            key->keyCode = 0;
+            key->character = byte;
+        } break;
+    }
+
+    input->event = CONSOLE_EVENT_KEY;
+    input->pasted = Posix.pasting;
+
+    return key->keyCode || key->character;
+}
+
+static int posix_wake() {
+    // Failing with EAGAIN means the pipe is full of wakeups already
+    if (write(Posix.wakePipe[1], "w", 1) == -1 && errno != EAGAIN) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Sleeps in poll() on the terminal and the wake pipe together
+static enum CONSOLE_WAIT posix_wait(int timeout) {
+    struct pollfd descriptors[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = Posix.wakePipe[0], .events = POLLIN },
+    };
+
+    // Bytes left over from a full batch are input too
+    if (posixResized || Posix.inputStart < Posix.inputEnd) {
+        return CONSOLE_WAIT_INPUT;
+    }
+
+    int ready = poll(descriptors, 2, timeout);
+
+    if (ready == 0) {
+        return CONSOLE_WAIT_TIMEOUT;
+    }
+
+    if (ready < 0) {
+        // Interrupted by a signal, the loop looks at its timers again
+        return posixResized ? CONSOLE_WAIT_INPUT : CONSOLE_WAIT_WAKEUP;
+    }
+
+    int woken = 0;
+
+    if (descriptors[1].revents & POLLIN) {
+        char drain[64];
+
+        while (read(Posix.wakePipe[0], drain, sizeof(drain)) > 0) {
+        }
+        woken = 1;
+    }
+
+    // A hang up is input as well, the read reports the console closing
+    if ((descriptors[0].revents & (POLLIN | POLLHUP | POLLERR)) || posixResized) {
+        return CONSOLE_WAIT_INPUT;
+    }
+
+    return woken ? CONSOLE_WAIT_WAKEUP : CONSOLE_WAIT_TIMEOUT;
+}
+
+// One read() takes everything the terminal has, up to POSIX_INPUT_BYTES, and
+// all of it is decoded into the batch: a paste is a few reads, not one per key
+static size_t posix_read_input(ConsoleInput *events, size_t capacity) {
+    size_t count = 0;
+
+    if (posixResized) {
+        posixResized = 0;
+        events[count++] = (ConsoleInput) { .event = CONSOLE_EVENT_RESIZE };
+    }
+
+    if (count == 0 && Posix.inputStart == Posix.inputEnd) {
+        ssize_t bytes = read(STDIN_FILENO, Posix.input, sizeof(Posix.input));
+
+        if (bytes == 0) {
+            events[0] = (ConsoleInput) { .event = CONSOLE_EVENT_CLOSED }; // the terminal hung up
+            return 1;
+        }
+
+        if (bytes < 0) {
+            if (posixResized) {
+                posixResized = 0;
+                events[0] = (ConsoleInput) { .event = CONSOLE_EVENT_RESIZE };
+            } else {
+                events[0] = (ConsoleInput) { .event = CONSOLE_EVENT_NONE };
+            }
+            return 1;
+        }
+
+        Posix.inputStart = 0;
+        Posix.inputEnd = (size_t) bytes;
+    }
+
+    // Only bytes that already arrived are decoded, the batch never waits for keys
+    while (count < capacity && Posix.inputStart < Posix.inputEnd) {
+        if (posix_decode_key(&events[count])) {
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        events[count++] = (ConsoleInput) { .event = CONSOLE_EVENT_NONE };
+    }
+
+    return count;
+}
+
+const ConsoleBackend posixConsoleBackend = {
+    .name = "posix",
+    .initialize = posix_initialize,
+    .kill = posix_kill,
+    .querySize = posix_query_size,
+    .writeCells = posix_write_cells,
+    .setCursor = posix_set_cursor,
+    .flush = posix_flush,
+    .wait = posix_wait,
+    .wake = posix_wake,
+    .readInput = posix_read_input,
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifdef XIM_CONSOLE_WIN32
+#include <Windows.h>
+#include <stdlib.h>
+#include "console.h"
+
+// Win32 console backend: an alternate screen buffer written with
+// WriteConsoleOutput, input through ReadConsoleInput.
+
+static struct {
+    // hOldConsole:
+    // This is the main console, after the program is done, we go back to it.
+    // That's its only use.
+    HANDLE hOldConsole;
+    HANDLE hInput;
+    HANDLE windowsConsoleHandle;
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    // Cells converted to CHAR_INFO, grown as needed
+    CHAR_INFO *cells;
+    size_t cellsSize;
+    // Set by wake, ends a wait on the input handle early
+    HANDLE wakeEvent;
+} Windows;
+
+static int win32_initialize() {
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    // alternate buffer
+    HANDLE hAlt = CreateConsoleScreenBuffer(
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        CONSOLE_TEXTMODE_BUFFER,
+        NULL
+    );
+
+    if (hAlt == NULL) {
+        return 1;
+    }
+
+    SetConsoleActiveScreenBuffer(hAlt);
+
+    Windows.hOldConsole = hConsole;
+    Windows.windowsConsoleHandle = hAlt;
+
+    // Get input buffer
+    Windows.hInput = GetStdHandle(STD_INPUT_HANDLE);
+
+    if (Windows.hInput == INVALID_HANDLE_VALUE) {
+        return 1;
+    }
+
+    DWORD mode;
+    GetConsoleMode(Windows.hInput, &mode);
+
+    // disables Enter to get new data, and adding character to screen after writing it
+    mode |= ENABLE_WINDOW_INPUT;
+    mode &= ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT);
+
+    SetConsoleMode(Windows.hInput, mode);
+    // SetConsoleCtrlHandler(NULL, 1);
+
+    Windows.wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (Windows.wakeEvent == NULL) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int win32_kill() {
+    SetConsoleActiveScreenBuffer(Windows.hOldConsole);
+    CloseHandle(Windows.windowsConsoleHandle);
+    CloseHandle(Windows.hOldConsole);
+    CloseHandle(Windows.hInput);
+    CloseHandle(Windows.wakeEvent);
+    free(Windows.cells);
+
+    // SetConsoleCtrlHandler(NULL, 0);
+
+    return 0;
+}
+
+static int win32_query_size(Size2s *size) {
+    if (!GetConsoleScreenBufferInfo(Windows.windowsConsoleHandle, &Windows.csbi)) {
+        return 1;
+    }
+
+    size->width = Windows.csbi.srWindow.Right - Windows.csbi.srWindow.Left + 1;
+    size->height = Windows.csbi.srWindow.Bottom - Windows.csbi.srWindow.Top + 1;
+
+    return 0;
+}
+
+static int win32_write_cells(Cell *cells, Vector2d where, Size2s size) {
+    size_t count = (size_t) size.width * size.height;
+
+    if (count > Windows.cellsSize) {
+        CHAR_INFO *grown = realloc(Windows.cells, count * sizeof(*grown));
+
+        if (grown == NULL) {
+            return 1;
+        }
+
+        Windows.cells = grown;
+        Windows.cellsSize = count;
+    }
+
+    // The attribute bits are the Win32 ones already
+    for (size_t i = 0; i < count; i++) {
+        Windows.cells[i].Char.UnicodeChar = 0;
+        Windows.cells[i].Char.AsciiChar = cells[i].character;
+        Windows.cells[i].Attributes = cells[i].attributes;
+    }
+
+    SMALL_RECT rect = {
+        where.x, where.y,
+        where.x + size.width - 1,
+        where.y + size.height - 1,
+    };
+
+    BOOL written = WriteConsoleOutput(
+        Windows.windowsConsoleHandle,
+        Windows.cells,
+        (COORD) { .X = size.width, .Y = size.height },
+        (COORD) {0,0},
+        &rect
+    );
+
+    return !written;
+}
+
+static int win32_set_cursor(Vector2d position) {
+    COORD coords = { .X = position.x, .Y = position.y };
+
+    return !SetConsoleCursorPosition(Windows.windowsConsoleHandle, coords);
+}
+
+// Every write reaches the console right away
+static int win32_flush() {
+    return 0;
+}
+
+// The input handle is signaled while records are waiting, resizes included
+static enum CONSOLE_WAIT win32_wait(int timeout) {
+    HANDLE handles[2] = { Windows.hInput, Windows.wakeEvent };
+    DWORD result = WaitForMultipleObjects(2, handles, FALSE, timeout < 0 ? INFINITE : (DWORD) timeout);
+
+    switch (result) {
+        case WAIT_OBJECT_0: return CONSOLE_WAIT_INPUT;
+        case WAIT_OBJECT_0 + 1: return CONSOLE_WAIT_WAKEUP;
+        case WAIT_TIMEOUT: return CONSOLE_WAIT_TIMEOUT;
+        // Nothing left to wait on, reading reports the console as gone
+        default: return CONSOLE_WAIT_INPUT;
+    }
+}
+
+static int win32_wake() {
+    return !SetEvent(Windows.wakeEvent);
+}
+
+// Records read per ReadConsoleInput call, a paste arrives as a burst of them
+#define WIN32_INPUT_RECORDS 512
+
+static size_t win32_read_input(ConsoleInput *events, size_t capacity) {
+    INPUT_RECORD records[WIN32_INPUT_RECORDS];
+    DWORD wanted = capacity < WIN32_INPUT_RECORDS ? (DWORD) capacity : WIN32_INPUT_RECORDS;
+    DWORD read = 0;
+    size_t count = 0;
+
+    // Blocks for the first record, then takes whatever else is already queued
+    if (!ReadConsoleInput(Windows.hInput, records, wanted, &read)) {
+        events[0] = (ConsoleInput) { .event = CONSOLE_EVENT_CLOSED };
+        return 1;
+    }
+
+    for (DWORD i = 0; i < read && count < capacity; i++) {
+        if (records[i].EventType == WINDOW_BUFFER_SIZE_EVENT) {
+            events[count++] = (ConsoleInput) { .event = CONSOLE_EVENT_RESIZE };
+        } else if (records[i].EventType == KEY_EVENT && records[i].Event.KeyEvent.bKeyDown) {
+            KEY_EVENT_RECORD *key = &records[i].Event.KeyEvent;
+
+            // A held key comes as one record with a repeat count
+            for (WORD repeat = 0; repeat < key->wRepeatCount && count < capacity; repeat++) {
+                events[count++] = (ConsoleInput) {
+                    .event = CONSOLE_EVENT_KEY,
+                    .key = { key->wVirtualKeyCode, (unsigned char) key->uChar.AsciiChar },
+                };
+            }
+        }
+    }
+
+    if (count == 0) {
+        events[count++] = (ConsoleInput) { .event = CONSOLE_EVENT_NONE };
+    }
+
+    return count;
+}
+
+const ConsoleBackend win32ConsoleBackend = {
+    .name = "win32",
+    .initialize = win32_initialize,
+    .kill = win32_kill,
+    .querySize = win32_query_size,
+    .writeCells = win32_write_cells,
+    .setCursor = win32_set_cursor,
+    .flush = win32_flush,
+    .wait = win32_wait,
+    .wake = win32_wake,
+    .readInput = win32_read_input,
+};
+
+#endif
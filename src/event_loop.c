@@ -0,0 +1,297 @@
+#include <limits.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+#include "event_loop.h"
+#include "console.h"
+#include "structures/vector.h"
+
+typedef struct {
+    int id;
+    unsigned long delay;
+    unsigned long long due;
+    EventCallback callback;
+    void *data;
+} EventTimer;
+
+typedef struct {
+    EventCallback callback; // NULL once cancelled or done
+    void *data;
+} EventWork;
+
+static struct {
+    int initialized;
+    int nextTimerId;
+    Vector *timers; // EventTimer
+    Vector *deferred; // EventWork
+    // Filled by other threads under the lock, emptied by the loop
+    Vector *posted; // EventWork
+    Vector *running; // EventWork, the posted callbacks being run
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} Loop;
+
+static void lockPosted() {
+#ifdef _WIN32
+    EnterCriticalSection(&Loop.lock);
+#else
+    pthread_mutex_lock(&Loop.lock);
+#endif
+}
+
+static void unlockPosted() {
+#ifdef _WIN32
+    LeaveCriticalSection(&Loop.lock);
+#else
+    pthread_mutex_unlock(&Loop.lock);
+#endif
+}
+
+int initializeEventLoop() {
+    if (Loop.initialized) {
+        return 0;
+    }
+
+    Loop.timers = initialize_vector("struct", sizeof(EventTimer));
+    Loop.deferred = initialize_vector("struct", sizeof(EventWork));
+    Loop.posted = initialize_vector("struct", sizeof(EventWork));
+    Loop.running = initialize_vector("struct", sizeof(EventWork));
+
+    if (Loop.timers == NULL || Loop.deferred == NULL || Loop.posted == NULL || Loop.running == NULL) {
+        killEventLoop();
+        return 1;
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&Loop.lock);
+#else
+    if (pthread_mutex_init(&Loop.lock, NULL) != 0) {
+        killEventLoop();
+        return 1;
+    }
+#endif
+
+    Loop.nextTimerId = 1;
+    Loop.initialized = 1;
+
+    return 0;
+}
+
+void killEventLoop() {
+    if (Loop.initialized) {
+#ifdef _WIN32
+        DeleteCriticalSection(&Loop.lock);
+#else
+        pthread_mutex_destroy(&Loop.lock);
+#endif
+    }
+
+    free_vector(Loop.timers);
+    free_vector(Loop.deferred);
+    free_vector(Loop.posted);
+    free_vector(Loop.running);
+    Loop.timers = Loop.deferred = Loop.posted = Loop.running = NULL;
+    Loop.initialized = 0;
+}
+
+unsigned long long eventLoopTime() {
+#ifdef _WIN32
+    return (unsigned long long) GetTickCount64();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000ULL + (unsigned long long) now.tv_nsec / 1000000ULL;
+#endif
+}
+
+int addTimer(unsigned long delay, EventCallback callback, void *data) {
+    assert(Loop.initialized && "THE EVENT LOOP IS NOT INITIALIZED!");
+
+    EventTimer timer = {
+        .id = Loop.nextTimerId++,
+        .delay = delay,
+        .due = eventLoopTime() + delay,
+        .callback = callback,
+        .data = data
+    };
+
+    vec_push_back(Loop.timers, &timer);
+
+    return timer.id;
+}
+
+// Timers are few, an unordered array is all they need
+static void removeTimerAt(size_t index) {
+    EventTimer *timers = (EventTimer *) Loop.timers->base;
+
+    timers[index] = timers[Loop.timers->len - 1];
+    Loop.timers->len--;
+}
+
+int cancelTimer(int id) {
+    EventTimer *timers = (EventTimer *) Loop.timers->base;
+
+    for (size_t i = 0; i < Loop.timers->len; i++) {
+        if (timers[i].id == id) {
+            removeTimerAt(i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Runs the timers that were due when the loop woke up. One run again later
+// than now even with no delay, so it cannot keep this loop going forever.
+static void runDueTimers() {
+    unsigned long long now = eventLoopTime();
+
+    for (size_t i = 0; i < Loop.timers->len;) {
+        EventTimer timer = ((EventTimer *) Loop.timers->base)[i];
+
+        if (timer.due > now) {
+            i++;
+            continue;
+        }
+
+        // Off the list first, the callback may add or cancel timers
+        removeTimerAt(i);
+
+        if (timer.callback(timer.data)) {
+            timer.due = now + (timer.delay ? timer.delay : 1);
+            vec_push_back(Loop.timers, &timer);
+        }
+
+        i = 0;
+    }
+}
+
+// Milliseconds until the next timer is due, -1 when there is none
+static long long nextTimerTimeout() {
+    EventTimer *timers = (EventTimer *) Loop.timers->base;
+    unsigned long long now = eventLoopTime();
+    long long timeout = -1;
+
+    for (size_t i = 0; i < Loop.timers->len; i++) {
+        long long left = timers[i].due > now ? (long long) (timers[i].due - now) : 0;
+
+        if (timeout < 0 || left < timeout) {
+            timeout = left;
+        }
+    }
+
+    return timeout;
+}
+
+int deferWork(EventCallback callback, void *data) {
+    assert(Loop.initialized && "THE EVENT LOOP IS NOT INITIALIZED!");
+
+    EventWork *work = (EventWork *) Loop.deferred->base;
+
+    for (size_t i = 0; i < Loop.deferred->len; i++) {
+        if (work[i].callback == callback && work[i].data == data) {
+            return 0;
+        }
+    }
+
+    vec_push_back(Loop.deferred, &(EventWork) { callback, data });
+
+    return 0;
+}
+
+int cancelDeferredWork(EventCallback callback, void *data) {
+    EventWork *work = (EventWork *) Loop.deferred->base;
+
+    for (size_t i = 0; i < Loop.deferred->len; i++) {
+        if (work[i].callback == callback && work[i].data == data) {
+            // Only marked, runDeferredWork may be walking the list right now
+            work[i].callback = NULL;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Gives every deferred job one turn, the ones with more to do stay queued
+int runDeferredWork() {
+    size_t count = Loop.deferred->len;
+
+    for (size_t i = 0; i < count; i++) {
+        // Read by index every time, work deferred by a callback may move the array
+        EventWork work = ((EventWork *) Loop.deferred->base)[i];
+
+        if (work.callback != NULL && !work.callback(work.data)) {
+            ((EventWork *) Loop.deferred->base)[i].callback = NULL;
+        }
+    }
+
+    EventWork *work = (EventWork *) Loop.deferred->base;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < Loop.deferred->len; i++) {
+        if (work[i].callback != NULL) {
+            work[kept++] = work[i];
+        }
+    }
+
+    Loop.deferred->len = kept;
+
+    return 0;
+}
+
+int postToEventLoop(EventCallback callback, void *data) {
+    lockPosted();
+    vec_push_back(Loop.posted, &(EventWork) { callback, data });
+    unlockPosted();
+
+    return wakeEventLoop();
+}
+
+int wakeEventLoop() {
+    return wakeConsole();
+}
+
+static void runPosted() {
+    // Swapped out under the lock, run without it so callbacks may post again
+    lockPosted();
+    Vector *posted = Loop.posted;
+    Loop.posted = Loop.running;
+    Loop.running = posted;
+    unlockPosted();
+
+    EventWork *work = (EventWork *) Loop.running->base;
+
+    for (size_t i = 0; i < Loop.running->len; i++) {
+        work[i].callback(work[i].data);
+    }
+
+    vec_clear(Loop.running);
+}
+
+int waitForEvents() {
+    long long timeout = Loop.deferred->len > 0 ? 0 : nextTimerTimeout();
+
+    if (timeout > INT_MAX) {
+        timeout = INT_MAX;
+    }
+
+    // The frame goes out before the wait, the user sees it while we sleep
+    flushConsole();
+
+    enum CONSOLE_WAIT woke = waitForConsole((int) timeout);
+
+    runPosted();
+    runDueTimers();
+
+    return woke == CONSOLE_WAIT_INPUT;
+}
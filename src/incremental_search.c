@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include "xim.h"
+
+// Incremental search: while a "/" or "?" pattern is typed, the matches on
+// screen are highlighted right away, and the rest of the document is scanned
+// a slice at a time between keys to count the matches and find the one the
+// cursor goes to. Each key starts the scan over, the prompt never waits for it.
+
+// Bytes the scan takes per turn of the event loop
+#define SEARCH_SLICE ((size_t) 1 << 18)
+// Cells at the right of the command line for the count, "[3/15]"
+#define SEARCH_COUNT_WIDTH 16
+
+enum SEARCH_TARGET {
+    SEARCH_TARGET_NONE = 0,
+    SEARCH_TARGET_MAYBE, // a later match may still take its place
+    SEARCH_TARGET_FOUND
+};
+
+static struct {
+    int active;
+    int backward;
+    // The cursor and the view when the prompt opened, <Esc> goes back there
+    size_t origin;
+    size_t originView;
+    Regex *preview; // what is typed so far, for the screen
+    Regex *counter; // the same pattern for the scan, whose scanner keeps its states between slices
+    // The scan runs from the line of the origin to the end (phase 0), then
+    // wraps around from the top to that line (phase 1)
+    int phase; // 2 once done
+    size_t position;
+    size_t phaseEnd;
+    RegexScanner scanner;
+    // The line the scanner stopped in has its matches listed, a slice's
+    // worth at a time however long it is
+    int listing;
+    RegexLineScan lines;
+    size_t counts[2]; // matches found in each phase
+    enum SEARCH_TARGET target;
+    int jumped; // the cursor went to the match
+    RegexMatch match; // where the cursor goes
+    int matchPhase;
+    size_t matchNumber; // within its phase, from 1
+    RegexMatch last; // the last match of phase 0, a "?" with nothing above the origin wraps to it
+    // Scratch space for the view read
+    char *text;
+    size_t textSize;
+    Vector *lineMatches; // RegexMatch, those of the last step of lines
+    Vector *view; // RegexMatch, the matches on screen
+} Search;
+
+static int scanSearchSlice(void *data);
+
+static char *readScratch(size_t offset, size_t length) {
+    if (length + 1 > Search.textSize) {
+        char *text = realloc(Search.text, length + 1);
+
+        if (text == NULL) {
+            return NULL;
+        }
+
+        Search.text = text;
+        Search.textSize = length + 1;
+    }
+
+    piece_table_read(Xim.document, offset, Search.text, length);
+
+    return Search.text;
+}
+
+static int byteAt(size_t offset) {
+    const char *text;
+
+    return piece_table_chunk_at(Xim.document, offset, &text) > 0 ? (unsigned char) *text : REGEX_EDGE;
+}
+
+// The count goes at the right end of the command line, as long as what is
+// typed leaves room for it
+static void showSearchCount() {
+    char count[SEARCH_COUNT_WIDTH] = "";
+    char field[SEARCH_COUNT_WIDTH + 1];
+    int at = Xim.commandArea.size.width - SEARCH_COUNT_WIDTH;
+    int cursor = Xim.commandBuffer.cursor;
+
+    if (at <= cursor) {
+        return;
+    }
+
+    if (Search.preview != NULL) {
+        size_t total = Search.counts[0] + Search.counts[1];
+        int done = Search.phase == 2;
+
+        if (done && Search.target == SEARCH_TARGET_NONE) {
+            snprintf(count, sizeof(count), "[0/0]");
+        } else if (done || (Search.target == SEARCH_TARGET_FOUND && Search.matchPhase == 1)) {
+            // Phase 1 is the top of the document, its matches come first
+            size_t index = Search.matchPhase == 0 ? Search.counts[1] + Search.matchNumber : Search.matchNumber;
+
+            snprintf(count, sizeof(count), done ? "[%zu/%zu]" : "[%zu/>%zu]", index, total);
+        } else {
+            snprintf(count, sizeof(count), "[?/>%zu]", total);
+        }
+    }
+
+    snprintf(field, sizeof(field), "%*s", SEARCH_COUNT_WIDTH, count);
+    addBufferToBuffer(COMMAND_BUFFER, field, at, 0);
+    Xim.commandBuffer.cursor = cursor;
+}
+
+// The cursor moves to the match, the terminal cursor stays on the prompt
+static void goToSearchMatch() {
+    Search.target = SEARCH_TARGET_FOUND;
+    Search.jumped = 1;
+    Xim.documentCursor = Search.match.start;
+    renderDocumentView();
+}
+
+static void setSearchMatch(RegexMatch match, int phase, size_t number, enum SEARCH_TARGET target) {
+    Search.match = match;
+    Search.matchPhase = phase;
+    Search.matchNumber = number;
+    Search.target = target;
+}
+
+// "/" goes to the first match after the origin, "?" to the last one before it
+static void countSearchMatch(RegexMatch match) {
+    int phase = Search.phase;
+    size_t number = ++Search.counts[phase];
+
+    if (phase == 0) {
+        Search.last = match;
+    }
+
+    if (Search.target == SEARCH_TARGET_FOUND) {
+        return;
+    }
+
+    if (!Search.backward) {
+        if (phase == 1 || match.start > Search.origin) {
+            setSearchMatch(match, phase, number, SEARCH_TARGET_FOUND);
+        }
+    } else if (phase == 1 || match.start < Search.origin) {
+        setSearchMatch(match, phase, number, SEARCH_TARGET_MAYBE);
+    }
+}
+
+static void startSearchPhase(int phase) {
+    size_t originLine = findLineStart(Search.origin);
+
+    Search.phase = phase;
+
+    if (phase == 0) {
+        Search.position = originLine;
+        Search.phaseEnd = piece_table_length(Xim.document);
+    } else {
+        Search.position = 0;
+        Search.phaseEnd = originLine;
+    }
+
+    regex_scanner_start(&Search.scanner, Search.counter, 0, Search.position,
+                        Search.position > 0 ? '\n' : REGEX_EDGE);
+}
+
+static void endSearchPhase() {
+    if (Search.phase == 0 && Search.phaseEnd > 0) {
+        startSearchPhase(1);
+        return;
+    }
+
+    Search.phase = 2;
+
+    // "?" with nothing above the origin wraps around to the last match
+    if (Search.backward && Search.target == SEARCH_TARGET_NONE && Search.counts[0] > 0) {
+        setSearchMatch(Search.last, 0, Search.counts[0], SEARCH_TARGET_MAYBE);
+    }
+
+    if (Search.target != SEARCH_TARGET_NONE && !Search.jumped) {
+        goToSearchMatch();
+    }
+}
+
+// Every match of the line the scanner stopped in gets listed
+static void startLineMatches(size_t offset) {
+    size_t length = piece_table_length(Xim.document);
+    size_t line = piece_table_line_at(Xim.document, offset);
+    size_t start = piece_table_line_start(Xim.document, line);
+    size_t end = line + 1 < piece_table_line_count(Xim.document) ? piece_table_line_start(Xim.document, line + 1) - 1 : length;
+
+    // Out of memory the line is passed over
+    regex_line_scan_start(&Search.lines, Search.counter, Xim.document, start, end);
+    Search.listing = 1;
+}
+
+// The line's matches for budget bytes of work, once they are all counted
+// the scan goes on from the next line. Returns the work done.
+static size_t listLineMatches(size_t budget) {
+    size_t work = 0;
+    int done = Search.lines.starts == NULL;
+
+    if (!done) {
+        vec_clear(Search.lineMatches);
+        work = regex_line_scan_step(&Search.lines, budget, Search.lineMatches, &done);
+
+        for (size_t i = 0; i < Search.lineMatches->len; i++) {
+            countSearchMatch(((RegexMatch *) Search.lineMatches->base)[i]);
+        }
+    }
+
+    if (!done) {
+        return work;
+    }
+
+    regex_line_scan_stop(&Search.lines);
+    Search.listing = 0;
+
+    // "/" has its match, or "?" one in the origin's line: none is closer
+    if (!Search.jumped && (Search.target == SEARCH_TARGET_FOUND || (Search.target == SEARCH_TARGET_MAYBE && Search.phase == 0))) {
+        goToSearchMatch();
+    }
+
+    if (Search.lines.end >= Search.phaseEnd) {
+        endSearchPhase();
+    } else {
+        Search.position = Search.lines.end + 1;
+        regex_scanner_start(&Search.scanner, Search.counter, 0, Search.position, '\n');
+    }
+
+    return work;
+}
+
+// Deferred work: one slice of the scan, then the count is shown again
+static int scanSearchSlice(void *data) {
+    (void) data;
+    size_t budget = SEARCH_SLICE;
+
+    while (Search.phase < 2 && budget > 0) {
+        if (Search.listing) {
+            size_t work = listLineMatches(budget);
+
+            budget -= work < budget ? work : budget;
+            continue;
+        }
+
+        if (Search.position >= Search.phaseEnd) {
+            // Only the end of the document can end a match, the wrap stops at a line start
+            if (Search.phase == 0 && regex_scanner_finish(&Search.scanner, REGEX_EDGE)) {
+                startLineMatches(Search.scanner.match);
+            } else {
+                endSearchPhase();
+            }
+
+            continue;
+        }
+
+        const char *text;
+        size_t length = piece_table_chunk_at(Xim.document, Search.position, &text);
+        int matched;
+
+        length = length < Search.phaseEnd - Search.position ? length : Search.phaseEnd - Search.position;
+        length = length < budget ? length : budget;
+
+        size_t taken = regex_scanner_feed(&Search.scanner, text, length, &matched);
+
+        Search.position += taken;
+        budget -= taken;
+
+        if (matched) {
+            startLineMatches(Search.scanner.match);
+        }
+    }
+
+    showSearchCount();
+
+    return Search.phase < 2;
+}
+
+// The prompt of a search was just opened
+int startIncrementalSearch() {
+    stopIncrementalSearch();
+
+    Search.lineMatches = initialize_vector("struct", sizeof(RegexMatch));
+    Search.view = initialize_vector("struct", sizeof(RegexMatch));
+
+    if (Search.lineMatches == NULL || Search.view == NULL) {
+        stopIncrementalSearch();
+        return 1;
+    }
+
+    Search.active = 1;
+    Search.backward = Xim.commandPrompt == '?';
+    Search.origin = Xim.documentCursor;
+    Search.originView = Xim.viewOffset;
+
+    return 0;
+}
+
+// What is typed changed: the last scan is dropped and the new pattern shown
+int updateIncrementalSearch() {
+    if (!Search.active) {
+        return 1;
+    }
+
+    cancelDeferredWork(scanSearchSlice, NULL);
+    regex_line_scan_stop(&Search.lines);
+    Search.listing = 0;
+    free_regex(Search.preview);
+    free_regex(Search.counter);
+    Search.preview = Search.counter = NULL;
+    Search.counts[0] = Search.counts[1] = 0;
+    Search.target = SEARCH_TARGET_NONE;
+    Search.jumped = 0;
+    Search.phase = 2;
+
+    Xim.documentCursor = Search.origin;
+    Xim.viewOffset = Search.originView;
+
+    const char *typed = Xim.writtenCommand->len > 0 ? (const char *) Xim.writtenCommand->base : "";
+    size_t length = strlen(typed);
+    const char *error;
+
+    // A pattern that does not compile yet shows nothing, the error waits for <CR>
+    if (length > 0 && (Search.preview = compile_regex(typed, length, &error)) != NULL &&
+        (Search.counter = compile_regex(typed, length, &error)) == NULL) {
+        free_regex(Search.preview);
+        Search.preview = NULL;
+    }
+
+    if (Search.preview != NULL) {
+        startSearchPhase(0);
+        deferWork(scanSearchSlice, NULL);
+    }
+
+    renderDocumentView();
+    showSearchCount();
+
+    return 0;
+}
+
+// The prompt closed, the cursor and the view go back to where they were
+int stopIncrementalSearch() {
+    int active = Search.active;
+    size_t origin = Search.origin, originView = Search.originView;
+
+    if (active) {
+        cancelDeferredWork(scanSearchSlice, NULL);
+    }
+
+    regex_line_scan_stop(&Search.lines);
+    free_regex(Search.preview);
+    free_regex(Search.counter);
+    free(Search.text);
+    free_vector(Search.lineMatches);
+    free_vector(Search.view);
+    memset(&Search, 0, sizeof(Search));
+
+    if (active) {
+        Xim.documentCursor = origin;
+        Xim.viewOffset = originView;
+        renderDocumentView();
+    }
+
+    return 0;
+}
+
+// The matches of the pattern being typed within [from, until), sorted, NULL
+// when nothing is highlighted. Only those bytes are read: a match crossing
+// the edges of the view is highlighted as far as it matches inside them.
+Vector *searchHighlights(size_t from, size_t until) {
+    size_t length = piece_table_length(Xim.document);
+
+    if (Search.preview == NULL) {
+        return NULL;
+    }
+
+    until = until < length ? until : length;
+    vec_clear(Search.view);
+
+    char *text = from < until ? readScratch(from, until - from) : NULL;
+
+    if (text == NULL) {
+        return Search.view;
+    }
+
+    for (size_t start = 0; start <= until - from;) {
+        const char *newline = memchr(text + start, '\n', until - from - start);
+        size_t end = newline != NULL ? (size_t) (newline - text) : until - from;
+        int before = start > 0 ? '\n' : (from > 0 ? byteAt(from - 1) : REGEX_EDGE);
+        int after = newline != NULL ? '\n' : byteAt(until);
+        size_t first = Search.view->len;
+
+        regex_line_matches(Search.preview, text + start, end - start, before, after, 1, Search.view);
+
+        // Empty matches have nothing to highlight
+        size_t kept = first;
+
+        for (size_t i = first; i < Search.view->len; i++) {
+            RegexMatch match = ((RegexMatch *) Search.view->base)[i];
+
+            if (match.end > match.start) {
+                match.start += from + start;
+                match.end += from + start;
+                ((RegexMatch *) Search.view->base)[kept++] = match;
+            }
+        }
+
+        Search.view->len = kept;
+        start = end + 1;
+    }
+
+    return Search.view;
+}
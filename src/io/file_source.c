@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "io/file_source.h"
+
+char *hidden_sibling_path(const char *path, const char *suffix) {
+    const char *name = path;
+
+    for (const char *at = path; *at; at++) {
+        if (*at == '/' || *at == '\\') {
+            name = at + 1;
+        }
+    }
+
+    size_t directory = (size_t) (name - path);
+    size_t length = strlen(name);
+    char *sibling = malloc(directory + 1 + length + strlen(suffix) + 1);
+
+    if (sibling == NULL) {
+        return NULL;
+    }
+
+    memcpy(sibling, path, directory);
+    sibling[directory] = '.';
+    memcpy(sibling + directory + 1, name, length);
+    strcpy(sibling + directory + 1 + length, suffix);
+
+    return sibling;
+}
+
+#ifdef _WIN32
+
+FileSource *open_file_source(const char *path) {
+    FileSource *source = calloc(1, sizeof(*source));
+
+    if (source == NULL) {
+        return NULL;
+    }
+
+    // Others may keep writing to the file (logs), we only ever read it
+    source->file = CreateFileA(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL
+    );
+
+    if (source->file == INVALID_HANDLE_VALUE) {
+        free(source);
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(source->file, &size) || (unsigned long long) size.QuadPart > SIZE_MAX) {
+        CloseHandle(source->file);
+        free(source);
+        return NULL;
+    }
+
+    source->length = (size_t) size.QuadPart;
+
+    // Empty files can't be mapped, there is nothing to point at anyway
+    if (source->length == 0) {
+        return source;
+    }
+
+    source->mapping = CreateFileMappingA(source->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (source->mapping == NULL) {
+        CloseHandle(source->file);
+        free(source);
+        return NULL;
+    }
+
+    source->data = MapViewOfFile(source->mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (source->data == NULL) {
+        CloseHandle(source->mapping);
+        CloseHandle(source->file);
+        free(source);
+        return NULL;
+    }
+
+    return source;
+}
+
+void close_file_source(FileSource *source) {
+    if (source == NULL) {
+        return;
+    }
+
+    if (source->data != NULL) {
+        UnmapViewOfFile(source->data);
+    }
+    if (source->mapping != NULL) {
+        CloseHandle(source->mapping);
+    }
+    if (source->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(source->file);
+    }
+
+    free(source);
+}
+
+int file_source_size(FileSource *source, size_t *size) {
+    LARGE_INTEGER now;
+
+    if (!GetFileSizeEx(source->file, &now) || (unsigned long long) now.QuadPart > SIZE_MAX) {
+        return 1;
+    }
+
+    *size = (size_t) now.QuadPart;
+
+    return 0;
+}
+
+// A mapping of the file as long as it is now, closed once the view is made:
+// the view keeps what it needs of it
+int map_file_region(FileSource *source, size_t offset, size_t length, FileRegion *region) {
+    SYSTEM_INFO system;
+
+    GetSystemInfo(&system);
+
+    size_t aligned = offset - offset % system.dwAllocationGranularity;
+    unsigned long long from = (unsigned long long) aligned;
+    HANDLE mapping = CreateFileMappingA(source->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (length == 0 || mapping == NULL) {
+        if (mapping != NULL) {
+            CloseHandle(mapping);
+        }
+        return 1;
+    }
+
+    region->viewLength = length + (offset - aligned);
+    region->view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD) (from >> 32), (DWORD) from, region->viewLength);
+    CloseHandle(mapping);
+
+    if (region->view == NULL) {
+        return 1;
+    }
+
+    region->data = (const char *) region->view + (offset - aligned);
+    region->length = length;
+
+    return 0;
+}
+
+void unmap_file_region(FileRegion *region) {
+    if (region->view != NULL) {
+        UnmapViewOfFile(region->view);
+    }
+
+    *region = (FileRegion) { 0 };
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+FileSource *open_file_source(const char *path) {
+    FileSource *source = calloc(1, sizeof(*source));
+
+    if (source == NULL) {
+        return NULL;
+    }
+
+    source->fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (source->fd < 0) {
+        free(source);
+        return NULL;
+    }
+
+    struct stat info;
+
+    if (fstat(source->fd, &info) != 0 || (unsigned long long) info.st_size > SIZE_MAX) {
+        close(source->fd);
+        free(source);
+        return NULL;
+    }
+
+    source->length = (size_t) info.st_size;
+
+    // Empty files can't be mapped, there is nothing to point at anyway
+    if (source->length == 0) {
+        return source;
+    }
+
+    void *data = mmap(NULL, source->length, PROT_READ, MAP_PRIVATE, source->fd, 0);
+
+    if (data == MAP_FAILED) {
+        close(source->fd);
+        free(source);
+        return NULL;
+    }
+
+    source->data = data;
+
+    return source;
+}
+
+void close_file_source(FileSource *source) {
+    if (source == NULL) {
+        return;
+    }
+
+    if (source->data != NULL) {
+        munmap((void *) source->data, source->length);
+    }
+
+    close(source->fd);
+    free(source);
+}
+
+int file_source_size(FileSource *source, size_t *size) {
+    struct stat info;
+
+    if (fstat(source->fd, &info) != 0 || (unsigned long long) info.st_size > SIZE_MAX) {
+        return 1;
+    }
+
+    *size = (size_t) info.st_size;
+
+    return 0;
+}
+
+int map_file_region(FileSource *source, size_t offset, size_t length, FileRegion *region) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t aligned = offset - offset % page;
+
+    if (length == 0) {
+        return 1;
+    }
+
+    void *view = mmap(NULL, length + (offset - aligned), PROT_READ, MAP_PRIVATE, source->fd, (off_t) aligned);
+
+    if (view == MAP_FAILED) {
+        return 1;
+    }
+
+    region->view = view;
+    region->viewLength = length + (offset - aligned);
+    region->data = (const char *) view + (offset - aligned);
+    region->length = length;
+
+    return 0;
+}
+
+void unmap_file_region(FileRegion *region) {
+    if (region->view != NULL) {
+        munmap(region->view, region->viewLength);
+    }
+
+    *region = (FileRegion) { 0 };
+}
+
+#endif
@@ -0,0 +1,456 @@
+#include <stdlib.h>
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#endif
+#include "io/follow.h"
+#include "event_loop.h"
+
+#ifdef __linux__
+// A thread waiting on inotify for the file to change, it tells the editor's
+// thread by posting to the loop, once until that post is handled
+typedef struct {
+    FileFollower *follower; // NULL once the follower stopped, the watch is only freed then
+    int inotify;
+    int wake[2]; // a byte written to [1] ends the thread
+    int posted; // under the lock
+    uint32_t events; // inotify masks seen since the last post, under the lock
+    pthread_mutex_t lock;
+    pthread_t thread;
+} FollowWatch;
+#endif
+
+struct FileFollower {
+    PieceTable *table;
+    // The file followed: the table's own until the document is written over
+    // it, then the one written, opened here once the following starts again
+    FileSource *source;
+    FileSource *opened; // source when the follower opened it, NULL otherwise
+    size_t length; // bytes of the file in the document
+    size_t handed; // the file up to here was given out by follower_take_appended
+    // What the file grew by since it was opened, from regionStart: the
+    // table's buffer once anything came in
+    size_t regionStart;
+    FileRegion region;
+    // Regions of the files followed before the document was written, the
+    // table may still point into them
+    FileRegion *kept;
+    size_t keptCount;
+    unsigned int buffer;
+    FollowCallback callback;
+    void *data;
+    int watching;
+    int timer; // 0 when the file is not polled
+#ifdef __linux__
+    FollowWatch *watch; // NULL when inotify is not used
+#endif
+};
+
+FileFollower *open_follower(PieceTable *table, FileSource *source) {
+    FileFollower *follower = calloc(1, sizeof(*follower));
+
+    if (follower == NULL) {
+        return NULL;
+    }
+
+    follower->table = table;
+    follower->source = source;
+    follower->length = follower->regionStart = follower->handed = source->length;
+
+    return follower;
+}
+
+void close_follower(FileFollower *follower) {
+    if (follower == NULL) {
+        return;
+    }
+
+    stop_following(follower);
+    unmap_file_region(&follower->region);
+
+    for (size_t i = 0; i < follower->keptCount; i++) {
+        unmap_file_region(&follower->kept[i]);
+    }
+
+    close_file_source(follower->opened);
+    free(follower->kept);
+    free(follower);
+}
+
+// What came in stays in the table, the next bytes start a buffer of their
+// own. Windows can't replace a file any of which is mapped, the table takes
+// a copy there; elsewhere the mapping is kept, the old file lives on in it.
+int follower_release(FileFollower *follower) {
+    if (follower == NULL) {
+        return 0;
+    }
+
+    if (follower->region.data != NULL) {
+#ifdef _WIN32
+        if (piece_table_own_buffer(follower->table, follower->buffer)) {
+            return 1;
+        }
+
+        unmap_file_region(&follower->region);
+#else
+        FileRegion *kept = realloc(follower->kept, (follower->keptCount + 1) * sizeof(*kept));
+
+        if (kept == NULL) {
+            return 1;
+        }
+
+        kept[follower->keptCount++] = follower->region;
+        follower->kept = kept;
+        follower->region = (FileRegion) { 0 };
+#endif
+    }
+
+    follower->regionStart = follower->length;
+    close_file_source(follower->opened);
+    follower->opened = NULL;
+    follower->source = NULL;
+
+    return 0;
+}
+
+void follower_written(FileFollower *follower, size_t length) {
+    follower->length = follower->regionStart = follower->handed = length;
+}
+
+// The region is mapped again from the same start up to the new end, only
+// the new bytes are indexed and the old mapping goes once the table has the new one
+static int take_in(FileFollower *follower, size_t size) {
+    FileRegion region;
+    size_t added = size - follower->length;
+
+    if (map_file_region(follower->source, follower->regionStart, size - follower->regionStart, &region)) {
+        return 1;
+    }
+
+    int failed = follower->region.data == NULL ?
+                 piece_table_add_buffer(follower->table, region.data, region.length, &follower->buffer) :
+                 piece_table_grow_buffer(follower->table, follower->buffer, region.data, region.length);
+
+    if (failed) {
+        unmap_file_region(&region);
+        return 1;
+    }
+
+    unmap_file_region(&follower->region);
+    follower->region = region;
+
+    if (piece_table_append(follower->table, follower->buffer, follower->length - follower->regionStart, added)) {
+        return 1;
+    }
+
+    size_t offset = piece_table_length(follower->table) - added;
+
+    follower->length = size;
+
+    if (follower->callback != NULL) {
+        follower->callback(follower->data, FOLLOW_GREW, offset, added);
+    }
+
+    return 0;
+}
+
+// The file got shorter: reading what the document holds of it could fault
+// on pages past the new end, so the table is emptied without a look and
+// the file taken in again from the start, as a region of its own
+static int reload(FileFollower *follower, size_t size) {
+    piece_table_clear(follower->table);
+    unmap_file_region(&follower->region);
+    follower->regionStart = 0;
+    follower->length = 0;
+
+    if (size > 0) {
+        FileRegion region;
+
+        if (map_file_region(follower->source, 0, size, &region)) {
+            return 1;
+        }
+
+        if (piece_table_add_buffer(follower->table, region.data, region.length, &follower->buffer) ||
+            piece_table_append(follower->table, follower->buffer, 0, size)) {
+            unmap_file_region(&region);
+            return 1;
+        }
+
+        follower->region = region;
+        follower->length = size;
+    }
+
+    // The document is the file again, there is nothing to give out
+    follower->handed = size;
+
+    if (follower->callback != NULL) {
+        follower->callback(follower->data, FOLLOW_RELOADED, 0, size);
+    }
+
+    return 0;
+}
+
+int follower_catch_up(FileFollower *follower) {
+    size_t size;
+
+    if (file_source_size(follower->source, &size)) {
+        return 1;
+    }
+
+    if (size == follower->length) {
+        return 0;
+    }
+
+    return size > follower->length ? take_in(follower, size) : reload(follower, size);
+}
+
+// Where nothing says when the file changes, its size is looked at on a timer
+static int poll_follower(void *data) {
+    FileFollower *follower = data;
+
+    follower_catch_up(follower);
+
+    return follower->timer != 0;
+}
+
+#ifdef __linux__
+
+static void free_watch(FollowWatch *watch) {
+    close(watch->inotify);
+    close(watch->wake[0]);
+    close(watch->wake[1]);
+    pthread_mutex_destroy(&watch->lock);
+    free(watch);
+}
+
+// Moved, deleted, or its last link went (the inode lives on while it is
+// open, only the link count tells)
+static int file_gone(FileFollower *follower, uint32_t events) {
+    struct stat info;
+
+    if (events & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+        return 1;
+    }
+
+    return (events & IN_ATTRIB) && fstat(follower->source->fd, &info) == 0 && info.st_nlink == 0;
+}
+
+// Back on the editor's thread, the file changed since the last post
+static int deliver_change(void *data) {
+    FollowWatch *watch = data;
+    FileFollower *follower = watch->follower;
+
+    pthread_mutex_lock(&watch->lock);
+    uint32_t events = watch->events;
+    watch->posted = 0;
+    watch->events = 0;
+    pthread_mutex_unlock(&watch->lock);
+
+    if (follower == NULL) {
+        free_watch(watch);
+        return 0;
+    }
+
+    // The callback may stop the following and free the watch, it is not touched after
+    follower_catch_up(follower);
+
+    if (follower->watching && file_gone(follower, events)) {
+        FollowCallback callback = follower->callback;
+        void *callbackData = follower->data;
+
+        stop_following(follower);
+
+        if (callback != NULL) {
+            callback(callbackData, FOLLOW_GONE, 0, 0);
+        }
+    }
+
+    return 0;
+}
+
+static void *run_watch(void *data) {
+    FollowWatch *watch = data;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = watch->inotify, .events = POLLIN },
+            { .fd = watch->wake[0], .events = POLLIN }
+        };
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        // The size tells what a change did, the masks whether the file went
+        uint32_t seen = 0;
+
+        while ((length = read(watch->inotify, events, sizeof(events))) > 0) {
+            for (char *at = events; at < events + length;) {
+                struct inotify_event *event = (struct inotify_event *) at;
+
+                seen |= event->mask;
+                at += sizeof(*event) + event->len;
+            }
+        }
+
+        pthread_mutex_lock(&watch->lock);
+        int post = !watch->posted;
+        watch->posted = 1;
+        watch->events |= seen;
+        pthread_mutex_unlock(&watch->lock);
+
+        if (post) {
+            postToEventLoop(deliver_change, watch);
+        }
+    }
+
+    return NULL;
+}
+
+static FollowWatch *start_watch(FileFollower *follower, const char *path) {
+    FollowWatch *watch = calloc(1, sizeof(*watch));
+
+    if (watch == NULL) {
+        return NULL;
+    }
+
+    watch->follower = follower;
+    watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watch->inotify < 0) {
+        free(watch);
+        return NULL;
+    }
+
+    uint32_t mask = IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB;
+
+    if (inotify_add_watch(watch->inotify, path, mask) < 0 || pipe(watch->wake) != 0) {
+        close(watch->inotify);
+        free(watch);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&watch->lock, NULL) != 0) {
+        close(watch->wake[0]);
+        close(watch->wake[1]);
+        close(watch->inotify);
+        free(watch);
+        return NULL;
+    }
+
+    if (pthread_create(&watch->thread, NULL, run_watch, watch) != 0) {
+        free_watch(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+// A change posted before the thread ended is still to come, the watch is
+// freed when it does
+static void stop_watch(FollowWatch *watch) {
+    char byte = 0;
+
+    while (write(watch->wake[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+
+    pthread_join(watch->thread, NULL);
+
+    if (watch->posted) {
+        watch->follower = NULL;
+    } else {
+        free_watch(watch);
+    }
+}
+
+#endif
+
+int start_following(FileFollower *follower, const char *path, FollowCallback callback, void *data) {
+    if (follower->watching) {
+        return 0;
+    }
+
+    if (follower->source == NULL) {
+        follower->source = follower->opened = open_file_source(path);
+
+        if (follower->source == NULL) {
+            return 1;
+        }
+    }
+
+    follower->callback = callback;
+    follower->data = data;
+    follower->watching = 1;
+
+    int notified = 0;
+
+#ifdef __linux__
+    follower->watch = start_watch(follower, path);
+    notified = follower->watch != NULL;
+#else
+    (void) path;
+#endif
+
+    if (!notified) {
+        follower->timer = addTimer(FOLLOW_POLL_DELAY, poll_follower, follower);
+
+        if (follower->timer == 0) {
+            follower->watching = 0;
+            return 1;
+        }
+    }
+
+    // Whatever the file grew by before it was watched
+    follower_catch_up(follower);
+
+    return 0;
+}
+
+void stop_following(FileFollower *follower) {
+    if (!follower->watching) {
+        return;
+    }
+
+#ifdef __linux__
+    if (follower->watch != NULL) {
+        stop_watch(follower->watch);
+        follower->watch = NULL;
+    }
+#endif
+
+    if (follower->timer != 0) {
+        cancelTimer(follower->timer);
+        follower->timer = 0;
+    }
+
+    follower->callback = NULL;
+    follower->data = NULL;
+    follower->watching = 0;
+}
+
+int follower_take_appended(FileFollower *follower, unsigned int *buffer, size_t *start, size_t *length) {
+    *buffer = follower->buffer;
+    *start = follower->handed - follower->regionStart;
+    *length = follower->length - follower->handed;
+    follower->handed = follower->length;
+
+    return *length > 0;
+}
+
+int follower_watching(FileFollower *follower) {
+    return follower->watching;
+}
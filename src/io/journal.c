@@ -0,0 +1,1226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+#include "io/journal.h"
+#include "io/file_source.h"
+#include "event_loop.h"
+
+// File: a header, then records one after the other. Numbers are little
+// endian whatever the machine, a journal may outlive the build that wrote it.
+//
+//     header: "XIMJRNL1", original length (8), original checksum (4), checksum (4)
+//     record: checksum (4), type (1), offset (8), removed (8), length (8), length bytes
+//     splice part: base offset (8) or JOURNAL_LITERAL, length (8), the bytes when literal
+//
+// A record's checksum covers everything after it, a torn write at the end
+// of the file (the crash the journal is for) fails it and replay stops there.
+#define JOURNAL_MAGIC "XIMJRNL1"
+#define JOURNAL_HEADER_SIZE 24
+#define JOURNAL_RECORD_SIZE 29
+// Snapshot edits: offset (8), removed (8), text length (8), text
+#define JOURNAL_SNAPSHOT_EDIT_SIZE 24
+#define JOURNAL_SPLICE_PART_SIZE 16
+#define JOURNAL_LITERAL UINT64_MAX
+// The original is told apart by its length and a checksum of both its ends
+#define JOURNAL_IDENTITY_BYTES ((size_t) 1 << 16)
+
+enum JOURNAL_RECORDS {
+    JOURNAL_EDIT = 1, // removed bytes at offset became the length that follow
+    JOURNAL_SNAPSHOT, // the whole document as edits to the original, in order
+    JOURNAL_SPLICE // removed bytes at offset became the parts that follow, in order
+};
+
+// Where a stretch of one of the table's buffers sits in the file the journal
+// is relative to: the original at first, what was saved once it is saved
+typedef struct {
+    unsigned int buffer;
+    size_t start;
+    size_t length;
+    size_t offset;
+} JournalSpan;
+
+// A snapshot being written to a file of its own on another thread
+typedef struct {
+    Journal *journal; // NULL once the journal is closed, the job is only freed then
+    char *path; // renamed over the journal once the records since are added
+    Vector *bytes; // header and snapshot
+    int failed;
+    int joined;
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+} JournalCompaction;
+
+struct Journal {
+    char *path;
+    FILE *file;
+    PieceTable *table;
+    // The file replay starts from: its length, checksum, and its text as
+    // spans of the buffers sorted by buffer and start, none overlapping
+    size_t baseLength;
+    uint32_t baseIdentity;
+    Vector *base; // JournalSpan
+    Vector *pending; // records of this turn, written all at once
+    Vector *tail; // records written since the running compaction's snapshot
+    size_t size; // bytes in the file
+    size_t compactSize;
+    size_t snapshotSize; // size of the file right after its snapshot
+    int unsynced;
+    int syncTimer; // 0 when not armed
+    JournalCompaction *compaction; // NULL when none runs
+    int failed; // a write failed, the journal no longer follows the document
+    JournalLock *lock; // let go of when the journal is closed, may be NULL
+    // Whoever observed the table before the journal, told of every change
+    // after it and the table's observer again once the journal is closed
+    PieceTableObserver next;
+    void *nextData;
+};
+
+static uint32_t CrcTable[256];
+
+static void initialize_crc_table() {
+    if (CrcTable[1] != 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        }
+
+        CrcTable[i] = crc;
+    }
+}
+
+// CRC-32 (the zlib one), crc is 0 to start or what the last part gave
+static uint32_t journal_crc(uint32_t crc, const void *bytes, size_t length) {
+    const unsigned char *at = bytes;
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; i++) {
+        crc = CrcTable[(crc ^ at[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    uint32_t value = 0;
+
+    for (int i = 3; i >= 0; i--) {
+        value = value << 8 | in[i];
+    }
+
+    return value;
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8 | in[i];
+    }
+
+    return value;
+}
+
+// Makes room for length more bytes and hands them out
+static unsigned char *reserve_bytes(Vector *out, size_t length) {
+    vec_reserve(out, out->len + length);
+
+    unsigned char *bytes = (unsigned char *) out->base + out->len;
+    out->len += length;
+
+    return bytes;
+}
+
+static uint32_t original_identity(PieceBuffer *original) {
+    size_t ends = original->len < JOURNAL_IDENTITY_BYTES ? original->len : JOURNAL_IDENTITY_BYTES;
+    uint32_t crc = journal_crc(0, original->base, ends);
+
+    return journal_crc(crc, original->base + original->len - ends, ends);
+}
+
+// The same checksum, of the document as it is in the table
+static uint32_t document_identity(PieceTable *table) {
+    size_t length = piece_table_length(table);
+    size_t ends = length < JOURNAL_IDENTITY_BYTES ? length : JOURNAL_IDENTITY_BYTES;
+    char *text = malloc(ends > 0 ? ends : 1);
+    uint32_t crc = 0;
+
+    if (text != NULL) {
+        crc = journal_crc(crc, text, piece_table_read(table, 0, text, ends));
+        crc = journal_crc(crc, text, piece_table_read(table, length - ends, text, ends));
+    }
+
+    free(text);
+
+    return crc;
+}
+
+static void append_header(Vector *out, Journal *journal) {
+    unsigned char *header = reserve_bytes(out, JOURNAL_HEADER_SIZE);
+
+    memcpy(header, JOURNAL_MAGIC, 8);
+    put_u64(header + 8, journal->baseLength);
+    put_u32(header + 16, journal->baseIdentity);
+    put_u32(header + 20, journal_crc(0, header, 20));
+}
+
+// The payload goes right after, end_record sizes and checksums it
+static size_t begin_record(Vector *out, int type, size_t offset, size_t removed) {
+    size_t start = out->len;
+    unsigned char *record = reserve_bytes(out, JOURNAL_RECORD_SIZE);
+
+    record[4] = (unsigned char) type;
+    put_u64(record + 5, offset);
+    put_u64(record + 13, removed);
+
+    return start;
+}
+
+static void end_record(Vector *out, size_t start) {
+    unsigned char *record = (unsigned char *) out->base + start;
+    size_t length = out->len - start - JOURNAL_RECORD_SIZE;
+
+    put_u64(record + 21, length);
+    put_u32(record, journal_crc(0, record + 4, JOURNAL_RECORD_SIZE - 4 + length));
+}
+
+static int compare_spans(const void *a, const void *b) {
+    const JournalSpan *left = a, *right = b;
+
+    if (left->buffer != right->buffer) {
+        return left->buffer < right->buffer ? -1 : 1;
+    }
+
+    return left->start < right->start ? -1 : left->start > right->start;
+}
+
+// The base becomes the document as the table holds it now, as spans of the
+// buffers. Text found twice (nothing the editor makes) is only kept once.
+static void set_journal_base(Journal *journal) {
+    Vector *base = journal->base;
+    RedBlackTreeIterator pieces;
+    size_t offset = 0;
+
+    vec_clear(base);
+
+    for (redblack_iterator_first(&pieces, journal->table->pieces); pieces.node != NULL; redblack_iterator_next(&pieces)) {
+        Piece *piece = pieces.node->value;
+
+        if (piece->length > 0) {
+            vec_push_back(base, &(JournalSpan) { piece->buffer, piece->start, piece->length, offset });
+        }
+
+        offset += piece->length;
+    }
+
+    JournalSpan *spans = (JournalSpan *) base->base;
+    size_t kept = 0;
+
+    qsort(spans, base->len, sizeof(JournalSpan), compare_spans);
+
+    for (size_t i = 0; i < base->len; i++) {
+        JournalSpan *last = kept > 0 ? &spans[kept - 1] : NULL;
+
+        if (last != NULL && last->buffer == spans[i].buffer && spans[i].start < last->start + last->length) {
+            continue;
+        }
+
+        if (last != NULL && last->buffer == spans[i].buffer && spans[i].start == last->start + last->length &&
+            spans[i].offset == last->offset + last->length) {
+            last->length += spans[i].length;
+            continue;
+        }
+
+        spans[kept++] = spans[i];
+    }
+
+    base->len = kept;
+    journal->baseLength = offset;
+}
+
+// The span of the base holding at of buffer, or where the next one starts
+// when none does (limit, SIZE_MAX when there is no next one)
+static JournalSpan *find_base_span(Journal *journal, unsigned int buffer, size_t at, size_t *limit) {
+    JournalSpan *spans = (JournalSpan *) journal->base->base;
+    JournalSpan key = { buffer, at, 0, 0 };
+    size_t low = 0, high = journal->base->len;
+
+    // The first span after at
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+
+        if (compare_spans(&spans[middle], &key) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    *limit = low < journal->base->len && spans[low].buffer == buffer ? spans[low].start : SIZE_MAX;
+
+    if (low > 0 && spans[low - 1].buffer == buffer && at < spans[low - 1].start + spans[low - 1].length) {
+        return &spans[low - 1];
+    }
+
+    return NULL;
+}
+
+// Closes the snapshot edit at entry: the base from next until until gives
+// way to the text appended since the entry
+static void end_snapshot_edit(Vector *out, size_t entry, size_t next, size_t until) {
+    unsigned char *edit = (unsigned char *) out->base + entry;
+
+    put_u64(edit, next);
+    put_u64(edit + 8, until - next);
+    put_u64(edit + 16, out->len - entry - JOURNAL_SNAPSHOT_EDIT_SIZE);
+}
+
+// The document as edits to the base: text still where it is in the base
+// stays offsets, only the text typed in since is copied. Base text out of
+// order (nothing the editor makes) is copied as well.
+static void append_snapshot(Vector *out, Journal *journal) {
+    PieceTable *table = journal->table;
+    size_t start = begin_record(out, JOURNAL_SNAPSHOT, 0, journal->baseLength);
+    size_t next = 0; // the base before it is accounted for
+    size_t entry = 0;
+    int open = 0;
+    RedBlackTreeIterator pieces;
+
+    for (redblack_iterator_first(&pieces, table->pieces); pieces.node != NULL; redblack_iterator_next(&pieces)) {
+        Piece *piece = pieces.node->value;
+        size_t end = piece->start + piece->length;
+
+        for (size_t at = piece->start, run; at < end; at += run) {
+            size_t limit;
+            JournalSpan *span = find_base_span(journal, piece->buffer, at, &limit);
+            size_t offset = span != NULL ? span->offset + at - span->start : 0;
+
+            run = (span != NULL ? span->start + span->length : limit) - at;
+            run = run < end - at ? run : end - at;
+
+            if (span != NULL && offset >= next) {
+                if (open || offset > next) {
+                    if (!open) {
+                        entry = out->len;
+                        reserve_bytes(out, JOURNAL_SNAPSHOT_EDIT_SIZE);
+                    }
+
+                    end_snapshot_edit(out, entry, next, offset);
+                    open = 0;
+                }
+
+                next = offset + run;
+                continue;
+            }
+
+            if (!open) {
+                entry = out->len;
+                reserve_bytes(out, JOURNAL_SNAPSHOT_EDIT_SIZE);
+                open = 1;
+            }
+
+            memcpy(reserve_bytes(out, run), piece_table_buffer(table, piece->buffer)->base + at, run);
+        }
+    }
+
+    if (open || next < journal->baseLength) {
+        if (!open) {
+            entry = out->len;
+            reserve_bytes(out, JOURNAL_SNAPSHOT_EDIT_SIZE);
+        }
+
+        end_snapshot_edit(out, entry, next, journal->baseLength);
+    }
+
+    end_record(out, start);
+}
+
+// The record of a change: the text it put in that the base holds (an undone
+// delete, lines moved) is written as where it is in the base, as in a
+// snapshot, so that costs the same however long it is. Bits of base text
+// shorter than a part are copied. A change of new text only is an edit.
+static void append_change(Vector *out, Journal *journal, size_t offset, size_t removed, size_t length) {
+    size_t start = begin_record(out, JOURNAL_SPLICE, offset, removed);
+    size_t literal = 0; // the part new text goes on in, 0 when it is closed
+    size_t reference = 0; // the last part when it is of the base, 0 when it is not
+    int referenced = 0;
+    PieceTableIterator chunks;
+
+    for (int more = piece_table_iterator_seek(&chunks, journal->table, offset);
+         more && chunks.offset < offset + length; more = piece_table_iterator_next(&chunks)) {
+        Piece *piece = chunks.pieces.node->value;
+        const char *text = piece_table_buffer(journal->table, piece->buffer)->base;
+        size_t at = (size_t) (chunks.text - text);
+        size_t end = at + (chunks.length < offset + length - chunks.offset ? chunks.length : offset + length - chunks.offset);
+
+        for (size_t run; at < end; at += run) {
+            size_t limit;
+            JournalSpan *span = find_base_span(journal, piece->buffer, at, &limit);
+
+            run = (span != NULL ? span->start + span->length : limit) - at;
+            run = run < end - at ? run : end - at;
+
+            if (span != NULL && run > JOURNAL_SPLICE_PART_SIZE) {
+                size_t from = span->offset + at - span->start;
+                unsigned char *part = (unsigned char *) out->base + reference;
+
+                // Pieces one after the other in the base are one part
+                if (reference != 0 && get_u64(part) + get_u64(part + 8) == from) {
+                    put_u64(part + 8, get_u64(part + 8) + run);
+                    continue;
+                }
+
+                reference = out->len;
+                part = reserve_bytes(out, JOURNAL_SPLICE_PART_SIZE);
+                put_u64(part, from);
+                put_u64(part + 8, run);
+                literal = 0;
+                referenced = 1;
+                continue;
+            }
+
+            reference = 0;
+
+            if (literal == 0) {
+                literal = out->len;
+                put_u64(reserve_bytes(out, JOURNAL_SPLICE_PART_SIZE), JOURNAL_LITERAL);
+            }
+
+            memcpy(reserve_bytes(out, run), text + at, run);
+            put_u64((unsigned char *) out->base + literal + 8, out->len - literal - JOURNAL_SPLICE_PART_SIZE);
+        }
+    }
+
+    // Only new text, one literal part: its bytes alone make an edit
+    if (!referenced) {
+        unsigned char *record = (unsigned char *) out->base + start;
+
+        record[4] = JOURNAL_EDIT;
+
+        if (literal != 0) {
+            memmove(record + JOURNAL_RECORD_SIZE, record + JOURNAL_RECORD_SIZE + JOURNAL_SPLICE_PART_SIZE,
+                    out->len - literal - JOURNAL_SPLICE_PART_SIZE);
+            out->len -= JOURNAL_SPLICE_PART_SIZE;
+        }
+    }
+
+    end_record(out, start);
+}
+
+char *journal_path(const char *path) {
+    return hidden_sibling_path(path, ".swp");
+}
+
+// The journal's path with suffix after it
+static char *journal_suffixed_path(const char *path, const char *suffix) {
+    size_t length = strlen(path);
+    char *suffixed = malloc(length + strlen(suffix) + 1);
+
+    if (suffixed != NULL) {
+        memcpy(suffixed, path, length);
+        strcpy(suffixed + length, suffix);
+    }
+
+    return suffixed;
+}
+
+// Where a new version of the journal is written before it replaces it
+static char *journal_temporary_path(const char *path) {
+    return journal_suffixed_path(path, ".new");
+}
+
+static int sync_file(FILE *file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) != 0;
+#else
+    return fsync(fileno(file)) != 0;
+#endif
+}
+
+static int replace_file(const char *from, const char *to) {
+#ifdef _WIN32
+    return !MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+#else
+    return rename(from, to) != 0;
+#endif
+}
+
+// Unbuffered, a batch of records is a single write
+static FILE *open_for_append(const char *path) {
+    FILE *file = fopen(path, "ab");
+
+    if (file != NULL) {
+        setvbuf(file, NULL, _IONBF, 0);
+    }
+
+    return file;
+}
+
+// Writes bytes to a new file at path and waits for them to reach the disk
+static int write_journal_file(const char *path, Vector *bytes) {
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL) {
+        return 1;
+    }
+
+    int failed = fwrite(bytes->base, 1, bytes->len, file) != bytes->len || fflush(file) || sync_file(file);
+
+    return fclose(file) != 0 || failed;
+}
+
+// Puts the file at path in place of the journal, with the records written
+// since it was made added at its end. The old journal stays when it fails.
+static int install_journal_file(Journal *journal, const char *path, size_t size) {
+    FILE *file = open_for_append(path);
+    int failed = file == NULL || (journal->tail->len > 0 && fwrite(journal->tail->base, 1, journal->tail->len, file) != journal->tail->len) ||
+                 sync_file(file);
+
+    failed = (file != NULL && fclose(file) != 0) || failed;
+
+    // Closed before the rename, Win32 does not replace open files
+    fclose(journal->file);
+    failed = failed || replace_file(path, journal->path);
+    journal->file = open_for_append(journal->path);
+
+    if (journal->file == NULL) {
+        journal->failed = 1;
+    }
+
+    if (failed) {
+        remove(path);
+    } else {
+        journal->size = journal->snapshotSize = size + journal->tail->len;
+    }
+
+    vec_clear(journal->tail);
+
+    return failed;
+}
+
+// ---------------------------------------------------------
+// Lock
+// ---------------------------------------------------------
+
+// The journal is replaced by renames, so the lock is a file of its own
+// beside it. The system lets go of it when its editor goes, however it goes.
+struct JournalLock {
+    char *path;
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+};
+
+#ifdef _WIN32
+
+// Open for nobody else to write, deleted once it is closed
+static int take_lock_file(JournalLock *lock, long *holder) {
+    lock->file = CreateFileA(lock->path, GENERIC_READ | GENERIC_WRITE | DELETE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_HIDDEN | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+
+    if (lock->file != INVALID_HANDLE_VALUE) {
+        char pid[32];
+        DWORD written;
+
+        snprintf(pid, sizeof(pid), "%lu\n", (unsigned long) GetCurrentProcessId());
+        WriteFile(lock->file, pid, (DWORD) strlen(pid), &written, NULL);
+
+        return 0;
+    }
+
+    if (GetLastError() == ERROR_SHARING_VIOLATION) {
+        HANDLE held = CreateFileA(lock->path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        char pid[32] = { 0 };
+        DWORD read;
+
+        if (held != INVALID_HANDLE_VALUE) {
+            ReadFile(held, pid, sizeof(pid) - 1, &read, NULL);
+            CloseHandle(held);
+        }
+
+        *holder = strtol(pid, NULL, 10);
+    }
+
+    return 1;
+}
+
+static void release_lock_file(JournalLock *lock) {
+    CloseHandle(lock->file);
+}
+
+#else
+
+// flock'd, and still the file at the path once it is: whoever had it
+// before may have removed it in between
+static int take_lock_file(JournalLock *lock, long *holder) {
+    for (;;) {
+        struct stat held, named;
+
+        lock->fd = open(lock->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+        if (lock->fd < 0) {
+            return 1;
+        }
+
+        if (flock(lock->fd, LOCK_EX | LOCK_NB) != 0) {
+            char pid[32] = { 0 };
+
+            if (errno == EWOULDBLOCK && read(lock->fd, pid, sizeof(pid) - 1) >= 0) {
+                *holder = strtol(pid, NULL, 10);
+            }
+
+            close(lock->fd);
+            return 1;
+        }
+
+        if (fstat(lock->fd, &held) == 0 && stat(lock->path, &named) == 0 &&
+            held.st_dev == named.st_dev && held.st_ino == named.st_ino) {
+            break;
+        }
+
+        close(lock->fd);
+    }
+
+    // Only there for whoever looks, the lock holds without it
+    char pid[32];
+    int length = snprintf(pid, sizeof(pid), "%ld\n", (long) getpid());
+    ssize_t written = ftruncate(lock->fd, 0) == 0 ? write(lock->fd, pid, (size_t) length) : -1;
+
+    (void) written;
+
+    return 0;
+}
+
+static void release_lock_file(JournalLock *lock) {
+    unlink(lock->path);
+    close(lock->fd);
+}
+
+#endif
+
+JournalLock *lock_journal(const char *path, long *holder) {
+    JournalLock *lock = calloc(1, sizeof(*lock));
+
+    *holder = 0;
+
+    if (lock == NULL) {
+        return NULL;
+    }
+
+    lock->path = journal_suffixed_path(path, JOURNAL_LOCK_SUFFIX);
+
+    if (lock->path == NULL || take_lock_file(lock, holder)) {
+        free(lock->path);
+        free(lock);
+        return NULL;
+    }
+
+    return lock;
+}
+
+void unlock_journal(JournalLock *lock) {
+    if (lock == NULL) {
+        return;
+    }
+
+    release_lock_file(lock);
+    free(lock->path);
+    free(lock);
+}
+
+// ---------------------------------------------------------
+// Compaction
+// ---------------------------------------------------------
+
+static void join_compaction(JournalCompaction *job) {
+    if (job->joined) {
+        return;
+    }
+
+#ifdef _WIN32
+    WaitForSingleObject(job->thread, INFINITE);
+    CloseHandle(job->thread);
+#else
+    pthread_join(job->thread, NULL);
+#endif
+    job->joined = 1;
+}
+
+static void free_compaction(JournalCompaction *job) {
+    free(job->path);
+    free_vector(job->bytes);
+    free(job);
+}
+
+// Back on the editor's thread once the snapshot is on disk
+static int finish_compaction(void *data) {
+    JournalCompaction *job = data;
+    Journal *journal = job->journal;
+
+    join_compaction(job);
+
+    if (journal != NULL) {
+        journal->compaction = NULL;
+
+        if (job->failed) {
+            remove(job->path);
+            vec_clear(journal->tail);
+            // Not again before the journal has grown as much once more
+            journal->snapshotSize = journal->size;
+        } else {
+            install_journal_file(journal, job->path, job->bytes->len);
+        }
+    }
+
+    free_compaction(job);
+
+    return 0;
+}
+
+static void write_compaction(JournalCompaction *job) {
+    job->failed = write_journal_file(job->path, job->bytes);
+    postToEventLoop(finish_compaction, job);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI run_compaction(LPVOID data) {
+    write_compaction(data);
+    return 0;
+}
+#else
+static void *run_compaction(void *data) {
+    write_compaction(data);
+    return NULL;
+}
+#endif
+
+// The snapshot is taken here, the document may change while the thread
+// writes it: what is written meanwhile goes to the old file and the tail,
+// and is added after the snapshot when it is done.
+static int start_compaction(Journal *journal) {
+    JournalCompaction *job = calloc(1, sizeof(*job));
+
+    if (job == NULL) {
+        return 1;
+    }
+
+    job->journal = journal;
+    job->path = journal_temporary_path(journal->path);
+    job->bytes = initialize_vector("struct", sizeof(char));
+
+    if (job->path == NULL || job->bytes == NULL) {
+        free_compaction(job);
+        return 1;
+    }
+
+    append_header(job->bytes, journal);
+    append_snapshot(job->bytes, journal);
+
+#ifdef _WIN32
+    job->thread = CreateThread(NULL, 0, run_compaction, job, 0, NULL);
+    int failed = job->thread == NULL;
+#else
+    int failed = pthread_create(&job->thread, NULL, run_compaction, job) != 0;
+#endif
+
+    if (failed) {
+        free_compaction(job);
+        return 1;
+    }
+
+    vec_clear(journal->tail);
+    journal->compaction = job;
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Writing
+// ---------------------------------------------------------
+
+static int write_pending(Journal *journal) {
+    Vector *pending = journal->pending;
+
+    if (pending->len == 0 || journal->failed) {
+        return journal->failed;
+    }
+
+    if (fwrite(pending->base, 1, pending->len, journal->file) != pending->len) {
+        journal->failed = 1;
+        return 1;
+    }
+
+    if (journal->compaction != NULL) {
+        memcpy(reserve_bytes(journal->tail, pending->len), pending->base, pending->len);
+    }
+
+    journal->size += pending->len;
+    journal->unsynced = 1;
+    vec_clear(pending);
+
+    return 0;
+}
+
+int journal_sync(Journal *journal) {
+    if (!journal->unsynced || journal->failed) {
+        return journal->failed;
+    }
+
+    journal->unsynced = 0;
+
+    if (sync_file(journal->file)) {
+        journal->failed = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int sync_journal_timer(void *data) {
+    Journal *journal = data;
+
+    journal->syncTimer = 0;
+    journal_sync(journal);
+
+    return 0;
+}
+
+// Everything recorded in a turn of the loop goes out in one write
+int journal_flush(Journal *journal) {
+    if (write_pending(journal)) {
+        return 1;
+    }
+
+    if (journal->unsynced && journal->syncTimer == 0) {
+        journal->syncTimer = addTimer(JOURNAL_SYNC_DELAY, sync_journal_timer, journal);
+    }
+
+    if (journal->compaction == NULL && journal->size > journal->compactSize && journal->size > 2 * journal->snapshotSize) {
+        start_compaction(journal);
+    }
+
+    return 0;
+}
+
+static int flush_journal_work(void *data) {
+    journal_flush(data);
+
+    return 0;
+}
+
+// The table's observer
+static void journal_change(void *data, size_t offset, size_t removed, size_t length) {
+    Journal *journal = data;
+
+    if (!journal->failed) {
+        append_change(journal->pending, journal, offset, removed, length);
+        deferWork(flush_journal_work, journal);
+    }
+
+    if (journal->next != NULL) {
+        journal->next(journal->nextData, offset, removed, length);
+    }
+}
+
+// A running compaction is of a journal about to go, its file is dropped
+static void abandon_compaction(Journal *journal) {
+    if (journal->compaction == NULL) {
+        return;
+    }
+
+    // The job frees itself once its posted callback runs
+    join_compaction(journal->compaction);
+    remove(journal->compaction->path);
+    journal->compaction->journal = NULL;
+    journal->compaction = NULL;
+}
+
+// Replaces the file with a header and a snapshot of the table. Made aside
+// and renamed in place, a crash leaves the old journal or the new one.
+static int restart_journal(Journal *journal) {
+    char *temporary = journal_temporary_path(journal->path);
+    Vector *bytes = initialize_vector("struct", sizeof(char));
+    int failed = temporary == NULL || bytes == NULL;
+
+    if (!failed) {
+        append_header(bytes, journal);
+        append_snapshot(bytes, journal);
+        failed = write_journal_file(temporary, bytes);
+    }
+
+    if (journal->file != NULL) {
+        fclose(journal->file);
+    }
+
+    failed = failed || replace_file(temporary, journal->path);
+    journal->file = open_for_append(journal->path);
+    journal->failed = failed || journal->file == NULL;
+
+    if (failed && temporary != NULL) {
+        remove(temporary);
+    } else if (!failed) {
+        journal->size = journal->snapshotSize = bytes->len;
+        journal->unsynced = 0;
+    }
+
+    free(temporary);
+    free_vector(bytes);
+
+    return journal->failed;
+}
+
+Journal *open_journal(const char *path, PieceTable *table, JournalLock *lock) {
+    initialize_crc_table();
+
+    Journal *journal = calloc(1, sizeof(*journal));
+
+    if (journal == NULL) {
+        unlock_journal(lock);
+        return NULL;
+    }
+
+    journal->table = table;
+    journal->lock = lock;
+    journal->compactSize = JOURNAL_COMPACT_SIZE;
+    journal->path = malloc(strlen(path) + 1);
+    journal->base = initialize_vector("struct", sizeof(JournalSpan));
+    journal->pending = initialize_vector("struct", sizeof(char));
+    journal->tail = initialize_vector("struct", sizeof(char));
+
+    if (journal->path == NULL || journal->base == NULL || journal->pending == NULL || journal->tail == NULL) {
+        close_journal(journal, 0);
+        return NULL;
+    }
+
+    strcpy(journal->path, path);
+
+    // Replay starts from the file the table was made from
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+
+    if (original->len > 0) {
+        vec_push_back(journal->base, &(JournalSpan) { PIECE_BUFFER_ORIGINAL, 0, original->len, 0 });
+    }
+
+    journal->baseLength = original->len;
+    journal->baseIdentity = original_identity(original);
+
+    if (restart_journal(journal)) {
+        close_journal(journal, 0);
+        return NULL;
+    }
+
+    journal->next = table->observer;
+    journal->nextData = table->observer_data;
+    table->observer = journal_change;
+    table->observer_data = journal;
+
+    return journal;
+}
+
+// The document was saved: the file holds what the table does, replay
+// starts from it now and what came before is of no use
+int journal_rebase(Journal *journal) {
+    abandon_compaction(journal);
+    vec_clear(journal->pending);
+    vec_clear(journal->tail);
+    cancelDeferredWork(flush_journal_work, journal);
+
+    if (journal->syncTimer != 0) {
+        cancelTimer(journal->syncTimer);
+        journal->syncTimer = 0;
+    }
+
+    set_journal_base(journal);
+    journal->baseIdentity = document_identity(journal->table);
+
+    return restart_journal(journal);
+}
+
+// Copies [offset, offset + length) of the file the base stands for
+static void read_base(Journal *journal, size_t offset, char *out, size_t length) {
+    JournalSpan *spans = (JournalSpan *) journal->base->base;
+
+    for (size_t i = 0; i < journal->base->len; i++) {
+        size_t from = spans[i].offset > offset ? spans[i].offset : offset;
+        size_t until = spans[i].offset + spans[i].length < offset + length ? spans[i].offset + spans[i].length : offset + length;
+
+        if (from < until) {
+            const char *text = piece_table_buffer(journal->table, spans[i].buffer)->base;
+
+            memcpy(out + (from - offset), text + spans[i].start + (from - spans[i].offset), until - from);
+        }
+    }
+}
+
+// The checksum of original_identity, of the file the base stands for
+static uint32_t base_identity(Journal *journal) {
+    size_t ends = journal->baseLength < JOURNAL_IDENTITY_BYTES ? journal->baseLength : JOURNAL_IDENTITY_BYTES;
+    char *text = malloc(ends > 0 ? ends : 1);
+    uint32_t crc = 0;
+
+    if (text != NULL) {
+        read_base(journal, 0, text, ends);
+        crc = journal_crc(crc, text, ends);
+        read_base(journal, journal->baseLength - ends, text, ends);
+        crc = journal_crc(crc, text, ends);
+    }
+
+    free(text);
+
+    return crc;
+}
+
+// The file grew by bytes the table holds as [start, start + length) of
+// buffer: they are the base's from now on, not changes, and the journal
+// starts over from the longer file
+int journal_extend_base(Journal *journal, unsigned int buffer, size_t start, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    abandon_compaction(journal);
+    vec_clear(journal->pending);
+    vec_clear(journal->tail);
+    cancelDeferredWork(flush_journal_work, journal);
+
+    if (journal->syncTimer != 0) {
+        cancelTimer(journal->syncTimer);
+        journal->syncTimer = 0;
+    }
+
+    vec_push_back(journal->base, &(JournalSpan) { buffer, start, length, journal->baseLength });
+    qsort(journal->base->base, journal->base->len, sizeof(JournalSpan), compare_spans);
+    journal->baseLength += length;
+    journal->baseIdentity = base_identity(journal);
+
+    return restart_journal(journal);
+}
+
+void close_journal(Journal *journal, int discard) {
+    if (journal == NULL) {
+        return;
+    }
+
+    if (journal->table->observer_data == journal) {
+        journal->table->observer = journal->next;
+        journal->table->observer_data = journal->nextData;
+    }
+
+    cancelDeferredWork(flush_journal_work, journal);
+
+    if (journal->syncTimer != 0) {
+        cancelTimer(journal->syncTimer);
+    }
+
+    abandon_compaction(journal);
+
+    if (journal->file != NULL) {
+        if (!discard) {
+            write_pending(journal);
+            journal_sync(journal);
+        }
+
+        fclose(journal->file);
+    }
+
+    if (discard && journal->path != NULL) {
+        remove(journal->path);
+    }
+
+    unlock_journal(journal->lock);
+    free(journal->path);
+    free_vector(journal->base);
+    free_vector(journal->pending);
+    free_vector(journal->tail);
+    free(journal);
+}
+
+void set_journal_compact_size(Journal *journal, size_t bytes) {
+    journal->compactSize = bytes;
+}
+
+size_t journal_size(Journal *journal) {
+    return journal->size;
+}
+
+int journal_compacting(Journal *journal) {
+    return journal->compaction != NULL;
+}
+
+// ---------------------------------------------------------
+// Recovery
+// ---------------------------------------------------------
+
+static int check_journal_header(FileSource *source, PieceTable *table) {
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+    const unsigned char *header = (const unsigned char *) source->data;
+
+    return source->length < JOURNAL_HEADER_SIZE || memcmp(header, JOURNAL_MAGIC, 8) != 0 ||
+           get_u32(header + 20) != journal_crc(0, header, 20) || get_u64(header + 8) != original->len ||
+           get_u32(header + 16) != original_identity(original);
+}
+
+// Snapshot edits point into the journal, the table copies their text
+static int replay_snapshot(PieceTable *table, const unsigned char *payload, size_t length, size_t *changes) {
+    Vector *edits = initialize_vector("struct", sizeof(PieceTableEdit));
+    size_t at = 0;
+
+    while (length - at >= JOURNAL_SNAPSHOT_EDIT_SIZE) {
+        const unsigned char *edit = payload + at;
+        size_t textLength = get_u64(edit + 16);
+
+        if (textLength > length - at - JOURNAL_SNAPSHOT_EDIT_SIZE) {
+            break;
+        }
+
+        vec_push_back(edits, &(PieceTableEdit) {
+            .offset = get_u64(edit),
+            .length = get_u64(edit + 8),
+            .text = (const char *) edit + JOURNAL_SNAPSHOT_EDIT_SIZE,
+            .textLength = textLength
+        });
+        at += JOURNAL_SNAPSHOT_EDIT_SIZE + textLength;
+    }
+
+    int failed = at != length || piece_table_replace(table, edits->base, edits->len);
+
+    *changes += !failed && edits->len > 0;
+    free_vector(edits);
+
+    return failed;
+}
+
+// Parts are edits at the same place one after the other, the base's are
+// spans of the original: the table holds the file the journal is of
+static int replay_splice(PieceTable *table, size_t offset, size_t removed, const unsigned char *payload, size_t length) {
+    size_t originalLength = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL)->len;
+    Vector *edits = initialize_vector("struct", sizeof(PieceTableEdit));
+    size_t at = 0;
+
+    vec_push_back(edits, &(PieceTableEdit) { .offset = offset, .length = removed });
+
+    while (length - at >= JOURNAL_SPLICE_PART_SIZE) {
+        uint64_t from = get_u64(payload + at);
+        size_t partLength = get_u64(payload + at + 8);
+        PieceTableEdit part = {
+            .offset = offset + removed,
+            .textLength = partLength,
+            .buffer = PIECE_BUFFER_ORIGINAL,
+            .start = from
+        };
+
+        if (from == JOURNAL_LITERAL) {
+            if (partLength > length - at - JOURNAL_SPLICE_PART_SIZE) {
+                break;
+            }
+
+            part.text = (const char *) payload + at + JOURNAL_SPLICE_PART_SIZE;
+            at += partLength;
+        } else if (from > originalLength || partLength > originalLength - from) {
+            break;
+        }
+
+        vec_push_back(edits, &part);
+        at += JOURNAL_SPLICE_PART_SIZE;
+    }
+
+    int failed = at != length || piece_table_replace(table, edits->base, edits->len);
+
+    free_vector(edits);
+
+    return failed;
+}
+
+int replay_journal(const char *path, PieceTable *table, size_t *changes) {
+    initialize_crc_table();
+    *changes = 0;
+
+    FileSource *source = open_file_source(path);
+
+    if (source == NULL) {
+        return 1;
+    }
+
+    if (check_journal_header(source, table)) {
+        close_file_source(source);
+        return 1;
+    }
+
+    const unsigned char *data = (const unsigned char *) source->data;
+    size_t at = JOURNAL_HEADER_SIZE;
+
+    while (source->length - at >= JOURNAL_RECORD_SIZE) {
+        const unsigned char *record = data + at;
+        size_t length = get_u64(record + 21);
+
+        if (length > source->length - at - JOURNAL_RECORD_SIZE ||
+            get_u32(record) != journal_crc(0, record + 4, JOURNAL_RECORD_SIZE - 4 + length)) {
+            break;
+        }
+
+        const unsigned char *payload = record + JOURNAL_RECORD_SIZE;
+        PieceTableEdit edit = {
+            .offset = get_u64(record + 5),
+            .length = get_u64(record + 13),
+            .text = (const char *) payload,
+            .textLength = length
+        };
+        int failed = 1;
+
+        // A snapshot is the whole document, only ever first
+        if (record[4] == JOURNAL_SNAPSHOT && at == JOURNAL_HEADER_SIZE) {
+            failed = replay_snapshot(table, payload, length, changes);
+        } else if (record[4] == JOURNAL_EDIT) {
+            failed = piece_table_replace(table, &edit, 1);
+            *changes += !failed;
+        } else if (record[4] == JOURNAL_SPLICE) {
+            failed = replay_splice(table, edit.offset, edit.length, payload, length);
+            *changes += !failed;
+        }
+
+        if (failed) {
+            break;
+        }
+
+        at += JOURNAL_RECORD_SIZE + length;
+    }
+
+    close_file_source(source);
+
+    return 0;
+}
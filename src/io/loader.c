@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+#include "io/loader.h"
+#include "event_loop.h"
+#include "text/newline_scan.h"
+
+struct DocumentLoader {
+    PieceTable *table;
+    const char *text; // the original, only ever read
+    size_t length;
+    size_t chunkCount;
+    size_t *counts; // newlines of each chunk, written by the thread
+    size_t counted; // chunks the thread is done with, under the lock
+    int stop; // under the lock
+    size_t applied; // chunks handed to the table
+    int timer; // 0 once every count is in
+    int joined;
+    LoaderProgress progress;
+    void *data;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    HANDLE thread;
+#else
+    pthread_mutex_t lock;
+    pthread_t thread;
+#endif
+};
+
+static void lock_loader(DocumentLoader *loader) {
+#ifdef _WIN32
+    EnterCriticalSection(&loader->lock);
+#else
+    pthread_mutex_lock(&loader->lock);
+#endif
+}
+
+static void unlock_loader(DocumentLoader *loader) {
+#ifdef _WIN32
+    LeaveCriticalSection(&loader->lock);
+#else
+    pthread_mutex_unlock(&loader->lock);
+#endif
+}
+
+static void join_loader(DocumentLoader *loader) {
+    if (loader->joined) {
+        return;
+    }
+
+#ifdef _WIN32
+    WaitForSingleObject(loader->thread, INFINITE);
+    CloseHandle(loader->thread);
+#else
+    pthread_join(loader->thread, NULL);
+#endif
+    loader->joined = 1;
+}
+
+static void count_chunks(DocumentLoader *loader) {
+    for (size_t chunk = 0; chunk < loader->chunkCount; chunk++) {
+        size_t start = chunk * PIECE_BUFFER_CHUNK_SIZE;
+        size_t length = loader->length - start < PIECE_BUFFER_CHUNK_SIZE ? loader->length - start : PIECE_BUFFER_CHUNK_SIZE;
+        size_t newlines = count_newlines(loader->text + start, length);
+
+        lock_loader(loader);
+        int stop = loader->stop;
+        loader->counts[chunk] = newlines;
+        loader->counted = chunk + 1;
+        unlock_loader(loader);
+
+        if (stop) {
+            break;
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI run_loader(LPVOID data) {
+    count_chunks(data);
+    return 0;
+}
+#else
+static void *run_loader(void *data) {
+    count_chunks(data);
+    return NULL;
+}
+#endif
+
+// On the editor's thread: the counts made since the last look go to the table
+static int poll_loader(void *data) {
+    DocumentLoader *loader = data;
+
+    lock_loader(loader);
+    size_t counted = loader->counted;
+    unlock_loader(loader);
+
+    if (counted > loader->applied) {
+        piece_table_set_chunk_newlines(loader->table, loader->applied, loader->counts + loader->applied, counted - loader->applied);
+        loader->applied = counted;
+
+        if (loader->progress != NULL) {
+            size_t bytes = counted * PIECE_BUFFER_CHUNK_SIZE;
+
+            loader->progress(loader->data, bytes < loader->length ? bytes : loader->length, loader->length);
+        }
+    }
+
+    if (counted < loader->chunkCount) {
+        return 1;
+    }
+
+    join_loader(loader);
+    loader->timer = 0;
+
+    return 0;
+}
+
+DocumentLoader *start_loader(PieceTable *table, LoaderProgress progress, void *data) {
+    DocumentLoader *loader = calloc(1, sizeof(*loader));
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+
+    if (loader == NULL) {
+        return NULL;
+    }
+
+    loader->table = table;
+    loader->text = original->base;
+    loader->length = original->len;
+    loader->chunkCount = (original->len + PIECE_BUFFER_CHUNK_SIZE - 1) / PIECE_BUFFER_CHUNK_SIZE;
+    loader->counts = malloc((loader->chunkCount > 0 ? loader->chunkCount : 1) * sizeof(*loader->counts));
+    loader->progress = progress;
+    loader->data = data;
+
+    if (loader->counts == NULL || original->chunks == NULL) {
+        free(loader->counts);
+        free(loader);
+        return NULL;
+    }
+
+    // The kernels are picked here, before two threads count at once
+    newline_scanner_in_use();
+
+#ifdef _WIN32
+    InitializeCriticalSection(&loader->lock);
+#else
+    if (pthread_mutex_init(&loader->lock, NULL) != 0) {
+        free(loader->counts);
+        free(loader);
+        return NULL;
+    }
+#endif
+
+    loader->timer = addTimer(LOADER_POLL_DELAY, poll_loader, loader);
+
+#ifdef _WIN32
+    loader->thread = loader->timer != 0 ? CreateThread(NULL, 0, run_loader, loader, 0, NULL) : NULL;
+    loader->joined = loader->thread == NULL;
+#else
+    loader->joined = loader->timer == 0 || pthread_create(&loader->thread, NULL, run_loader, loader) != 0;
+#endif
+
+    if (loader->joined) {
+        stop_loader(loader);
+        return NULL;
+    }
+
+    return loader;
+}
+
+void stop_loader(DocumentLoader *loader) {
+    if (loader == NULL) {
+        return;
+    }
+
+    lock_loader(loader);
+    loader->stop = 1;
+    unlock_loader(loader);
+    join_loader(loader);
+
+    if (loader->timer != 0) {
+        cancelTimer(loader->timer);
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&loader->lock);
+#else
+    pthread_mutex_destroy(&loader->lock);
+#endif
+    free(loader->counts);
+    free(loader);
+}
+
+int loader_done(DocumentLoader *loader) {
+    return loader->timer == 0;
+}
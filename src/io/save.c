@@ -0,0 +1,361 @@
+#ifdef __linux__
+#define _GNU_SOURCE // copy_file_range
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "io/save.h"
+
+// The new file's name while it is written, until it replaces the old one
+#define SAVE_SUFFIX ".new"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+static int write_span(HANDLE file, const char *text, size_t length) {
+    while (length > 0) {
+        DWORD chunk = length > (1u << 30) ? (1u << 30) : (DWORD) length;
+        DWORD written;
+
+        if (!WriteFile(file, text, chunk, &written, NULL) || written == 0) {
+            return 1;
+        }
+
+        text += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// Whether path names the source's file, the one a save would replace
+static int is_source_file(FileSource *source, const char *path) {
+    BY_HANDLE_FILE_INFORMATION ours, theirs;
+    HANDLE file = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    int same = GetFileInformationByHandle(source->file, &ours) && GetFileInformationByHandle(file, &theirs) &&
+               ours.dwVolumeSerialNumber == theirs.dwVolumeSerialNumber &&
+               ours.nFileIndexHigh == theirs.nFileIndexHigh && ours.nFileIndexLow == theirs.nFileIndexLow;
+
+    CloseHandle(file);
+
+    return same;
+}
+
+// Windows can't replace a file any of which is mapped: the table gets its
+// own copy of the original and the source lets go of the file altogether
+static int release_source(PieceTable *table, FileSource *source) {
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+
+    if (source->data != NULL && source->data == original->base &&
+        piece_table_own_buffer(table, PIECE_BUFFER_ORIGINAL)) {
+        return 1;
+    }
+
+    if (source->data != NULL) {
+        UnmapViewOfFile(source->data);
+        source->data = NULL;
+    }
+    if (source->mapping != NULL) {
+        CloseHandle(source->mapping);
+        source->mapping = NULL;
+    }
+    if (source->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(source->file);
+        source->file = INVALID_HANDLE_VALUE;
+    }
+
+    return 0;
+}
+
+// The source is the file at path again, the one written or the old one if
+// that failed. Nothing is mapped, the table has what it needs of it.
+static void reopen_source(FileSource *source, const char *path) {
+    LARGE_INTEGER size;
+
+    source->file = CreateFileA(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL
+    );
+
+    if (source->file != INVALID_HANDLE_VALUE && GetFileSizeEx(source->file, &size)) {
+        source->length = (size_t) size.QuadPart;
+    }
+}
+
+int save_piece_table(PieceTable *table, const char *path, FileSource *source) {
+    char *temporary = hidden_sibling_path(path, SAVE_SUFFIX);
+
+    if (temporary == NULL) {
+        return 1;
+    }
+
+    HANDLE file = CreateFileA(temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        free(temporary);
+        return 1;
+    }
+
+    RedBlackTreeIterator pieces;
+    int failed = 0;
+
+    for (redblack_iterator_first(&pieces, table->pieces); !failed && pieces.node != NULL; redblack_iterator_next(&pieces)) {
+        Piece *piece = pieces.node->value;
+
+        failed = write_span(file, piece_table_buffer(table, piece->buffer)->base + piece->start, piece->length);
+    }
+
+    failed = !FlushFileBuffers(file) || failed;
+    failed = !CloseHandle(file) || failed;
+
+    // Only a source that is the file replaced has to let go of it
+    int released = !failed && source != NULL && source->file != INVALID_HANDLE_VALUE && is_source_file(source, path);
+
+    if (released && release_source(table, source)) {
+        released = 0;
+        failed = 1;
+    }
+
+    failed = failed || !MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+    if (released) {
+        reopen_source(source, path);
+    }
+
+    if (failed) {
+        DeleteFileA(temporary);
+    }
+
+    free(temporary);
+
+    return failed;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Pieces waiting to go out in one writev
+typedef struct {
+    int fd;
+    struct iovec batch[SAVE_BATCH];
+    int count;
+    int copy; // the original may be copied from its file
+} SaveWriter;
+
+static int flush_batch(SaveWriter *writer) {
+    struct iovec *next = writer->batch;
+    int left = writer->count;
+
+    writer->count = 0;
+
+    while (left > 0) {
+        ssize_t written = writev(writer->fd, next, left);
+
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return 1;
+        }
+
+        // A short write goes on from the first byte it did not take
+        while (left > 0 && (size_t) written >= next->iov_len) {
+            written -= (ssize_t) next->iov_len;
+            next++;
+            left--;
+        }
+
+        if (left > 0) {
+            next->iov_base = (char *) next->iov_base + written;
+            next->iov_len -= (size_t) written;
+        }
+    }
+
+    return 0;
+}
+
+// Copies what it can of [start, start + length) of the source file in the
+// kernel, returns how much. When the system can't (other file systems,
+// old kernels) the rest is written from the mapping.
+static size_t copy_span(SaveWriter *writer, FileSource *source, size_t start, size_t length, int *failed) {
+#ifdef __linux__
+    loff_t from = (loff_t) start;
+    size_t copied = 0;
+
+    while (copied < length) {
+        ssize_t chunk = copy_file_range(source->fd, &from, writer->fd, NULL, length - copied, 0);
+
+        if (chunk < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (chunk < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP) {
+            *failed = 1;
+            break;
+        }
+
+        if (chunk <= 0) {
+            writer->copy = 0;
+            break;
+        }
+
+        copied += (size_t) chunk;
+    }
+
+    return copied;
+#else
+    (void) source;
+    (void) start;
+    (void) length;
+    (void) failed;
+    writer->copy = 0;
+
+    return 0;
+#endif
+}
+
+// The rename is only on disk once the directory is
+static void sync_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *directory = slash != NULL ? strndup(path, (size_t) (slash - path) + 1) : strdup(".");
+    int fd = directory != NULL ? open(directory, O_RDONLY | O_CLOEXEC) : -1;
+
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    free(directory);
+}
+
+// Every piece in order. Long spans of the original are copied file to file
+// when the writer may.
+static int write_pieces(SaveWriter *writer, PieceTable *table, FileSource *source) {
+    RedBlackTreeIterator pieces;
+    int failed = 0;
+
+    for (redblack_iterator_first(&pieces, table->pieces); !failed && pieces.node != NULL; redblack_iterator_next(&pieces)) {
+        Piece *piece = pieces.node->value;
+        const char *text = piece_table_buffer(table, piece->buffer)->base + piece->start;
+        size_t length = piece->length;
+
+        if (piece->buffer == PIECE_BUFFER_ORIGINAL && writer->copy && length >= SAVE_COPY_SIZE) {
+            failed = flush_batch(writer);
+            size_t copied = failed ? 0 : copy_span(writer, source, piece->start, length, &failed);
+
+            text += copied;
+            length -= copied;
+        }
+
+        if (failed || length == 0) {
+            continue;
+        }
+
+        writer->batch[writer->count++] = (struct iovec) { (void *) text, length };
+
+        if (writer->count == SAVE_BATCH) {
+            failed = flush_batch(writer);
+        }
+    }
+
+    return failed || flush_batch(writer);
+}
+
+// A new file beside the old one, synced and renamed over it. It gets the
+// old one's owner (where we may give it) and permissions.
+static int save_by_rename(PieceTable *table, const char *path, const struct stat *old, FileSource *source) {
+    char *temporary = hidden_sibling_path(path, SAVE_SUFFIX);
+
+    if (temporary == NULL) {
+        return 1;
+    }
+
+    mode_t mode = old != NULL ? old->st_mode & 07777 : 0666;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+
+    if (fd < 0) {
+        free(temporary);
+        return 1;
+    }
+
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+    SaveWriter writer = {
+        .fd = fd,
+        .count = 0,
+        .copy = source != NULL && source->data != NULL && source->data == original->base,
+    };
+    // The owner first, changing it may clear the set-id bits
+    int failed = old != NULL && fchown(fd, old->st_uid, old->st_gid) != 0 && errno != EPERM;
+
+    failed = failed || (old != NULL && fchmod(fd, mode) != 0);
+    failed = failed || write_pieces(&writer, table, source) || fsync(fd) != 0;
+    failed = close(fd) != 0 || failed;
+    failed = failed || rename(temporary, path) != 0;
+
+    if (failed) {
+        unlink(temporary);
+    } else {
+        sync_directory(path);
+    }
+
+    free(temporary);
+
+    return failed;
+}
+
+// A file of several links: a rename would leave the others on the old
+// text, so it is written where it is. That is not atomic, and the table
+// may point into the very bytes written over: it copies all it points into first.
+static int save_in_place(PieceTable *table, const char *path) {
+    for (unsigned int buffer = 0; buffer < table->buffers->len; buffer++) {
+        if (piece_table_own_buffer(table, buffer)) {
+            return 1;
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 1;
+    }
+
+    SaveWriter writer = { .fd = fd, .count = 0, .copy = 0 };
+    int failed = write_pieces(&writer, table, NULL);
+
+    failed = failed || ftruncate(fd, (off_t) piece_table_length(table)) != 0 || fsync(fd) != 0;
+
+    return close(fd) != 0 || failed;
+}
+
+int save_piece_table(PieceTable *table, const char *path, FileSource *source) {
+    // A symbolic link stays one, the file it names is written
+    char *resolved = realpath(path, NULL);
+    const char *file = resolved != NULL ? resolved : path;
+    struct stat info;
+    int existed = stat(file, &info) == 0;
+    int failed = existed && info.st_nlink > 1 ? save_in_place(table, file) :
+                 save_by_rename(table, file, existed ? &info : NULL, source);
+
+    free(resolved);
+
+    return failed;
+}
+
+#endif
@@ -0,0 +1,418 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "keymap.h"
+
+// Edges are looked up by (node, symbol) in an open addressing table that is
+// never more than half full
+#define KEYMAP_FIRST_EDGES 64
+// Counts stop growing here, "99999999999dd" is not worth an overflow
+#define KEYMAP_MAX_COUNT 100000000
+
+typedef struct {
+    int from; // -1 for an empty slot
+    unsigned short symbol;
+    int to;
+} KeymapEdge;
+
+static struct {
+    Vector *nodes; // KeymapNode
+    Vector *keymaps; // Keymap *, freed with the trie
+    KeymapEdge *edges;
+    size_t edgeCount;
+    size_t edgeCapacity;
+} Trie;
+
+static const struct {
+    const char *name;
+    unsigned short keyCode;
+} KeymapKeyNames[] = {
+    { "Esc", XIM_KEY_ESCAPE },
+    { "CR", XIM_KEY_RETURN },
+    { "Enter", XIM_KEY_RETURN },
+    { "BS", XIM_KEY_BACK },
+    { "Tab", XIM_KEY_TAB },
+    { "Del", XIM_KEY_DELETE },
+    { "Left", XIM_KEY_LEFT },
+    { "Right", XIM_KEY_RIGHT },
+    { "Up", XIM_KEY_UP },
+    { "Down", XIM_KEY_DOWN },
+    { "Home", XIM_KEY_HOME },
+    { "End", XIM_KEY_END },
+    { "PageUp", XIM_KEY_PAGE_UP },
+    { "PageDown", XIM_KEY_PAGE_DOWN },
+};
+
+static KeymapNode *keymapNode(int node) {
+    return (KeymapNode *) Trie.nodes->base + node;
+}
+
+static size_t edgeSlot(int from, unsigned short symbol) {
+    size_t hash = (size_t) (unsigned int) from * 0x9E3779B1u ^ (size_t) symbol * 0x85EBCA77u;
+
+    return (hash ^ (hash >> 15)) & (Trie.edgeCapacity - 1);
+}
+
+static int findEdge(int from, unsigned short symbol) {
+    for (size_t slot = edgeSlot(from, symbol);; slot = (slot + 1) & (Trie.edgeCapacity - 1)) {
+        KeymapEdge *edge = &Trie.edges[slot];
+
+        if (edge->from == -1) {
+            return -1;
+        }
+
+        if (edge->from == from && edge->symbol == symbol) {
+            return edge->to;
+        }
+    }
+}
+
+static void placeEdge(KeymapEdge edge) {
+    size_t slot = edgeSlot(edge.from, edge.symbol);
+
+    while (Trie.edges[slot].from != -1) {
+        slot = (slot + 1) & (Trie.edgeCapacity - 1);
+    }
+
+    Trie.edges[slot] = edge;
+}
+
+static int growEdges() {
+    KeymapEdge *old = Trie.edges;
+    size_t oldCapacity = Trie.edgeCapacity;
+    size_t capacity = oldCapacity ? oldCapacity * 2 : KEYMAP_FIRST_EDGES;
+    KeymapEdge *edges = malloc(capacity * sizeof(*edges));
+
+    if (edges == NULL) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        edges[i].from = -1;
+    }
+
+    Trie.edges = edges;
+    Trie.edgeCapacity = capacity;
+
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].from != -1) {
+            placeEdge(old[i]);
+        }
+    }
+
+    free(old);
+
+    return 0;
+}
+
+static int addNode() {
+    KeymapNode node = { .kind = KEYMAP_NONE };
+
+    vec_push_back(Trie.nodes, &node);
+
+    return (int) Trie.nodes->len - 1;
+}
+
+int initializeKeymaps() {
+    if (Trie.nodes != NULL) {
+        return 0;
+    }
+
+    Trie.nodes = initialize_vector("struct", sizeof(KeymapNode));
+    Trie.keymaps = initialize_vector("struct", sizeof(Keymap *));
+
+    if (Trie.nodes == NULL || Trie.keymaps == NULL || growEdges()) {
+        killKeymaps();
+        return 1;
+    }
+
+    return 0;
+}
+
+void killKeymaps() {
+    if (Trie.keymaps != NULL) {
+        for (size_t i = 0; i < Trie.keymaps->len; i++) {
+            free(((Keymap **) Trie.keymaps->base)[i]);
+        }
+    }
+
+    free_vector(Trie.nodes);
+    free_vector(Trie.keymaps);
+    free(Trie.edges);
+    memset(&Trie, 0, sizeof(Trie));
+}
+
+Keymap *createKeymap(KeymapHandler move, int counts) {
+    assert(Trie.nodes != NULL && "KEYMAPS ARE NOT INITIALIZED!");
+
+    Keymap *keymap = malloc(sizeof(*keymap));
+
+    if (keymap == NULL) {
+        return NULL;
+    }
+
+    keymap->root = addNode();
+    keymap->move = move;
+    keymap->operatorPending = NULL;
+    keymap->counts = counts;
+    vec_push_back(Trie.keymaps, &keymap);
+
+    return keymap;
+}
+
+// Printable characters are themselves, special keys are their key code
+// above them, the same on every backend
+unsigned short keymapSymbol(KeyCode key) {
+    if (key.character >= ' ' && key.character != 0x7F) {
+        return key.character;
+    }
+
+    // Win32 gives Ctrl+letter the letter's virtual key, POSIX no key code at all
+    if (key.character < ' ' && key.keyCode >= 'A' && key.keyCode <= 'Z') {
+        return key.character;
+    }
+
+    return key.keyCode ? (unsigned short) (0x100 | key.keyCode) : key.character;
+}
+
+// Reads one key of a sequence, "<Name>" or a single character
+static const char *parseSequenceKey(const char *sequence, unsigned short *symbol) {
+    if (sequence[0] == '<') {
+        const char *end = strchr(sequence, '>');
+
+        for (size_t i = 0; end != NULL && i < sizeof(KeymapKeyNames) / sizeof(KeymapKeyNames[0]); i++) {
+            size_t length = strlen(KeymapKeyNames[i].name);
+
+            if ((size_t) (end - sequence - 1) == length && !strncmp(sequence + 1, KeymapKeyNames[i].name, length)) {
+                *symbol = keymapSymbol((KeyCode) { KeymapKeyNames[i].keyCode, 0 });
+                return end + 1;
+            }
+        }
+
+        // "<C-r>": the control character of the letter
+        if (end == sequence + 4 && (sequence[1] == 'C' || sequence[1] == 'c') && sequence[2] == '-' &&
+            isalpha((unsigned char) sequence[3])) {
+            *symbol = (unsigned short) (sequence[3] & 0x1F);
+            return end + 1;
+        }
+    }
+
+    *symbol = (unsigned char) sequence[0];
+
+    return sequence + 1;
+}
+
+// Walks the sequence from the keymap's root, adding the missing nodes
+static KeymapNode *bindSequence(Keymap *keymap, const char *sequence, unsigned short *last) {
+    int node = keymap->root;
+
+    if (sequence == NULL || *sequence == '\0') {
+        return NULL;
+    }
+
+    while (*sequence) {
+        unsigned short symbol;
+        sequence = parseSequenceKey(sequence, &symbol);
+
+        int child = findEdge(node, symbol);
+
+        if (child < 0) {
+            if ((Trie.edgeCount + 1) * 2 > Trie.edgeCapacity && growEdges()) {
+                return NULL;
+            }
+
+            child = addNode();
+            placeEdge((KeymapEdge) { node, symbol, child });
+            Trie.edgeCount++;
+            keymapNode(node)->children++;
+        }
+
+        node = child;
+        *last = symbol;
+    }
+
+    return keymapNode(node);
+}
+
+int bindCommand(Keymap *keymap, const char *sequence, KeymapHandler handler) {
+    unsigned short last;
+    KeymapNode *node = bindSequence(keymap, sequence, &last);
+
+    if (node == NULL) {
+        return 1;
+    }
+
+    node->kind = KEYMAP_COMMAND;
+    node->handler = handler;
+
+    return 0;
+}
+
+int bindMotion(Keymap *keymap, const char *sequence, KeymapMotion motion, int linewise) {
+    unsigned short last;
+    KeymapNode *node = bindSequence(keymap, sequence, &last);
+
+    if (node == NULL) {
+        return 1;
+    }
+
+    node->kind = KEYMAP_MOTION;
+    node->motion = motion;
+    node->linewise = linewise;
+
+    return 0;
+}
+
+int bindOperator(Keymap *keymap, const char *sequence, KeymapHandler handler) {
+    unsigned short last;
+    KeymapNode *node = bindSequence(keymap, sequence, &last);
+
+    if (node == NULL) {
+        return 1;
+    }
+
+    node->kind = KEYMAP_OPERATOR;
+    node->handler = handler;
+    node->symbol = last;
+
+    return 0;
+}
+
+void resetKeymapState(KeymapState *state) {
+    Keymap *keymap = state->keymap;
+
+    memset(state, 0, sizeof(*state));
+    state->keymap = keymap;
+    state->node = -1;
+}
+
+// Runs the binding the sequence ended on
+static enum KEYMAP_RESULTS runBinding(KeymapState *state, KeymapNode *node, KeyCode key) {
+    KeymapCall call = {
+        .count = state->hasCount ? state->count : 1,
+        .hasCount = state->hasCount,
+        .key = key,
+    };
+    KeymapHandler operator = state->operator;
+
+    switch (node->kind) {
+        case KEYMAP_COMMAND: {
+            KeymapHandler handler = node->handler;
+
+            resetKeymapState(state);
+            handler(&call);
+        } return KEYMAP_HANDLED;
+
+        case KEYMAP_OPERATOR: {
+            // Without a table for motions it cannot wait for one
+            if (state->keymap->operatorPending == NULL) {
+                resetKeymapState(state);
+                return KEYMAP_HANDLED;
+            }
+
+            size_t count = call.count;
+            int hasCount = call.hasCount;
+
+            resetKeymapState(state);
+            state->operator = node->handler;
+            state->operatorSymbol = node->symbol;
+            state->operatorCount = count;
+            state->operatorHasCount = hasCount;
+        } return KEYMAP_PENDING;
+
+        case KEYMAP_MOTION: {
+            call.motion = node->motion;
+            call.linewise = node->linewise;
+
+            // "2d3w" deletes 6 words
+            if (operator != NULL) {
+                call.count *= state->operatorCount;
+                call.hasCount |= state->operatorHasCount;
+            }
+
+            KeymapHandler move = state->keymap->move;
+
+            resetKeymapState(state);
+
+            if (operator != NULL) {
+                operator(&call);
+            } else if (move != NULL) {
+                move(&call);
+            }
+        } return KEYMAP_HANDLED;
+
+        default:
+            resetKeymapState(state);
+            return KEYMAP_HANDLED;
+    }
+}
+
+// One key of input for the table of the current mode. A binding that is a
+// prefix of longer ones waits for the next key: if that key goes nowhere,
+// the shorter binding runs and the key starts a new sequence.
+enum KEYMAP_RESULTS dispatchKey(KeymapState *state, Keymap *keymap, KeyCode key) {
+    if (state->keymap != keymap) {
+        state->keymap = keymap;
+        resetKeymapState(state);
+    }
+
+    Keymap *table = state->operator != NULL ? keymap->operatorPending : keymap;
+    unsigned short symbol = keymapSymbol(key);
+    int node = state->node;
+
+    if (node < 0) {
+        int digit = key.character >= '0' && key.character <= '9' && key.character == symbol;
+
+        // A leading 0 is a key of its own (start of line in normal mode)
+        if (keymap->counts && digit && (key.character != '0' || state->hasCount)) {
+            if (state->count < KEYMAP_MAX_COUNT) {
+                state->count = state->count * 10 + (key.character - '0');
+            }
+            state->hasCount = 1;
+
+            return KEYMAP_PENDING;
+        }
+
+        // "dd", "cc": the operator doubled works on lines
+        if (state->operator != NULL && symbol == state->operatorSymbol) {
+            KeymapHandler operator = state->operator;
+            KeymapCall call = {
+                .count = (state->hasCount ? state->count : 1) * state->operatorCount,
+                .hasCount = state->hasCount || state->operatorHasCount,
+                .key = key,
+                .motion = NULL,
+                .linewise = 1,
+            };
+
+            resetKeymapState(state);
+            operator(&call);
+
+            return KEYMAP_HANDLED;
+        }
+
+        node = table->root;
+    }
+
+    int child = findEdge(node, symbol);
+
+    if (child < 0) {
+        if (state->node >= 0 && keymapNode(state->node)->kind != KEYMAP_NONE) {
+            runBinding(state, keymapNode(state->node), key);
+            return dispatchKey(state, keymap, key);
+        }
+
+        int swallowed = state->node >= 0 || state->hasCount || state->operator != NULL;
+
+        // Typed in the middle of something, the whole thing is dropped like vim does
+        resetKeymapState(state);
+
+        return swallowed ? KEYMAP_HANDLED : KEYMAP_UNBOUND;
+    }
+
+    if (keymapNode(child)->children > 0) {
+        state->node = child;
+        return KEYMAP_PENDING;
+    }
+
+    return runBinding(state, keymapNode(child), key);
+}
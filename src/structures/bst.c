@@ -4,7 +4,7 @@
 #include "structures/bst.h"
 
 BinaryTreeNodeDirection find_node_for_insertion(BinaryTree *tree, BinaryTreeNode *currentNode, void *value);
-void free_node(BinaryTreeNode *node);
+void *take_node_value(BinaryTree *tree, BinaryTreeNode *node);
 
 BinaryTree *initialize_binary_tree(char *type, size_t type_size, short(*compare)(void *a, void *b)) {
     if (compare == NULL) {
@@ -27,6 +27,12 @@ BinaryTree *initialize_binary_tree(char *type, size_t type_size, short(*compare)
 
     tree->compare = compare;
     tree->type_size = type_size;
+    tree->pool = initialize_node_pool(NODE_POOL_ALIGN(sizeof(BinaryTreeNode)) + type_size);
+
+    if (tree->pool == NULL) {
+        free(tree);
+        return NULL;
+    }
 
     return tree;
 }
@@ -36,14 +42,16 @@ BinaryTreeNode *push_to_tree(BinaryTree *tree, void *value) {
         return NULL;
     }
 
-    BinaryTreeNode *node = calloc(1, sizeof(*node));
+    // Nodes come from the tree's pool, with the value stored right behind them
+    BinaryTreeNode *node = pool_alloc(tree->pool);
 
     if (node == NULL) {
         return NULL;
     }
 
+    memset(node, 0, sizeof(*node));
     tree->size++;
-    node->value = malloc(tree->type_size);
+    node->value = (char *) node + NODE_POOL_ALIGN(sizeof(BinaryTreeNode));
 
     memcpy(node->value, value, tree->type_size);
 
@@ -127,11 +135,7 @@ void *remove_by_value_binary_tree(BinaryTree *tree, void *value) {
             tree->root = NULL;
         }
 
-        void *temp = node->value;
-
-        free(node);
-
-        return temp;
+        return take_node_value(tree, node);
     }
     // case-3: it is a node with 2 children
     else if (node->left != NULL && node->right != NULL) {
@@ -143,9 +147,13 @@ void *remove_by_value_binary_tree(BinaryTree *tree, void *value) {
             min_node = min_node->left;
         }
 
-        void *temp = node->value;
+        void *temp = malloc(tree->type_size);
+
+        if (temp != NULL) {
+            memcpy(temp, node->value, tree->type_size);
+        }
 
-        node->value = min_node->value;
+        memcpy(node->value, min_node->value, tree->type_size);
 
         BinaryTreeNode *right_child = min_node->right;
 
@@ -159,7 +167,7 @@ void *remove_by_value_binary_tree(BinaryTree *tree, void *value) {
             right_child->parent = min_node->parent;
         }        
 
-        free(min_node);
+        pool_release(tree->pool, min_node);
 
         return temp;
     }  // case-2: It is a node with 1 child
@@ -182,12 +190,21 @@ void *remove_by_value_binary_tree(BinaryTree *tree, void *value) {
         }
 
 
-        void *temp = node->value;
+        return take_node_value(tree, node);
+    }
+}
 
-        free(node);
+// The value lives inside the pooled node, the caller owns (and frees) a copy
+void *take_node_value(BinaryTree *tree, BinaryTreeNode *node) {
+    void *value = malloc(tree->type_size);
 
-        return temp;
+    if (value != NULL) {
+        memcpy(value, node->value, tree->type_size);
     }
+
+    pool_release(tree->pool, node);
+
+    return value;
 }
 
 void right_rotate_subtree_tree(BinaryTree *tree, BinaryTreeNode *x) {
@@ -286,17 +303,7 @@ void free_tree(BinaryTree *tree) {
         return;
     }
 
-    free_node(tree->root);
+    // Dropping the pool's slabs frees every node at once
+    free_node_pool(tree->pool);
     free(tree);
 }
-
-void free_node(BinaryTreeNode *node) {
-    if (node == NULL) {
-        return;
-    }
-
-    free_node(node->left);
-    free_node(node->right);
-    free(node->value);
-    free(node);
-}
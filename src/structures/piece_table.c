@@ -0,0 +1,1238 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "structures/piece_table.h"
+#include "text/newline_scan.h"
+
+#define PIECE_TABLE_ADDED_BASE_SIZE 4096
+// No state the history can reach back to was saved
+#define PIECE_TABLE_NEVER_SAVED ((size_t) -1)
+
+void measure_piece(void *value, RedBlackTreeAggregate *aggregate);
+int append_to_piece_buffer(PieceBuffer *buffer, const char *text, size_t length);
+int index_piece_buffer(PieceBuffer *buffer);
+int chunk_piece_buffer(PieceBuffer *buffer);
+size_t count_line_starts_until(Vector *lineStarts, size_t offset);
+size_t count_buffer_newlines(PieceBuffer *buffer, size_t start, size_t end);
+size_t find_buffer_line_start(PieceBuffer *buffer, size_t start, size_t newline);
+int load_piece_table_chunk(PieceTableIterator *iterator, size_t head);
+void set_piece_span(PieceTable *table, Piece *piece, size_t start, size_t length);
+int split_piece_at(PieceTable *table, size_t offset);
+void push_piece(PieceTable *table, Vector *pieces, unsigned int buffer, size_t start, size_t length);
+size_t redblack_tree_length(RedBlackTree *tree);
+void record_piece_table_change(PieceTable *table, size_t offset, size_t length, RedBlackTree *removed);
+void free_piece_table_history(PieceTableHistory *history);
+void notify_piece_table_change(PieceTable *table, size_t offset, size_t removed, size_t length);
+
+static PieceTable *create_piece_table(const char *original, size_t length, int lazy) {
+    PieceTable *table = calloc(1, sizeof(*table));
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->pieces = initialize_measured_redblack_tree("struct", sizeof(Piece), measure_piece);
+    table->buffers = initialize_vector("PieceBuffer", sizeof(PieceBuffer));
+
+    PieceBuffer originalBuffer = { .base = (char *) original, .len = length, .size = 0 };
+    PieceBuffer addedBuffer = { .base = malloc(PIECE_TABLE_ADDED_BASE_SIZE), .len = 0, .size = PIECE_TABLE_ADDED_BASE_SIZE };
+
+    if (table->pieces == NULL || addedBuffer.base == NULL ||
+        (lazy ? chunk_piece_buffer(&originalBuffer) : index_piece_buffer(&originalBuffer)) ||
+        index_piece_buffer(&addedBuffer)) {
+        free(addedBuffer.base);
+        free(originalBuffer.chunks);
+        free_vector(originalBuffer.lineStartsOffsets);
+        free_vector(addedBuffer.lineStartsOffsets);
+        free_redblack_tree(table->pieces);
+        free_vector(table->buffers);
+        free(table);
+
+        return NULL;
+    }
+
+    vec_push_back(table->buffers, &originalBuffer);
+    vec_push_back(table->buffers, &addedBuffer);
+
+    // A piece per chunk: each is counted on its own, as soon as its chunk is
+    for (size_t start = 0, step = lazy ? PIECE_BUFFER_CHUNK_SIZE : length; start < length; start += step) {
+        Piece piece = { .buffer = PIECE_BUFFER_ORIGINAL };
+
+        set_piece_span(table, &piece, start, length - start < step ? length - start : step);
+        insert_redblack_node_before(table->pieces, NULL, &piece);
+    }
+
+    return table;
+}
+
+// original is only referenced, never copied nor written to, it has to
+// outlive the table (e.g. a memory mapped file).
+PieceTable *initialize_piece_table(const char *original, size_t length) {
+    return create_piece_table(original, length, 0);
+}
+
+// The same, without reading original: the table is ready at once whatever
+// its size, and a chunk is only read when something looks into it (what is
+// on screen, an edit) or its newlines are given by piece_table_set_chunk_newlines.
+// Line lookups count the chunks in front of what they look for that are
+// still pending.
+PieceTable *initialize_lazy_piece_table(const char *original, size_t length) {
+    return create_piece_table(original, length, 1);
+}
+
+void measure_piece(void *value, RedBlackTreeAggregate *aggregate) {
+    aggregate->length = ((Piece *) value)->length;
+    aggregate->newlines = ((Piece *) value)->newlines;
+    aggregate->pending = ((Piece *) value)->pending;
+}
+
+// A whole chunk of a lazily indexed buffer, that nobody counted yet
+static int is_uncounted_chunk(PieceBuffer *buffer, size_t start, size_t length) {
+    return buffer->chunks != NULL && start % PIECE_BUFFER_CHUNK_SIZE == 0 &&
+           (length == PIECE_BUFFER_CHUNK_SIZE || (length > 0 && start + length == buffer->len)) &&
+           buffer->chunks[start / PIECE_BUFFER_CHUNK_SIZE].newlines == PIECE_BUFFER_UNCOUNTED;
+}
+
+void set_piece_span(PieceTable *table, Piece *piece, size_t start, size_t length) {
+    piece->start = start;
+    piece->length = length;
+    piece->pending = (unsigned int) is_uncounted_chunk(piece_table_buffer(table, piece->buffer), start, length);
+    piece->newlines = piece->pending ? 0 : piece_table_count_newlines(table, piece);
+}
+
+// Builds the line starts of everything already in the buffer
+int index_piece_buffer(PieceBuffer *buffer) {
+    size_t first = 0;
+
+    buffer->lineStartsOffsets = initialize_vector("size_t", sizeof(size_t));
+
+    if (buffer->lineStartsOffsets == NULL) {
+        return 1;
+    }
+
+    vec_push_back(buffer->lineStartsOffsets, &first);
+    scan_line_starts(buffer->base, buffer->len, 0, buffer->lineStartsOffsets);
+
+    return 0;
+}
+
+// Nothing is read yet, every chunk starts uncounted
+int chunk_piece_buffer(PieceBuffer *buffer) {
+    size_t count = (buffer->len + PIECE_BUFFER_CHUNK_SIZE - 1) / PIECE_BUFFER_CHUNK_SIZE;
+
+    buffer->chunks = malloc((count > 0 ? count : 1) * sizeof(*buffer->chunks));
+
+    if (buffer->chunks == NULL) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        buffer->chunks[i] = (PieceBufferChunk) { PIECE_BUFFER_UNCOUNTED, NULL };
+    }
+
+    return 0;
+}
+
+static size_t chunk_length(PieceBuffer *buffer, size_t chunk) {
+    size_t start = chunk * PIECE_BUFFER_CHUNK_SIZE;
+
+    return buffer->len - start < PIECE_BUFFER_CHUNK_SIZE ? buffer->len - start : PIECE_BUFFER_CHUNK_SIZE;
+}
+
+static size_t chunk_newlines(PieceBuffer *buffer, size_t chunk) {
+    PieceBufferChunk *at = &buffer->chunks[chunk];
+
+    if (at->newlines == PIECE_BUFFER_UNCOUNTED) {
+        at->newlines = count_newlines(buffer->base + chunk * PIECE_BUFFER_CHUNK_SIZE, chunk_length(buffer, chunk));
+    }
+
+    return at->newlines;
+}
+
+static Vector *chunk_line_starts(PieceBuffer *buffer, size_t chunk) {
+    PieceBufferChunk *at = &buffer->chunks[chunk];
+
+    if (at->lineStarts == NULL) {
+        size_t start = chunk * PIECE_BUFFER_CHUNK_SIZE;
+
+        at->lineStarts = initialize_vector("size_t", sizeof(size_t));
+        assert(at->lineStarts != NULL && "COULD NOT INDEX THE CHUNK");
+        at->newlines = scan_line_starts(buffer->base + start, chunk_length(buffer, chunk), start, at->lineStarts);
+    }
+
+    return at->lineStarts;
+}
+
+// How many of the line starts are at or before offset
+size_t count_line_starts_until(Vector *lineStarts, size_t offset) {
+    const size_t *starts = lineStarts->base;
+    size_t low = 0;
+    size_t high = lineStarts->len;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (starts[mid] <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// Newlines in [start, end) of the buffer. Chunks wholly inside are only
+// counted, the ones cut by either end have their line starts scanned.
+size_t count_buffer_newlines(PieceBuffer *buffer, size_t start, size_t end) {
+    if (buffer->chunks == NULL) {
+        return count_line_starts_until(buffer->lineStartsOffsets, end) -
+               count_line_starts_until(buffer->lineStartsOffsets, start);
+    }
+
+    size_t newlines = 0;
+
+    while (start < end) {
+        size_t chunk = start / PIECE_BUFFER_CHUNK_SIZE;
+        size_t chunkStart = chunk * PIECE_BUFFER_CHUNK_SIZE;
+        size_t chunkEnd = chunkStart + chunk_length(buffer, chunk);
+        size_t stop = end < chunkEnd ? end : chunkEnd;
+
+        if (start == chunkStart && stop == chunkEnd) {
+            newlines += chunk_newlines(buffer, chunk);
+        } else {
+            Vector *lineStarts = chunk_line_starts(buffer, chunk);
+
+            newlines += count_line_starts_until(lineStarts, stop) - count_line_starts_until(lineStarts, start);
+        }
+
+        start = stop;
+    }
+
+    return newlines;
+}
+
+// Offset right after the newline-th (counting from 1) '\n' at or after
+// start, which has to be in the buffer
+size_t find_buffer_line_start(PieceBuffer *buffer, size_t start, size_t newline) {
+    if (buffer->chunks == NULL) {
+        size_t first = count_line_starts_until(buffer->lineStartsOffsets, start);
+
+        return ((size_t *) buffer->lineStartsOffsets->base)[first + newline - 1];
+    }
+
+    // Only the chunk holding it is scanned, the ones before are counted
+    for (;;) {
+        size_t chunk = start / PIECE_BUFFER_CHUNK_SIZE;
+        size_t chunkEnd = chunk * PIECE_BUFFER_CHUNK_SIZE + chunk_length(buffer, chunk);
+        size_t here = count_buffer_newlines(buffer, start, chunkEnd);
+
+        if (newline <= here) {
+            Vector *lineStarts = chunk_line_starts(buffer, chunk);
+
+            return ((size_t *) lineStarts->base)[count_line_starts_until(lineStarts, start) + newline - 1];
+        }
+
+        newline -= here;
+        start = chunkEnd;
+    }
+}
+
+// Number of '\n' bytes inside the piece, found from its buffer's line starts
+size_t piece_table_count_newlines(PieceTable *table, Piece *piece) {
+    return count_buffer_newlines(piece_table_buffer(table, piece->buffer), piece->start, piece->start + piece->length);
+}
+
+// Settles the pending pieces under node whose chunk got counted since
+static void settle_counted_pieces(PieceTable *table, RedBlackTreeNode *node) {
+    if (node == NULL || node->aggregate.pending == 0) {
+        return;
+    }
+
+    settle_counted_pieces(table, node->left);
+
+    Piece *piece = node->value;
+
+    if (piece->pending) {
+        set_piece_span(table, piece, piece->start, piece->length);
+
+        if (!piece->pending) {
+            update_redblack_node_aggregates(table->pieces, node);
+        }
+    }
+
+    settle_counted_pieces(table, node->right);
+}
+
+void piece_table_set_chunk_newlines(PieceTable *table, size_t first, const size_t *newlines, size_t count) {
+    PieceBuffer *original = piece_table_buffer(table, PIECE_BUFFER_ORIGINAL);
+
+    if (original->chunks == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (original->chunks[first + i].newlines == PIECE_BUFFER_UNCOUNTED) {
+            original->chunks[first + i].newlines = newlines[i];
+        }
+    }
+
+    settle_counted_pieces(table, table->pieces->root);
+}
+
+// Pieces of the document still waiting for their chunk to be counted
+size_t piece_table_pending(PieceTable *table) {
+    return table->pieces->root != NULL ? table->pieces->root->aggregate.pending : 0;
+}
+
+// Counts the chunk of a pending piece right away, for a lookup past it
+static void count_pending_piece(PieceTable *table, RedBlackTreeNode *node) {
+    Piece *piece = node->value;
+    PieceBuffer *buffer = piece_table_buffer(table, piece->buffer);
+
+    chunk_newlines(buffer, piece->start / PIECE_BUFFER_CHUNK_SIZE);
+    set_piece_span(table, piece, piece->start, piece->length);
+    update_redblack_node_aggregates(table->pieces, node);
+}
+
+PieceBuffer *piece_table_buffer(PieceTable *table, unsigned int buffer) {
+    assert(buffer < table->buffers->len && "THIS PIECE BUFFER DOES NOT EXIST");
+
+    return (PieceBuffer *) table->buffers->base + buffer;
+}
+
+int append_to_piece_buffer(PieceBuffer *buffer, const char *text, size_t length) {
+    if (buffer->len + length > buffer->size) {
+        size_t size = buffer->size;
+
+        while (buffer->len + length > size) {
+            size *= 2;
+        }
+
+        char *base = realloc(buffer->base, size);
+
+        if (base == NULL) {
+            return 1;
+        }
+
+        buffer->base = base;
+        buffer->size = size;
+    }
+
+    memcpy(buffer->base + buffer->len, text, length);
+    scan_line_starts(buffer->base + buffer->len, length, buffer->len, buffer->lineStartsOffsets);
+    buffer->len += length;
+
+    return 0;
+}
+
+// Another buffer the table only references, indexed as a whole. Its index
+// goes to *buffer.
+int piece_table_add_buffer(PieceTable *table, const char *base, size_t length, unsigned int *buffer) {
+    PieceBuffer added = { .base = (char *) base, .len = length, .size = 0 };
+
+    if (table == NULL || index_piece_buffer(&added)) {
+        return 1;
+    }
+
+    *buffer = (unsigned int) table->buffers->len;
+    vec_push_back(table->buffers, &added);
+
+    return 0;
+}
+
+// A referenced buffer grew: base holds what it did and more after that (a
+// longer mapping of the same file). Only the new bytes are indexed.
+int piece_table_grow_buffer(PieceTable *table, unsigned int buffer, const char *base, size_t length) {
+    PieceBuffer *grown = piece_table_buffer(table, buffer);
+
+    if (grown->size != 0 || grown->chunks != NULL || length < grown->len) {
+        return 1;
+    }
+
+    if (length > grown->len) {
+        scan_line_starts(base + grown->len, length - grown->len, grown->len, grown->lineStartsOffsets);
+    }
+
+    grown->base = (char *) base;
+    grown->len = length;
+
+    return 0;
+}
+
+// The memory a referenced buffer points into is about to go (a mapping of a
+// file that gets replaced): the table copies the bytes and owns them from here
+int piece_table_own_buffer(PieceTable *table, unsigned int buffer) {
+    PieceBuffer *owned = piece_table_buffer(table, buffer);
+
+    if (owned->size != 0 || owned->len == 0) {
+        return 0;
+    }
+
+    char *base = malloc(owned->len);
+
+    if (base == NULL) {
+        return 1;
+    }
+
+    memcpy(base, owned->base, owned->len);
+    owned->base = base;
+    owned->size = owned->len;
+
+    return 0;
+}
+
+size_t piece_table_length(PieceTable *table) {
+    if (table == NULL || table->pieces->root == NULL) {
+        return 0;
+    }
+
+    return table->pieces->root->aggregate.length;
+}
+
+int piece_table_insert(PieceTable *table, size_t offset, const char *text, size_t length) {
+    if (table == NULL || text == NULL) {
+        return 1;
+    }
+
+    size_t total = piece_table_length(table);
+
+    if (offset > total) {
+        return 1; // can't insert after the end of the document
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    PieceBuffer *added = piece_table_buffer(table, PIECE_BUFFER_ADDED);
+    size_t start = added->len;
+
+    if (append_to_piece_buffer(added, text, length)) {
+        return 1;
+    }
+
+    if (table->last_insert != NULL && table->last_insert_end == offset) {
+        Piece *last = table->last_insert->value;
+
+        if (last->buffer == PIECE_BUFFER_ADDED && last->start + last->length == start) {
+            set_piece_span(table, last, last->start, last->length + length);
+            update_redblack_node_aggregates(table->pieces, table->last_insert);
+            table->last_insert_end += length;
+            record_piece_table_change(table, offset, length, NULL);
+            notify_piece_table_change(table, offset, 0, length);
+
+            return 0;
+        }
+    }
+
+    Piece piece = { .buffer = PIECE_BUFFER_ADDED };
+    RedBlackTreeNode *node = NULL;
+
+    set_piece_span(table, &piece, start, length);
+
+    if (offset == total) {
+        node = insert_redblack_node_before(table->pieces, NULL, &piece);
+    } else {
+        RedBlackTreeAggregate before;
+        RedBlackTreeNode *at = find_redblack_node_by_offset(table->pieces, offset, &before);
+
+        if (at == NULL) {
+            return 1;
+        }
+
+        size_t nodeOffset = before.length;
+
+        if (offset == nodeOffset) {
+            node = insert_redblack_node_before(table->pieces, at, &piece);
+        } else {
+            // Inserting inside a piece: it keeps its head, the tail moves after the new text
+            Piece *existing = at->value;
+            size_t head = offset - nodeOffset;
+            Piece tail = { .buffer = existing->buffer };
+
+            set_piece_span(table, &tail, existing->start + head, existing->length - head);
+            set_piece_span(table, existing, existing->start, head);
+            update_redblack_node_aggregates(table->pieces, at);
+
+            node = insert_redblack_node_after(table->pieces, at, &piece);
+
+            if (node == NULL || insert_redblack_node_after(table->pieces, node, &tail) == NULL) {
+                return 1;
+            }
+        }
+    }
+
+    if (node == NULL) {
+        return 1;
+    }
+
+    table->last_insert = node;
+    table->last_insert_end = offset + length;
+    record_piece_table_change(table, offset, length, NULL);
+    notify_piece_table_change(table, offset, 0, length);
+
+    return 0;
+}
+
+// The document gets [start, start + length) of buffer at its end, the last
+// piece grows when the span carries on from it. Text coming in from the file
+// (it grew) and not an edit: neither the history nor the observer hears of
+// it, whoever follows the changes is told by the caller.
+int piece_table_append(PieceTable *table, unsigned int buffer, size_t start, size_t length) {
+    if (table == NULL || buffer >= table->buffers->len || start + length > piece_table_buffer(table, buffer)->len) {
+        return 1;
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    RedBlackTreeIterator pieces;
+
+    redblack_iterator_last(&pieces, table->pieces);
+
+    Piece *last = pieces.node != NULL ? pieces.node->value : NULL;
+
+    if (last != NULL && last->buffer == buffer && last->start + last->length == start && !last->pending) {
+        set_piece_span(table, last, last->start, last->length + length);
+        update_redblack_node_aggregates(table->pieces, pieces.node);
+    } else {
+        Piece piece = { .buffer = buffer };
+
+        set_piece_span(table, &piece, start, length);
+
+        if (insert_redblack_node_before(table->pieces, NULL, &piece) == NULL) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Makes offset fall on a piece boundary, splitting the piece covering it
+int split_piece_at(PieceTable *table, size_t offset) {
+    RedBlackTreeAggregate before;
+    RedBlackTreeNode *node = find_redblack_node_by_offset(table->pieces, offset, &before);
+
+    if (node == NULL || before.length == offset) {
+        return 0;
+    }
+
+    Piece *piece = node->value;
+    size_t head = offset - before.length;
+    Piece tail = { .buffer = piece->buffer };
+
+    set_piece_span(table, &tail, piece->start + head, piece->length - head);
+    set_piece_span(table, piece, piece->start, head);
+    update_redblack_node_aggregates(table->pieces, node);
+
+    return insert_redblack_node_after(table->pieces, node, &tail) == NULL;
+}
+
+// Takes the pieces covering [offset, offset + length) out of the document in
+// O(log n), whatever the number of pieces. The returned tree can be pasted
+// back (into this table only, it points into its buffers) or freed.
+RedBlackTree *piece_table_cut(PieceTable *table, size_t offset, size_t length) {
+    if (table == NULL) {
+        return NULL;
+    }
+
+    size_t total = piece_table_length(table);
+
+    if (offset > total) {
+        return NULL;
+    }
+
+    if (length > total - offset) {
+        length = total - offset;
+    }
+
+    // Cutting moves the text after the range, so the piece is no longer at its end
+    table->last_insert = NULL;
+
+    if (split_piece_at(table, offset) || split_piece_at(table, offset + length)) {
+        return NULL;
+    }
+
+    RedBlackTree *cut = split_redblack_tree_at_offset(table->pieces, offset);
+
+    if (cut == NULL) {
+        return NULL;
+    }
+
+    RedBlackTree *after = split_redblack_tree_at_offset(cut, length);
+
+    if (after == NULL) {
+        join_redblack_trees(table->pieces, cut);
+        return NULL;
+    }
+
+    join_redblack_trees(table->pieces, after);
+
+    return cut;
+}
+
+// Puts the pieces of a cut back in at offset, consuming the tree
+int piece_table_paste(PieceTable *table, size_t offset, RedBlackTree *pieces) {
+    if (table == NULL || pieces == NULL || offset > piece_table_length(table)) {
+        return 1;
+    }
+
+    table->last_insert = NULL;
+
+    if (split_piece_at(table, offset)) {
+        return 1;
+    }
+
+    RedBlackTree *after = split_redblack_tree_at_offset(table->pieces, offset);
+
+    if (after == NULL) {
+        return 1;
+    }
+
+    join_redblack_trees(table->pieces, pieces);
+    join_redblack_trees(table->pieces, after);
+
+    return 0;
+}
+
+int piece_table_delete(PieceTable *table, size_t offset, size_t length) {
+    if (table == NULL || offset > piece_table_length(table)) {
+        return 1;
+    }
+
+    RedBlackTree *cut = piece_table_cut(table, offset, length);
+
+    if (cut == NULL) {
+        return 1;
+    }
+
+    record_piece_table_change(table, offset, 0, cut);
+    notify_piece_table_change(table, offset, length, 0);
+
+    return 0;
+}
+
+// Adds a piece at the end of pieces, growing the last one when it goes on
+// right where that one stops in the same buffer
+void push_piece(PieceTable *table, Vector *pieces, unsigned int buffer, size_t start, size_t length) {
+    Piece *last = pieces->len > 0 ? (Piece *) pieces->base + pieces->len - 1 : NULL;
+
+    if (length == 0) {
+        return;
+    }
+
+    // Chunks nobody counted are kept apart, growing one would count it
+    if (last != NULL && last->buffer == buffer && last->start + last->length == start && !last->pending &&
+        !is_uncounted_chunk(piece_table_buffer(table, buffer), start, length)) {
+        set_piece_span(table, last, last->start, last->length + length);
+        return;
+    }
+
+    Piece piece = { .buffer = buffer };
+
+    set_piece_span(table, &piece, start, length);
+    vec_push_back(pieces, &piece);
+}
+
+// Many edits as one: the span from the first edit to the end of the last is
+// cut out, its pieces are rebuilt around the edits and the balanced tree of
+// the result pasted back. O(log n + pieces in the span + edits), however many
+// edits there are. Edits must be sorted by offset and must not overlap.
+int piece_table_replace(PieceTable *table, const PieceTableEdit *edits, size_t count) {
+    if (table == NULL || (count > 0 && edits == NULL)) {
+        return 1;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t total = piece_table_length(table);
+
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].offset > total || edits[i].length > total - edits[i].offset ||
+            (i > 0 && edits[i].offset < edits[i - 1].offset + edits[i - 1].length) ||
+            (edits[i].textLength > 0 && edits[i].text == NULL &&
+             (edits[i].buffer >= table->buffers->len ||
+              edits[i].start + edits[i].textLength > piece_table_buffer(table, edits[i].buffer)->len))) {
+            return 1;
+        }
+    }
+
+    // The new text first, nothing is changed when there is no room for it
+    PieceBuffer *added = piece_table_buffer(table, PIECE_BUFFER_ADDED);
+    size_t addedStart = added->len;
+
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].text != NULL && append_to_piece_buffer(added, edits[i].text, edits[i].textLength)) {
+            return 1;
+        }
+    }
+
+    size_t spanStart = edits[0].offset;
+    RedBlackTree *span = piece_table_cut(table, spanStart, edits[count - 1].offset + edits[count - 1].length - spanStart);
+
+    if (span == NULL) {
+        return 1;
+    }
+
+    Vector *pieces = initialize_vector("struct", sizeof(Piece));
+    RedBlackTreeIterator old;
+    size_t position = spanStart; // document offset reached in the old pieces
+    size_t head = 0; // bytes of the current old piece already handled
+    size_t textStart = addedStart;
+
+    redblack_iterator_first(&old, span);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t keepUntil = edits[i].offset;
+        size_t skipUntil = edits[i].offset + edits[i].length;
+
+        // Old text up to the edit is kept, then the bytes it replaces dropped.
+        // The span ends with the last edit, nothing is left after it.
+        while (old.node != NULL && position < skipUntil) {
+            Piece *piece = old.node->value;
+            size_t limit = position < keepUntil ? keepUntil : skipUntil;
+            size_t take = piece->length - head < limit - position ? piece->length - head : limit - position;
+
+            if (position < keepUntil) {
+                push_piece(table, pieces, piece->buffer, piece->start + head, take);
+            }
+
+            position += take;
+            head += take;
+
+            if (head == piece->length) {
+                redblack_iterator_next(&old);
+                head = 0;
+            }
+        }
+
+        if (edits[i].text == NULL) {
+            push_piece(table, pieces, edits[i].buffer, edits[i].start, edits[i].textLength);
+        } else {
+            push_piece(table, pieces, PIECE_BUFFER_ADDED, textStart, edits[i].textLength);
+            textStart += edits[i].textLength;
+        }
+    }
+
+    // The span tree is emptied and filled again, keeping its node pool so it
+    // can be pasted back. The old pieces are what the history keeps.
+    RedBlackTree *emptied = split_redblack_tree_at_offset(span, 0);
+    int failed = emptied == NULL || fill_redblack_tree_from_sorted(span, pieces);
+    size_t spanLength = failed ? 0 : redblack_tree_length(span);
+
+    failed = failed || piece_table_paste(table, spanStart, span);
+
+    if (failed) {
+        free_redblack_tree(emptied);
+    } else {
+        record_piece_table_change(table, spanStart, spanLength, emptied);
+
+        // Edit by edit, each at its offset once the ones before it are made.
+        // shifted wraps below zero, the sums come out right all the same.
+        for (size_t i = 0, shifted = 0; i < count; i++) {
+            notify_piece_table_change(table, edits[i].offset + shifted, edits[i].length, edits[i].textLength);
+            shifted += edits[i].textLength - edits[i].length;
+        }
+    }
+
+    free_vector(pieces);
+
+    return failed;
+}
+
+// ---------------------------------------------------------
+// History
+// ---------------------------------------------------------
+
+// The change left length bytes at offset where removed's pieces were. Undoing
+// it swaps the two back, which turns it into the change redo makes.
+typedef struct {
+    size_t offset;
+    size_t length;
+    RedBlackTree *removed; // NULL when nothing was taken out
+} PieceTableChange;
+
+// Changes keep the pieces they took out, not copies of the text: an undo or
+// a redo is a cut and a paste per change, O(log n) each, however much text
+// the change covers.
+struct PieceTableHistory {
+    Vector *changes; // PieceTableChange, oldest first
+    Vector *transactions; // size_t, index of the first change of each
+    size_t applied; // transactions in effect, those after them were undone
+    int open; // the last transaction still takes changes
+    size_t saved; // what applied was when the text was saved, PIECE_TABLE_NEVER_SAVED when gone
+};
+
+void notify_piece_table_change(PieceTable *table, size_t offset, size_t removed, size_t length) {
+    if (table->observer != NULL && (removed > 0 || length > 0)) {
+        table->observer(table->observer_data, offset, removed, length);
+    }
+}
+
+size_t redblack_tree_length(RedBlackTree *tree) {
+    return tree != NULL && tree->root != NULL ? tree->root->aggregate.length : 0;
+}
+
+int piece_table_enable_history(PieceTable *table) {
+    if (table == NULL) {
+        return 1;
+    }
+
+    if (table->history != NULL) {
+        return 0;
+    }
+
+    PieceTableHistory *history = calloc(1, sizeof(*history));
+
+    if (history == NULL) {
+        return 1;
+    }
+
+    history->changes = initialize_vector("struct", sizeof(PieceTableChange));
+    history->transactions = initialize_vector("struct", sizeof(size_t));
+
+    if (history->changes == NULL || history->transactions == NULL) {
+        free_piece_table_history(history);
+        return 1;
+    }
+
+    table->history = history;
+
+    return 0;
+}
+
+// Frees the changes from first on
+static void drop_piece_table_changes(PieceTableHistory *history, size_t first) {
+    for (size_t i = first; i < history->changes->len; i++) {
+        free_redblack_tree(((PieceTableChange *) history->changes->base)[i].removed);
+    }
+
+    history->changes->len = first < history->changes->len ? first : history->changes->len;
+}
+
+void free_piece_table_history(PieceTableHistory *history) {
+    if (history == NULL) {
+        return;
+    }
+
+    if (history->changes != NULL) {
+        drop_piece_table_changes(history, 0);
+    }
+
+    free_vector(history->changes);
+    free_vector(history->transactions);
+    free(history);
+}
+
+// The document becomes empty without reading any of it, for when its text
+// is gone from under it (a mapped file got shorter). The history goes as
+// well, nothing could be undone onto text that is gone; the buffers stay.
+int piece_table_clear(PieceTable *table) {
+    RedBlackTree *pieces = initialize_measured_redblack_tree("struct", sizeof(Piece), measure_piece);
+
+    if (table == NULL || pieces == NULL) {
+        free_redblack_tree(pieces);
+        return 1;
+    }
+
+    free_redblack_tree(table->pieces);
+    table->pieces = pieces;
+    table->last_insert = NULL;
+    table->last_insert_end = 0;
+
+    if (table->history != NULL) {
+        drop_piece_table_changes(table->history, 0);
+        vec_clear(table->history->transactions);
+        table->history->applied = 0;
+        table->history->open = 0;
+        table->history->saved = PIECE_TABLE_NEVER_SAVED;
+    }
+
+    return 0;
+}
+
+// Folds a change into the last one when it goes on from it, so typing a
+// line or holding backspace is one change. Returns 1 when it did.
+static int merge_piece_table_change(PieceTableChange *last, size_t offset, size_t length, RedBlackTree *removed) {
+    size_t removedLength = redblack_tree_length(removed);
+
+    // Typing on where the last change ended
+    if (removed == NULL && offset == last->offset + last->length) {
+        last->length += length;
+        return 1;
+    }
+
+    if (length > 0) {
+        return 0;
+    }
+
+    // Deleting text the last change put in: it was not there before either
+    if (offset >= last->offset && offset + removedLength <= last->offset + last->length) {
+        last->length -= removedLength;
+        free_redblack_tree(removed);
+        return 1;
+    }
+
+    // Deleting right before ("<BS>") or right after ("x") what it deleted
+    if (last->length == 0 && (offset + removedLength == last->offset || offset == last->offset)) {
+        if (last->removed == NULL) {
+            last->removed = removed;
+        } else if (offset == last->offset) {
+            join_redblack_trees(last->removed, removed);
+        } else {
+            join_redblack_trees(removed, last->removed);
+            last->removed = removed;
+        }
+
+        last->offset = offset;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Adds a change to the open transaction, opening one when none is. The
+// history owns removed from then on, without a history it is freed.
+void record_piece_table_change(PieceTable *table, size_t offset, size_t length, RedBlackTree *removed) {
+    PieceTableHistory *history = table->history;
+
+    if (removed != NULL && removed->root == NULL) {
+        free_redblack_tree(removed);
+        removed = NULL;
+    }
+
+    if (history == NULL || (length == 0 && removed == NULL)) {
+        free_redblack_tree(removed);
+        return;
+    }
+
+    // A new change ends what could be redone, the saved state with it when it was there
+    if (history->applied < history->transactions->len) {
+        drop_piece_table_changes(history, ((size_t *) history->transactions->base)[history->applied]);
+        history->transactions->len = history->applied;
+        history->open = 0;
+
+        if (history->saved != PIECE_TABLE_NEVER_SAVED && history->saved > history->applied) {
+            history->saved = PIECE_TABLE_NEVER_SAVED;
+        }
+    }
+
+    if (history->open) {
+        PieceTableChange *last = (PieceTableChange *) history->changes->base + history->changes->len - 1;
+
+        if (merge_piece_table_change(last, offset, length, removed)) {
+            return;
+        }
+    } else {
+        size_t first = history->changes->len;
+
+        vec_push_back(history->transactions, &first);
+        history->applied++;
+        history->open = 1;
+    }
+
+    PieceTableChange change = { offset, length, removed };
+
+    vec_push_back(history->changes, &change);
+}
+
+void piece_table_commit(PieceTable *table) {
+    if (table != NULL && table->history != NULL) {
+        table->history->open = 0;
+    }
+}
+
+// Takes out what the change put in and puts back what it took out
+static int swap_piece_table_change(PieceTable *table, PieceTableChange *change) {
+    size_t removedLength = redblack_tree_length(change->removed);
+    RedBlackTree *inserted = piece_table_cut(table, change->offset, change->length);
+
+    if (inserted == NULL) {
+        return 1;
+    }
+
+    if (change->removed != NULL && piece_table_paste(table, change->offset, change->removed)) {
+        piece_table_paste(table, change->offset, inserted);
+        return 1;
+    }
+
+    if (inserted->root == NULL) {
+        free_redblack_tree(inserted);
+        inserted = NULL;
+    }
+
+    notify_piece_table_change(table, change->offset, change->length, removedLength);
+    change->removed = inserted;
+    change->length = removedLength;
+
+    return 0;
+}
+
+// Changes [first, end) of the transaction
+static void piece_table_transaction(PieceTableHistory *history, size_t transaction, size_t *first, size_t *end) {
+    size_t *starts = (size_t *) history->transactions->base;
+
+    *first = starts[transaction];
+    *end = transaction + 1 < history->transactions->len ? starts[transaction + 1] : history->changes->len;
+}
+
+int piece_table_undo(PieceTable *table, size_t *offset) {
+    PieceTableHistory *history = table != NULL ? table->history : NULL;
+    size_t first, end;
+
+    if (history == NULL || history->applied == 0) {
+        return 1;
+    }
+
+    history->open = 0;
+    piece_table_transaction(history, history->applied - 1, &first, &end);
+    *offset = piece_table_length(table);
+
+    // Last change first, each one's offset is right for the document it left
+    for (size_t i = end; i-- > first;) {
+        PieceTableChange *change = (PieceTableChange *) history->changes->base + i;
+
+        if (swap_piece_table_change(table, change)) {
+            return 1;
+        }
+
+        *offset = change->offset < *offset ? change->offset : *offset;
+    }
+
+    history->applied--;
+
+    return 0;
+}
+
+int piece_table_redo(PieceTable *table, size_t *offset) {
+    PieceTableHistory *history = table != NULL ? table->history : NULL;
+    size_t first, end;
+
+    if (history == NULL || history->applied == history->transactions->len) {
+        return 1;
+    }
+
+    history->open = 0;
+    piece_table_transaction(history, history->applied, &first, &end);
+    *offset = piece_table_length(table);
+
+    for (size_t i = first; i < end; i++) {
+        PieceTableChange *change = (PieceTableChange *) history->changes->base + i;
+
+        if (swap_piece_table_change(table, change)) {
+            return 1;
+        }
+
+        *offset = change->offset < *offset ? change->offset : *offset;
+    }
+
+    history->applied++;
+
+    return 0;
+}
+
+// The open transaction is closed: what is typed next is a change from the saved text
+void piece_table_mark_saved(PieceTable *table) {
+    if (table != NULL && table->history != NULL) {
+        table->history->open = 0;
+        table->history->saved = table->history->applied;
+    }
+}
+
+int piece_table_modified(PieceTable *table) {
+    return table != NULL && table->history != NULL && table->history->applied != table->history->saved;
+}
+
+// Points text at the contiguous bytes starting at offset, without copying.
+// Returns how many bytes are readable there, 0 past the end of the document.
+size_t piece_table_chunk_at(PieceTable *table, size_t offset, const char **text) {
+    if (table == NULL) {
+        return 0;
+    }
+
+    RedBlackTreeAggregate before;
+    RedBlackTreeNode *node = find_redblack_node_by_offset(table->pieces, offset, &before);
+
+    if (node == NULL) {
+        return 0;
+    }
+
+    Piece *piece = node->value;
+    size_t head = offset - before.length;
+
+    *text = piece_table_buffer(table, piece->buffer)->base + piece->start + head;
+
+    return piece->length - head;
+}
+
+size_t piece_table_read(PieceTable *table, size_t offset, char *out, size_t length) {
+    PieceTableIterator iterator;
+    size_t copied = 0;
+
+    if (table == NULL) {
+        return 0;
+    }
+
+    for (int more = piece_table_iterator_seek(&iterator, table, offset); more && copied < length;
+         more = piece_table_iterator_next(&iterator)) {
+        size_t available = iterator.length;
+
+        if (available > length - copied) {
+            available = length - copied;
+        }
+
+        memcpy(out + copied, iterator.text, available);
+        copied += available;
+    }
+
+    return copied;
+}
+
+// Loads the chunk of the iterator's current piece, starting head bytes in
+int load_piece_table_chunk(PieceTableIterator *iterator, size_t head) {
+    RedBlackTreeNode *node = iterator->pieces.node;
+
+    if (node == NULL) {
+        iterator->text = NULL;
+        iterator->length = 0;
+        iterator->offset = piece_table_length(iterator->table);
+
+        return 0;
+    }
+
+    Piece *piece = node->value;
+
+    iterator->text = piece_table_buffer(iterator->table, piece->buffer)->base + piece->start + head;
+    iterator->length = piece->length - head;
+    iterator->offset = iterator->pieces.before.length + head;
+
+    return 1;
+}
+
+// Returns 1 when there is a chunk at offset, its text runs to the end of its piece
+int piece_table_iterator_seek(PieceTableIterator *iterator, PieceTable *table, size_t offset) {
+    iterator->table = table;
+    redblack_iterator_seek_offset(&iterator->pieces, table->pieces, offset);
+
+    return load_piece_table_chunk(iterator, iterator->pieces.node != NULL ? offset - iterator->pieces.before.length : 0);
+}
+
+int piece_table_iterator_next(PieceTableIterator *iterator) {
+    redblack_iterator_next(&iterator->pieces);
+
+    return load_piece_table_chunk(iterator, 0);
+}
+
+int piece_table_iterator_prev(PieceTableIterator *iterator) {
+    redblack_iterator_prev(&iterator->pieces);
+
+    return load_piece_table_chunk(iterator, 0);
+}
+
+size_t piece_table_line_count(PieceTable *table) {
+    if (table == NULL || table->pieces->root == NULL) {
+        return 1;
+    }
+
+    RedBlackTreeNode *pending;
+
+    while ((pending = find_first_pending_redblack_node(table->pieces, NULL)) != NULL) {
+        count_pending_piece(table, pending);
+    }
+
+    return table->pieces->root->aggregate.newlines + 1;
+}
+
+// Zero based line holding offset, i.e. how many newlines come before it
+size_t piece_table_line_at(PieceTable *table, size_t offset) {
+    if (table == NULL) {
+        return 0;
+    }
+
+    RedBlackTreeAggregate before;
+    RedBlackTreeNode *node;
+
+    // The pieces in front are counted, the one holding offset is only scanned up to it
+    while ((node = find_first_pending_redblack_node(table->pieces, &before)) != NULL && before.length < offset) {
+        count_pending_piece(table, node);
+    }
+
+    node = find_redblack_node_by_offset(table->pieces, offset, &before);
+
+    if (node == NULL) {
+        return piece_table_line_count(table) - 1;
+    }
+
+    Piece *piece = node->value;
+
+    return before.newlines + count_buffer_newlines(piece_table_buffer(table, piece->buffer), piece->start, offset - before.length + piece->start);
+}
+
+// Offset of the first byte of the zero based line, lines past the end
+// resolve to the start of the last line.
+size_t piece_table_line_start(PieceTable *table, size_t line) {
+    if (table == NULL || line == 0) {
+        return 0;
+    }
+
+    RedBlackTreeAggregate before;
+    RedBlackTreeNode *node;
+
+    // Pending pieces are counted until the line is known to come before them
+    while ((node = find_first_pending_redblack_node(table->pieces, &before)) != NULL && before.newlines < line) {
+        count_pending_piece(table, node);
+    }
+
+    if (node == NULL && line >= piece_table_line_count(table)) {
+        line = piece_table_line_count(table) - 1;
+
+        if (line == 0) {
+            return 0;
+        }
+    }
+
+    // Line n starts right after the n-th newline
+    node = find_redblack_node_by_newline(table->pieces, line, &before);
+
+    if (node == NULL) {
+        return 0;
+    }
+
+    Piece *piece = node->value;
+    size_t lineStart = find_buffer_line_start(piece_table_buffer(table, piece->buffer), piece->start, line - before.newlines);
+
+    return before.length + (lineStart - piece->start);
+}
+
+void free_piece_table(PieceTable *table) {
+    if (table == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < table->buffers->len; i++) {
+        PieceBuffer *buffer = piece_table_buffer(table, (unsigned int) i);
+
+        if (buffer->size != 0) {
+            free(buffer->base);
+        }
+
+        free_vector(buffer->lineStartsOffsets);
+
+        if (buffer->chunks != NULL) {
+            for (size_t chunk = 0; chunk * PIECE_BUFFER_CHUNK_SIZE < buffer->len; chunk++) {
+                free_vector(buffer->chunks[chunk].lineStarts);
+            }
+
+            free(buffer->chunks);
+        }
+    }
+
+    free_piece_table_history(table->history);
+    free_redblack_tree(table->pieces);
+    free_vector(table->buffers);
+    free(table);
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+#include "structures/pool.h"
+
+#define NODE_POOL_FIRST_SLAB_BLOCKS 64
+#define NODE_POOL_MAX_SLAB_BLOCKS (1 << 16)
+
+NodePool *initialize_node_pool(size_t block_size) {
+    NodePool *pool = calloc(1, sizeof(*pool));
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    // A released block stores the free list link in its first bytes
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+
+    pool->block_size = NODE_POOL_ALIGN(block_size);
+    pool->slab_blocks = NODE_POOL_FIRST_SLAB_BLOCKS;
+    pool->references = 1;
+
+    return pool;
+}
+
+void *pool_alloc(NodePool *pool) {
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    if (pool->free_list != NULL) {
+        void *block = pool->free_list;
+
+        memcpy(&pool->free_list, block, sizeof(void *));
+        return block;
+    }
+
+    if (pool->cursor == pool->end) {
+        size_t header = NODE_POOL_ALIGN(sizeof(NodePoolSlab));
+        NodePoolSlab *slab = malloc(header + pool->block_size * pool->slab_blocks);
+
+        if (slab == NULL) {
+            return NULL;
+        }
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->cursor = (char *) slab + header;
+        pool->end = pool->cursor + pool->block_size * pool->slab_blocks;
+
+        // Growing geometrically keeps the slab count logarithmic in the node count
+        if (pool->slab_blocks < NODE_POOL_MAX_SLAB_BLOCKS) {
+            pool->slab_blocks *= 2;
+        }
+    }
+
+    void *block = pool->cursor;
+    pool->cursor += pool->block_size;
+
+    return block;
+}
+
+void pool_release(NodePool *pool, void *block) {
+    if (pool == NULL || block == NULL) {
+        return;
+    }
+
+    memcpy(block, &pool->free_list, sizeof(void *));
+    pool->free_list = block;
+}
+
+NodePool *retain_node_pool(NodePool *pool) {
+    if (pool != NULL) {
+        pool->references++;
+    }
+
+    return pool;
+}
+
+// Drops one reference, the last owner frees every slab at once
+void free_node_pool(NodePool *pool) {
+    if (pool == NULL || --pool->references > 0) {
+        return;
+    }
+
+    while (pool->slabs != NULL) {
+        NodePoolSlab *next = pool->slabs->next;
+
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+
+    free(pool);
+}
@@ -7,9 +7,23 @@ RedBlackTreeNodeDirection find_redblack_node_for_insertion(RedBlackTree *tree, R
 RedBlackTreeNode *cut_node_from_tree_by_value(RedBlackTree *tree, void *value);
 void fix_red_violations(RedBlackTree *tree, RedBlackTreeNode *node);
 void fix_black_violations(RedBlackTree *tree, RedBlackTreeNode *x, RedBlackTreeNode *x_parent);
-void free_redblack_node(RedBlackTreeNode *node);
+void free_redblack_node(RedBlackTree *tree, RedBlackTreeNode *node);
 void right_rotate_redblack_subtree(RedBlackTree *tree, RedBlackTreeNode *x);
 void left_rotate_redblack_subtree(RedBlackTree *tree, RedBlackTreeNode *x);
+RedBlackTreeNode *create_redblack_node(RedBlackTree *tree, void *value);
+RedBlackTreeNode *attach_redblack_node(RedBlackTree *tree, RedBlackTreeNode *parent, enum BINARY_TREE_NODE_DIRECTION direction, RedBlackTreeNode *node);
+RedBlackTreeNode *cut_redblack_node(RedBlackTree *tree, RedBlackTreeNode *target);
+void recalculate_redblack_aggregate(RedBlackTree *tree, RedBlackTreeNode *node);
+enum DATA_TYPES redblack_type_from_name(char *type);
+RedBlackTreeAggregate redblack_node_own_aggregate(RedBlackTreeNode *node);
+void add_redblack_aggregate(RedBlackTreeAggregate *to, RedBlackTreeAggregate add);
+void repair_red_red_violations(RedBlackTree *tree, RedBlackTreeNode *node);
+size_t redblack_black_height(RedBlackTreeNode *node);
+RedBlackTreeNode *detach_redblack_subtree(RedBlackTreeNode *node, size_t *height);
+RedBlackTreeNode *join_redblack_subtrees(RedBlackTree *tree, RedBlackTreeNode *left, size_t leftHeight, RedBlackTreeNode *pivot, RedBlackTreeNode *right, size_t rightHeight, size_t *height);
+RedBlackTree *create_redblack_tree_like(RedBlackTree *tree);
+void link_redblack_child(RedBlackTreeNode *parent, enum BINARY_TREE_NODE_DIRECTION direction, RedBlackTreeNode *child);
+RedBlackTreeNode *build_redblack_subtree(RedBlackTree *tree, char *values, size_t from, size_t to, size_t depth, size_t redDepth);
 
 RedBlackTree *initialize_redblack_tree(char *type, size_t type_size, short(*compare)(void *a, void *b)) {
     if (compare == NULL) {
@@ -22,65 +36,518 @@ RedBlackTree *initialize_redblack_tree(char *type, size_t type_size, short(*comp
         return NULL;
     }
 
-    if (! strcmp(type, "char")) {
-        tree->type = TYPE_CHAR;
-    } else if (!strcmp(type, "int")) {
-        tree->type = TYPE_INT;
-    } else {
-        assert(0 && "THIS TYPE IS NOT SUPPORTED FOR BINARY TREES!");
-    }
-
+    tree->type = redblack_type_from_name(type);
     tree->compare = compare;
     tree->type_size = type_size;
+    tree->pool = initialize_node_pool(NODE_POOL_ALIGN(sizeof(RedBlackTreeNode)) + type_size);
+
+    if (tree->pool == NULL) {
+        free(tree);
+        return NULL;
+    }
 
     return tree;
 }
 
-RedBlackTreeNode *push_to_redblack_tree(RedBlackTree *tree, void *value) {
+// A tree ordered by insertion position instead of by value. Every node keeps
+// the measured aggregate of its subtree, so offsets can be resolved in O(log n).
+RedBlackTree *initialize_measured_redblack_tree(char *type, size_t type_size, void(*measure)(void *value, RedBlackTreeAggregate *aggregate)) {
+    if (measure == NULL) {
+        return NULL;
+    }
+
+    RedBlackTree *tree = calloc(1, sizeof(*tree));
+
     if (tree == NULL) {
         return NULL;
     }
 
-    RedBlackTreeNode *node = calloc(1, sizeof(*node));
+    tree->type = redblack_type_from_name(type);
+    tree->measure = measure;
+    tree->type_size = type_size;
+    tree->pool = initialize_node_pool(NODE_POOL_ALIGN(sizeof(RedBlackTreeNode)) + type_size);
+
+    if (tree->pool == NULL) {
+        free(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+enum DATA_TYPES redblack_type_from_name(char *type) {
+    if (! strcmp(type, "char")) {
+        return TYPE_CHAR;
+    } else if (!strcmp(type, "int")) {
+        return TYPE_INT;
+    } else if (!strcmp(type, "struct")) {
+        return TYPE_STRUCT;
+    }
+
+    assert(0 && "THIS TYPE IS NOT SUPPORTED FOR BINARY TREES!");
+    return TYPE_UNKNOWN;
+}
+
+// Nodes come from the tree's pool, with the value stored right behind them
+RedBlackTreeNode *create_redblack_node(RedBlackTree *tree, void *value) {
+    RedBlackTreeNode *node = pool_alloc(tree->pool);
 
     if (node == NULL) {
         return NULL;
     }
 
-    tree->size++;
+    memset(node, 0, sizeof(*node));
     node->color = RBT_COLOR_RED;
-    node->value = malloc(tree->type_size);
+    node->value = (char *) node + NODE_POOL_ALIGN(sizeof(RedBlackTreeNode));
 
     memcpy(node->value, value, tree->type_size);
+    recalculate_redblack_aggregate(tree, node);
 
-    if (tree->root == NULL) {
+    return node;
+}
+
+// Links a fresh red node under parent (or as the root when parent is NULL),
+// then restores the aggregates on the path and the red-black properties.
+RedBlackTreeNode *attach_redblack_node(RedBlackTree *tree, RedBlackTreeNode *parent, enum BINARY_TREE_NODE_DIRECTION direction, RedBlackTreeNode *node) {
+    tree->size++;
+
+    if (parent == NULL) {
         tree->root = node;
         node->color = RBT_COLOR_BLACK;
         return node;
     }
 
+    if (direction == BINARY_TREE_NODE_LEFT) {
+        parent->left = node;
+        node->direction_from_parent = BINARY_TREE_NODE_LEFT;
+    } else {
+        parent->right = node;
+        node->direction_from_parent = BINARY_TREE_NODE_RIGHT;
+    }
+
+    node->parent = parent;
+
+    update_redblack_node_aggregates(tree, parent);
+    fix_red_violations(tree, node);
+
+    return node;
+}
+
+RedBlackTreeNode *push_to_redblack_tree(RedBlackTree *tree, void *value) {
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = create_redblack_node(tree, value);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (tree->root == NULL) {
+        return attach_redblack_node(tree, NULL, BINARY_TREE_NODE_NONE, node);
+    }
+
     RedBlackTreeNodeDirection nodeObj = find_redblack_node_for_insertion(tree, tree->root, value);
 
     if (nodeObj. node == NULL) {
+        free_redblack_node(tree, node);
         return NULL;
     }
 
-    if (nodeObj.direction == BINARY_TREE_NODE_LEFT) {
-        nodeObj.node->left = node;
-        node->direction_from_parent = BINARY_TREE_NODE_LEFT;
-    } else {
-        nodeObj.node->right = node;
-        node->direction_from_parent = BINARY_TREE_NODE_RIGHT;
+    return attach_redblack_node(tree, nodeObj.node, nodeObj.direction, node);
+}
+
+// Inserts value as the in-order successor of node.
+// A NULL node inserts at the very beginning of the tree.
+RedBlackTreeNode *insert_redblack_node_after(RedBlackTree *tree, RedBlackTreeNode *node, void *value) {
+    if (tree == NULL) {
+        return NULL;
     }
 
-    node->parent = nodeObj.node;
+    RedBlackTreeNode *created = create_redblack_node(tree, value);
 
-    fix_red_violations(tree, node);
+    if (created == NULL) {
+        return NULL;
+    }
+
+    if (tree->root == NULL) {
+        return attach_redblack_node(tree, NULL, BINARY_TREE_NODE_NONE, created);
+    }
+
+    if (node == NULL) {
+        return attach_redblack_node(tree, redblack_tree_first(tree), BINARY_TREE_NODE_LEFT, created);
+    }
+
+    if (node->right == NULL) {
+        return attach_redblack_node(tree, node, BINARY_TREE_NODE_RIGHT, created);
+    }
+
+    node = node->right;
+    while (node->left != NULL) {
+        node = node->left;
+    }
+
+    return attach_redblack_node(tree, node, BINARY_TREE_NODE_LEFT, created);
+}
+
+// Inserts value as the in-order predecessor of node.
+// A NULL node inserts at the very end of the tree.
+RedBlackTreeNode *insert_redblack_node_before(RedBlackTree *tree, RedBlackTreeNode *node, void *value) {
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *created = create_redblack_node(tree, value);
+
+    if (created == NULL) {
+        return NULL;
+    }
+
+    if (tree->root == NULL) {
+        return attach_redblack_node(tree, NULL, BINARY_TREE_NODE_NONE, created);
+    }
+
+    if (node == NULL) {
+        return attach_redblack_node(tree, redblack_tree_last(tree), BINARY_TREE_NODE_RIGHT, created);
+    }
+
+    if (node->left == NULL) {
+        return attach_redblack_node(tree, node, BINARY_TREE_NODE_LEFT, created);
+    }
+
+    node = node->left;
+    while (node->right != NULL) {
+        node = node->right;
+    }
+
+    return attach_redblack_node(tree, node, BINARY_TREE_NODE_RIGHT, created);
+}
+
+// Node counts are always kept, lengths and newlines only for measured trees
+void recalculate_redblack_aggregate(RedBlackTree *tree, RedBlackTreeNode *node) {
+    if (node == NULL) {
+        return;
+    }
+
+    node->aggregate = (RedBlackTreeAggregate) {0};
+
+    if (tree->measure != NULL) {
+        tree->measure(node->value, &node->aggregate);
+    }
+
+    node->aggregate.nodes = 1;
+
+    if (node->left != NULL) {
+        add_redblack_aggregate(&node->aggregate, node->left->aggregate);
+    }
+    if (node->right != NULL) {
+        add_redblack_aggregate(&node->aggregate, node->right->aggregate);
+    }
+}
+
+// Must be called after a node's value changed in a way the measure sees.
+void update_redblack_node_aggregates(RedBlackTree *tree, RedBlackTreeNode *node) {
+    if (tree == NULL) {
+        return;
+    }
+
+    for (; node != NULL; node = node->parent) {
+        recalculate_redblack_aggregate(tree, node);
+    }
+}
+
+// Aggregate of node alone, without its subtrees
+RedBlackTreeAggregate redblack_node_own_aggregate(RedBlackTreeNode *node) {
+    RedBlackTreeAggregate own = node->aggregate;
+
+    if (node->left != NULL) {
+        own.length -= node->left->aggregate.length;
+        own.newlines -= node->left->aggregate.newlines;
+        own.pending -= node->left->aggregate.pending;
+        own.nodes -= node->left->aggregate.nodes;
+    }
+    if (node->right != NULL) {
+        own.length -= node->right->aggregate.length;
+        own.newlines -= node->right->aggregate.newlines;
+        own.pending -= node->right->aggregate.pending;
+        own.nodes -= node->right->aggregate.nodes;
+    }
+
+    return own;
+}
+
+void add_redblack_aggregate(RedBlackTreeAggregate *to, RedBlackTreeAggregate add) {
+    to->length += add.length;
+    to->newlines += add.newlines;
+    to->pending += add.pending;
+    to->nodes += add.nodes;
+}
+
+// Finds the node covering offset, where every node spans aggregate.length units.
+// before receives the sum of everything in front of that node.
+RedBlackTreeNode *find_redblack_node_by_offset(RedBlackTree *tree, size_t offset, RedBlackTreeAggregate *before) {
+    if (tree == NULL || tree->measure == NULL) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = tree->root;
+    RedBlackTreeAggregate passed = {0};
+
+    while (node != NULL) {
+        RedBlackTreeAggregate left = node->left != NULL ? node->left->aggregate : (RedBlackTreeAggregate) {0};
+        RedBlackTreeAggregate own = redblack_node_own_aggregate(node);
+
+        if (offset < left.length) {
+            node = node->left;
+        } else if (offset < left.length + own.length) {
+            add_redblack_aggregate(&passed, left);
+            break;
+        } else {
+            offset -= left.length + own.length;
+            add_redblack_aggregate(&passed, left);
+            add_redblack_aggregate(&passed, own);
+            node = node->right;
+        }
+    }
+
+    if (node != NULL && before != NULL) {
+        *before = passed;
+    }
+
+    return node;
+}
+
+// Finds the node holding the newline-th (counting from 1) newline.
+// before receives the sum of everything in front of that node.
+RedBlackTreeNode *find_redblack_node_by_newline(RedBlackTree *tree, size_t newline, RedBlackTreeAggregate *before) {
+    if (tree == NULL || tree->measure == NULL || newline == 0) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = tree->root;
+    RedBlackTreeAggregate passed = {0};
+
+    while (node != NULL) {
+        RedBlackTreeAggregate left = node->left != NULL ? node->left->aggregate : (RedBlackTreeAggregate) {0};
+        RedBlackTreeAggregate own = redblack_node_own_aggregate(node);
+
+        if (newline <= left.newlines) {
+            node = node->left;
+        } else if (newline <= left.newlines + own.newlines) {
+            add_redblack_aggregate(&passed, left);
+            break;
+        } else {
+            newline -= left.newlines + own.newlines;
+            add_redblack_aggregate(&passed, left);
+            add_redblack_aggregate(&passed, own);
+            node = node->right;
+        }
+    }
+
+    if (node != NULL && before != NULL) {
+        *before = passed;
+    }
+
+    return node;
+}
+
+// Finds the first node whose own measure has pending units, NULL when none has.
+// before receives the sum of everything in front of that node.
+RedBlackTreeNode *find_first_pending_redblack_node(RedBlackTree *tree, RedBlackTreeAggregate *before) {
+    if (tree == NULL || tree->measure == NULL || tree->root == NULL || tree->root->aggregate.pending == 0) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = tree->root;
+    RedBlackTreeAggregate passed = {0};
+
+    while (node != NULL) {
+        RedBlackTreeAggregate left = node->left != NULL ? node->left->aggregate : (RedBlackTreeAggregate) {0};
+        RedBlackTreeAggregate own = redblack_node_own_aggregate(node);
+
+        if (left.pending > 0) {
+            node = node->left;
+        } else if (own.pending > 0) {
+            add_redblack_aggregate(&passed, left);
+            break;
+        } else {
+            add_redblack_aggregate(&passed, left);
+            add_redblack_aggregate(&passed, own);
+            node = node->right;
+        }
+    }
+
+    if (node != NULL && before != NULL) {
+        *before = passed;
+    }
+
+    return node;
+}
+
+RedBlackTreeNode *redblack_tree_first(RedBlackTree *tree) {
+    if (tree == NULL || tree->root == NULL) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = tree->root;
+    while (node->left != NULL) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+RedBlackTreeNode *redblack_tree_last(RedBlackTree *tree) {
+    if (tree == NULL || tree->root == NULL) {
+        return NULL;
+    }
+
+    RedBlackTreeNode *node = tree->root;
+    while (node->right != NULL) {
+        node = node->right;
+    }
 
     return node;
 }
 
+RedBlackTreeNode *redblack_node_successor(RedBlackTreeNode *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+
+        return node;
+    }
+
+    while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+RedBlackTreeNode *redblack_node_predecessor(RedBlackTreeNode *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->left != NULL) {
+        node = node->left;
+        while (node->right != NULL) {
+            node = node->right;
+        }
+
+        return node;
+    }
+
+    while (node->parent != NULL && node->parent->left == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+// ---------------------------------------------------------
+// Iterators: walk in order through parent links, no allocation
+// ---------------------------------------------------------
+
+void redblack_iterator_first(RedBlackTreeIterator *iterator, RedBlackTree *tree) {
+    iterator->tree = tree;
+    iterator->node = redblack_tree_first(tree);
+    iterator->before = (RedBlackTreeAggregate) {0};
+}
+
+void redblack_iterator_last(RedBlackTreeIterator *iterator, RedBlackTree *tree) {
+    iterator->tree = tree;
+    iterator->node = redblack_tree_last(tree);
+    iterator->before = (RedBlackTreeAggregate) {0};
+
+    if (iterator->node != NULL && tree->measure != NULL) {
+        RedBlackTreeAggregate own = redblack_node_own_aggregate(iterator->node);
+
+        iterator->before.length = tree->root->aggregate.length - own.length;
+        iterator->before.newlines = tree->root->aggregate.newlines - own.newlines;
+        iterator->before.pending = tree->root->aggregate.pending - own.pending;
+        iterator->before.nodes = tree->root->aggregate.nodes - own.nodes;
+    }
+}
+
+// Positions the iterator on the first node whose value is not less than value
+void redblack_iterator_seek(RedBlackTreeIterator *iterator, RedBlackTree *tree, void *value) {
+    RedBlackTreeNode *node = tree != NULL ? tree->root : NULL;
+    RedBlackTreeNode *found = NULL;
+
+    iterator->tree = tree;
+    iterator->before = (RedBlackTreeAggregate) {0};
+
+    while (node != NULL) {
+        if (tree->compare(value, node->value) <= 0) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    iterator->node = found;
+}
+
+// Positions the iterator on the node covering offset of a measured tree
+void redblack_iterator_seek_offset(RedBlackTreeIterator *iterator, RedBlackTree *tree, size_t offset) {
+    iterator->tree = tree;
+    iterator->before = (RedBlackTreeAggregate) {0};
+    iterator->node = find_redblack_node_by_offset(tree, offset, &iterator->before);
+}
+
+RedBlackTreeNode *redblack_iterator_next(RedBlackTreeIterator *iterator) {
+    if (iterator->node == NULL) {
+        return NULL;
+    }
+
+    if (iterator->tree->measure != NULL) {
+        add_redblack_aggregate(&iterator->before, redblack_node_own_aggregate(iterator->node));
+    }
+
+    iterator->node = redblack_node_successor(iterator->node);
+
+    return iterator->node;
+}
+
+RedBlackTreeNode *redblack_iterator_prev(RedBlackTreeIterator *iterator) {
+    if (iterator->node == NULL) {
+        return NULL;
+    }
+
+    iterator->node = redblack_node_predecessor(iterator->node);
+
+    if (iterator->node != NULL && iterator->tree->measure != NULL) {
+        RedBlackTreeAggregate own = redblack_node_own_aggregate(iterator->node);
+
+        iterator->before.length -= own.length;
+        iterator->before.newlines -= own.newlines;
+        iterator->before.pending -= own.pending;
+        iterator->before.nodes -= own.nodes;
+    }
+
+    return iterator->node;
+}
+
 void fix_red_violations(RedBlackTree *tree, RedBlackTreeNode *node) {
+    repair_red_red_violations(tree, node);
+
+    if (tree->root != NULL) {
+        tree->root->color = RBT_COLOR_BLACK;
+    }
+}
+
+// The insertion fixup loop, it leaves the root's color to the caller
+void repair_red_red_violations(RedBlackTree *tree, RedBlackTreeNode *node) {
     while (node != NULL && node->parent != NULL && node->parent->color == RBT_COLOR_RED) {
         RedBlackTreeNode *parent = node->parent;
         RedBlackTreeNode *grandparent = parent->parent;
@@ -137,10 +604,6 @@ void fix_red_violations(RedBlackTree *tree, RedBlackTreeNode *node) {
         // Once we’ve done the rotations & recolor, we’re done for this insertion
         break;
     }
-
-    if (tree->root != NULL) {
-        tree->root->color = RBT_COLOR_BLACK;
-    }
 }
 
 void fix_black_violations(RedBlackTree *tree, RedBlackTreeNode *x, RedBlackTreeNode *x_parent) {
@@ -246,32 +709,51 @@ void fix_black_violations(RedBlackTree *tree, RedBlackTreeNode *x, RedBlackTreeN
         tree->root->color = RBT_COLOR_BLACK;
 }
 
+// Copies the values of node's subtree in order, prefer an iterator on hot paths
 RedBlackTreeNode *iterate_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node, Vector *container) {
     if (tree == NULL || node == NULL) {
         return NULL;
     }
 
-    iterate_redblack_tree(tree, node->left, container);
-    vec_push_back(container, node->value);
-    iterate_redblack_tree(tree, node->right, container);
+    RedBlackTreeNode *current = node;
+    RedBlackTreeNode *last = node;
+
+    while (current->left != NULL) {
+        current = current->left;
+    }
+    while (last->right != NULL) {
+        last = last->right;
+    }
+
+    for (;; current = redblack_node_successor(current)) {
+        vec_push_back(container, current->value);
+
+        if (current == last) {
+            break;
+        }
+    }
 
     return node;
 }
 
 RedBlackTreeNode *search_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node, void *value) {
-    if (tree == NULL || node == NULL) {
+    if (tree == NULL) {
         return NULL;
     }
 
-    short result = tree->compare(value, node->value);
+    while (node != NULL) {
+        short result = tree->compare(value, node->value);
 
-    if (result < 0) {
-        return search_redblack_tree(tree, node->left, value);
-    } else if (result > 0) {
-        return search_redblack_tree(tree, node->right, value);
+        if (result < 0) {
+            node = node->left;
+        } else if (result > 0) {
+            node = node->right;
+        } else {
+            return node;
+        }
     }
 
-    return node;
+    return NULL;
 }
 
 void *remove_by_value_redblack_tree(RedBlackTree *tree, void *value) {
@@ -279,10 +761,15 @@ void *remove_by_value_redblack_tree(RedBlackTree *tree, void *value) {
 
     if (! removed_node) return NULL;
 
-    void *removed_value = removed_node->value;
+    // The value lives inside the pooled node, the caller owns (and frees) a copy
+    void *removed_value = malloc(tree->type_size);
+
+    if (removed_value != NULL) {
+        memcpy(removed_value, removed_node->value, tree->type_size);
+    }
 
     tree->size--;
-    free(removed_node);
+    free_redblack_node(tree, removed_node);
 
     return removed_value;
 }
@@ -298,6 +785,24 @@ RedBlackTreeNode *cut_node_from_tree_by_value(RedBlackTree *tree, void *value) {
         return NULL;
     }
 
+    return cut_redblack_node(tree, target);
+}
+
+void delete_redblack_node(RedBlackTree *tree, RedBlackTreeNode *node) {
+    if (tree == NULL || node == NULL) {
+        return;
+    }
+
+    cut_redblack_node(tree, node);
+    tree->size--;
+    free_redblack_node(tree, node);
+}
+
+RedBlackTreeNode *cut_redblack_node(RedBlackTree *tree, RedBlackTreeNode *target) {
+    if (tree == NULL || target == NULL) {
+        return NULL;
+    }
+
     // replacement = node that will physically be removed from the tree
     // (may be target itself, or its in-order successor)
     RedBlackTreeNode *replacement = target;
@@ -399,6 +904,9 @@ RedBlackTreeNode *cut_node_from_tree_by_value(RedBlackTree *tree, void *value) {
         replacement->color = target->color;
     }
 
+    // Subtrees below fix_parent lost a node, re-sum them before rotating
+    update_redblack_node_aggregates(tree, fix_parent);
+
     // If the physically removed node was black, we may have to fix black-height
     if (replacement_original_color == RBT_COLOR_BLACK) {
         if (fix_node != NULL || fix_parent != NULL) {
@@ -433,6 +941,10 @@ void right_rotate_redblack_subtree(RedBlackTree *tree, RedBlackTreeNode *x) {
         swapped_child->parent = x;
     }
 
+    // x is now the child, so its subtree has to be summed first
+    recalculate_redblack_aggregate(tree, x);
+    recalculate_redblack_aggregate(tree, x->parent);
+
     if (grand_parent == NULL) {
         tree->root = x->parent;
         return;
@@ -467,6 +979,10 @@ void left_rotate_redblack_subtree(RedBlackTree *tree, RedBlackTreeNode *x) {
         swapped_child->parent = x;
     }
 
+    // x is now the child, so its subtree has to be summed first
+    recalculate_redblack_aggregate(tree, x);
+    recalculate_redblack_aggregate(tree, x->parent);
+
     if (grand_parent == NULL) {
         tree->root = x->parent;
         return;
@@ -484,19 +1000,361 @@ RedBlackTreeNodeDirection find_redblack_node_for_insertion(RedBlackTree *tree, R
         return (RedBlackTreeNodeDirection) {. node = NULL, .direction = BINARY_TREE_NODE_NONE};
     }
 
-    if (tree->compare(value, currentNode->value) > -1) {
-        if (currentNode->right == NULL) {
-            return (RedBlackTreeNodeDirection) {.node = currentNode, .direction = BINARY_TREE_NODE_RIGHT};
+    for (;;) {
+        // Equal values go right, so duplicates keep their insertion order
+        if (tree->compare(value, currentNode->value) > -1) {
+            if (currentNode->right == NULL) {
+                return (RedBlackTreeNodeDirection) {.node = currentNode, .direction = BINARY_TREE_NODE_RIGHT};
+            }
+
+            currentNode = currentNode->right;
+        } else {
+            if (currentNode->left == NULL) {
+                return (RedBlackTreeNodeDirection) {.node = currentNode, .direction = BINARY_TREE_NODE_LEFT};
+            }
+
+            currentNode = currentNode->left;
         }
+    }
+}
+
+// ---------------------------------------------------------
+// Bulk construction from values that are already in order
+// ---------------------------------------------------------
+
+// Builds the subtree holding values [from, to) around its middle value. Every
+// level above redDepth is full, so only the nodes on it are red: this keeps all
+// paths at the same black height without any rotation.
+RedBlackTreeNode *build_redblack_subtree(RedBlackTree *tree, char *values, size_t from, size_t to, size_t depth, size_t redDepth) {
+    if (from >= to) {
+        return NULL;
+    }
+
+    size_t middle = from + (to - from) / 2;
+    RedBlackTreeNode *node = create_redblack_node(tree, values + middle * tree->type_size);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->color = depth == redDepth ? RBT_COLOR_RED : RBT_COLOR_BLACK;
+
+    RedBlackTreeNode *left = build_redblack_subtree(tree, values, from, middle, depth + 1, redDepth);
+    RedBlackTreeNode *right = build_redblack_subtree(tree, values, middle + 1, to, depth + 1, redDepth);
+
+    if ((left == NULL && from < middle) || (right == NULL && middle + 1 < to)) {
+        // Out of memory, the nodes built so far go back with the pool
+        return NULL;
+    }
+
+    link_redblack_child(node, BINARY_TREE_NODE_LEFT, left);
+    link_redblack_child(node, BINARY_TREE_NODE_RIGHT, right);
+    recalculate_redblack_aggregate(tree, node);
+
+    return node;
+}
+
+// Fills an empty tree with every value of the vector in O(n), keeping their
+// order: for a compared tree they must already be sorted, a measured tree
+// takes them as its sequence. The vector must hold values of the tree's type.
+int fill_redblack_tree_from_sorted(RedBlackTree *tree, Vector *values) {
+    if (tree == NULL || values == NULL) {
+        return 1;
+    }
 
-        return find_redblack_node_for_insertion(tree, currentNode->right, value);
+    assert(tree->root == NULL && "ONLY AN EMPTY TREE CAN BE FILLED!");
+    assert(values->type_size == tree->type_size && "THE VECTOR DOES NOT HOLD THE TREE'S TYPE!");
+
+    if (values->len == 0) {
+        return 0;
+    }
+
+    // Depth of the deepest level, which is the only one that can be partial
+    size_t redDepth = 0;
+
+    while (((size_t) 2 << redDepth) - 1 < values->len) {
+        redDepth++;
+    }
+
+    RedBlackTreeNode *root = build_redblack_subtree(tree, values->base, 0, values->len, 0, redDepth);
+
+    if (root == NULL) {
+        return 1;
+    }
+
+    // A single node sits on the red level too
+    root->color = RBT_COLOR_BLACK;
+    tree->root = root;
+    tree->size = values->len;
+
+    return 0;
+}
+
+RedBlackTree *build_redblack_tree_from_sorted(char *type, size_t type_size, short(*compare)(void *a, void *b), Vector *values) {
+    RedBlackTree *tree = initialize_redblack_tree(type, type_size, compare);
+
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    if (fill_redblack_tree_from_sorted(tree, values)) {
+        free_redblack_tree(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+// ---------------------------------------------------------
+// Split and join: cut a tree in two or concatenate two trees in O(log n)
+// ---------------------------------------------------------
+
+// Black nodes on any path from node down to a leaf
+size_t redblack_black_height(RedBlackTreeNode *node) {
+    size_t height = 0;
+
+    for (; node != NULL; node = node->left) {
+        if (node->color == RBT_COLOR_BLACK) {
+            height++;
+        }
+    }
+
+    return height;
+}
+
+// Makes node the root of a free standing subtree. A red root is blackened,
+// which makes the subtree one black level taller.
+RedBlackTreeNode *detach_redblack_subtree(RedBlackTreeNode *node, size_t *height) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->parent = NULL;
+    node->direction_from_parent = BINARY_TREE_NODE_NONE;
+
+    if (node->color == RBT_COLOR_RED) {
+        node->color = RBT_COLOR_BLACK;
+        (*height)++;
+    }
+
+    return node;
+}
+
+void link_redblack_child(RedBlackTreeNode *parent, enum BINARY_TREE_NODE_DIRECTION direction, RedBlackTreeNode *child) {
+    if (direction == BINARY_TREE_NODE_LEFT) {
+        parent->left = child;
     } else {
-        if (currentNode->left == NULL) {
-            return (RedBlackTreeNodeDirection) {.node = currentNode, .direction = BINARY_TREE_NODE_LEFT};
+        parent->right = child;
+    }
+
+    if (child != NULL) {
+        child->parent = parent;
+        child->direction_from_parent = direction;
+    }
+}
+
+// Joins left, pivot and right (in this order) into one subtree with a black
+// root. leftHeight and rightHeight are the black heights of the two sides and
+// height receives the joined one. Costs O(|leftHeight - rightHeight| + 1).
+RedBlackTreeNode *join_redblack_subtrees(RedBlackTree *tree, RedBlackTreeNode *left, size_t leftHeight, RedBlackTreeNode *pivot, RedBlackTreeNode *right, size_t rightHeight, size_t *height) {
+    pivot->parent = pivot->left = pivot->right = NULL;
+    pivot->direction_from_parent = BINARY_TREE_NODE_NONE;
+
+    if (leftHeight == rightHeight) {
+        link_redblack_child(pivot, BINARY_TREE_NODE_LEFT, left);
+        link_redblack_child(pivot, BINARY_TREE_NODE_RIGHT, right);
+        pivot->color = RBT_COLOR_BLACK;
+        recalculate_redblack_aggregate(tree, pivot);
+
+        *height = leftHeight + 1;
+        return pivot;
+    }
+
+    // Walk down the inner spine of the taller side to a black node as tall as
+    // the shorter side, and hang the pivot (red) in its place.
+    RedBlackTreeNode *savedRoot = tree->root;
+    RedBlackTreeNode *parent = NULL;
+    RedBlackTreeNode *spine;
+    size_t spineHeight;
+
+    if (leftHeight > rightHeight) {
+        spine = left;
+        spineHeight = leftHeight;
+
+        while (spineHeight > rightHeight || (spine != NULL && spine->color == RBT_COLOR_RED)) {
+            parent = spine;
+            spineHeight -= spine->color == RBT_COLOR_BLACK;
+            spine = spine->right;
+        }
+
+        link_redblack_child(pivot, BINARY_TREE_NODE_LEFT, spine);
+        link_redblack_child(pivot, BINARY_TREE_NODE_RIGHT, right);
+        link_redblack_child(parent, BINARY_TREE_NODE_RIGHT, pivot);
+        tree->root = left;
+    } else {
+        spine = right;
+        spineHeight = rightHeight;
+
+        while (spineHeight > leftHeight || (spine != NULL && spine->color == RBT_COLOR_RED)) {
+            parent = spine;
+            spineHeight -= spine->color == RBT_COLOR_BLACK;
+            spine = spine->left;
         }
 
-        return find_redblack_node_for_insertion(tree, currentNode->left, value);
+        link_redblack_child(pivot, BINARY_TREE_NODE_LEFT, left);
+        link_redblack_child(pivot, BINARY_TREE_NODE_RIGHT, spine);
+        link_redblack_child(parent, BINARY_TREE_NODE_LEFT, pivot);
+        tree->root = right;
     }
+
+    pivot->color = RBT_COLOR_RED;
+    recalculate_redblack_aggregate(tree, pivot);
+    update_redblack_node_aggregates(tree, parent);
+
+    // The rotations of the fixup treat the joined subtree as the whole tree
+    repair_red_red_violations(tree, pivot);
+
+    RedBlackTreeNode *root = tree->root;
+
+    *height = leftHeight > rightHeight ? leftHeight : rightHeight;
+
+    if (root->color == RBT_COLOR_RED) {
+        root->color = RBT_COLOR_BLACK;
+        (*height)++;
+    }
+
+    tree->root = savedRoot;
+
+    return root;
+}
+
+// An empty tree with the same type, compare and measure, sharing the pool
+RedBlackTree *create_redblack_tree_like(RedBlackTree *tree) {
+    RedBlackTree *created = calloc(1, sizeof(*created));
+
+    if (created == NULL) {
+        return NULL;
+    }
+
+    created->type = tree->type;
+    created->type_size = tree->type_size;
+    created->compare = tree->compare;
+    created->measure = tree->measure;
+    created->pool = retain_node_pool(tree->pool);
+
+    return created;
+}
+
+// Moves node and everything after it into a new tree, which is returned.
+// tree keeps what was before node. A NULL node returns an empty tree.
+// Both trees share the node pool, so they can be joined back later.
+RedBlackTree *split_redblack_tree(RedBlackTree *tree, RedBlackTreeNode *node) {
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    RedBlackTree *right = create_redblack_tree_like(tree);
+
+    if (right == NULL || node == NULL) {
+        return right;
+    }
+
+    // Going up from node, every ancestor joins the side node is not on,
+    // together with its other subtree. The heights telescope to O(log n).
+    size_t childHeight = redblack_black_height(node);
+    size_t sideHeight = childHeight - (node->color == RBT_COLOR_BLACK);
+    size_t leftHeight = sideHeight;
+    size_t rightHeight = sideHeight;
+    RedBlackTreeNode *child = node;
+    RedBlackTreeNode *parent = node->parent;
+    RedBlackTreeNode *leftRoot = detach_redblack_subtree(node->left, &leftHeight);
+    RedBlackTreeNode *rightRoot = detach_redblack_subtree(node->right, &rightHeight);
+
+    rightRoot = join_redblack_subtrees(tree, NULL, 0, node, rightRoot, rightHeight, &rightHeight);
+
+    while (parent != NULL) {
+        RedBlackTreeNode *next = parent->parent;
+        int fromLeft = parent->left == child;
+        int parentBlack = parent->color == RBT_COLOR_BLACK;
+        size_t siblingHeight = childHeight;
+
+        if (fromLeft) {
+            RedBlackTreeNode *sibling = detach_redblack_subtree(parent->right, &siblingHeight);
+            rightRoot = join_redblack_subtrees(tree, rightRoot, rightHeight, parent, sibling, siblingHeight, &rightHeight);
+        } else {
+            RedBlackTreeNode *sibling = detach_redblack_subtree(parent->left, &siblingHeight);
+            leftRoot = join_redblack_subtrees(tree, sibling, siblingHeight, parent, leftRoot, leftHeight, &leftHeight);
+        }
+
+        childHeight += parentBlack;
+        child = parent;
+        parent = next;
+    }
+
+    tree->root = leftRoot;
+    right->root = rightRoot;
+    tree->size = leftRoot != NULL ? leftRoot->aggregate.nodes : 0;
+    right->size = rightRoot != NULL ? rightRoot->aggregate.nodes : 0;
+
+    return right;
+}
+
+// Splits a measured tree so that the returned tree starts with the node that
+// starts at or after offset. A node straddling offset stays in tree.
+RedBlackTree *split_redblack_tree_at_offset(RedBlackTree *tree, size_t offset) {
+    RedBlackTreeAggregate before;
+    RedBlackTreeNode *node = find_redblack_node_by_offset(tree, offset, &before);
+
+    if (node != NULL && before.length < offset) {
+        node = redblack_node_successor(node);
+    }
+
+    return split_redblack_tree(tree, node);
+}
+
+// Splits a value tree so that the returned tree holds every value not less than value
+RedBlackTree *split_redblack_tree_at_value(RedBlackTree *tree, void *value) {
+    RedBlackTreeIterator iterator;
+
+    redblack_iterator_seek(&iterator, tree, value);
+
+    return split_redblack_tree(tree, iterator.node);
+}
+
+// Appends every node of right after the nodes of left. right is consumed and
+// must come from the same pool, e.g. a split of left.
+void join_redblack_trees(RedBlackTree *left, RedBlackTree *right) {
+    if (left == NULL || right == NULL) {
+        return;
+    }
+
+    assert(left->pool == right->pool && "ONLY TREES SHARING A POOL CAN BE JOINED!");
+
+    if (right->root != NULL) {
+        if (left->root == NULL) {
+            left->root = right->root;
+        } else {
+            // The first node of right becomes the pivot between the two trees
+            RedBlackTreeNode *pivot = redblack_tree_first(right);
+            size_t height;
+
+            cut_redblack_node(right, pivot);
+
+            left->root = join_redblack_subtrees(
+                left,
+                left->root, redblack_black_height(left->root),
+                pivot,
+                right->root, redblack_black_height(right->root),
+                &height
+            );
+        }
+
+        left->root->parent = NULL;
+        left->size = left->root->aggregate.nodes;
+    }
+
+    free_node_pool(right->pool);
+    free(right);
 }
 
 void free_redblack_tree(RedBlackTree *tree) {
@@ -504,17 +1362,22 @@ void free_redblack_tree(RedBlackTree *tree) {
         return;
     }
 
-    free_redblack_node(tree->root);
+    // Nodes only have to be handed back when other trees still use the pool,
+    // otherwise dropping its slabs tears the whole tree down at once.
+    if (tree->pool->references > 1) {
+        free_redblack_node(tree, tree->root);
+    }
+
+    free_node_pool(tree->pool);
     free(tree);
 }
 
-void free_redblack_node(RedBlackTreeNode *node) {
+void free_redblack_node(RedBlackTree *tree, RedBlackTreeNode *node) {
     if (node == NULL) {
         return;
     }
 
-    free_redblack_node(node->left);
-    free_redblack_node(node->right);
-    free(node->value);
-    free(node);
+    free_redblack_node(tree, node->left);
+    free_redblack_node(tree, node->right);
+    pool_release(tree->pool, node);
 }
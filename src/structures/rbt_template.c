@@ -0,0 +1,268 @@
+#include "structures/rbt_template.h"
+
+// Rebalancing for the RBT_DEFINE instantiations. It only moves links around,
+// so one copy serves every key type.
+
+void rbt_links_replace_child(RbtLinks **root, RbtLinks *parent, RbtLinks *old, RbtLinks *new);
+void rbt_links_rotate_left(RbtLinks **root, RbtLinks *x);
+void rbt_links_rotate_right(RbtLinks **root, RbtLinks *x);
+void rbt_links_erase_fixup(RbtLinks **root, RbtLinks *x, RbtLinks *parent);
+
+void rbt_links_replace_child(RbtLinks **root, RbtLinks *parent, RbtLinks *old, RbtLinks *new) {
+    if (parent == NULL) {
+        *root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+void rbt_links_rotate_left(RbtLinks **root, RbtLinks *x) {
+    RbtLinks *y = x->right;
+
+    x->right = y->left;
+    if (y->left != NULL) {
+        y->left->parent = x;
+    }
+
+    y->parent = x->parent;
+    rbt_links_replace_child(root, x->parent, x, y);
+
+    y->left = x;
+    x->parent = y;
+}
+
+void rbt_links_rotate_right(RbtLinks **root, RbtLinks *x) {
+    RbtLinks *y = x->left;
+
+    x->left = y->right;
+    if (y->right != NULL) {
+        y->right->parent = x;
+    }
+
+    y->parent = x->parent;
+    rbt_links_replace_child(root, x->parent, x, y);
+
+    y->right = x;
+    x->parent = y;
+}
+
+// Hangs node at link (a NULL child slot of parent, or the root) and rebalances
+void rbt_links_insert(RbtLinks **root, RbtLinks *parent, RbtLinks **link, RbtLinks *node) {
+    node->left = node->right = NULL;
+    node->parent = parent;
+    node->color = RBT_LINKS_RED;
+    *link = node;
+
+    while (node->parent != NULL && node->parent->color == RBT_LINKS_RED) {
+        RbtLinks *parentNode = node->parent;
+        RbtLinks *grandParent = parentNode->parent;
+
+        if (parentNode == grandParent->left) {
+            RbtLinks *uncle = grandParent->right;
+
+            if (uncle != NULL && uncle->color == RBT_LINKS_RED) {
+                parentNode->color = uncle->color = RBT_LINKS_BLACK;
+                grandParent->color = RBT_LINKS_RED;
+                node = grandParent;
+                continue;
+            }
+
+            if (node == parentNode->right) {
+                rbt_links_rotate_left(root, parentNode);
+                node = parentNode;
+                parentNode = node->parent;
+            }
+
+            parentNode->color = RBT_LINKS_BLACK;
+            grandParent->color = RBT_LINKS_RED;
+            rbt_links_rotate_right(root, grandParent);
+        } else {
+            RbtLinks *uncle = grandParent->left;
+
+            if (uncle != NULL && uncle->color == RBT_LINKS_RED) {
+                parentNode->color = uncle->color = RBT_LINKS_BLACK;
+                grandParent->color = RBT_LINKS_RED;
+                node = grandParent;
+                continue;
+            }
+
+            if (node == parentNode->left) {
+                rbt_links_rotate_right(root, parentNode);
+                node = parentNode;
+                parentNode = node->parent;
+            }
+
+            parentNode->color = RBT_LINKS_BLACK;
+            grandParent->color = RBT_LINKS_RED;
+            rbt_links_rotate_left(root, grandParent);
+        }
+    }
+
+    (*root)->color = RBT_LINKS_BLACK;
+}
+
+void rbt_links_erase(RbtLinks **root, RbtLinks *node) {
+    RbtLinks *x;
+    RbtLinks *xParent;
+    enum RBT_LINKS_COLOR removedColor = node->color;
+
+    if (node->left == NULL || node->right == NULL) {
+        x = node->left != NULL ? node->left : node->right;
+        xParent = node->parent;
+
+        if (x != NULL) {
+            x->parent = xParent;
+        }
+        rbt_links_replace_child(root, xParent, node, x);
+    } else {
+        // Two children: the successor takes node's place and color
+        RbtLinks *successor = rbt_links_first(node->right);
+
+        removedColor = successor->color;
+        x = successor->right;
+
+        if (successor->parent == node) {
+            xParent = successor;
+        } else {
+            xParent = successor->parent;
+            xParent->left = x;
+            if (x != NULL) {
+                x->parent = xParent;
+            }
+
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->parent = node->parent;
+        successor->color = node->color;
+        rbt_links_replace_child(root, node->parent, node, successor);
+    }
+
+    if (removedColor == RBT_LINKS_BLACK) {
+        rbt_links_erase_fixup(root, x, xParent);
+    }
+}
+
+// x carries an extra black, parent is needed because x may be NULL
+void rbt_links_erase_fixup(RbtLinks **root, RbtLinks *x, RbtLinks *parent) {
+    while (x != *root && (x == NULL || x->color == RBT_LINKS_BLACK)) {
+        if (x == parent->left) {
+            RbtLinks *sibling = parent->right;
+
+            if (sibling->color == RBT_LINKS_RED) {
+                sibling->color = RBT_LINKS_BLACK;
+                parent->color = RBT_LINKS_RED;
+                rbt_links_rotate_left(root, parent);
+                sibling = parent->right;
+            }
+
+            if ((sibling->left == NULL || sibling->left->color == RBT_LINKS_BLACK)
+                && (sibling->right == NULL || sibling->right->color == RBT_LINKS_BLACK)) {
+                sibling->color = RBT_LINKS_RED;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+
+            if (sibling->right == NULL || sibling->right->color == RBT_LINKS_BLACK) {
+                sibling->left->color = RBT_LINKS_BLACK;
+                sibling->color = RBT_LINKS_RED;
+                rbt_links_rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RBT_LINKS_BLACK;
+            sibling->right->color = RBT_LINKS_BLACK;
+            rbt_links_rotate_left(root, parent);
+        } else {
+            RbtLinks *sibling = parent->left;
+
+            if (sibling->color == RBT_LINKS_RED) {
+                sibling->color = RBT_LINKS_BLACK;
+                parent->color = RBT_LINKS_RED;
+                rbt_links_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+
+            if ((sibling->left == NULL || sibling->left->color == RBT_LINKS_BLACK)
+                && (sibling->right == NULL || sibling->right->color == RBT_LINKS_BLACK)) {
+                sibling->color = RBT_LINKS_RED;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+
+            if (sibling->left == NULL || sibling->left->color == RBT_LINKS_BLACK) {
+                sibling->right->color = RBT_LINKS_BLACK;
+                sibling->color = RBT_LINKS_RED;
+                rbt_links_rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RBT_LINKS_BLACK;
+            sibling->left->color = RBT_LINKS_BLACK;
+            rbt_links_rotate_right(root, parent);
+        }
+
+        x = *root;
+    }
+
+    if (x != NULL) {
+        x->color = RBT_LINKS_BLACK;
+    }
+}
+
+RbtLinks *rbt_links_first(RbtLinks *root) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    while (root->left != NULL) {
+        root = root->left;
+    }
+
+    return root;
+}
+
+RbtLinks *rbt_links_last(RbtLinks *root) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    while (root->right != NULL) {
+        root = root->right;
+    }
+
+    return root;
+}
+
+RbtLinks *rbt_links_next(RbtLinks *node) {
+    if (node->right != NULL) {
+        return rbt_links_first(node->right);
+    }
+
+    while (node->parent != NULL && node == node->parent->right) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+RbtLinks *rbt_links_prev(RbtLinks *node) {
+    if (node->left != NULL) {
+        return rbt_links_last(node->left);
+    }
+
+    while (node->parent != NULL && node == node->parent->left) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
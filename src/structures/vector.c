@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "structures/vector.h"
 
 Vector *initialize_vector(char *type, size_t type_size) {
@@ -8,12 +9,13 @@ Vector *initialize_vector(char *type, size_t type_size) {
 
     if (!strcmp(type, "char")) {
         vector->type = TYPE_CHAR;
+    } else if (!strcmp(type, "int")) {
+        vector->type = TYPE_INT;
+    } else if (!strcmp(type, "size_t")) {
+        vector->type = TYPE_SIZE_T;
+    } else {
+        vector->type = TYPE_STRUCT;
     }
-    //! TODO: Ignore for now!
-    //  else {
-    //     kill_vector(vector); // dk why, but don't care
-    //     assert(0 && "CANNOT INITIALIZE A VECTOR WITH THAT TYPE!");
-    // }
 
     vector->len = 0;
     vector->size = 2;
@@ -46,6 +48,26 @@ void vec_push_back(Vector *vector, void *element) {
     }
 }
 
+// Makes room for at least size elements, so bulk writers can fill base directly
+void vec_reserve(Vector *vector, size_t size) {
+    if (size <= vector->size) {
+        return;
+    }
+
+    size_t newSize = vector->size;
+
+    while (newSize < size) {
+        newSize *= 2;
+    }
+
+    vector->base = realloc(vector->base, newSize * vector->type_size);
+
+    if (!vector->base)
+        assert(0 && "vector realloc failed");
+
+    vector->size = newSize;
+}
+
 void vec_clear(Vector *vector) {
     if (!vector) return;
 
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <string.h>
+#include "text/newline_scan.h"
+#include "text/simd.h"
+
+// Each vector kernel turns 64 bytes into a bitmask of where the '\n's are
+#define NEWLINE_SCAN_BLOCK 64
+
+// The counters add up the compare results of this many blocks per byte lane
+// before summing the lanes, a lane holds at most 255
+#define NEWLINE_COUNT_ROUNDS 255
+
+typedef size_t(*NewlineScanner)(const char *text, size_t length, size_t base, size_t *out);
+typedef size_t(*NewlineCounter)(const char *text, size_t length);
+
+size_t scan_line_starts_scalar(const char *text, size_t length, size_t base, size_t *out);
+size_t count_newlines_scalar(const char *text, size_t length);
+void pick_newline_kernels();
+
+static NewlineScanner scanner = NULL;
+static NewlineCounter counter = NULL;
+static enum NEWLINE_SCANNERS scannerKind = NEWLINE_SCANNER_SCALAR;
+
+// Writes one line start per set bit of mask, lowest bit first
+static inline size_t emit_line_starts(uint64_t mask, size_t at, size_t *out) {
+    size_t count = 0;
+
+    while (mask) {
+        out[count++] = at + trailing_zeros64(mask) + 1;
+        mask &= mask - 1;
+    }
+
+    return count;
+}
+
+size_t scan_line_starts_scalar(const char *text, size_t length, size_t base, size_t *out) {
+    const char *cursor = text;
+    const char *end = text + length;
+    size_t count = 0;
+
+    // memchr is already vectorized by most C libraries
+    while (cursor < end && (cursor = memchr(cursor, '\n', (size_t) (end - cursor))) != NULL) {
+        out[count++] = base + (size_t) (cursor - text) + 1;
+        cursor++;
+    }
+
+    return count;
+}
+
+size_t count_newlines_scalar(const char *text, size_t length) {
+    const char *cursor = text;
+    const char *end = text + length;
+    size_t count = 0;
+
+    while (cursor < end && (cursor = memchr(cursor, '\n', (size_t) (end - cursor))) != NULL) {
+        count++;
+        cursor++;
+    }
+
+    return count;
+}
+
+#ifdef TEXT_SIMD_SSE2
+size_t scan_line_starts_sse2(const char *text, size_t length, size_t base, size_t *out) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + NEWLINE_SCAN_BLOCK <= length; i += NEWLINE_SCAN_BLOCK) {
+        const __m128i *block = (const __m128i *) (text + i);
+        uint64_t a = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(block), newline));
+        uint64_t b = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(block + 1), newline));
+        uint64_t c = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(block + 2), newline));
+        uint64_t d = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(block + 3), newline));
+        uint64_t mask = a | (b << 16) | (c << 32) | (d << 48);
+
+        if (mask) {
+            count += emit_line_starts(mask, base + i, out + count);
+        }
+    }
+
+    return count + scan_line_starts_scalar(text + i, length - i, base + i, out + count);
+}
+
+// A match compares to -1, subtracting it counts it in its byte lane
+size_t count_newlines_sse2(const char *text, size_t length) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+
+    while (i + 16 <= length) {
+        __m128i lanes = zero;
+
+        for (int round = 0; round < NEWLINE_COUNT_ROUNDS && i + 16 <= length; round++, i += 16) {
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (text + i)), newline));
+        }
+
+        total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+    }
+
+    uint64_t sums[2];
+
+    _mm_storeu_si128((__m128i *) sums, total);
+
+    return (size_t) (sums[0] + sums[1]) + count_newlines_scalar(text + i, length - i);
+}
+#endif
+
+#ifdef TEXT_SIMD_X86
+TEXT_SIMD_TARGET_AVX2
+size_t scan_line_starts_avx2(const char *text, size_t length, size_t base, size_t *out) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + NEWLINE_SCAN_BLOCK <= length; i += NEWLINE_SCAN_BLOCK) {
+        const __m256i *block = (const __m256i *) (text + i);
+        uint64_t low = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(block), newline));
+        uint64_t high = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(block + 1), newline));
+        uint64_t mask = low | (high << 32);
+
+        if (mask) {
+            count += emit_line_starts(mask, base + i, out + count);
+        }
+    }
+
+    return count + scan_line_starts_scalar(text + i, length - i, base + i, out + count);
+}
+
+TEXT_SIMD_TARGET_AVX2
+size_t count_newlines_avx2(const char *text, size_t length) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+
+    while (i + 32 <= length) {
+        __m256i lanes = zero;
+
+        for (int round = 0; round < NEWLINE_COUNT_ROUNDS && i + 32 <= length; round++, i += 32) {
+            lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (text + i)), newline));
+        }
+
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(lanes, zero));
+    }
+
+    uint64_t sums[4];
+
+    _mm256_storeu_si256((__m256i *) sums, total);
+
+    return (size_t) (sums[0] + sums[1] + sums[2] + sums[3]) + count_newlines_scalar(text + i, length - i);
+}
+#endif
+
+void pick_newline_kernels() {
+#ifdef TEXT_SIMD_X86
+    if (cpu_supports_avx2()) {
+        scannerKind = NEWLINE_SCANNER_AVX2;
+        counter = count_newlines_avx2;
+        scanner = scan_line_starts_avx2;
+        return;
+    }
+#endif
+#ifdef TEXT_SIMD_SSE2
+    scannerKind = NEWLINE_SCANNER_SSE2;
+    counter = count_newlines_sse2;
+    scanner = scan_line_starts_sse2;
+#else
+    scannerKind = NEWLINE_SCANNER_SCALAR;
+    counter = count_newlines_scalar;
+    scanner = scan_line_starts_scalar;
+#endif
+}
+
+enum NEWLINE_SCANNERS newline_scanner_in_use() {
+    if (scanner == NULL) {
+        pick_newline_kernels();
+    }
+
+    return scannerKind;
+}
+
+size_t count_newlines(const char *text, size_t length) {
+    if (counter == NULL) {
+        pick_newline_kernels();
+    }
+
+    return counter(text, length);
+}
+
+size_t scan_line_starts(const char *text, size_t length, size_t base, Vector *lineStarts) {
+    if (scanner == NULL) {
+        pick_newline_kernels();
+    }
+
+    size_t total = 0;
+
+    // Reserve for the worst case of a chunk being all newlines, chunking keeps
+    // that reservation small for huge buffers with few lines.
+    while (length > 0) {
+        size_t chunk = length < (1 << 20) ? length : (1 << 20);
+
+        vec_reserve(lineStarts, lineStarts->len + chunk);
+
+        size_t found = scanner(text, chunk, base, (size_t *) lineStarts->base + lineStarts->len);
+
+        lineStarts->len += found;
+        total += found;
+        text += chunk;
+        base += chunk;
+        length -= chunk;
+    }
+
+    return total;
+}
@@ -0,0 +1,1793 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "text/regex.h"
+#include "text/search.h"
+
+// Longer patterns are refused: every state of the automata is a set of
+// instructions, the closure of one is walked for each new transition
+#define REGEX_MAX_INSTRUCTIONS 4096
+// Groups nested deeper than this are refused, the parser recurses on them
+#define REGEX_MAX_DEPTH 64
+// Lines up to this long are matched in a copy on the stack
+#define REGEX_LINE_WINDOW 512
+
+static const char *const PatternTooLong = "E339: Pattern too long";
+static const char *const UnmatchedOpen = "E54: Unmatched \\(";
+static const char *const UnmatchedClose = "E55: Unmatched \\)";
+static const char *const NestedMulti = "E61: Nested *";
+static const char *const MultiFollowsNothing = "E64: * follows nothing";
+static const char *const BadBraces = "E554: Syntax error in \\{...}";
+static const char *const ReverseRange = "E944: Reverse range in character class";
+static const char *const InvalidPattern = "E383: Invalid search string";
+static const char *const OutOfMemory = "E342: Out of memory";
+
+enum REGEX_OPCODES {
+    REGEX_BYTES = 0,
+    REGEX_SPLIT,
+    REGEX_JUMP,
+    REGEX_LINE_START,
+    REGEX_LINE_END,
+    REGEX_WORD_START,
+    REGEX_WORD_END,
+    REGEX_MATCH
+};
+
+enum REGEX_NODES {
+    REGEX_NODE_EMPTY = 0,
+    REGEX_NODE_BYTES,
+    REGEX_NODE_CONCAT,
+    REGEX_NODE_ALTERNATE,
+    REGEX_NODE_REPEAT,
+    REGEX_NODE_ASSERT
+};
+
+// What a state knows besides its instructions: the byte before it, and
+// whether a match may start anywhere (searching) or only where it began
+enum REGEX_STATE_FLAGS {
+    REGEX_AFTER_LINE_BREAK = 1, // or the start of the document
+    REGEX_AFTER_WORD = 2,
+    REGEX_UNANCHORED = 4
+};
+
+// A transition is the next state shifted left, with these in its low bits
+enum REGEX_TRANSITION_FLAGS {
+    REGEX_MATCH_BEFORE = 1, // a match ends (starts, reversed) before the byte
+    REGEX_DEAD = 2 // nothing can match any more
+};
+
+#define REGEX_TRANSITION_SHIFT 2
+#define REGEX_NO_TRANSITION (-1)
+
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+typedef struct {
+    unsigned char opcode;
+    int next;
+    int alternative; // the other way out of a split
+    int set; // bytes a REGEX_BYTES takes
+} RegexInstruction;
+
+typedef struct {
+    unsigned char type;
+    unsigned char assertion; // opcode of a REGEX_NODE_ASSERT
+    int left; // children, a repeat only has left
+    int right;
+    int set;
+    int min;
+    int max; // -1 for no limit
+} RegexNode;
+
+typedef struct {
+    const char *text;
+    const char *end;
+    RegexNode *nodes;
+    int nodeCount;
+    int nodeSize;
+    ByteSet *sets;
+    int setCount;
+    int setSize;
+    int depth;
+    const char *error;
+} RegexParser;
+
+typedef struct {
+    RegexInstruction *program;
+    int length;
+    int size;
+    const RegexNode *nodes;
+    const char *error;
+} RegexEmitter;
+
+typedef struct {
+    size_t kernel; // where its instructions are in the kernels
+    int length;
+    unsigned char flags;
+} RegexState;
+
+// A DFA built while it runs: a state is the set of instructions threads are
+// on (its kernel), a transition is worked out the first time it is taken and
+// kept. When the cache holds limit bytes it is dropped and built again.
+struct RegexAutomaton {
+    RegexInstruction *program;
+    int length;
+    const ByteSet *sets;
+    // Bytes no instruction tells apart share a class, and a column of transitions
+    unsigned char classes[256];
+    unsigned char representatives[256];
+    unsigned char classFlags[257]; // the REGEX_AFTER_* flags of a class, the edge last
+    int classCount; // the edge of the document is class classCount
+    int stride; // transitions per state, one per class and the edge
+    RegexState *states;
+    int stateCount;
+    int stateSize;
+    int *kernels;
+    size_t kernelsLength;
+    size_t kernelsSize;
+    int *transitions;
+    int *table; // hash of the states, -1 for a free slot
+    size_t tableSize;
+    int starts[8]; // start state per REGEX_STATE_FLAGS, -1 until built
+    size_t memory;
+    size_t limit;
+    size_t flushes;
+    // Scratch for building transitions
+    int *stack;
+    unsigned *visited;
+    unsigned *added;
+    unsigned stamp;
+    int *kernel;
+    int *kept;
+};
+
+// ---------------------------------------------------------
+// Byte sets
+// ---------------------------------------------------------
+
+static void set_add(ByteSet *set, unsigned char byte) {
+    set->bits[byte >> 6] |= (uint64_t) 1 << (byte & 63);
+}
+
+static void set_add_range(ByteSet *set, unsigned char low, unsigned char high) {
+    for (int byte = low; byte <= high; byte++) {
+        set_add(set, (unsigned char) byte);
+    }
+}
+
+static int set_has(const ByteSet *set, unsigned char byte) {
+    return (set->bits[byte >> 6] >> (byte & 63)) & 1;
+}
+
+static void set_invert(ByteSet *set) {
+    for (int i = 0; i < 4; i++) {
+        set->bits[i] = ~set->bits[i];
+    }
+}
+
+static int is_word_byte(int byte) {
+    return (byte >= '0' && byte <= '9') || (byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z') || byte == '_';
+}
+
+// "\d", "\w", "\s"... their upper case is everything else. Returns 1 when
+// letter names no class.
+static int escape_class(char letter, ByteSet *set) {
+    char lower = letter >= 'A' && letter <= 'Z' ? (char) (letter - 'A' + 'a') : letter;
+
+    memset(set, 0, sizeof(*set));
+
+    switch (lower) {
+    case 'd':
+        set_add_range(set, '0', '9');
+        break;
+    case 'w':
+        set_add_range(set, '0', '9');
+        // fallthrough
+    case 'h':
+        set_add_range(set, 'A', 'Z');
+        set_add_range(set, 'a', 'z');
+        set_add(set, '_');
+        break;
+    case 's':
+        set_add(set, ' ');
+        set_add(set, '\t');
+        break;
+    case 'a':
+        set_add_range(set, 'A', 'Z');
+        set_add_range(set, 'a', 'z');
+        break;
+    case 'l':
+        set_add_range(set, 'a', 'z');
+        break;
+    case 'u':
+        set_add_range(set, 'A', 'Z');
+        break;
+    case 'x':
+        set_add_range(set, '0', '9');
+        set_add_range(set, 'A', 'F');
+        set_add_range(set, 'a', 'f');
+        break;
+    default:
+        return 1;
+    }
+
+    if (lower != letter) {
+        set_invert(set);
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Parser: vim's "magic" syntax to a tree of nodes
+// ---------------------------------------------------------
+
+static int parse_alternation(RegexParser *parser);
+
+static int add_node(RegexParser *parser, RegexNode node) {
+    if (parser->nodeCount == parser->nodeSize) {
+        int size = parser->nodeSize > 0 ? parser->nodeSize * 2 : 32;
+        RegexNode *nodes = realloc(parser->nodes, (size_t) size * sizeof(*nodes));
+
+        if (nodes == NULL) {
+            parser->error = OutOfMemory;
+            return -1;
+        }
+
+        parser->nodes = nodes;
+        parser->nodeSize = size;
+    }
+
+    parser->nodes[parser->nodeCount] = node;
+
+    return parser->nodeCount++;
+}
+
+// No set holds the line break, matches never run over a line
+static int add_bytes_node(RegexParser *parser, ByteSet *set) {
+    if (parser->setCount == parser->setSize) {
+        int size = parser->setSize > 0 ? parser->setSize * 2 : 16;
+        ByteSet *sets = realloc(parser->sets, (size_t) size * sizeof(*sets));
+
+        if (sets == NULL) {
+            parser->error = OutOfMemory;
+            return -1;
+        }
+
+        parser->sets = sets;
+        parser->setSize = size;
+    }
+
+    set->bits['\n' >> 6] &= ~((uint64_t) 1 << ('\n' & 63));
+    parser->sets[parser->setCount] = *set;
+
+    return add_node(parser, (RegexNode) { .type = REGEX_NODE_BYTES, .set = parser->setCount++ });
+}
+
+static int add_byte_node(RegexParser *parser, unsigned char byte) {
+    ByteSet set = { { 0 } };
+
+    set_add(&set, byte);
+
+    return add_bytes_node(parser, &set);
+}
+
+static int fail_parse(RegexParser *parser, const char *error) {
+    parser->error = error;
+
+    return -1;
+}
+
+static int at_escape(RegexParser *parser, const char *at, char character) {
+    return at + 1 < parser->end && at[0] == '\\' && at[1] == character;
+}
+
+// "$" is only the end of a line last in a branch
+static int at_branch_end(RegexParser *parser, const char *at) {
+    return at >= parser->end || at_escape(parser, at, '|') || at_escape(parser, at, ')');
+}
+
+static int at_multi(RegexParser *parser) {
+    const char *at = parser->text;
+
+    return at < parser->end && (*at == '*' || at_escape(parser, at, '+') || at_escape(parser, at, '=') ||
+                                at_escape(parser, at, '?') || at_escape(parser, at, '{'));
+}
+
+// One byte of a "[]" class, a backslash only escapes what is special there
+static unsigned char class_byte(RegexParser *parser, const char **at) {
+    unsigned char byte = (unsigned char) *(*at)++;
+
+    if (byte != '\\' || *at >= parser->end) {
+        return byte;
+    }
+
+    switch (**at) {
+    case '\\':
+    case ']':
+    case '^':
+    case '-':
+        return (unsigned char) *(*at)++;
+    case 't':
+        (*at)++;
+        return '\t';
+    case 'e':
+        (*at)++;
+        return 27;
+    case 'r':
+        (*at)++;
+        return '\r';
+    default:
+        return byte;
+    }
+}
+
+// "[abc]", "[^a-z]". A "]" right after "[" or "[^" is one of the bytes. A
+// "[" without its "]" is a plain "[": returns -2 for that.
+static int parse_class(RegexParser *parser) {
+    const char *at = parser->text + 1;
+    ByteSet set = { { 0 } };
+    int negated = 0;
+
+    if (at < parser->end && *at == '^') {
+        negated = 1;
+        at++;
+    }
+
+    if (at < parser->end && *at == ']') {
+        set_add(&set, ']');
+        at++;
+    }
+
+    while (at < parser->end && *at != ']') {
+        unsigned char low = class_byte(parser, &at);
+
+        if (at + 1 < parser->end && *at == '-' && at[1] != ']') {
+            at++;
+            unsigned char high = class_byte(parser, &at);
+
+            if (high < low) {
+                return fail_parse(parser, ReverseRange);
+            }
+
+            set_add_range(&set, low, high);
+        } else {
+            set_add(&set, low);
+        }
+    }
+
+    if (at >= parser->end) {
+        return -2;
+    }
+
+    parser->text = at + 1;
+
+    if (negated) {
+        set_invert(&set);
+    }
+
+    return add_bytes_node(parser, &set);
+}
+
+static int parse_group(RegexParser *parser) {
+    int inner = parse_alternation(parser);
+
+    if (inner < 0) {
+        return -1;
+    }
+
+    if (!at_escape(parser, parser->text, ')')) {
+        return fail_parse(parser, UnmatchedOpen);
+    }
+
+    parser->text += 2;
+
+    return inner;
+}
+
+static int parse_escape(RegexParser *parser) {
+    char character = parser->text[1];
+    ByteSet set;
+
+    parser->text += 2;
+
+    switch (character) {
+    case '(':
+        return parse_group(parser);
+    case '%':
+        // "\%(" groups without capturing, nothing captures here anyway
+        if (parser->text < parser->end && *parser->text == '(') {
+            parser->text++;
+            return parse_group(parser);
+        }
+
+        return fail_parse(parser, InvalidPattern);
+    case '<':
+        return add_node(parser, (RegexNode) { .type = REGEX_NODE_ASSERT, .assertion = REGEX_WORD_START });
+    case '>':
+        return add_node(parser, (RegexNode) { .type = REGEX_NODE_ASSERT, .assertion = REGEX_WORD_END });
+    case '+':
+    case '=':
+    case '?':
+    case '{':
+        return fail_parse(parser, MultiFollowsNothing);
+    case 'n':
+        // A match would run over the end of the line
+        return fail_parse(parser, InvalidPattern);
+    case 't':
+        return add_byte_node(parser, '\t');
+    case 'e':
+        return add_byte_node(parser, 27);
+    case 'r':
+        return add_byte_node(parser, '\r');
+    default:
+        if (!escape_class(character, &set)) {
+            return add_bytes_node(parser, &set);
+        }
+
+        return add_byte_node(parser, (unsigned char) character);
+    }
+}
+
+static int parse_atom(RegexParser *parser, int atStart) {
+    unsigned char character = (unsigned char) *parser->text;
+
+    if (character == '^' && atStart) {
+        parser->text++;
+        return add_node(parser, (RegexNode) { .type = REGEX_NODE_ASSERT, .assertion = REGEX_LINE_START });
+    }
+
+    if (character == '$' && at_branch_end(parser, parser->text + 1)) {
+        parser->text++;
+        return add_node(parser, (RegexNode) { .type = REGEX_NODE_ASSERT, .assertion = REGEX_LINE_END });
+    }
+
+    if (character == '.') {
+        ByteSet set;
+
+        memset(&set, 0xff, sizeof(set));
+        parser->text++;
+
+        return add_bytes_node(parser, &set);
+    }
+
+    if (character == '[') {
+        int node = parse_class(parser);
+
+        if (node != -2) {
+            return node;
+        }
+    }
+
+    if (character == '\\' && parser->text + 1 < parser->end) {
+        return parse_escape(parser);
+    }
+
+    // Anything else is itself, "*" too where there is nothing to repeat
+    parser->text++;
+
+    return add_byte_node(parser, character);
+}
+
+static int parse_count(RegexParser *parser, int *count) {
+    if (parser->text >= parser->end || *parser->text < '0' || *parser->text > '9') {
+        return 0;
+    }
+
+    for (*count = 0; parser->text < parser->end && *parser->text >= '0' && *parser->text <= '9'; parser->text++) {
+        if (*count <= REGEX_MAX_INSTRUCTIONS) {
+            *count = *count * 10 + (*parser->text - '0');
+        }
+    }
+
+    return 1;
+}
+
+// "\{n,m}" and its shorter forms, parser is past the "\{". The lazy "\{-"
+// has no meaning for leftmost-longest matches and is refused.
+static int parse_braces(RegexParser *parser, int *min, int *max) {
+    int hasMin = parse_count(parser, min);
+
+    *max = hasMin ? *min : -1;
+
+    if (!hasMin) {
+        *min = 0;
+    }
+
+    if (parser->text < parser->end && *parser->text == ',') {
+        parser->text++;
+
+        if (!parse_count(parser, max)) {
+            *max = -1;
+        }
+    }
+
+    if (parser->text < parser->end && *parser->text == '\\') {
+        parser->text++;
+    }
+
+    if (parser->text >= parser->end || *parser->text != '}') {
+        return fail_parse(parser, BadBraces);
+    }
+
+    parser->text++;
+
+    if (*min > REGEX_MAX_INSTRUCTIONS || *max > REGEX_MAX_INSTRUCTIONS) {
+        return fail_parse(parser, PatternTooLong);
+    }
+
+    if (*max >= 0 && *min > *max) {
+        int swap = *min;
+        *min = *max;
+        *max = swap;
+    }
+
+    return 0;
+}
+
+// An atom and what repeats it: "*", "\+", "\=" or "\?", "\{n,m}"
+static int parse_piece(RegexParser *parser, int atStart) {
+    int atom = parse_atom(parser, atStart);
+
+    // "^*" is a "*" at the start of a line
+    if (atom < 0 || !at_multi(parser) ||
+        (parser->nodes[atom].type == REGEX_NODE_ASSERT && parser->nodes[atom].assertion == REGEX_LINE_START)) {
+        return atom;
+    }
+
+    int min = 0, max = -1;
+
+    if (*parser->text == '*') {
+        parser->text++;
+    } else {
+        char multi = parser->text[1];
+
+        parser->text += 2;
+
+        if (multi == '+') {
+            min = 1;
+        } else if (multi == '=' || multi == '?') {
+            max = 1;
+        } else if (parse_braces(parser, &min, &max)) {
+            return -1;
+        }
+    }
+
+    if (at_multi(parser)) {
+        return fail_parse(parser, NestedMulti);
+    }
+
+    return add_node(parser, (RegexNode) { .type = REGEX_NODE_REPEAT, .left = atom, .min = min, .max = max });
+}
+
+static int parse_branch(RegexParser *parser) {
+    int branch = -1;
+
+    while (parser->text < parser->end && !at_escape(parser, parser->text, '|') && !at_escape(parser, parser->text, ')')) {
+        int piece = parse_piece(parser, branch < 0);
+
+        if (piece < 0) {
+            return -1;
+        }
+
+        branch = branch < 0 ? piece : add_node(parser, (RegexNode) { .type = REGEX_NODE_CONCAT, .left = branch, .right = piece });
+
+        if (branch < 0) {
+            return -1;
+        }
+    }
+
+    return branch >= 0 ? branch : add_node(parser, (RegexNode) { .type = REGEX_NODE_EMPTY });
+}
+
+static int parse_alternation(RegexParser *parser) {
+    if (++parser->depth > REGEX_MAX_DEPTH) {
+        return fail_parse(parser, PatternTooLong);
+    }
+
+    int alternation = parse_branch(parser);
+
+    while (alternation >= 0 && at_escape(parser, parser->text, '|')) {
+        parser->text += 2;
+
+        int branch = parse_branch(parser);
+
+        if (branch < 0) {
+            return -1;
+        }
+
+        alternation = add_node(parser, (RegexNode) { .type = REGEX_NODE_ALTERNATE, .left = alternation, .right = branch });
+    }
+
+    parser->depth--;
+
+    return alternation;
+}
+
+// ---------------------------------------------------------
+// Programs: the tree as NFA instructions, forwards or backwards
+// ---------------------------------------------------------
+
+static int emit_instruction(RegexEmitter *emitter, unsigned char opcode, int set) {
+    if (emitter->length >= REGEX_MAX_INSTRUCTIONS) {
+        emitter->error = PatternTooLong;
+        return -1;
+    }
+
+    if (emitter->length == emitter->size) {
+        int size = emitter->size > 0 ? emitter->size * 2 : 64;
+        RegexInstruction *program = realloc(emitter->program, (size_t) size * sizeof(*program));
+
+        if (program == NULL) {
+            emitter->error = OutOfMemory;
+            return -1;
+        }
+
+        emitter->program = program;
+        emitter->size = size;
+    }
+
+    emitter->program[emitter->length] = (RegexInstruction) { opcode, emitter->length + 1, -1, set };
+
+    return emitter->length++;
+}
+
+// Read backwards, the start of a line or word is where it ends
+static unsigned char mirror_assertion(unsigned char assertion) {
+    switch (assertion) {
+    case REGEX_LINE_START:
+        return REGEX_LINE_END;
+    case REGEX_LINE_END:
+        return REGEX_LINE_START;
+    case REGEX_WORD_START:
+        return REGEX_WORD_END;
+    default:
+        return REGEX_WORD_START;
+    }
+}
+
+static int emit_node(RegexEmitter *emitter, int index, int reverse) {
+    const RegexNode *node = &emitter->nodes[index];
+
+    switch (node->type) {
+    case REGEX_NODE_EMPTY:
+        return 0;
+    case REGEX_NODE_BYTES:
+        return emit_instruction(emitter, REGEX_BYTES, node->set) < 0;
+    case REGEX_NODE_ASSERT:
+        return emit_instruction(emitter, reverse ? mirror_assertion(node->assertion) : node->assertion, -1) < 0;
+    case REGEX_NODE_CONCAT:
+        return emit_node(emitter, reverse ? node->right : node->left, reverse) ||
+               emit_node(emitter, reverse ? node->left : node->right, reverse);
+    case REGEX_NODE_ALTERNATE: {
+        int split = emit_instruction(emitter, REGEX_SPLIT, -1);
+
+        if (split < 0 || emit_node(emitter, node->left, reverse)) {
+            return 1;
+        }
+
+        int jump = emit_instruction(emitter, REGEX_JUMP, -1);
+
+        if (jump < 0) {
+            return 1;
+        }
+
+        emitter->program[split].alternative = emitter->length;
+
+        if (emit_node(emitter, node->right, reverse)) {
+            return 1;
+        }
+
+        emitter->program[jump].next = emitter->length;
+
+        return 0;
+    }
+    default: {
+        int child = node->left, min = node->min, max = node->max;
+
+        for (int i = 0; i < min; i++) {
+            if (emit_node(emitter, child, reverse)) {
+                return 1;
+            }
+        }
+
+        if (max < 0) {
+            int loop = emit_instruction(emitter, REGEX_SPLIT, -1);
+
+            if (loop < 0 || emit_node(emitter, child, reverse)) {
+                return 1;
+            }
+
+            int jump = emit_instruction(emitter, REGEX_JUMP, -1);
+
+            if (jump < 0) {
+                return 1;
+            }
+
+            emitter->program[jump].next = loop;
+            emitter->program[loop].alternative = emitter->length;
+
+            return 0;
+        }
+
+        // Each optional copy can be skipped to the end, the splits waiting
+        // for it are chained through their alternative
+        int pending = -1;
+
+        for (int i = min; i < max; i++) {
+            int split = emit_instruction(emitter, REGEX_SPLIT, -1);
+
+            if (split < 0) {
+                return 1;
+            }
+
+            emitter->program[split].alternative = pending;
+            pending = split;
+
+            if (emit_node(emitter, child, reverse)) {
+                return 1;
+            }
+        }
+
+        while (pending >= 0) {
+            int previous = emitter->program[pending].alternative;
+
+            emitter->program[pending].alternative = emitter->length;
+            pending = previous;
+        }
+
+        return 0;
+    }
+    }
+}
+
+// ---------------------------------------------------------
+// Automata
+// ---------------------------------------------------------
+
+static void assign_byte_classes(RegexAutomaton *automaton, const ByteSet *sets, int setCount) {
+    unsigned char boundary[257] = { 0 };
+
+    boundary[0] = 1;
+
+    for (int set = 0; set < setCount; set++) {
+        for (int byte = 1; byte < 256; byte++) {
+            if (set_has(&sets[set], (unsigned char) byte) != set_has(&sets[set], (unsigned char) (byte - 1))) {
+                boundary[byte] = 1;
+            }
+        }
+    }
+
+    // The assertions look at line breaks and word bytes, a class has to be
+    // all or none of them
+    boundary['\n'] = boundary['\n' + 1] = 1;
+
+    for (int byte = 1; byte < 256; byte++) {
+        if (is_word_byte(byte) != is_word_byte(byte - 1)) {
+            boundary[byte] = 1;
+        }
+    }
+
+    int class = -1;
+
+    for (int byte = 0; byte < 256; byte++) {
+        if (boundary[byte]) {
+            class++;
+            automaton->representatives[class] = (unsigned char) byte;
+            automaton->classFlags[class] = (unsigned char) ((byte == '\n' ? REGEX_AFTER_LINE_BREAK : 0) |
+                                                            (is_word_byte(byte) ? REGEX_AFTER_WORD : 0));
+        }
+
+        automaton->classes[byte] = (unsigned char) class;
+    }
+
+    automaton->classCount = class + 1;
+    automaton->classFlags[automaton->classCount] = REGEX_AFTER_LINE_BREAK;
+    automaton->stride = automaton->classCount + 1;
+}
+
+static void flush_regex_cache(RegexAutomaton *automaton) {
+    automaton->stateCount = 0;
+    automaton->kernelsLength = 0;
+    automaton->memory = 0;
+    automaton->flushes++;
+
+    for (size_t slot = 0; slot < automaton->tableSize; slot++) {
+        automaton->table[slot] = -1;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        automaton->starts[i] = -1;
+    }
+}
+
+static void free_automaton(RegexAutomaton *automaton) {
+    if (automaton == NULL) {
+        return;
+    }
+
+    free(automaton->program);
+    free(automaton->states);
+    free(automaton->kernels);
+    free(automaton->transitions);
+    free(automaton->table);
+    free(automaton->stack);
+    free(automaton->visited);
+    free(automaton->added);
+    free(automaton->kernel);
+    free(automaton->kept);
+    free(automaton);
+}
+
+static RegexAutomaton *build_automaton(RegexParser *parser, int root, int reverse) {
+    RegexEmitter emitter = { .nodes = parser->nodes };
+
+    if (emit_node(&emitter, root, reverse) || emit_instruction(&emitter, REGEX_MATCH, -1) < 0) {
+        parser->error = emitter.error;
+        free(emitter.program);
+        return NULL;
+    }
+
+    RegexAutomaton *automaton = calloc(1, sizeof(*automaton));
+
+    if (automaton == NULL) {
+        parser->error = OutOfMemory;
+        free(emitter.program);
+        return NULL;
+    }
+
+    size_t length = (size_t) emitter.length;
+
+    automaton->program = emitter.program;
+    automaton->length = emitter.length;
+    automaton->sets = parser->sets;
+    automaton->limit = REGEX_CACHE_LIMIT;
+    automaton->tableSize = 64;
+    automaton->table = malloc(automaton->tableSize * sizeof(int));
+    // Every instruction is expanded once per closure and pushes two at most
+    automaton->stack = malloc((3 * length + 1) * sizeof(int));
+    automaton->visited = calloc(length, sizeof(unsigned));
+    automaton->added = calloc(length, sizeof(unsigned));
+    automaton->kernel = malloc(length * sizeof(int));
+    automaton->kept = malloc(length * sizeof(int));
+
+    if (automaton->table == NULL || automaton->stack == NULL || automaton->visited == NULL ||
+        automaton->added == NULL || automaton->kernel == NULL || automaton->kept == NULL) {
+        parser->error = OutOfMemory;
+        free_automaton(automaton);
+        return NULL;
+    }
+
+    assign_byte_classes(automaton, parser->sets, parser->setCount);
+    flush_regex_cache(automaton);
+    automaton->flushes = 0;
+
+    return automaton;
+}
+
+static uint32_t hash_state(const int *kernel, int length, unsigned char flags) {
+    uint32_t hash = 2166136261u ^ flags;
+
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (uint32_t) kernel[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t state_cost(RegexAutomaton *automaton, int length) {
+    return sizeof(RegexState) + ((size_t) automaton->stride + (size_t) length + 2) * sizeof(int);
+}
+
+// Room for one more state and its kernel, 1 out of memory
+static int reserve_state(RegexAutomaton *automaton, int length) {
+    if (automaton->stateCount == automaton->stateSize) {
+        int size = automaton->stateSize > 0 ? automaton->stateSize * 2 : 16;
+        RegexState *states = realloc(automaton->states, (size_t) size * sizeof(*states));
+
+        if (states == NULL) {
+            return 1;
+        }
+
+        automaton->states = states;
+
+        int *transitions = realloc(automaton->transitions, (size_t) size * (size_t) automaton->stride * sizeof(int));
+
+        if (transitions == NULL) {
+            return 1;
+        }
+
+        automaton->transitions = transitions;
+        automaton->stateSize = size;
+    }
+
+    if (automaton->kernelsLength + (size_t) length > automaton->kernelsSize) {
+        size_t size = automaton->kernelsSize > 0 ? automaton->kernelsSize : 256;
+
+        while (automaton->kernelsLength + (size_t) length > size) {
+            size *= 2;
+        }
+
+        int *kernels = realloc(automaton->kernels, size * sizeof(int));
+
+        if (kernels == NULL) {
+            return 1;
+        }
+
+        automaton->kernels = kernels;
+        automaton->kernelsSize = size;
+    }
+
+    // Kept at most half full
+    if ((size_t) automaton->stateCount * 2 + 2 > automaton->tableSize) {
+        size_t size = automaton->tableSize * 2;
+        int *table = malloc(size * sizeof(int));
+
+        if (table == NULL) {
+            return 1;
+        }
+
+        for (size_t slot = 0; slot < size; slot++) {
+            table[slot] = -1;
+        }
+
+        for (int index = 0; index < automaton->stateCount; index++) {
+            RegexState *state = &automaton->states[index];
+            size_t slot = hash_state(automaton->kernels + state->kernel, state->length, state->flags) & (size - 1);
+
+            while (table[slot] >= 0) {
+                slot = (slot + 1) & (size - 1);
+            }
+
+            table[slot] = index;
+        }
+
+        free(automaton->table);
+        automaton->table = table;
+        automaton->tableSize = size;
+    }
+
+    return 0;
+}
+
+// The state with kernel and flags, added when the cache does not have it.
+// -1 when the cache is full, -2 out of memory.
+static int intern_state(RegexAutomaton *automaton, const int *kernel, int length, unsigned char flags) {
+    if (reserve_state(automaton, length)) {
+        return -2;
+    }
+
+    size_t mask = automaton->tableSize - 1;
+    size_t slot = hash_state(kernel, length, flags) & mask;
+
+    for (; automaton->table[slot] >= 0; slot = (slot + 1) & mask) {
+        RegexState *state = &automaton->states[automaton->table[slot]];
+
+        if (state->flags == flags && state->length == length &&
+            !memcmp(automaton->kernels + state->kernel, kernel, (size_t) length * sizeof(int))) {
+            return automaton->table[slot];
+        }
+    }
+
+    size_t cost = state_cost(automaton, length);
+
+    // Two states always fit: the one a scanner is on and where it goes
+    if (automaton->memory + cost > automaton->limit && automaton->stateCount >= 2) {
+        return -1;
+    }
+
+    int index = automaton->stateCount++;
+    RegexState *state = &automaton->states[index];
+
+    state->kernel = automaton->kernelsLength;
+    state->length = length;
+    state->flags = flags;
+    memcpy(automaton->kernels + automaton->kernelsLength, kernel, (size_t) length * sizeof(int));
+    automaton->kernelsLength += (size_t) length;
+
+    int *transitions = automaton->transitions + (size_t) index * (size_t) automaton->stride;
+
+    for (int class = 0; class < automaton->stride; class++) {
+        transitions[class] = REGEX_NO_TRANSITION;
+    }
+
+    automaton->table[slot] = index;
+    automaton->memory += cost;
+
+    return index;
+}
+
+// Like intern_state, but a full cache is dropped to make room. The state at
+// *keep, when keep is not NULL, is put back after that and *keep updated.
+static int add_state(RegexAutomaton *automaton, const int *kernel, int length, unsigned char flags, int *keep) {
+    int index = intern_state(automaton, kernel, length, flags);
+
+    if (index != -1) {
+        return index;
+    }
+
+    int keptLength = 0;
+    unsigned char keptFlags = 0;
+
+    if (keep != NULL) {
+        RegexState *kept = &automaton->states[*keep];
+
+        keptLength = kept->length;
+        keptFlags = kept->flags;
+        memcpy(automaton->kept, automaton->kernels + kept->kernel, (size_t) keptLength * sizeof(int));
+    }
+
+    flush_regex_cache(automaton);
+
+    if (keep != NULL && (*keep = intern_state(automaton, automaton->kept, keptLength, keptFlags)) < 0) {
+        return -2;
+    }
+
+    return intern_state(automaton, kernel, length, flags);
+}
+
+static unsigned char context_flags(RegexAutomaton *automaton, int context) {
+    return automaton->classFlags[context == REGEX_EDGE ? automaton->classCount : automaton->classes[(unsigned char) context]];
+}
+
+static int start_state(RegexAutomaton *automaton, int context, int unanchored) {
+    unsigned char flags = (unsigned char) (context_flags(automaton, context) | (unanchored ? REGEX_UNANCHORED : 0));
+
+    if (automaton->starts[flags] < 0) {
+        // Searching threads start anywhere, added by every step on their own
+        int first = 0;
+
+        automaton->starts[flags] = add_state(automaton, &first, unanchored ? 0 : 1, flags, NULL);
+    }
+
+    return automaton->starts[flags];
+}
+
+static int compare_instructions(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+// Where *state goes on a byte of class: the threads of its kernel follow
+// the free moves the byte allows (the assertions see the byte before and
+// this one), then take the byte. Stores the transition and returns it, -1
+// out of memory. *state is updated when making room moved it.
+static int build_transition(RegexAutomaton *automaton, int *state, int class) {
+    RegexState from = automaton->states[*state];
+    const int *kernel = automaton->kernels + from.kernel;
+    int afterBreak = from.flags & REGEX_AFTER_LINE_BREAK, afterWord = from.flags & REGEX_AFTER_WORD;
+    int beforeBreak = automaton->classFlags[class] & REGEX_AFTER_LINE_BREAK;
+    int beforeWord = automaton->classFlags[class] & REGEX_AFTER_WORD;
+    int top = 0, length = 0, matched = 0;
+
+    if (++automaton->stamp == 0) {
+        memset(automaton->visited, 0, (size_t) automaton->length * sizeof(unsigned));
+        memset(automaton->added, 0, (size_t) automaton->length * sizeof(unsigned));
+        automaton->stamp = 1;
+    }
+
+    unsigned stamp = automaton->stamp;
+
+    for (int i = 0; i < from.length; i++) {
+        automaton->stack[top++] = kernel[i];
+    }
+
+    if (from.flags & REGEX_UNANCHORED) {
+        automaton->stack[top++] = 0;
+    }
+
+    while (top > 0) {
+        int pc = automaton->stack[--top];
+
+        if (automaton->visited[pc] == stamp) {
+            continue;
+        }
+
+        automaton->visited[pc] = stamp;
+        const RegexInstruction *instruction = &automaton->program[pc];
+        int follow = 0;
+
+        switch (instruction->opcode) {
+        case REGEX_BYTES:
+            if (class < automaton->classCount && automaton->added[instruction->next] != stamp &&
+                set_has(&automaton->sets[instruction->set], automaton->representatives[class])) {
+                automaton->added[instruction->next] = stamp;
+                automaton->kernel[length++] = instruction->next;
+            }
+            break;
+        case REGEX_SPLIT:
+            automaton->stack[top++] = instruction->alternative;
+            follow = 1;
+            break;
+        case REGEX_JUMP:
+            follow = 1;
+            break;
+        case REGEX_LINE_START:
+            follow = afterBreak;
+            break;
+        case REGEX_LINE_END:
+            follow = beforeBreak;
+            break;
+        case REGEX_WORD_START:
+            follow = !afterWord && beforeWord;
+            break;
+        case REGEX_WORD_END:
+            follow = afterWord && !beforeWord;
+            break;
+        default:
+            matched = 1;
+            break;
+        }
+
+        if (follow) {
+            automaton->stack[top++] = instruction->next;
+        }
+    }
+
+    int transition;
+
+    if (class == automaton->classCount) {
+        // Nothing comes after the edge, only whether a match ends there counts
+        transition = (*state << REGEX_TRANSITION_SHIFT) | (matched ? REGEX_MATCH_BEFORE : 0);
+    } else {
+        unsigned char flags = (unsigned char) (automaton->classFlags[class] | (from.flags & REGEX_UNANCHORED));
+
+        qsort(automaton->kernel, (size_t) length, sizeof(int), compare_instructions);
+
+        int next = add_state(automaton, automaton->kernel, length, flags, state);
+
+        if (next < 0) {
+            return -1;
+        }
+
+        transition = (next << REGEX_TRANSITION_SHIFT) | (matched ? REGEX_MATCH_BEFORE : 0) |
+                     (length == 0 && !(flags & REGEX_UNANCHORED) ? REGEX_DEAD : 0);
+    }
+
+    automaton->transitions[(size_t) *state * (size_t) automaton->stride + (size_t) class] = transition;
+
+    return transition;
+}
+
+// ---------------------------------------------------------
+// Regexes
+// ---------------------------------------------------------
+
+// Appends the bytes of a pattern that is plain text, 1 when it is not
+static int collect_literal(RegexParser *parser, int index, char *literal, size_t *length) {
+    const RegexNode *node = &parser->nodes[index];
+
+    if (node->type == REGEX_NODE_CONCAT) {
+        return collect_literal(parser, node->left, literal, length) ||
+               collect_literal(parser, node->right, literal, length);
+    }
+
+    if (node->type != REGEX_NODE_BYTES) {
+        return 1;
+    }
+
+    int byte = -1;
+
+    for (int candidate = 0; candidate < 256; candidate++) {
+        if (set_has(&parser->sets[node->set], (unsigned char) candidate)) {
+            if (byte >= 0) {
+                return 1;
+            }
+
+            byte = candidate;
+        }
+    }
+
+    if (byte < 0) {
+        return 1;
+    }
+
+    literal[(*length)++] = (char) byte;
+
+    return 0;
+}
+
+Regex *compile_regex(const char *pattern, size_t length, const char **error) {
+    RegexParser parser = { .text = pattern, .end = pattern + length };
+    Regex *regex = NULL;
+    int root = parse_alternation(&parser);
+
+    // The top level only stops early on a "\)" that opens nothing
+    if (root >= 0 && parser.text < parser.end) {
+        parser.error = UnmatchedClose;
+    }
+
+    if (root >= 0 && parser.error == NULL) {
+        regex = calloc(1, sizeof(*regex));
+
+        if (regex == NULL) {
+            parser.error = OutOfMemory;
+        } else if ((regex->forward = build_automaton(&parser, root, 0)) == NULL ||
+                   (regex->reverse = build_automaton(&parser, root, 1)) == NULL) {
+            free_automaton(regex->forward);
+            free(regex);
+            regex = NULL;
+        }
+    }
+
+    if (regex != NULL) {
+        regex->literal = malloc(length + 1);
+
+        if (regex->literal != NULL && collect_literal(&parser, root, regex->literal, &regex->literalLength)) {
+            regex->literalLength = 0;
+        }
+    } else {
+        *error = parser.error != NULL ? parser.error : OutOfMemory;
+        free(parser.sets);
+    }
+
+    free(parser.nodes);
+
+    return regex;
+}
+
+void free_regex(Regex *regex) {
+    if (regex == NULL) {
+        return;
+    }
+
+    // Both automata share the byte sets
+    free((void *) regex->forward->sets);
+    free_automaton(regex->forward);
+    free_automaton(regex->reverse);
+    free(regex->literal);
+    free(regex);
+}
+
+void set_regex_cache_limit(Regex *regex, size_t bytes) {
+    regex->forward->limit = bytes;
+    regex->reverse->limit = bytes;
+}
+
+size_t regex_cache_flushes(Regex *regex) {
+    return regex->forward->flushes + regex->reverse->flushes;
+}
+
+// ---------------------------------------------------------
+// Scanners
+// ---------------------------------------------------------
+
+static void start_scanner(RegexScanner *scanner, RegexAutomaton *automaton, int reverse, size_t offset, int context, int unanchored) {
+    scanner->automaton = automaton;
+    scanner->reverse = reverse;
+    scanner->offset = offset;
+    scanner->match = offset;
+    scanner->state = start_state(automaton, context, unanchored);
+    scanner->flushes = automaton->flushes;
+    scanner->dead = 0;
+}
+
+void regex_scanner_start(RegexScanner *scanner, Regex *regex, int reverse, size_t offset, int context) {
+    start_scanner(scanner, reverse ? regex->reverse : regex->forward, reverse, offset, context, 1);
+}
+
+// One table lookup per byte once the transitions are built
+size_t regex_scanner_feed(RegexScanner *scanner, const char *chunk, size_t length, int *matched) {
+    RegexAutomaton *automaton = scanner->automaton;
+    const unsigned char *text = (const unsigned char *) chunk;
+    int state = scanner->state;
+    size_t taken = 0;
+
+    *matched = 0;
+
+    if (state < 0) {
+        scanner->dead = 1;
+        return length;
+    }
+
+    assert(scanner->flushes == automaton->flushes && "ANOTHER SCANNER DROPPED THIS SCANNER'S STATE!");
+
+    while (taken < length) {
+        int class = automaton->classes[scanner->reverse ? text[length - 1 - taken] : text[taken]];
+        int transition = automaton->transitions[(size_t) state * (size_t) automaton->stride + (size_t) class];
+
+        if (transition < 0 && (transition = build_transition(automaton, &state, class)) < 0) {
+            // Out of memory, nothing is found
+            state = -1;
+            taken = length;
+            scanner->dead = 1;
+            break;
+        }
+
+        state = transition >> REGEX_TRANSITION_SHIFT;
+        taken++;
+
+        if (transition & (REGEX_MATCH_BEFORE | REGEX_DEAD)) {
+            if (transition & REGEX_MATCH_BEFORE) {
+                *matched = 1;
+                scanner->match = scanner->reverse ? scanner->offset - (taken - 1) : scanner->offset + taken - 1;
+                break;
+            }
+
+            taken = length;
+            scanner->dead = 1;
+        }
+    }
+
+    scanner->state = state;
+    scanner->flushes = automaton->flushes;
+    scanner->offset = scanner->reverse ? scanner->offset - taken : scanner->offset + taken;
+
+    return taken;
+}
+
+int regex_scanner_finish(RegexScanner *scanner, int context) {
+    RegexAutomaton *automaton = scanner->automaton;
+
+    if (scanner->state < 0) {
+        return 0;
+    }
+
+    int class = context == REGEX_EDGE ? automaton->classCount : automaton->classes[(unsigned char) context];
+    int transition = automaton->transitions[(size_t) scanner->state * (size_t) automaton->stride + (size_t) class];
+
+    if (transition < 0 && (transition = build_transition(automaton, &scanner->state, class)) < 0) {
+        return 0;
+    }
+
+    scanner->flushes = automaton->flushes;
+
+    if (transition & REGEX_MATCH_BEFORE) {
+        scanner->match = scanner->offset;
+        return 1;
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Lines
+// ---------------------------------------------------------
+
+// End of the longest match starting at start, -1 when none does
+static long longest_match_end(Regex *regex, const char *line, size_t length, size_t start, int before, int after) {
+    RegexScanner scanner;
+    long end = -1;
+    int matched;
+
+    start_scanner(&scanner, regex->forward, 0, start, start > 0 ? (unsigned char) line[start - 1] : before, 0);
+
+    // A dead state takes the rest at once
+    for (size_t at = start; at < length;) {
+        at += regex_scanner_feed(&scanner, line + at, length - at, &matched);
+
+        if (matched) {
+            end = (long) scanner.match;
+        }
+    }
+
+    if (regex_scanner_finish(&scanner, after)) {
+        end = (long) length;
+    }
+
+    return end;
+}
+
+int regex_line_matches(Regex *regex, const char *line, size_t length, int before, int after, int all, Vector *matches) {
+    if (regex == NULL || matches == NULL) {
+        return 1;
+    }
+
+    if (regex->literalLength > 0) {
+        for (size_t at = 0; at < length;) {
+            const char *found = find_substring(line + at, length - at, regex->literal, regex->literalLength);
+
+            if (found == NULL) {
+                break;
+            }
+
+            RegexMatch match = { (size_t) (found - line), (size_t) (found - line) + regex->literalLength };
+
+            vec_push_back(matches, &match);
+            at = match.end;
+
+            if (!all) {
+                break;
+            }
+        }
+
+        return 0;
+    }
+
+    // One pass backwards over the line marks every place a match starts
+    unsigned char *starts = calloc(length + 1, 1);
+
+    if (starts == NULL) {
+        return 1;
+    }
+
+    RegexScanner scanner;
+    int matched;
+
+    regex_scanner_start(&scanner, regex, 1, length, after);
+
+    for (size_t left = length; left > 0;) {
+        left -= regex_scanner_feed(&scanner, line, left, &matched);
+
+        if (matched) {
+            starts[scanner.match] = 1;
+        }
+    }
+
+    if (regex_scanner_finish(&scanner, before)) {
+        starts[0] = 1;
+    }
+
+    int previous = 0;
+    size_t previousEnd = 0;
+
+    for (size_t at = 0; at <= length; at++) {
+        if (!starts[at]) {
+            continue;
+        }
+
+        long end = longest_match_end(regex, line, length, at, before, after);
+
+        if (end < 0 || ((size_t) end == at && previous && at == previousEnd)) {
+            continue;
+        }
+
+        RegexMatch match = { at, (size_t) end };
+
+        vec_push_back(matches, &match);
+
+        if (!all) {
+            break;
+        }
+
+        previous = 1;
+        previousEnd = match.end;
+
+        if (match.end > at) {
+            at = match.end - 1;
+        }
+    }
+
+    free(starts);
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Piece tables
+// ---------------------------------------------------------
+
+// The byte before offset, REGEX_EDGE at the start of the document
+static int byte_before(PieceTable *table, size_t offset) {
+    const char *text;
+
+    return offset > 0 && piece_table_chunk_at(table, offset - 1, &text) > 0 ? (unsigned char) *text : REGEX_EDGE;
+}
+
+static size_t line_end_from(PieceTable *table, size_t offset) {
+    size_t end;
+
+    return search_piece_table(table, offset, "\n", 1, &end) ? piece_table_length(table) : end;
+}
+
+// The first match in [low, high), one line or the end of one
+static int match_in_span(Regex *regex, PieceTable *table, size_t low, size_t high, RegexMatch *match) {
+    char stackWindow[REGEX_LINE_WINDOW];
+    size_t size = high - low;
+    char *window = size <= sizeof(stackWindow) ? stackWindow : malloc(size);
+    Vector *matches = initialize_vector("struct", sizeof(RegexMatch));
+
+    if (window == NULL || matches == NULL) {
+        if (window != stackWindow) {
+            free(window);
+        }
+
+        free_vector(matches);
+        return 1;
+    }
+
+    size_t length = piece_table_read(table, low, window, size);
+    int after = high < piece_table_length(table) ? '\n' : REGEX_EDGE;
+    int missing = regex_line_matches(regex, window, length, byte_before(table, low), after, 0, matches) || matches->len == 0;
+
+    if (!missing) {
+        *match = *(RegexMatch *) matches->base;
+        match->start += low;
+        match->end += low;
+    }
+
+    if (window != stackWindow) {
+        free(window);
+    }
+
+    free_vector(matches);
+
+    return missing;
+}
+
+// The pieces are fed to the automaton where they lie until some match ends.
+// Matches do not span lines, so the leftmost one is in the line of that end
+// and only that line is looked at again.
+int regex_search_piece_table(Regex *regex, PieceTable *table, size_t from, RegexMatch *match) {
+    if (regex == NULL || table == NULL || from > piece_table_length(table)) {
+        return 1;
+    }
+
+    if (regex->literalLength > 0) {
+        if (search_piece_table(table, from, regex->literal, regex->literalLength, &match->start)) {
+            return 1;
+        }
+
+        match->end = match->start + regex->literalLength;
+
+        return 0;
+    }
+
+    RegexScanner scanner;
+    PieceTableIterator chunks;
+    int matched = 0;
+
+    regex_scanner_start(&scanner, regex, 0, from, byte_before(table, from));
+
+    for (int more = piece_table_iterator_seek(&chunks, table, from); more; more = piece_table_iterator_next(&chunks)) {
+        regex_scanner_feed(&scanner, chunks.text, chunks.length, &matched);
+
+        if (matched) {
+            break;
+        }
+    }
+
+    if (!matched && !regex_scanner_finish(&scanner, REGEX_EDGE)) {
+        return 1;
+    }
+
+    size_t lineStart = piece_table_line_start(table, piece_table_line_at(table, scanner.match));
+
+    return match_in_span(regex, table, lineStart > from ? lineStart : from, line_end_from(table, scanner.match), match);
+}
+
+// The reversed pattern is fed the pieces backwards from the end of the line
+// of before - 1, each match it reports is where one starts: the first one
+// before before is the last such match.
+int regex_search_piece_table_reverse(Regex *regex, PieceTable *table, size_t before, RegexMatch *match) {
+    if (regex == NULL || table == NULL) {
+        return 1;
+    }
+
+    size_t length = piece_table_length(table);
+
+    if (before > length) {
+        before = length;
+    }
+
+    if (before == 0) {
+        return 1;
+    }
+
+    if (regex->literalLength > 0) {
+        if (search_piece_table_reverse(table, before, regex->literal, regex->literalLength, &match->start)) {
+            return 1;
+        }
+
+        match->end = match->start + regex->literalLength;
+
+        return 0;
+    }
+
+    size_t high = line_end_from(table, before - 1);
+    RegexScanner scanner;
+    PieceTableIterator chunks;
+    int found = 0, matched;
+
+    regex_scanner_start(&scanner, regex, 1, high, high < length ? '\n' : REGEX_EDGE);
+
+    if (high > 0 && piece_table_iterator_seek(&chunks, table, high - 1)) {
+        // All of the piece up to high, the seek gave its tail
+        size_t start = chunks.pieces.before.length;
+        const char *text = chunks.text - (high - 1 - start);
+        size_t left = high - start;
+
+        for (;;) {
+            while (left > 0 && !found) {
+                left -= regex_scanner_feed(&scanner, text, left, &matched);
+                found = matched && scanner.match < before;
+            }
+
+            if (found || !piece_table_iterator_prev(&chunks)) {
+                break;
+            }
+
+            text = chunks.text;
+            left = chunks.length;
+        }
+    }
+
+    if (!found && (!regex_scanner_finish(&scanner, REGEX_EDGE) || scanner.match >= before)) {
+        return 1;
+    }
+
+    // Its end is the longest match from there
+    return match_in_span(regex, table, scanner.match, line_end_from(table, scanner.match), match);
+}
+
+// ---------------------------------------------------------
+// Line scans
+// ---------------------------------------------------------
+
+// The contiguous text of the table that ends at offset, how long it is
+static size_t chunk_before(PieceTable *table, size_t offset, const char **text) {
+    PieceTableIterator chunks;
+
+    if (offset == 0 || !piece_table_iterator_seek(&chunks, table, offset - 1)) {
+        return 0;
+    }
+
+    size_t start = chunks.pieces.before.length;
+
+    *text = chunks.text - (offset - 1 - start);
+
+    return offset - start;
+}
+
+static void mark_start(RegexLineScan *scan, size_t offset) {
+    size_t bit = offset - scan->start;
+
+    scan->starts[bit / 8] |= (unsigned char) (1u << (bit % 8));
+}
+
+static int marked_start(RegexLineScan *scan, size_t offset) {
+    size_t bit = offset - scan->start;
+
+    return scan->starts[bit / 8] >> (bit % 8) & 1;
+}
+
+int regex_line_scan_start(RegexLineScan *scan, Regex *regex, PieceTable *table, size_t start, size_t end) {
+    *scan = (RegexLineScan) {
+        .regex = regex,
+        .table = table,
+        .start = start,
+        .end = end,
+        .starts = calloc((end - start) / 8 + 1, 1),
+        .marking = 1,
+        .at = start,
+    };
+
+    if (scan->starts == NULL) {
+        return 1;
+    }
+
+    regex_scanner_start(&scan->scanner, regex, 1, end, end < piece_table_length(table) ? '\n' : REGEX_EDGE);
+
+    return 0;
+}
+
+void regex_line_scan_stop(RegexLineScan *scan) {
+    free(scan->starts);
+    scan->starts = NULL;
+}
+
+// Backwards from where the last step stopped, every start gets its bit
+static size_t mark_starts(RegexLineScan *scan, size_t budget) {
+    size_t work = 0;
+
+    while (work < budget && !scan->scanner.dead && scan->scanner.offset > scan->start) {
+        const char *text;
+        size_t chunk = chunk_before(scan->table, scan->scanner.offset, &text);
+        size_t length = chunk;
+        int matched;
+
+        length = length < scan->scanner.offset - scan->start ? length : scan->scanner.offset - scan->start;
+        length = length < budget - work ? length : budget - work;
+
+        // The scanner reads what it is given last byte first
+        size_t taken = regex_scanner_feed(&scan->scanner, text + chunk - length, length, &matched);
+
+        work += scan->scanner.dead ? 1 : taken;
+
+        if (matched) {
+            mark_start(scan, scan->scanner.match);
+        }
+    }
+
+    if (scan->scanner.dead || scan->scanner.offset == scan->start) {
+        if (regex_scanner_finish(&scan->scanner, byte_before(scan->table, scan->start))) {
+            mark_start(scan, scan->start);
+        }
+
+        scan->marking = 0;
+    }
+
+    return work;
+}
+
+// The longest match from the probed start, fed on until it can't grow
+static size_t probe_start(RegexLineScan *scan, size_t budget) {
+    size_t work = 0;
+
+    while (work < budget && !scan->scanner.dead && scan->scanner.offset < scan->end) {
+        const char *text;
+        size_t length = piece_table_chunk_at(scan->table, scan->scanner.offset, &text);
+        int matched;
+
+        length = length < scan->end - scan->scanner.offset ? length : scan->end - scan->scanner.offset;
+        length = length < budget - work ? length : budget - work;
+
+        size_t taken = regex_scanner_feed(&scan->scanner, text, length, &matched);
+
+        // A dead scanner took the rest without reading it
+        work += scan->scanner.dead ? 1 : taken;
+
+        if (matched) {
+            scan->longest = (long) scan->scanner.match;
+        }
+    }
+
+    if (scan->scanner.dead || scan->scanner.offset >= scan->end) {
+        if (!scan->scanner.dead && regex_scanner_finish(&scan->scanner, scan->end < piece_table_length(scan->table) ? '\n' : REGEX_EDGE)) {
+            scan->longest = (long) scan->end;
+        }
+
+        scan->probing = 0;
+    }
+
+    return work;
+}
+
+// What regex_line_matches does once the starts are marked, a start at a time
+size_t regex_line_scan_step(RegexLineScan *scan, size_t budget, Vector *matches, int *done) {
+    size_t work = 0;
+
+    *done = 0;
+
+    while (work < budget) {
+        if (scan->marking) {
+            work += mark_starts(scan, budget - work);
+            continue;
+        }
+
+        if (scan->probing) {
+            work += probe_start(scan, budget - work);
+
+            if (scan->probing) {
+                continue;
+            }
+
+            size_t at = scan->probe;
+            long end = scan->longest;
+
+            if (end < 0 || ((size_t) end == at && scan->previous && at == scan->previousEnd)) {
+                scan->at = at + 1;
+                continue;
+            }
+
+            RegexMatch match = { at, (size_t) end };
+
+            vec_push_back(matches, &match);
+            scan->previous = 1;
+            scan->previousEnd = match.end;
+            scan->at = match.end > at ? match.end : at + 1;
+            continue;
+        }
+
+        // The next marked start, a byte of the bits at a time
+        while (scan->at <= scan->end && work < budget && !marked_start(scan, scan->at)) {
+            scan->at++;
+            work++;
+        }
+
+        if (scan->at > scan->end) {
+            *done = 1;
+            break;
+        }
+
+        if (work < budget) {
+            scan->probing = 1;
+            scan->probe = scan->at;
+            scan->longest = -1;
+            start_scanner(&scan->scanner, scan->regex->forward, 0, scan->at, byte_before(scan->table, scan->at), 0);
+        }
+    }
+
+    return work;
+}
@@ -0,0 +1,426 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "text/search.h"
+#include "text/simd.h"
+
+// Each vector kernel tests 64 start positions per step
+#define SEARCH_BLOCK 64
+// Piece boundaries are searched in a copy of the few bytes around them
+#define SEARCH_WINDOW 512
+
+typedef const char *(*SubstringSearcher)(const char *text, size_t length, const char *needle, size_t needleLength);
+
+const char *find_substring_scalar(const char *text, size_t length, const char *needle, size_t needleLength);
+const char *find_substring_reverse_scalar(const char *text, size_t length, const char *needle, size_t needleLength);
+void pick_substring_searchers();
+
+static SubstringSearcher searcher = NULL;
+static SubstringSearcher reverseSearcher = NULL;
+static enum SUBSTRING_SEARCHERS searcherKind = SUBSTRING_SEARCHER_SCALAR;
+
+// The two bytes of the needle the kernels look for, the rarest ones: the
+// fewer places both match, the fewer full compares
+typedef struct {
+    size_t rare; // offset of the rarest byte in the needle
+    size_t other; // offset of the second rarest, never the same offset
+} BytePair;
+
+// Rough rank of how often a byte turns up in prose, code and logs, higher is rarer
+static unsigned byte_rarity(unsigned char byte) {
+    if (byte >= 0x80 || byte < ' ') {
+        return byte == '\n' || byte == '\t' ? 0 : 5;
+    }
+
+    if (strchr(" etaoinsrhl", byte)) {
+        return 0;
+    }
+
+    if (byte >= 'a' && byte <= 'z') {
+        return 1;
+    }
+
+    if ((byte >= '0' && byte <= '9') || strchr(".,:;/-_=\"'()", byte)) {
+        return 2;
+    }
+
+    return byte >= 'A' && byte <= 'Z' ? 3 : 4;
+}
+
+static BytePair pick_byte_pair(const char *needle, size_t needleLength) {
+    BytePair pair = { 0, needleLength - 1 };
+    unsigned best = 0, second = 0;
+
+    for (size_t i = 0; i < needleLength; i++) {
+        unsigned rarity = byte_rarity((unsigned char) needle[i]);
+
+        if (i == 0 || rarity > best) {
+            best = rarity;
+            pair.rare = i;
+        }
+    }
+
+    // A different byte value filters more than the same one again
+    for (size_t i = 0, found = 0; i < needleLength; i++) {
+        unsigned rarity = byte_rarity((unsigned char) needle[i]) + (needle[i] != needle[pair.rare] ? 8 : 0);
+
+        if (i != pair.rare && (!found || rarity > second)) {
+            second = rarity;
+            pair.other = i;
+            found = 1;
+        }
+    }
+
+    return pair;
+}
+
+const char *find_substring_scalar(const char *text, size_t length, const char *needle, size_t needleLength) {
+    if (needleLength > length) {
+        return NULL;
+    }
+
+    const char *cursor = text;
+    const char *last = text + length - needleLength; // the last place a match can start
+
+    // memchr is already vectorized by most C libraries
+    while (cursor <= last && (cursor = memchr(cursor, needle[0], (size_t) (last - cursor) + 1)) != NULL) {
+        if (cursor[needleLength - 1] == needle[needleLength - 1] && !memcmp(cursor, needle, needleLength)) {
+            return cursor;
+        }
+
+        cursor++;
+    }
+
+    return NULL;
+}
+
+const char *find_substring_reverse_scalar(const char *text, size_t length, const char *needle, size_t needleLength) {
+    if (needleLength > length) {
+        return NULL;
+    }
+
+    for (size_t i = length - needleLength + 1; i-- > 0;) {
+        if (text[i] == needle[0] && !memcmp(text + i, needle, needleLength)) {
+            return text + i;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef TEXT_SIMD_SSE2
+// Bit i is set when text[i + pair.rare] and text[i + pair.other] are the
+// needle's bytes there. Blocks without the rare byte end after one compare.
+static inline uint64_t pair_mask_sse2(const char *text, BytePair pair, __m128i rare, __m128i other) {
+    __m128i hits[SEARCH_BLOCK / 16];
+    __m128i any = _mm_setzero_si128();
+    uint64_t mask = 0;
+
+    for (int i = 0; i < SEARCH_BLOCK / 16; i++) {
+        hits[i] = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (text + i * 16 + pair.rare)), rare);
+        any = _mm_or_si128(any, hits[i]);
+    }
+
+    if (!_mm_movemask_epi8(any)) {
+        return 0;
+    }
+
+    for (int i = 0; i < SEARCH_BLOCK / 16; i++) {
+        __m128i both = _mm_and_si128(hits[i], _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (text + i * 16 + pair.other)), other));
+
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(both) << (i * 16);
+    }
+
+    return mask;
+}
+
+const char *find_substring_sse2(const char *text, size_t length, const char *needle, size_t needleLength) {
+    BytePair pair = pick_byte_pair(needle, needleLength);
+    const __m128i rare = _mm_set1_epi8(needle[pair.rare]);
+    const __m128i other = _mm_set1_epi8(needle[pair.other]);
+    size_t i = 0;
+
+    for (; i + needleLength - 1 + SEARCH_BLOCK <= length; i += SEARCH_BLOCK) {
+        for (uint64_t mask = pair_mask_sse2(text + i, pair, rare, other); mask; mask &= mask - 1) {
+            const char *at = text + i + trailing_zeros64(mask);
+
+            if (!memcmp(at, needle, needleLength)) {
+                return at;
+            }
+        }
+    }
+
+    return find_substring_scalar(text + i, length - i, needle, needleLength);
+}
+
+const char *find_substring_reverse_sse2(const char *text, size_t length, const char *needle, size_t needleLength) {
+    BytePair pair = pick_byte_pair(needle, needleLength);
+    const __m128i rare = _mm_set1_epi8(needle[pair.rare]);
+    const __m128i other = _mm_set1_epi8(needle[pair.other]);
+    size_t starts = length - needleLength + 1; // the caller made sure the needle fits
+
+    for (; starts >= SEARCH_BLOCK; starts -= SEARCH_BLOCK) {
+        size_t i = starts - SEARCH_BLOCK;
+
+        for (uint64_t mask = pair_mask_sse2(text + i, pair, rare, other); mask;) {
+            unsigned bit = highest_bit64(mask);
+
+            if (!memcmp(text + i + bit, needle, needleLength)) {
+                return text + i + bit;
+            }
+
+            mask &= ~((uint64_t) 1 << bit);
+        }
+    }
+
+    return find_substring_reverse_scalar(text, starts + needleLength - 1, needle, needleLength);
+}
+#endif
+
+#ifdef TEXT_SIMD_X86
+TEXT_SIMD_TARGET_AVX2
+static inline uint64_t pair_mask_avx2(const char *text, BytePair pair, __m256i rare, __m256i other) {
+    __m256i low = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (text + pair.rare)), rare);
+    __m256i high = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (text + 32 + pair.rare)), rare);
+
+    if (_mm256_testz_si256(_mm256_or_si256(low, high), _mm256_or_si256(low, high))) {
+        return 0;
+    }
+
+    low = _mm256_and_si256(low, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (text + pair.other)), other));
+    high = _mm256_and_si256(high, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (text + 32 + pair.other)), other));
+
+    return (uint32_t) _mm256_movemask_epi8(low) | ((uint64_t) (uint32_t) _mm256_movemask_epi8(high) << 32);
+}
+
+TEXT_SIMD_TARGET_AVX2
+const char *find_substring_avx2(const char *text, size_t length, const char *needle, size_t needleLength) {
+    BytePair pair = pick_byte_pair(needle, needleLength);
+    const __m256i rare = _mm256_set1_epi8(needle[pair.rare]);
+    const __m256i other = _mm256_set1_epi8(needle[pair.other]);
+    size_t i = 0;
+
+    for (; i + needleLength - 1 + SEARCH_BLOCK <= length; i += SEARCH_BLOCK) {
+        for (uint64_t mask = pair_mask_avx2(text + i, pair, rare, other); mask; mask &= mask - 1) {
+            const char *at = text + i + trailing_zeros64(mask);
+
+            if (!memcmp(at, needle, needleLength)) {
+                return at;
+            }
+        }
+    }
+
+    return find_substring_scalar(text + i, length - i, needle, needleLength);
+}
+
+TEXT_SIMD_TARGET_AVX2
+const char *find_substring_reverse_avx2(const char *text, size_t length, const char *needle, size_t needleLength) {
+    BytePair pair = pick_byte_pair(needle, needleLength);
+    const __m256i rare = _mm256_set1_epi8(needle[pair.rare]);
+    const __m256i other = _mm256_set1_epi8(needle[pair.other]);
+    size_t starts = length - needleLength + 1;
+
+    for (; starts >= SEARCH_BLOCK; starts -= SEARCH_BLOCK) {
+        size_t i = starts - SEARCH_BLOCK;
+
+        for (uint64_t mask = pair_mask_avx2(text + i, pair, rare, other); mask;) {
+            unsigned bit = highest_bit64(mask);
+
+            if (!memcmp(text + i + bit, needle, needleLength)) {
+                return text + i + bit;
+            }
+
+            mask &= ~((uint64_t) 1 << bit);
+        }
+    }
+
+    return find_substring_reverse_scalar(text, starts + needleLength - 1, needle, needleLength);
+}
+#endif
+
+void pick_substring_searchers() {
+#ifdef TEXT_SIMD_X86
+    if (cpu_supports_avx2()) {
+        searcherKind = SUBSTRING_SEARCHER_AVX2;
+        searcher = find_substring_avx2;
+        reverseSearcher = find_substring_reverse_avx2;
+        return;
+    }
+#endif
+#ifdef TEXT_SIMD_SSE2
+    searcherKind = SUBSTRING_SEARCHER_SSE2;
+    searcher = find_substring_sse2;
+    reverseSearcher = find_substring_reverse_sse2;
+#else
+    searcherKind = SUBSTRING_SEARCHER_SCALAR;
+    searcher = find_substring_scalar;
+    reverseSearcher = find_substring_reverse_scalar;
+#endif
+}
+
+enum SUBSTRING_SEARCHERS substring_searcher_in_use() {
+    if (searcher == NULL) {
+        pick_substring_searchers();
+    }
+
+    return searcherKind;
+}
+
+const char *find_substring(const char *text, size_t length, const char *needle, size_t needleLength) {
+    if (needleLength == 0) {
+        return text;
+    }
+
+    if (needleLength > length) {
+        return NULL;
+    }
+
+    if (needleLength == 1) {
+        return memchr(text, needle[0], length);
+    }
+
+    if (searcher == NULL) {
+        pick_substring_searchers();
+    }
+
+    return searcher(text, length, needle, needleLength);
+}
+
+const char *find_substring_reverse(const char *text, size_t length, const char *needle, size_t needleLength) {
+    if (needleLength == 0) {
+        return text + length;
+    }
+
+    if (needleLength > length) {
+        return NULL;
+    }
+
+    if (searcher == NULL) {
+        pick_substring_searchers();
+    }
+
+    return reverseSearcher(text, length, needle, needleLength);
+}
+
+// ---------------------------------------------------------
+// Piece tables
+// ---------------------------------------------------------
+
+// Matches starting in [low, high), looked for in a copy of the bytes there.
+// Only used for the few starts from which a match runs over a piece boundary.
+static int search_window(PieceTable *table, size_t low, size_t high, const char *needle, size_t needleLength, int reverse, size_t *found) {
+    char stackWindow[SEARCH_WINDOW];
+    size_t size = high - low + needleLength - 1;
+    char *window = size <= sizeof(stackWindow) ? stackWindow : malloc(size);
+
+    if (window == NULL) {
+        return 1;
+    }
+
+    size_t length = piece_table_read(table, low, window, size);
+    const char *match = reverse ? find_substring_reverse(window, length, needle, needleLength)
+                                : find_substring(window, length, needle, needleLength);
+
+    if (match != NULL) {
+        *found = low + (size_t) (match - window);
+    }
+
+    if (window != stackWindow) {
+        free(window);
+    }
+
+    return match == NULL;
+}
+
+// Piece by piece from from on. Before a piece is searched, the starts just
+// in front of it are: a match there ends in this piece (or later).
+int search_piece_table(PieceTable *table, size_t from, const char *needle, size_t needleLength, size_t *found) {
+    PieceTableIterator chunks;
+    int first = 1;
+
+    if (table == NULL || needleLength == 0) {
+        return 1;
+    }
+
+    for (int more = piece_table_iterator_seek(&chunks, table, from); more; more = piece_table_iterator_next(&chunks)) {
+        size_t boundary = chunks.offset;
+
+        if (!first && needleLength > 1) {
+            size_t low = boundary - from > needleLength - 1 ? boundary - (needleLength - 1) : from;
+
+            if (!search_window(table, low, boundary, needle, needleLength, 0, found)) {
+                return 0;
+            }
+        }
+
+        const char *match = find_substring(chunks.text, chunks.length, needle, needleLength);
+
+        if (match != NULL) {
+            *found = boundary + (size_t) (match - chunks.text);
+            return 0;
+        }
+
+        first = 0;
+    }
+
+    return 1;
+}
+
+// The same backwards: a piece, then the starts just in front of it, then the
+// piece before
+int search_piece_table_reverse(PieceTable *table, size_t before, const char *needle, size_t needleLength, size_t *found) {
+    PieceTableIterator chunks;
+
+    if (table == NULL || needleLength == 0) {
+        return 1;
+    }
+
+    size_t length = piece_table_length(table);
+
+    if (before > length) {
+        before = length;
+    }
+
+    if (before == 0 || !piece_table_iterator_seek(&chunks, table, before - 1)) {
+        return 1;
+    }
+
+    // All of the piece holding before - 1, the seek gave its tail
+    size_t start = chunks.pieces.before.length;
+    const char *text = chunks.text - (before - 1 - start);
+    size_t end = chunks.offset + chunks.length;
+
+    // Starts in this piece whose match runs into the next one
+    if (needleLength > 1 && end < length) {
+        size_t low = end - start > needleLength - 1 ? end - (needleLength - 1) : start;
+
+        if (low < before && !search_window(table, low, before, needle, needleLength, 1, found)) {
+            return 0;
+        }
+    }
+
+    size_t limit = before - 1 + needleLength < end ? before - 1 + needleLength : end;
+    const char *match = find_substring_reverse(text, limit - start, needle, needleLength);
+
+    while (match == NULL) {
+        if (needleLength > 1 && start > 0) {
+            size_t low = start > needleLength - 1 ? start - (needleLength - 1) : 0;
+
+            if (!search_window(table, low, start, needle, needleLength, 1, found)) {
+                return 0;
+            }
+        }
+
+        if (!piece_table_iterator_prev(&chunks)) {
+            return 1;
+        }
+
+        start = chunks.offset;
+        text = chunks.text;
+        match = find_substring_reverse(text, chunks.length, needle, needleLength);
+    }
+
+    *found = start + (size_t) (match - text);
+
+    return 0;
+}
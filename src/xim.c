@@ -1,44 +1,238 @@
 #include "xim.h"
+#include "io/save.h"
+
+XimState Xim;
+
+// Unchanged gaps shorter than this are sent along with the runs around them,
+// one console write costs more than a few extra cells
+#define RENDER_RUN_GAP 8
+#define DOCUMENT_TEXT_ATTRIBUTES (CELL_FOREGROUND_RED | CELL_FOREGROUND_BLUE | CELL_FOREGROUND_GREEN | CELL_FOREGROUND_INTENSITY)
+// Black on yellow, like vim's Search group
+#define SEARCH_HIGHLIGHT_ATTRIBUTES (CELL_BACKGROUND_RED | CELL_BACKGROUND_GREEN)
+
+void damageBufferCells(Buffer *buffer, Area *area, int from, int to);
+int resizeBufferGrids(Buffer *buffer, Area *area);
 
 int resetCommandBuffer() {
     Xim.commandBuffer.cursor = 0;
 
     for (size_t i = 0; i < (size_t) (Xim.commandBuffer.size.width * Xim.commandBuffer.size.height); i++) {
-        Xim.commandBuffer.cells[i].Char.AsciiChar = ' ';
-        Xim.commandBuffer.cells[i].Attributes = 0;
+        Xim.commandBuffer.cells[i].character = ' ';
+        Xim.commandBuffer.cells[i].attributes = 0;
+    }
+    damageBufferCells(&Xim.commandBuffer, &Xim.commandArea, 0, Xim.commandArea.size.width * Xim.commandArea.size.height);
+
+    return 0;
+}
+
+// Marks cells [from, to) of the buffer as changed, clipped to its area
+void damageBufferCells(Buffer *buffer, Area *area, int from, int to) {
+    int width = area->size.width;
+    int cellCount = width * area->size.height;
+
+    if (buffer->damage == NULL || width == 0) {
+        return;
+    }
+
+    if (from < 0) {
+        from = 0;
+    }
+    if (to > cellCount) {
+        to = cellCount;
+    }
+
+    while (from < to) {
+        int row = from / width;
+        int rowEnd = (row + 1) * width < to ? (row + 1) * width : to;
+        RowDamage *damage = &buffer->damage[row];
+        int start = from - row * width;
+        int end = rowEnd - row * width;
+
+        if (damage->start == damage->end) {
+            damage->start = start;
+            damage->end = end;
+        } else {
+            damage->start = start < damage->start ? start : damage->start;
+            damage->end = end > damage->end ? end : damage->end;
+        }
+
+        from = rowEnd;
+    }
+}
+
+// Writes a cell of the back grid, only a real change is recorded as damage
+void setBufferCell(Buffer *buffer, Area *area, int cell, char character, unsigned short attributes) {
+    Cell *target = &buffer->cells[cell];
+
+    if (target->character == character && target->attributes == attributes) {
+        return;
     }
-    Xim.commandBuffer.dirty = 1;
+
+    target->character = character;
+    target->attributes = attributes;
+    damageBufferCells(buffer, area, cell, cell + 1);
+}
+
+// Forgets what the console shows for the area, the next frame repaints it all
+void invalidateBuffer(Buffer *buffer, Area *area) {
+    int cellCount = area->size.width * area->size.height;
+
+    if (buffer->front == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < cellCount; i++) {
+        // No real cell has these attributes, so every cell compares changed
+        buffer->front[i].character = '\0';
+        buffer->front[i].attributes = 0xFFFF;
+    }
+
+    damageBufferCells(buffer, area, 0, cellCount);
+}
+
+// The front grid and the damage rows follow the size of the area
+int resizeBufferGrids(Buffer *buffer, Area *area) {
+    size_t cellCount = area->size.width * area->size.height;
+    Cell *front = realloc(buffer->front, (cellCount ? cellCount : 1) * sizeof(*front));
+
+    if (front == NULL) {
+        return 1;
+    }
+
+    buffer->front = front;
+
+    RowDamage *damage = realloc(buffer->damage, (area->size.height ? area->size.height : 1) * sizeof(*damage));
+
+    if (damage == NULL) {
+        return 1;
+    }
+
+    buffer->damage = damage;
+    memset(buffer->damage, 0, area->size.height * sizeof(*damage));
+    invalidateBuffer(buffer, area);
 
     return 0;
 }
 
+static inline int sameCell(Cell *a, Cell *b) {
+    return a->character == b->character && a->attributes == b->attributes;
+}
+
+// Compares the damaged parts of the back grid with the front grid and sends
+// only the changed runs to the console, so the cost follows the edit and not
+// the size of the area.
+int presentBuffer(Buffer *buffer, Area *area) {
+    int width = area->size.width;
+
+    if (buffer->damage == NULL) {
+        return 0;
+    }
+
+    for (int row = 0; row < area->size.height; row++) {
+        RowDamage *damage = &buffer->damage[row];
+        Cell *back = buffer->cells + row * width;
+        Cell *front = buffer->front + row * width;
+        int column = damage->start;
+
+        while (column < damage->end) {
+            while (column < damage->end && sameCell(&back[column], &front[column])) {
+                column++;
+            }
+
+            if (column == damage->end) {
+                break;
+            }
+
+            int runStart = column;
+            int runEnd = column;
+
+            // Grow the run over short unchanged gaps
+            while (column < damage->end && column - runEnd < RENDER_RUN_GAP) {
+                if (!sameCell(&back[column], &front[column])) {
+                    runEnd = column + 1;
+                }
+                column++;
+            }
+
+            writeConsoleBuffer(
+                back + runStart,
+                (Vector2d) { area->startLoc.x + runStart, area->startLoc.y + row },
+                (Size2s) { (unsigned short) (runEnd - runStart), 1 }
+            );
+            memcpy(front + runStart, back + runStart, (runEnd - runStart) * sizeof(*front));
+            column = runEnd;
+        }
+
+        damage->start = damage->end = 0;
+    }
+
+    return 0;
+}
+
+// The document's observer, under the journal's when there is one
+static void documentChanged(void *data, size_t offset, size_t removed, size_t length) {
+    (void) data;
+    moveExMarks(Xim.marks, offset, removed, length);
+}
+
+// A new document has no marks, those set from now on follow its changes
+static void watchDocument(PieceTable *document) {
+    for (int i = 0; i < EX_MARKS; i++) {
+        Xim.marks[i] = EX_NO_MARK;
+    }
+
+    document->observer = documentChanged;
+    document->observer_data = NULL;
+}
+
 int initVirtualBuffer() {
     Xim.mode = NO_MODE;
     Xim.signal = NOP_SIGNAL;
 
     //! TODO: Change these later, make them work with dynamic arrays or something
-    Xim.editorBuffer.size.width = 500;
-    Xim.editorBuffer.size.height = 1000;
     Xim.commandBuffer.size.width = 500;
     Xim.commandBuffer.size.height = 1000;
 
     Xim.editorBuffer.cursor = 0;
     Xim.commandBuffer.cursor = 0;
 
-    size_t bufferSize =  Xim.editorBuffer.size.width * Xim.editorBuffer.size.height;
-    Xim.editorBuffer.cells = calloc(bufferSize, sizeof(*(Xim.editorBuffer.cells)));
-    
-    bufferSize = Xim.commandBuffer.size.width * Xim.commandBuffer.size.height;
+    // The editor cells are sized to the editor area in recalculateScreenBuffers
+    Xim.editorBuffer.cells = NULL;
+    Xim.editorBuffer.size = (Size2s) { 0, 0 };
+
+    // Front grids and damage rows are sized to the areas as well
+    Xim.editorBuffer.front = Xim.commandBuffer.front = NULL;
+    Xim.editorBuffer.damage = Xim.commandBuffer.damage = NULL;
+
+    size_t bufferSize = Xim.commandBuffer.size.width * Xim.commandBuffer.size.height;
     Xim.commandBuffer.cells = calloc(bufferSize, sizeof(*(Xim.commandBuffer.cells)));
 
-    if (Xim.editorBuffer.cells == NULL || Xim.commandBuffer.cells == NULL) {
-        free(Xim.editorBuffer.cells);
+    Xim.document = initialize_piece_table(NULL, 0);
+    Xim.source = NULL;
+    Xim.path = NULL;
+    Xim.journal = NULL;
+    Xim.loader = NULL;
+    Xim.follower = NULL;
+    piece_table_enable_history(Xim.document);
+    Xim.documentCursor = 0;
+    Xim.viewOffset = 0;
+
+    if (Xim.commandBuffer.cells == NULL || Xim.document == NULL) {
         free(Xim.commandBuffer.cells);
+        free_piece_table(Xim.document);
 
         return 1;
     }
 
     Xim.writtenCommand = initialize_vector("char", sizeof(char));
+    watchDocument(Xim.document);
+
+    Xim.search = NULL;
+    Xim.replacement = NULL;
+
+    if (initializeBindings()) {
+        return 1;
+    }
 
     recalculateScreenBuffers();
     renderVirtualBuffer(1);
@@ -56,21 +250,586 @@ int recalculateScreenBuffers() {
     Xim.commandArea.startLoc.x = 0;
     Xim.commandArea.startLoc.y = console.state.Size.height - 1;
 
-    Xim.editorBuffer.dirty = 1;
-    Xim.commandBuffer.dirty = 1;
+    // The editor view is exactly as big as its area, re-layout it on every resize
+    size_t viewSize = Xim.editorArea.size.width * Xim.editorArea.size.height;
+    Cell *cells = realloc(Xim.editorBuffer.cells, (viewSize ? viewSize : 1) * sizeof(*cells));
+
+    if (cells == NULL) {
+        return 1;
+    }
+
+    Xim.editorBuffer.cells = cells;
+    Xim.editorBuffer.size = Xim.editorArea.size;
+
+    if (resizeBufferGrids(&Xim.editorBuffer, &Xim.editorArea) || resizeBufferGrids(&Xim.commandBuffer, &Xim.commandArea)) {
+        return 1;
+    }
+
+    renderDocumentView();
 
     return 0;
 }
 
 
 int killVirtualBuffer() {
+    stopIncrementalSearch();
+    // Changes that were not written are kept for recovery when the editor
+    // goes without a quit (its terminal closed)
+    close_journal(Xim.journal, !piece_table_modified(Xim.document));
+    Xim.journal = NULL;
+    stop_loader(Xim.loader);
+    Xim.loader = NULL;
+    free(Xim.path);
+    Xim.path = NULL;
     free(Xim.editorBuffer.cells);
+    free(Xim.editorBuffer.front);
+    free(Xim.editorBuffer.damage);
     free(Xim.commandBuffer.cells);
+    free(Xim.commandBuffer.front);
+    free(Xim.commandBuffer.damage);
+    free_piece_table(Xim.document);
+    close_follower(Xim.follower);
+    Xim.follower = NULL;
+    close_file_source(Xim.source);
     free_vector(Xim.writtenCommand);
+    free_regex(Xim.search);
+    Xim.search = NULL;
+    free(Xim.replacement);
+    Xim.replacement = NULL;
+    killKeymaps();
+
+    return 0;
+}
+
+// Lines as vim counts them in "3L, 12B": an unfinished last line is one
+static size_t countFileLines(PieceTable *document) {
+    size_t length = piece_table_length(document);
+    char last = '\n';
+
+    if (length > 0) {
+        piece_table_read(document, length - 1, &last, 1);
+    }
+
+    return piece_table_line_count(document) - (last == '\n');
+}
+
+// The command line follows the count of a big file's lines, ending on what
+// vim says when it opens a file
+static void showLoadProgress(void *data, size_t counted, size_t length) {
+    (void) data;
+    char message[256];
+
+    if (Xim.mode == EX_MODE || Xim.path == NULL) {
+        return;
+    }
+
+    if (counted < length) {
+        snprintf(message, sizeof(message), "\"%s\" %d%%", Xim.path, (int) ((double) counted * 100 / (double) length));
+    } else {
+        snprintf(message, sizeof(message), "\"%s\" %zuL, %zuB", Xim.path, countFileLines(Xim.document),
+                 piece_table_length(Xim.document));
+    }
+
+    resetCommandBuffer();
+    addBufferToBuffer(COMMAND_BUFFER, message, 0, 0);
+}
+
+// The file is mapped, not read: the document's original pieces point straight
+// into the mapping, so nothing is copied and only touched pages are loaded.
+// Its lines are not counted either, the first screen is drawn from the top
+// chunk alone: a thread counts the rest, a jump further down counts what it
+// passes over itself. Changes a crash left in the file's journal are
+// replayed onto it, one undo takes them all back.
+int openDocument(const char *path) {
+    FileSource *source = open_file_source(path);
+
+    if (source == NULL) {
+        return 1;
+    }
+
+    PieceTable *document = initialize_lazy_piece_table(source->data, source->length);
+    FileFollower *follower = document != NULL ? open_follower(document, source) : NULL;
+    char *copy = malloc(strlen(path) + 1);
+    char *journalPath = journal_path(path);
+
+    if (follower == NULL || copy == NULL || journalPath == NULL || piece_table_enable_history(document)) {
+        close_follower(follower);
+        free_piece_table(document);
+        close_file_source(source);
+        free(copy);
+        free(journalPath);
+        return 1;
+    }
+
+    strcpy(copy, path);
+    close_journal(Xim.journal, 1);
+    stop_loader(Xim.loader);
+    free_piece_table(Xim.document);
+    close_follower(Xim.follower);
+    close_file_source(Xim.source);
+    free(Xim.path);
+
+    // Another xim editing the file keeps its journal to itself: what it
+    // holds is not a crash's to recover, nor ours to write over
+    long holder;
+    JournalLock *lock = lock_journal(journalPath, &holder);
+    size_t recovered = 0;
+
+    if (lock != NULL) {
+        replay_journal(journalPath, document, &recovered);
+        piece_table_commit(document);
+    }
+
+    Xim.document = document;
+    Xim.source = source;
+    Xim.path = copy;
+    watchDocument(document);
+    Xim.journal = lock != NULL ? open_journal(journalPath, document, lock) : NULL;
+    Xim.follower = follower;
+    Xim.documentCursor = 0;
+    Xim.viewOffset = 0;
+    // A file of one chunk is counted as soon as it is looked at, no thread needed
+    Xim.loader = source->length > PIECE_BUFFER_CHUNK_SIZE ?
+                 start_loader(document, recovered > 0 || lock == NULL ? NULL : showLoadProgress, NULL) : NULL;
+
+    if (lock == NULL) {
+        char message[96];
+
+        if (holder > 0) {
+            snprintf(message, sizeof(message), "E325: Journal in use by process %ld, changes are not journaled", holder);
+        } else {
+            snprintf(message, sizeof(message), "E325: Can't lock the journal, changes are not journaled");
+        }
+
+        resetCommandBuffer();
+        addBufferToBuffer(COMMAND_BUFFER, message, 0, 0);
+    } else if (recovered > 0) {
+        char message[64];
+
+        snprintf(message, sizeof(message), "Recovered %zu changes", recovered);
+        resetCommandBuffer();
+        addBufferToBuffer(COMMAND_BUFFER, message, 0, 0);
+    } else if (Xim.loader != NULL) {
+        showLoadProgress(NULL, 0, source->length);
+    }
+
+    free(journalPath);
+    renderDocumentView();
+    renderVirtualBuffer(0);
+    setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
+
+    return 0;
+}
+
+// ":w": the document's own file when path is empty, another one otherwise.
+// Writing its own file (or naming a new document) starts the journal over
+// from what is now on disk.
+const char *writeDocument(const char *path, size_t length, const char **message) {
+    static char written[256];
+    char *target = length > 0 ? malloc(length + 1) : Xim.path;
+
+    if (target == NULL) {
+        return length > 0 ? "E342: Out of memory" : "E32: No file name";
+    }
+
+    if (length > 0) {
+        memcpy(target, path, length);
+        target[length] = '\0';
+    }
+
+    int own = Xim.path != NULL && (target == Xim.path || !strcmp(target, Xim.path));
+
+    // The count reads the original, which the save may copy and let go of.
+    // What is written says how many lines there are, they get counted anyway.
+    stop_loader(Xim.loader);
+    Xim.loader = NULL;
+
+    // Nor does the follower hold on to the file written over
+    if ((own && follower_release(Xim.follower)) || save_piece_table(Xim.document, target, Xim.source)) {
+        snprintf(written, sizeof(written), "E212: Can't open file for writing: %s", target);
+
+        if (target != Xim.path) {
+            free(target);
+        }
+
+        return written;
+    }
+
+    snprintf(written, sizeof(written), "\"%s\" %zuL, %zuB written", target, countFileLines(Xim.document),
+             piece_table_length(Xim.document));
+    *message = written;
+
+    // A copy written somewhere else, the document stays its file's
+    if (Xim.path != NULL && target != Xim.path) {
+        free(target);
+
+        if (!own) {
+            return NULL;
+        }
+    }
+
+    if (Xim.path == NULL) {
+        char *journalPath = journal_path(target);
+
+        Xim.path = target;
+        long holder;
+        JournalLock *lock = journalPath != NULL ? lock_journal(journalPath, &holder) : NULL;
+
+        Xim.journal = lock != NULL ? open_journal(journalPath, Xim.document, lock) : NULL;
+        free(journalPath);
+    }
+
+    piece_table_mark_saved(Xim.document);
+
+    if (Xim.journal != NULL) {
+        journal_rebase(Xim.journal);
+    }
+
+    // The file is a new one, it grows from what was written
+    if (Xim.follower != NULL) {
+        follower_written(Xim.follower, piece_table_length(Xim.document));
+    }
+
+    return NULL;
+}
+
+// What came in while following is the file's, the journal replays onto it
+static void keepFollowedText() {
+    unsigned int buffer;
+    size_t start, length;
+
+    if (follower_take_appended(Xim.follower, &buffer, &start, &length) && Xim.journal != NULL) {
+        journal_extend_base(Xim.journal, buffer, start, length);
+    }
+}
+
+// The view stays on the last line of a followed document as it grows. A
+// file that got shorter was taken in again from the start, nothing of the
+// old document is left to look at: the view starts over. A file that went
+// away is not followed anymore, the document keeps what came in.
+static void showFollowedEnd(void *data, enum FOLLOW_EVENTS event, size_t offset, size_t length) {
+    (void) data;
+    (void) offset;
+    (void) length;
+
+    if (event == FOLLOW_GONE) {
+        keepFollowedText();
+        resetCommandBuffer();
+        addBufferToBuffer(COMMAND_BUFFER, "File moved or deleted, not followed anymore", 0, 0);
+        return;
+    }
+
+    if (event == FOLLOW_RELOADED) {
+        // The count of the original's lines would read bytes that are gone
+        stop_loader(Xim.loader);
+        Xim.loader = NULL;
+        Xim.viewOffset = 0;
+
+        // The document is the file as it is now, the marks were in text that went
+        piece_table_mark_saved(Xim.document);
+
+        for (int i = 0; i < EX_MARKS; i++) {
+            Xim.marks[i] = EX_NO_MARK;
+        }
+
+        if (Xim.journal != NULL) {
+            journal_rebase(Xim.journal);
+        }
+
+        resetCommandBuffer();
+        addBufferToBuffer(COMMAND_BUFFER, "File truncated, read again", 0, 0);
+    }
+
+    moveDocumentCursor(findLineStart(piece_table_length(Xim.document)));
+}
+
+// "F", after less: what is appended to the file comes into the document and
+// the view keeps to its end until the next key, which only stops it. What
+// comes in is the file's, not a change: the journal takes it into the file
+// it replays onto once the following stops. The view is read-only: a
+// document with changes not written is not followed, a file that got
+// shorter is read again and would take them with it. Returns what the
+// command line says.
+const char *followDocument() {
+    if (Xim.follower == NULL) {
+        return "E32: No file name";
+    }
+
+    if (piece_table_modified(Xim.document)) {
+        return "E37: No write since last change";
+    }
+
+    if (start_following(Xim.follower, Xim.path, showFollowedEnd, NULL)) {
+        return "Can't follow the file";
+    }
+
+    moveDocumentCursor(findLineStart(piece_table_length(Xim.document)));
+
+    return "Waiting for data... (any key stops)";
+}
+
+int stopFollowing() {
+    if (Xim.follower == NULL || !follower_watching(Xim.follower)) {
+        return 1;
+    }
+
+    stop_following(Xim.follower);
+    keepFollowedText();
+    resetCommandBuffer();
+
+    return 0;
+}
+
+// Finds the first byte of the line holding offset
+size_t findLineStart(size_t offset) {
+    return piece_table_line_start(Xim.document, piece_table_line_at(Xim.document, offset));
+}
+
+// Moves the cursor and the top of the view to the zero based line
+int goToLine(size_t line) {
+    Xim.documentCursor = piece_table_line_start(Xim.document, line);
+    Xim.viewOffset = Xim.documentCursor;
+
+    renderDocumentView();
+    setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
 
     return 0;
 }
 
+// Lays the document out into the editor cells starting at Xim.viewOffset.
+// Returns 1 when the document cursor ended up on screen, nextRowOffset gets
+// the first byte of the second screen row, used to scroll down by one row.
+int layoutDocumentView(size_t *nextRowOffset) {
+    Buffer *buffer = &Xim.editorBuffer;
+    Area *area = &Xim.editorArea;
+    size_t width = buffer->size.width;
+    size_t cellCount = width * buffer->size.height;
+    size_t offset = Xim.viewOffset;
+    size_t cell = 0;
+    size_t filled = 0; // cells before this one are laid out
+    int cursorShown = 0;
+    PieceTableIterator chunks;
+    // Every byte shown but '\r' takes a cell or ends a row, the view holds
+    // fewer than twice as many bytes as cells
+    Vector *highlights = searchHighlights(offset, offset + 2 * cellCount);
+    size_t highlight = 0;
+
+    *nextRowOffset = piece_table_length(Xim.document);
+
+    // Only the pieces that end up on screen are visited
+    for (int more = piece_table_iterator_seek(&chunks, Xim.document, offset); more && cell < cellCount;
+         more = piece_table_iterator_next(&chunks)) {
+        const char *text = chunks.text;
+
+        for (size_t i = 0; i < chunks.length && cell < cellCount; i++, offset++) {
+            size_t row = cell / width;
+
+            if (offset == Xim.documentCursor) {
+                buffer->cursor = (int) cell;
+                cursorShown = 1;
+            }
+
+            if (text[i] == '\n') {
+                cell = (row + 1) * width;
+            } else if (text[i] != '\r') {
+                for (; filled < cell; filled++) {
+                    setBufferCell(buffer, area, (int) filled, ' ', 0);
+                }
+
+                unsigned short attributes = DOCUMENT_TEXT_ATTRIBUTES;
+
+                if (highlights != NULL) {
+                    RegexMatch *matches = (RegexMatch *) highlights->base;
+
+                    while (highlight < highlights->len && matches[highlight].end <= offset) {
+                        highlight++;
+                    }
+
+                    if (highlight < highlights->len && matches[highlight].start <= offset) {
+                        attributes = SEARCH_HIGHLIGHT_ATTRIBUTES;
+                    }
+                }
+
+                setBufferCell(buffer, area, (int) cell, text[i], attributes);
+                filled = ++cell;
+            }
+
+            if (row == 0 && cell >= width) {
+                *nextRowOffset = offset + 1;
+            }
+        }
+    }
+
+    // The cursor may sit right after the last character of the document
+    if (!cursorShown && offset == Xim.documentCursor && cell < cellCount) {
+        buffer->cursor = (int) cell;
+        cursorShown = 1;
+    }
+
+    for (; filled < cellCount; filled++) {
+        setBufferCell(buffer, area, (int) filled, ' ', 0);
+    }
+
+    return cursorShown;
+}
+
+// Walks the cells of a line from offset as layoutDocumentView lays them out,
+// every byte but '\r' takes one, until cells of them are passed or end is
+// reached. Returns the offset reached, walked gets the cells passed.
+static size_t walkLineCells(size_t offset, size_t end, size_t cells, size_t *walked) {
+    PieceTableIterator chunks;
+
+    *walked = 0;
+
+    for (int more = piece_table_iterator_seek(&chunks, Xim.document, offset); more && offset < end && *walked < cells;
+         more = piece_table_iterator_next(&chunks)) {
+        const char *text = chunks.text;
+        const char *stop = text + (chunks.length < end - offset ? chunks.length : end - offset);
+
+        while (text < stop && *walked < cells) {
+            const char *skipped = memchr(text, '\r', (size_t) (stop - text));
+            size_t run = (size_t) ((skipped != NULL ? skipped : stop) - text);
+
+            run = run < cells - *walked ? run : cells - *walked;
+            text += run;
+            *walked += run;
+
+            if (text == skipped && *walked < cells) {
+                text++;
+            }
+        }
+
+        offset += (size_t) (text - chunks.text);
+    }
+
+    return offset;
+}
+
+// The first byte of the view that shows the cursor on its last row, found
+// from the cursor up a line at a time with the rows each line wraps into:
+// a line of n cells takes n / width + 1 rows, its line break included.
+static size_t viewTopAboveCursor() {
+    size_t width = Xim.editorBuffer.size.width;
+    size_t rows = Xim.editorBuffer.size.height - 1; // above the cursor's row
+    size_t line = piece_table_line_at(Xim.document, Xim.documentCursor);
+    size_t start = piece_table_line_start(Xim.document, line);
+    size_t cells;
+
+    walkLineCells(start, Xim.documentCursor, (size_t) -1, &cells);
+
+    for (size_t lineRows = cells / width;; lineRows = cells / width + 1) {
+        if (lineRows >= rows) {
+            return walkLineCells(start, (size_t) -1, (lineRows - rows) * width, &cells);
+        }
+
+        if (line == 0) {
+            return 0;
+        }
+
+        rows -= lineRows;
+        size_t end = start - 1;
+
+        start = piece_table_line_start(Xim.document, --line);
+        walkLineCells(start, end, (size_t) -1, &cells);
+    }
+}
+
+int renderDocumentView() {
+    Buffer *buffer = &Xim.editorBuffer;
+    size_t nextRowOffset;
+
+    if (buffer->size.width == 0 || buffer->size.height == 0) {
+        return 0;
+    }
+
+    if (Xim.documentCursor < Xim.viewOffset) {
+        Xim.viewOffset = findLineStart(Xim.documentCursor);
+    }
+
+    // A view starting above this cannot show the cursor: jump there instead of
+    // scrolling past it row by row, long lines wrap into many rows
+    if (!layoutDocumentView(&nextRowOffset)) {
+        size_t top = viewTopAboveCursor();
+
+        if (top > Xim.viewOffset) {
+            Xim.viewOffset = top;
+        }
+
+        // Scroll down a row at a time until the cursor fits in the view
+        while (!layoutDocumentView(&nextRowOffset) && nextRowOffset > Xim.viewOffset) {
+            Xim.viewOffset = nextRowOffset;
+        }
+    }
+
+    return 0;
+}
+
+int addTextToDocument(char *text, size_t at, unsigned short relocate_cursor) {
+    size_t length = strlen(text);
+
+    if (at != AT_DOCUMENT_CURSOR) {
+        Xim.documentCursor = at;
+    }
+
+    if (Xim.documentCursor > piece_table_length(Xim.document)) {
+        Xim.documentCursor = piece_table_length(Xim.document);
+    }
+
+    if (piece_table_insert(Xim.document, Xim.documentCursor, text, length)) {
+        return 1;
+    }
+
+    Xim.documentCursor += length;
+    renderDocumentView();
+
+    if (relocate_cursor) {
+        setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
+    }
+
+    return 0;
+}
+
+int deleteBeforeCursor() {
+    if (Xim.documentCursor == 0) {
+        return 1;
+    }
+
+    Xim.documentCursor--;
+
+    if (piece_table_delete(Xim.document, Xim.documentCursor, 1)) {
+        return 1;
+    }
+
+    renderDocumentView();
+    setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
+
+    return 0;
+}
+
+// Puts the document cursor at offset, clamped to the document, and scrolls to it
+int moveDocumentCursor(size_t offset) {
+    size_t length = piece_table_length(Xim.document);
+
+    Xim.documentCursor = offset < length ? offset : length;
+    renderDocumentView();
+    setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
+
+    return 0;
+}
+
+// Removes [start, end) from the document, the cursor ends up at start
+int deleteDocumentRange(size_t start, size_t end) {
+    size_t length = piece_table_length(Xim.document);
+
+    end = end < length ? end : length;
+
+    if (start < end && piece_table_delete(Xim.document, start, end - start)) {
+        return 1;
+    }
+
+    return moveDocumentCursor(start);
+}
+
 int addBufferToBuffer(enum XIM_BUFFER_TYPES type, char *text, int at, unsigned short relocate_cursor) {
     char character = '\0';
 
@@ -104,6 +863,11 @@ int addBufferToBuffer(enum XIM_BUFFER_TYPES type, char *text, int at, unsigned s
         break;
     }
 
+    // Editor text goes into the document, the cells are re-rendered from it
+    if (buffer == &Xim.editorBuffer) {
+        return addTextToDocument(text, at >= 0 ? (size_t) at : AT_DOCUMENT_CURSOR, relocate_cursor);
+    }
+
     // Negative values mean text will be placed at the current last char
     //  of the buffer
     if (at >= 0) {
@@ -123,14 +887,12 @@ int addBufferToBuffer(enum XIM_BUFFER_TYPES type, char *text, int at, unsigned s
             break; // max buffer size
         }
 
-        buffer->cells[buffer->cursor].Char.AsciiChar = character;
-        buffer->cells[buffer->cursor].Attributes |= FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+        buffer->cells[buffer->cursor].character = character;
+        buffer->cells[buffer->cursor].attributes |= DOCUMENT_TEXT_ATTRIBUTES;
         buffer->cursor++;
     }
 
-    if (buffer->cursor != start) {
-        buffer->dirty = 1;
-    }
+    damageBufferCells(buffer, area, start, buffer->cursor);
 
     if (relocate_cursor) {
         setCursorPosition(area->startLoc, buffer->cursor);
@@ -139,131 +901,151 @@ int addBufferToBuffer(enum XIM_BUFFER_TYPES type, char *text, int at, unsigned s
     return 0;
 }
 
-int flushScreenBuffer(Area *area) {
-    Buffer flushBuffer;
+// Draws one frame: only what changed since the last one reaches the console.
+// flush repaints everything, for when the console content is unknown.
+int renderVirtualBuffer(unsigned short flush) {
+    if (flush != 0) {
+        invalidateBuffer(&Xim.editorBuffer, &Xim.editorArea);
+        invalidateBuffer(&Xim.commandBuffer, &Xim.commandArea);
+    }
+
+    presentBuffer(&Xim.editorBuffer, &Xim.editorArea);
+    presentBuffer(&Xim.commandBuffer, &Xim.commandArea);
+
+    return 0;
+}
+
+
+// Keys that only add themselves to the document while inserting
+static int isTextKey(ConsoleInput *input) {
+    KeyCode key = input->key;
+
+    if (input->event != CONSOLE_EVENT_KEY) {
+        return 0;
+    }
+
+    if (key.keyCode == XIM_KEY_RETURN || key.keyCode == XIM_KEY_TAB) {
+        return 1;
+    }
+
+    // Win32 reports the virtual key of letters too, the character is what counts
+    return key.character >= ' ' && key.character != 0x7F && key.character < 0x100;
+}
+
+// Inserts the run of text keys at the start of events with one document
+// insert and one layout, returns how many events it took. Insert mode only
+// binds special keys, so text never needs to go through its keymap.
+size_t insertTextRun(ConsoleInput *events, size_t count) {
+    static char text[CONSOLE_INPUT_BATCH + 1];
+    size_t length = 0;
 
-    flushBuffer.cells = malloc(sizeof(*(flushBuffer.cells)) * area->size.width * area->size.height);
-    flushBuffer.size = (Size2s) { area->size.width, area->size.height };
-    flushBuffer.cursor = 0;
+    while (length < count && length < CONSOLE_INPUT_BATCH && isTextKey(&events[length])) {
+        KeyCode key = events[length].key;
 
-    for (size_t i = 0; i < (size_t) (flushBuffer.size.width * flushBuffer.size.height); i++) {
-        flushBuffer.cells[i].Char.AsciiChar = ' ';
-        flushBuffer.cells[i].Attributes = 0;
+        text[length++] = key.keyCode == XIM_KEY_RETURN ? '\n' : (char) key.character;
     }
 
-    writeWindowsBuffer(
-        flushBuffer.cells,
-        (COORD){ .X = area->startLoc.x, .Y = area->startLoc.y },
-        (COORD){ .X = area->size.width, .Y = area->size.height }
-    );
+    text[length] = '\0';
 
-    free(flushBuffer.cells);
+    if (length > 0) {
+        addTextToDocument(text, AT_DOCUMENT_CURSOR, 1);
+    }
 
-    return 0;
+    return length;
 }
 
-int renderVirtualBuffer(unsigned short flush) {
-    if (!(Xim.editorBuffer.dirty || Xim.commandBuffer.dirty))
-        return 0;
+// Keys go through the table of the current mode first (see bindings.c), the
+// ones bound to nothing are text in insert mode and on the command line
+void handleKey(KeyCode key) {
+    if (!key.character && !key.keyCode)
+        return;
 
-    Buffer *buffer;
-    Area *area;
+    if (dispatchKey(&Xim.keys, Xim.keymaps[Xim.mode], key) != KEYMAP_UNBOUND) {
+        return;
+    }
 
-    if (flush != 0) {
-        if (Xim.editorBuffer.dirty) {
-            flushScreenBuffer(&Xim.editorArea);
-        }
-        Sleep(1);
-        if (Xim.commandBuffer.dirty) {
-            flushScreenBuffer(&Xim.commandArea);
-        }
-        // A hack: wait before writing to the buffers
-        Sleep(1);
-    }
-
-    if (Xim.editorBuffer.dirty) {
-        buffer = &(Xim.editorBuffer);
-        area = &Xim.editorArea;
-        writeWindowsBuffer(
-            buffer->cells,
-            (COORD){ .X = area->startLoc.x, .Y = area->startLoc.y },
-            (COORD){ .X = area->size.width, .Y = area->size.height }
-        );
-        buffer->dirty = 0;
-    }
-    if (Xim.commandBuffer.dirty) {
-        // A hack: wait before writing to the 2nd buffer
-        Sleep(1);
-        buffer = &(Xim.commandBuffer);
-        area = &Xim.commandArea;
-        writeWindowsBuffer(
-            buffer->cells,
-            (COORD){ .X = area->startLoc.x, .Y = area->startLoc.y },
-            (COORD){ .X = area->size.width, .Y = area->size.height }
-        );
-        buffer->dirty = 0;
+    if (key.character < ' ' && key.keyCode != XIM_KEY_TAB) {
+        return;
     }
 
-    return 0;
+    if (Xim.mode == RAW_MODE || Xim.mode == EX_MODE) {
+        addBufferToBuffer(CURRENT, (char[2]) {(char) key.character}, -1, 1);
+
+        if (Xim.mode == EX_MODE) {
+            char ch = (char) key.character;
+            vec_push_back(Xim.writtenCommand, &ch);
+
+            if (Xim.commandPrompt != ':') {
+                updateIncrementalSearch();
+            }
+        }
+    }
 }
 
+// A terminal being dragged to a new size sends many resizes, the screen is
+// laid out again once for all of them
+static int resizeScreen(void *data) {
+    (void) data;
+    rerenderScreen();
 
-int initializeXim() {
-    KeyCode key;
+    return 0;
+}
 
-    while(Xim.signal != EXIT_SIGNAL) {
-        key = pollInputFromConsole();
+// What one key did is undone at once, a whole insert as well
+static void commitChanges() {
+    if (Xim.mode != RAW_MODE) {
+        piece_table_commit(Xim.document);
+    }
+}
 
-        if (!key.character && !key.keyCode)
+void handleInputBatch(ConsoleInput *events, size_t count) {
+    for (size_t i = 0; i < count && Xim.signal != EXIT_SIGNAL;) {
+        // A followed document takes no keys, the first one stops the following
+        if (events[i].event == CONSOLE_EVENT_KEY && !stopFollowing()) {
+            i++;
             continue;
-
-        //! TODO: Tightly coupled to windows bruh.
-        //! VK_ESCAPE, are you blind ??
-        if (key.keyCode == VK_ESCAPE) {
-            resetCommandBuffer();
-            setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
-            Xim.mode = NO_MODE;
         }
 
-        if (Xim.mode == EX_MODE) {
-            if (key.keyCode == VK_RETURN) {
-                enum SIGNALS result = parseCommandFromBuffer(Xim.writtenCommand);
+        // Pasted text is text in every mode but the command line, it never runs commands
+        int inserting = Xim.mode == RAW_MODE || (events[i].pasted && Xim.mode == NO_MODE);
+        size_t taken = inserting ? insertTextRun(events + i, count - i) : 0;
 
-                if (result == EXIT_SIGNAL) {
-                    Xim.signal = EXIT_SIGNAL;
-                }
+        if (taken > 0) {
+            i += taken;
+            commitChanges();
+            continue;
+        }
 
-                vec_clear(Xim.writtenCommand);
-                resetCommandBuffer();
-                setCursorPosition(Xim.editorArea.startLoc, Xim.editorBuffer.cursor);
-                Xim.mode = NO_MODE;
-            }
+        switch (events[i].event) {
+            case CONSOLE_EVENT_KEY:
+                handleKey(events[i].key);
+                break;
+            case CONSOLE_EVENT_RESIZE:
+                deferWork(resizeScreen, NULL);
+                break;
+            case CONSOLE_EVENT_CLOSED:
+                Xim.signal = EXIT_SIGNAL;
+                break;
+            default:
+                break;
         }
+        i++;
+        commitChanges();
+    }
+}
 
-        if (Xim.mode == NO_MODE) {
-            //! TODO: These keys have multiple purposes inside raw mode, implement them you lazy fossil
-             if (key.character == 'i' || key.character == 'I' ||
-                 key.character == 's' || key.character == 'S' ||
-                 key.character == 'o' || key.character == 'O' ||
-                 key.character == 'a' || key.character == 'A') {
-                // enable insert mode if it wasn't, otherwise just type the character to the screen
-                addBufferToBuffer(COMMAND_BUFFER, "-- INSERT --", 0, 0);
-                Xim.mode = RAW_MODE;
-            } else if (key.character == ':') {
-                Xim.mode = EX_MODE;
-                addBufferToBuffer(CURRENT, ":", -1, 1);
-            }
-        } else {
-            if (key.character) {
-                addBufferToBuffer(CURRENT, (char[2]) {(char) key.character}, -1, 1);
+// Input is taken a batch at a time and the screen drawn once per batch, so a
+// paste costs a handful of frames however long it is. Between batches the
+// editor sleeps in waitForEvents, timers and other threads can wake it.
+int initializeXim() {
+    static ConsoleInput events[CONSOLE_INPUT_BATCH];
 
-                if (Xim.mode == EX_MODE) {
-                    char ch = (char) key.character;
-                    vec_push_back(Xim.writtenCommand, &ch);
-                }
-            }
+    while(Xim.signal != EXIT_SIGNAL) {
+        if (waitForEvents()) {
+            handleInputBatch(events, pollInputFromConsole(events, CONSOLE_INPUT_BATCH));
         }
 
+        runDeferredWork();
         renderVirtualBuffer(0);
     }
 
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "types.h"
+#include "console/ansi.h"
+
+// ---------------------------------------------------------
+// A tiny VT terminal, just the sequences the writer may send
+// ---------------------------------------------------------
+
+#define MAX_W 64
+#define MAX_H 24
+
+typedef struct {
+    int width, height;
+    int x, y;
+    int pendingWrap;
+    int fg, bg; // SGR codes, 39/49 = default
+    struct { char ch; int fg, bg; } cells[MAX_H][MAX_W];
+} Terminal;
+
+static void term_init(Terminal *t, int width, int height) {
+    memset(t, 0, sizeof(*t));
+    t->width = width;
+    t->height = height;
+    t->fg = 39;
+    t->bg = 49;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            t->cells[y][x].ch = '?'; // garbage until cleared
+            t->cells[y][x].fg = 39;
+            t->cells[y][x].bg = 49;
+        }
+}
+
+static void term_sgr(Terminal *t, int *params, int count) {
+    if (count == 0) { t->fg = 39; t->bg = 49; return; }
+    for (int i = 0; i < count; ++i) {
+        int p = params[i];
+        if (p == 0) { t->fg = 39; t->bg = 49; }
+        else if ((p >= 30 && p <= 39) || (p >= 90 && p <= 97)) t->fg = p;
+        else if ((p >= 40 && p <= 49) || (p >= 100 && p <= 107)) t->bg = p;
+        else assert(0 && "unexpected SGR parameter");
+    }
+}
+
+static void term_feed(Terminal *t, const char *data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        char c = data[i];
+
+        if (c == '\x1b') {
+            assert(data[i + 1] == '[' && "only CSI sequences are expected");
+            i += 2;
+            int params[8] = {0}, count = 0, has = 0;
+            while (1) {
+                char d = data[i];
+                if (d >= '0' && d <= '9') { params[count] = params[count] * 10 + (d - '0'); has = 1; i++; continue; }
+                if (d == ';') { count++; i++; continue; }
+                break;
+            }
+            if (has || count) count++;
+            char final = data[i];
+            int n = (count && params[0]) ? params[0] : 1;
+
+            switch (final) {
+                case 'H': t->y = (count >= 1 && params[0] ? params[0] : 1) - 1;
+                          t->x = (count >= 2 && params[1] ? params[1] : 1) - 1; break;
+                case 'A': t->y -= n; break;
+                case 'B': t->y += n; break;
+                case 'C': t->x += n; break;
+                case 'D': t->x -= n; break;
+                case 'm': term_sgr(t, params, count); break;
+                case 'K': for (int x = t->x; x < t->width; ++x) {
+                              t->cells[t->y][x].ch = ' '; t->cells[t->y][x].fg = t->fg; t->cells[t->y][x].bg = t->bg;
+                          } break;
+                case 'J': assert(params[0] == 2);
+                          for (int y = 0; y < t->height; ++y) for (int x = 0; x < t->width; ++x) {
+                              t->cells[y][x].ch = ' '; t->cells[y][x].fg = t->fg; t->cells[y][x].bg = t->bg;
+                          } break;
+                default: assert(0 && "unexpected CSI sequence");
+            }
+            t->pendingWrap = 0;
+            assert(t->x >= 0 && t->x < t->width && t->y >= 0 && t->y < t->height && "cursor left the screen");
+            continue;
+        }
+
+        if (c == '\r') { t->x = 0; t->pendingWrap = 0; continue; }
+        if (c == '\n') { assert(t->y + 1 < t->height && "line feed would scroll"); t->y++; t->pendingWrap = 0; continue; }
+        if (c == '\b') { assert(!t->pendingWrap && "backspace right after the last column"); if (t->x > 0) t->x--; continue; }
+
+        assert((unsigned char)c >= ' ' && "raw control byte sent");
+        if (t->pendingWrap) {
+            assert(0 && "printed while waiting to wrap");
+        }
+        t->cells[t->y][t->x].ch = c;
+        t->cells[t->y][t->x].fg = t->fg;
+        t->cells[t->y][t->x].bg = t->bg;
+        if (t->x == t->width - 1) t->pendingWrap = 1;
+        else t->x++;
+    }
+}
+
+// The colors a cell must end up with on the terminal
+static int expected_fg(unsigned short a) {
+    int c = ((a & CELL_FOREGROUND_RED) ? 1 : 0) | ((a & CELL_FOREGROUND_GREEN) ? 2 : 0) | ((a & CELL_FOREGROUND_BLUE) ? 4 : 0);
+    if (a & CELL_FOREGROUND_INTENSITY) return 90 + c;
+    return c ? 30 + c : 39;
+}
+
+static int expected_bg(unsigned short a) {
+    int c = ((a & CELL_BACKGROUND_RED) ? 1 : 0) | ((a & CELL_BACKGROUND_GREEN) ? 2 : 0) | ((a & CELL_BACKGROUND_BLUE) ? 4 : 0);
+    if (a & CELL_BACKGROUND_INTENSITY) return 100 + c;
+    return c ? 40 + c : 49;
+}
+
+static void check_screen(Terminal *t, Cell *screen, const char *phase) {
+    for (int y = 0; y < t->height; ++y)
+        for (int x = 0; x < t->width; ++x) {
+            Cell *want = &screen[y * t->width + x];
+            if (t->cells[y][x].ch != want->character ||
+                t->cells[y][x].fg != expected_fg(want->attributes) ||
+                t->cells[y][x].bg != expected_bg(want->attributes)) {
+                printf("MISMATCH at %d,%d during %s: got '%c' %d/%d, want '%c' %d/%d\n", x, y, phase,
+                       t->cells[y][x].ch, t->cells[y][x].fg, t->cells[y][x].bg,
+                       want->character, expected_fg(want->attributes), expected_bg(want->attributes));
+                assert(0 && "terminal differs from the cells written");
+            }
+        }
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static unsigned short random_attributes() {
+    static const unsigned short palette[] = {
+        0, 0, 0,
+        CELL_FOREGROUND_RED | CELL_FOREGROUND_GREEN | CELL_FOREGROUND_BLUE | CELL_FOREGROUND_INTENSITY,
+        CELL_FOREGROUND_GREEN,
+        CELL_FOREGROUND_RED | CELL_BACKGROUND_BLUE,
+        CELL_BACKGROUND_RED | CELL_BACKGROUND_INTENSITY,
+    };
+    return palette[rand() % (int)(sizeof(palette) / sizeof(palette[0]))];
+}
+
+static void test_random_frames(int frames) {
+    printf("=== test_random_frames (frames=%d) ===\n", frames);
+    srand((unsigned)time(NULL) ^ 0xA451);
+
+    int width = 20 + rand() % (MAX_W - 20), height = 5 + rand() % (MAX_H - 5);
+    Terminal t;
+    AnsiWriter writer;
+    Cell *screen = malloc(sizeof(Cell) * (size_t)(width * height));
+    Cell *patch = malloc(sizeof(Cell) * (size_t)(width * height));
+
+    term_init(&t, width, height);
+    initialize_ansi_writer(&writer);
+    assert(ansi_resize(&writer, (Size2s) { (unsigned short)width, (unsigned short)height }) == 0);
+    assert(ansi_clear_screen(&writer) == 0);
+    for (int i = 0; i < width * height; ++i) screen[i] = (Cell) { ' ', 0 };
+
+    for (int f = 0; f < frames; ++f) {
+        int writes = 1 + rand() % 6;
+        for (int w = 0; w < writes; ++w) {
+            // A rectangle of text, often with blank tails so EL gets used
+            int x = rand() % width, y = rand() % height;
+            int pw = 1 + rand() % (width - x), ph = 1 + rand() % (height - y < 3 ? height - y : 3);
+            int text = rand() % (pw + 1);
+
+            for (int r = 0; r < ph; ++r)
+                for (int c = 0; c < pw; ++c) {
+                    Cell cell = c < text ? (Cell) { (char)('a' + rand() % 26), random_attributes() } : (Cell) { ' ', 0 };
+                    patch[r * pw + c] = cell;
+                    screen[(y + r) * width + x + c] = cell;
+                }
+
+            assert(ansi_write_cells(&writer, patch, (Vector2d) { x, y }, (Size2s) { (unsigned short)pw, (unsigned short)ph }) == 0);
+        }
+
+        // The frame ends with the cursor placed somewhere
+        Vector2d cursor = { rand() % width, rand() % height };
+        assert(ansi_move_cursor(&writer, cursor) == 0);
+
+        term_feed(&t, writer.data, writer.length);
+        writer.length = 0;
+
+        check_screen(&t, screen, "random frame");
+        assert(t.x == cursor.x && t.y == cursor.y && "cursor is not where it was asked to be");
+    }
+
+    free(screen);
+    free(patch);
+    free_ansi_writer(&writer);
+}
+
+static void test_cheap_moves() {
+    printf("=== test_cheap_moves ===\n");
+
+    AnsiWriter writer;
+    initialize_ansi_writer(&writer);
+    ansi_resize(&writer, (Size2s) { 80, 24 });
+    ansi_clear_screen(&writer);
+    writer.length = 0;
+
+    // Unknown cursor: an absolute move
+    ansi_move_cursor(&writer, (Vector2d) { 4, 2 });
+    assert(writer.length == strlen("\x1b[3;5H"));
+    writer.length = 0;
+
+    // Same place costs nothing
+    ansi_move_cursor(&writer, (Vector2d) { 4, 2 });
+    assert(writer.length == 0);
+
+    // One left is a backspace, one down a line feed
+    ansi_move_cursor(&writer, (Vector2d) { 3, 2 });
+    assert(writer.length == 1 && writer.data[0] == '\b');
+    writer.length = 0;
+    ansi_move_cursor(&writer, (Vector2d) { 3, 3 });
+    assert(writer.length == 1 && writer.data[0] == '\n');
+    writer.length = 0;
+
+    // Start of the row is a carriage return
+    ansi_move_cursor(&writer, (Vector2d) { 0, 3 });
+    assert(writer.length == 1 && writer.data[0] == '\r');
+    writer.length = 0;
+
+    // Printing a cell leaves the cursor right after it, the next one is free
+    Cell cell = { 'x', CELL_FOREGROUND_GREEN };
+    ansi_write_cells(&writer, &cell, (Vector2d) { 0, 3 }, (Size2s) { 1, 1 });
+    size_t first = writer.length;
+    ansi_write_cells(&writer, &cell, (Vector2d) { 1, 3 }, (Size2s) { 1, 1 });
+    assert(writer.length - first == 1 && "same color and position need only the character");
+    writer.length = 0;
+
+    // A blank row tail is erased rather than printed
+    Cell row[80];
+    for (int i = 0; i < 80; ++i) row[i] = (Cell) { ' ', 0 };
+    row[0] = cell;
+    ansi_write_cells(&writer, row, (Vector2d) { 0, 5 }, (Size2s) { 80, 1 });
+    assert(writer.length < 20);
+
+    free_ansi_writer(&writer);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("ANSI WRITER TEST START\n");
+
+    test_cheap_moves();
+    test_random_frames(3000);
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
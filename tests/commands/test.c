@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "xim.h"
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static const char *Lines = "one\ntwo\nthree\nfour\nfive";
+
+static PieceTable *document = NULL;
+static size_t marks[EX_MARKS];
+
+static ExCall start_call(const char *text, size_t cursorLine) {
+    if (document != NULL) {
+        free_piece_table(document);
+    }
+
+    document = initialize_piece_table(text, strlen(text));
+    assert(document != NULL);
+
+    for (int i = 0; i < EX_MARKS; i++) {
+        marks[i] = EX_NO_MARK;
+    }
+
+    ExCall call = {
+        .document = document,
+        .cursor = piece_table_line_start(document, cursorLine),
+        .marks = marks,
+    };
+
+    return call;
+}
+
+static void assert_document(const char *expected) {
+    size_t length = piece_table_length(document);
+    char *text = malloc(length + 1);
+
+    text[piece_table_read(document, 0, text, length)] = '\0';
+
+    if (strcmp(text, expected) != 0) {
+        printf("DOCUMENT: got \"%s\", expected \"%s\"\n", text, expected);
+        assert(0 && "document differs");
+    }
+
+    free(text);
+}
+
+static void assert_range(ExCall *call, const char *range, size_t first, size_t last) {
+    const char *text = range;
+
+    if (parseExRange(call, &text, range + strlen(range)) != 0) {
+        printf("RANGE \"%s\": %s\n", range, call->error);
+        assert(0 && "range did not parse");
+    }
+
+    if (call->range.first != first || call->range.last != last) {
+        printf("RANGE \"%s\": got %zu,%zu, expected %zu,%zu\n", range, call->range.first, call->range.last, first, last);
+        assert(0 && "range differs");
+    }
+}
+
+static void assert_range_fails(ExCall *call, const char *range, const char *error) {
+    const char *text = range;
+
+    assert(parseExRange(call, &text, range + strlen(range)) == 1);
+    assert(!strncmp(call->error, error, strlen(error)));
+}
+
+// Runs the script on a fresh copy of Lines with the cursor on line
+static int run(const char *script, size_t line) {
+    ExCall call = start_call(Lines, line);
+
+    return runExCommands(&call, script, strlen(script));
+}
+
+// Same on text of its own
+static int run_on(const char *text, const char *script, size_t line) {
+    ExCall call = start_call(text, line);
+
+    return runExCommands(&call, script, strlen(script));
+}
+
+static void assert_fails(const char *script, const char *error) {
+    ExCall call = start_call(Lines, 0);
+
+    assert(runExCommands(&call, script, strlen(script)) == 1);
+
+    if (strncmp(call.error, error, strlen(error)) != 0) {
+        printf("COMMAND \"%s\": got \"%s\", expected \"%s\"\n", script, call.error, error);
+        assert(0 && "wrong error");
+    }
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_names_and_abbreviations() {
+    printf("=== test_names_and_abbreviations ===\n");
+
+    assert(!strcmp(findExCommand("d", 1)->name, "delete"));
+    assert(!strcmp(findExCommand("del", 3)->name, "delete"));
+    assert(!strcmp(findExCommand("delete", 6)->name, "delete"));
+    assert(findExCommand("deletes", 7) == NULL);
+    assert(!strcmp(findExCommand("m", 1)->name, "move"));
+    assert(!strcmp(findExCommand("ma", 2)->name, "mark"));
+    assert(!strcmp(findExCommand("mo", 2)->name, "move"));
+    assert(!strcmp(findExCommand("q", 1)->name, "quit"));
+    assert(!strcmp(findExCommand("qa", 2)->name, "qall"));
+    assert(!strcmp(findExCommand("co", 2)->name, "copy"));
+    assert(findExCommand("c", 1) == NULL);
+    assert(!strcmp(findExCommand("s", 1)->name, "substitute"));
+    assert(!strcmp(findExCommand("t", 1)->name, "t"));
+    assert(!strcmp(findExCommand("w", 1)->name, "write"));
+    assert(!strcmp(findExCommand("wq", 2)->name, "wq"));
+    assert(!strcmp(findExCommand("x", 1)->name, "xit"));
+    assert(findExCommand("zz", 2) == NULL);
+    assert(findExCommand("", 0) == NULL);
+}
+
+static void test_ranges() {
+    printf("=== test_ranges ===\n");
+    ExCall call = start_call(Lines, 1);
+
+    assert_range(&call, "", 1, 1);
+    assert(call.range.given == 0);
+    assert_range(&call, "%", 0, 4);
+    assert(call.range.given == 2);
+    assert_range(&call, "2,4", 1, 3);
+    assert_range(&call, ".,$", 1, 4);
+    assert_range(&call, "4,2", 1, 3); // backwards ranges are turned around
+    assert_range(&call, "$-1", 3, 3);
+    assert_range(&call, "+", 2, 2);
+    assert_range(&call, " . +2", 3, 3);
+    assert_range(&call, "3;+1", 2, 3);
+    assert_range(&call, "3,+1", 2, 2);
+    assert_range(&call, "/fi/", 4, 4);
+    assert_range(&call, "/o/", 3, 3); // the search starts below the cursor
+    assert_range(&call, "?one?", 0, 0);
+    assert_range(&call, "/thr", 2, 2); // the closing delimiter may be left out
+}
+
+static void test_range_errors_and_marks() {
+    printf("=== test_range_errors_and_marks ===\n");
+    ExCall call = start_call(Lines, 0);
+
+    assert_range_fails(&call, "9", "E16");
+    assert_range_fails(&call, "1-3", "E16");
+    assert_range_fails(&call, "'a", "E20");
+    assert_range_fails(&call, "'A", "E78");
+    assert_range_fails(&call, "/six/", "E486");
+    assert_range_fails(&call, "//", "E35");
+
+    // Any offset in a line marks it
+    marks[1] = piece_table_line_start(document, 1);
+    marks[3] = piece_table_line_start(document, 3) + 2;
+    assert_range(&call, "'b,'d", 1, 3);
+    assert_range(&call, "'d+1", 4, 4);
+
+    // A pattern longer than a command line is taken whole
+    char text[1024], range[1024];
+    memset(text, 'a', 900);
+    text[300] = '\n';
+    strcpy(text + 900, "b");
+    range[0] = '/';
+    memset(range + 1, 'a', 599);
+    strcpy(range + 600, "b/");
+    call = start_call(text, 0);
+    assert_range(&call, range, 1, 1);
+}
+
+static void move_marks(void *data, size_t offset, size_t removed, size_t length) {
+    (void) data;
+    moveExMarks(marks, offset, removed, length);
+}
+
+// Marks keep to their lines through what the commands change around them
+static void test_marks_follow_changes() {
+    printf("=== test_marks_follow_changes ===\n");
+    ExCall call = start_call(Lines, 0);
+    const char *script = "3ka|1,2m$|'ad";
+
+    document->observer = move_marks;
+    assert(runExCommands(&call, script, strlen(script)) == 0);
+    assert_document("four\nfive\none\ntwo");
+
+    // Text put in right at a mark goes before it, a mark in text that went
+    // is where the text was
+    marks[0] = 10;
+    marks[1] = 20;
+    marks[2] = EX_NO_MARK;
+    moveExMarks(marks, 10, 0, 3);
+    assert(marks[0] == 13 && marks[1] == 23 && marks[2] == EX_NO_MARK);
+    moveExMarks(marks, 15, 10, 1);
+    assert(marks[0] == 13 && marks[1] == 15);
+    moveExMarks(marks, 0, 4, 0);
+    assert(marks[0] == 9 && marks[1] == 11);
+}
+
+static void test_line_commands() {
+    printf("=== test_line_commands ===\n");
+
+    assert(run("2,3d", 0) == 0);
+    assert_document("one\nfour\nfive");
+    assert(run("$d", 0) == 0);
+    assert_document("one\ntwo\nthree\nfour");
+    assert(run("%d", 0) == 0);
+    assert_document("");
+    assert(run(":delete", 2) == 0);
+    assert_document("one\ntwo\nfour\nfive");
+
+    assert(run("j", 0) == 0);
+    assert_document("one two\nthree\nfour\nfive");
+    assert(run("%j", 0) == 0);
+    assert_document("one two three four five");
+
+    assert(run("1t$", 0) == 0);
+    assert_document("one\ntwo\nthree\nfour\nfive\none");
+    assert(run("4,5co0", 0) == 0);
+    assert_document("four\nfive\none\ntwo\nthree\nfour\nfive");
+    assert(run("1m$", 0) == 0);
+    assert_document("two\nthree\nfour\nfive\none");
+    assert(run("$m0", 0) == 0);
+    assert_document("five\none\ntwo\nthree\nfour");
+    assert(run("2,3m4", 0) == 0);
+    assert_document("one\nfour\ntwo\nthree\nfive");
+
+    // Marks set from a command are seen by the next one
+    assert(run("2ka|4mark b|'a,'bd", 0) == 0);
+    assert_document("one\nfive");
+
+    // A script runs every command until one fails
+    assert(run("1d\n1d|$d", 0) == 0);
+    assert_document("three\nfour");
+    assert(run("1d|9d|1d", 0) == 1);
+    assert_document("two\nthree\nfour\nfive");
+
+    // A line break ending the document does not start one more line
+    const char *ended = "a\nb\nc\n";
+    ExCall call = start_call(ended, 0);
+    assert_range(&call, "$", 2, 2);
+    assert_range(&call, "%", 0, 2);
+    assert_range_fails(&call, "4", "E16");
+    assert(run_on(ended, "$d", 0) == 0);
+    assert_document("a\nb\n");
+    assert(run_on(ended, "2,$d", 0) == 0);
+    assert_document("a\n");
+    assert(run_on(ended, "%d", 0) == 0);
+    assert_document("");
+    assert(run_on(ended, "1t$", 0) == 0);
+    assert_document("a\nb\nc\na\n");
+    assert(run_on(ended, "1m$", 0) == 0);
+    assert_document("b\nc\na\n");
+    assert(run_on(ended, "%j", 0) == 0);
+    assert_document("a b c\n");
+    assert(run_on(ended, "%s/$/X/", 0) == 0);
+    assert_document("aX\nbX\ncX\n");
+    assert(run_on("\n", "$d", 0) == 0);
+    assert_document("");
+}
+
+static void test_cursor_and_quit() {
+    printf("=== test_cursor_and_quit ===\n");
+
+    ExCall call = start_call(Lines, 0);
+    assert(runExCommands(&call, "4", 1) == 0);
+    assert(call.cursor == piece_table_line_start(document, 3));
+    assert(runExCommands(&call, "2,3d", 4) == 0);
+    assert(call.cursor == piece_table_line_start(document, 1));
+    assert(!call.quit);
+    assert(runExCommands(&call, "q!", 2) == 0);
+    assert(call.quit && call.bang);
+
+    call = start_call(Lines, 0);
+    assert(runExCommands(&call, "qa|1d", 5) == 0);
+    assert(call.quit);
+    assert_document(Lines); // nothing runs after a quit
+}
+
+static void test_command_errors() {
+    printf("=== test_command_errors ===\n");
+
+    assert_fails("frobnicate", "E492");
+    assert_fails("d!", "E477");
+    assert_fails("3q", "E481");
+    assert_fails("d x", "E488");
+    assert_fails("2,4m3", "E134");
+    assert_fails("co", "E16");
+    assert_fails("mark", "E78");
+}
+
+static char written[64];
+
+static const char *fake_write(const char *path, size_t length, const char **message) {
+    if (length == 0) {
+        return "E32: No file name";
+    }
+
+    snprintf(written, sizeof(written), "%.*s", (int) length, path);
+    *message = "written";
+    piece_table_mark_saved(document);
+
+    return NULL;
+}
+
+static void test_write() {
+    printf("=== test_write ===\n");
+
+    assert_fails("w", "E32"); // nothing to write with
+
+    ExCall call = start_call(Lines, 0);
+    call.write = fake_write;
+    assert(runExCommands(&call, "w other.txt  ", 13) == 0);
+    assert(!strcmp(written, "other.txt") && !strcmp(call.message, "written"));
+    assert(!call.quit);
+    assert(runExCommands(&call, "w", 1) == 1);
+    assert(!strncmp(call.error, "E32", 3));
+
+    // A write that fails does not quit
+    assert(runExCommands(&call, "wq", 2) == 1);
+    assert(!call.quit);
+    assert(runExCommands(&call, "wq file", 7) == 0);
+    assert(!strcmp(written, "file") && call.quit);
+}
+
+// Changes that were not written keep :q from quitting, :x only writes them
+static void test_modified() {
+    printf("=== test_modified ===\n");
+
+    ExCall call = start_call(Lines, 0);
+    call.write = fake_write;
+    assert(piece_table_enable_history(document) == 0);
+    assert(runExCommands(&call, "q", 1) == 0 && call.quit);
+
+    call.quit = 0;
+    written[0] = '\0';
+    assert(runExCommands(&call, "x", 1) == 0 && call.quit);
+    assert(written[0] == '\0' && "nothing to write");
+
+    call.quit = 0;
+    assert(runExCommands(&call, "1d", 2) == 0);
+    assert(runExCommands(&call, "q", 1) == 1 && !call.quit);
+    assert(!strncmp(call.error, "E37", 3));
+    assert(runExCommands(&call, "qa", 2) == 1 && !call.quit);
+
+    // Undone back to what was written, nothing was changed
+    size_t offset;
+    assert(piece_table_undo(document, &offset) == 0);
+    assert(runExCommands(&call, "q", 1) == 0 && call.quit);
+    assert(piece_table_redo(document, &offset) == 0);
+
+    call.quit = 0;
+    assert(runExCommands(&call, "x out", 5) == 0 && call.quit);
+    assert(!strcmp(written, "out"));
+    assert(!piece_table_modified(document));
+
+    // Written, changed, undone past the write and changed otherwise: the
+    // written text cannot come back by undo or redo anymore
+    call.quit = 0;
+    assert(runExCommands(&call, "1d", 2) == 0);
+    assert(piece_table_undo(document, &offset) == 0);
+    assert(piece_table_undo(document, &offset) == 0);
+    assert(runExCommands(&call, "2d|1d", 5) == 0);
+    assert(piece_table_undo(document, &offset) == 0);
+    assert(piece_table_modified(document));
+    assert(runExCommands(&call, "q!", 2) == 0 && call.quit);
+}
+
+static void test_substitute() {
+    printf("=== test_substitute ===\n");
+
+    assert(run("%s/o/0/g", 0) == 0);
+    assert_document("0ne\ntw0\nthree\nf0ur\nfive");
+    assert(run("%s/e/E/", 0) == 0);
+    assert_document("onE\ntwo\nthrEe\nfour\nfivE");
+    assert(run("s#o#[&]#", 1) == 0);
+    assert_document("one\ntw[o]\nthree\nfour\nfive");
+    assert(run("2,3s/\\w\\+/<\\0>", 0) == 0);
+    assert_document("one\n<two>\n<three>\nfour\nfive");
+    assert(run("%s/^f\\|e$/_/g", 0) == 0);
+    assert_document("on_\ntwo\nthre_\n_our\n_iv_");
+    assert(run("1s/n/\\r/", 0) == 0);
+    assert_document("o\ne\ntwo\nthree\nfour\nfive");
+    assert(run("%s/x*/-/g", 4) == 0);
+    assert_document("-o-n-e-\n-t-w-o-\n-t-h-r-e-e-\n-f-o-u-r-\n-f-i-v-e-");
+    assert(run("$s/i/I/|1d", 0) == 0);
+    assert_document("two\nthree\nfour\nfIve");
+
+    // The cursor lands on the last line changed, past lines that grew above it
+    ExCall call = start_call(Lines, 0);
+    assert(runExCommands(&call, "%s/o/ooo/g", 10) == 0);
+    assert_document("ooone\ntwooo\nthree\nfooour\nfive");
+    assert(call.cursor == piece_table_line_start(document, 3));
+
+    // "e" keeps a missing pattern from being an error
+    assert(run("%s/six/6/e", 0) == 0);
+    assert_document(Lines);
+    assert_fails("%s/six/6/", "E486");
+    assert_fails("s/o/0/x", "E488");
+    assert_fails("s1o1x1", "E146");
+    assert_fails("s//x/", "E35");
+    assert_fails("s/\\(o/0/", "E54");
+    assert_fails("s/\\(o\\)/\\1/", "E65");
+
+    // Patterns and replacements longer than a command line are taken whole
+    char text[1024], script[2048], want[1024];
+    memset(text, 'a', 900);
+    text[300] = '\n';
+    strcpy(text + 900, "b");
+    strcpy(script, "%s/");
+    memset(script + 3, 'a', 599);
+    strcpy(script + 602, "b/");
+    memset(script + 604, 'x', 500);
+    strcpy(script + 1104, "/");
+    memcpy(want, text, 301);
+    memset(want + 301, 'x', 500);
+    strcpy(want + 801, "");
+    assert(run_on(text, script, 0) == 0);
+    assert_document(want);
+}
+
+static ExCall start_call_keeping(const char *text, Regex **last, char **replacement) {
+    ExCall call = start_call(text, 0);
+
+    call.lastPattern = last;
+    call.lastReplacement = replacement;
+
+    return call;
+}
+
+// An empty pattern is the last one used, ":s" alone repeats the last
+// replacement without its flags
+static void test_last_pattern() {
+    printf("=== test_last_pattern ===\n");
+    Regex *last = NULL;
+    char *replacement = NULL;
+    ExCall call = start_call_keeping(Lines, &last, &replacement);
+
+    assert(runExCommands(&call, "s", 1) == 1 && !strncmp(call.error, "E35", 3));
+    assert(runExCommands(&call, "s//x/", 5) == 1 && !strncmp(call.error, "E35", 3));
+    assert_range_fails(&call, "//", "E35");
+
+    assert(runExCommands(&call, "/th/d", 5) == 0);
+    assert_document("one\ntwo\nfour\nfive");
+    assert(last != NULL && replacement == NULL);
+    assert(runExCommands(&call, "%s//x/e", 7) == 0);
+    assert_document("one\ntwo\nfour\nfive");
+    assert(!strcmp(replacement, "x"));
+
+    call = start_call_keeping("one one\ntwo two", &last, &replacement);
+    assert(runExCommands(&call, "%s/o/0/|%s", 10) == 0);
+    assert_document("0ne 0ne\ntw0 tw0");
+    assert(!strcmp(replacement, "0"));
+
+    call = start_call_keeping(Lines, &last, &replacement);
+    assert(runExCommands(&call, "s/f/F/e", 7) == 0);
+    assert_range(&call, "//", 3, 3);
+
+    free_regex(last);
+    free(replacement);
+}
+
+static void test_parse_speed() {
+    printf("=== test_parse_speed ===\n");
+    ExCall call = start_call(Lines, 2);
+    const char *commands[] = { "%d", ".,$j", "2,4co$", "'a,'bm0", "3", "qa!", "$-2;+1delete", "1,5t0" };
+    size_t count = 1000000;
+
+    marks[0] = 0;
+    marks[1] = piece_table_line_start(document, 4);
+
+    size_t capacity = count * 16;
+    char *script = malloc(capacity);
+    size_t length = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *command = commands[i % (sizeof(commands) / sizeof(commands[0]))];
+        size_t size = strlen(command);
+
+        memcpy(script + length, command, size);
+        length += size;
+        script[length++] = i % 2 ? '|' : '\n';
+    }
+
+    const char *text = script;
+    const char *end = script + length;
+    size_t parsed = 0;
+    clock_t start = clock();
+
+    int failed = 0;
+
+    while (text < end) {
+        const ExCommand *command = NULL;
+
+        failed |= parseExCommand(&call, &text, end, &command) || command == NULL;
+        parsed++;
+    }
+
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("%zu commands parsed in %.1f ms, %.1f million per second\n", parsed, seconds * 1000, parsed / seconds / 1e6);
+
+    assert(!failed && parsed == count);
+
+    free(script);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("COMMANDS TEST START\n");
+
+    test_names_and_abbreviations();
+    test_ranges();
+    test_range_errors_and_marks();
+    test_marks_follow_changes();
+    test_line_commands();
+    test_cursor_and_quit();
+    test_command_errors();
+    test_write();
+    test_modified();
+    test_substitute();
+    test_last_pattern();
+    test_parse_speed();
+
+    free_piece_table(document);
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "console.h"
+#include "event_loop.h"
+#include "console/headless.h"
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static int order[16];
+static int fired = 0;
+
+static int record_timer(void *data) {
+    order[fired++] = (int) (size_t) data;
+    return 0;
+}
+
+static int repeats = 0;
+
+static int repeat_three_times(void *data) {
+    (void) data;
+    return ++repeats < 3;
+}
+
+static void start_loop() {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize((Size2s) { 20, 5 });
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+}
+
+static void stop_loop() {
+    killEventLoop();
+    killConsole();
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_timers_fire_in_order() {
+    printf("=== test_timers_fire_in_order ===\n");
+    start_loop();
+    fired = 0;
+
+    unsigned long long start = eventLoopTime();
+    addTimer(30, record_timer, (void *) 3);
+    addTimer(10, record_timer, (void *) 1);
+    int cancelled = addTimer(15, record_timer, (void *) 99);
+    addTimer(20, record_timer, (void *) 2);
+    assert(cancelled != 0);
+    assert(cancelTimer(cancelled) == 0);
+    assert(cancelTimer(cancelled) == 1 && "a timer is cancelled once");
+
+    while (fired < 3) {
+        assert(waitForEvents() == 0 && "there is no input, only timers");
+    }
+
+    assert(order[0] == 1 && order[1] == 2 && order[2] == 3);
+    assert(eventLoopTime() - start >= 30);
+
+    // Nothing is left: the wait would sleep forever, headless says it closed
+    assert(waitForEvents() == 1);
+
+    stop_loop();
+}
+
+static void test_repeating_timer() {
+    printf("=== test_repeating_timer ===\n");
+    start_loop();
+    repeats = 0;
+
+    addTimer(2, repeat_three_times, NULL);
+
+    while (repeats < 3) {
+        waitForEvents();
+    }
+
+    // The third run returned 0, the timer is gone
+    assert(waitForEvents() == 1);
+    assert(repeats == 3);
+
+    stop_loop();
+}
+
+typedef struct {
+    int slices;
+    int left;
+} Job;
+
+static int run_job(void *data) {
+    Job *job = data;
+
+    job->slices++;
+    return --job->left > 0;
+}
+
+static void test_deferred_work_runs_in_slices() {
+    printf("=== test_deferred_work_runs_in_slices ===\n");
+    start_loop();
+
+    Job job = { 0, 5 };
+    Job cancelled = { 0, 100 };
+
+    deferWork(run_job, &job);
+    deferWork(run_job, &job); // the same job is queued once
+    deferWork(run_job, &cancelled);
+
+    runDeferredWork();
+    assert(job.slices == 1 && cancelled.slices == 1);
+
+    // Pending work makes the wait return right away instead of sleeping
+    unsigned long long start = eventLoopTime();
+    assert(waitForEvents() == 0);
+    assert(eventLoopTime() - start < 50);
+
+    assert(cancelDeferredWork(run_job, &cancelled) == 0);
+
+    for (int turn = 0; turn < 10; ++turn) {
+        runDeferredWork();
+    }
+
+    assert(job.slices == 5 && job.left == 0);
+    assert(cancelled.slices == 1);
+
+    stop_loop();
+}
+
+#ifndef _WIN32
+static int posted_value = 0;
+
+static int receive_post(void *data) {
+    posted_value = (int) (size_t) data;
+    return 0;
+}
+
+static void *post_from_thread(void *data) {
+    (void) data;
+    struct timespec delay = { 0, 20 * 1000000L };
+
+    nanosleep(&delay, NULL);
+    postToEventLoop(receive_post, (void *) 42);
+
+    return NULL;
+}
+
+static int never(void *data) {
+    (void) data;
+    assert(0 && "the long timer should not fire");
+    return 0;
+}
+
+static void test_post_wakes_the_loop() {
+    printf("=== test_post_wakes_the_loop ===\n");
+    start_loop();
+
+    // The loop would sleep for 5 seconds if nothing woke it
+    int timer = addTimer(5000, never, NULL);
+    pthread_t thread;
+    unsigned long long start = eventLoopTime();
+
+    assert(pthread_create(&thread, NULL, post_from_thread, NULL) == 0);
+
+    while (posted_value == 0) {
+        waitForEvents();
+    }
+
+    unsigned long long waited = eventLoopTime() - start;
+    printf("woken after %llu ms\n", waited);
+    assert(posted_value == 42);
+    assert(waited < 1000);
+
+    pthread_join(thread, NULL);
+    cancelTimer(timer);
+    stop_loop();
+}
+#endif
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("EVENT LOOP TEST START\n");
+
+    test_timers_fire_in_order();
+    test_repeating_timer();
+    test_deferred_work_runs_in_slices();
+#ifndef _WIN32
+    test_post_wakes_the_loop();
+#endif
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
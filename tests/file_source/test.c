@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "io/file_source.h"
+
+static const char *SourceFile = "file_source_test.txt";
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static void write_file(const char *mode, const char *text, size_t length) {
+    FILE *file = fopen(SourceFile, mode);
+
+    assert(file != NULL);
+    assert(fwrite(text, 1, length, file) == length);
+    fclose(file);
+}
+
+static void assert_sibling(const char *path, const char *suffix, const char *expected) {
+    char *sibling = hidden_sibling_path(path, suffix);
+
+    assert(sibling != NULL);
+
+    if (strcmp(sibling, expected) != 0) {
+        printf("SIBLING of \"%s\": got \"%s\", expected \"%s\"\n", path, sibling, expected);
+        assert(0 && "sibling path differs");
+    }
+
+    free(sibling);
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_reads_the_file() {
+    printf("=== test_reads_the_file ===\n");
+    write_file("wb", "hello\nworld\n", 12);
+
+    FileSource *source = open_file_source(SourceFile);
+    size_t size;
+
+    assert(source != NULL);
+    assert(source->length == 12 && !memcmp(source->data, "hello\nworld\n", 12));
+    assert(file_source_size(source, &size) == 0 && size == 12);
+
+    close_file_source(source);
+    remove(SourceFile);
+}
+
+// Nothing to map, the source is still there to grow from
+static void test_empty_file() {
+    printf("=== test_empty_file ===\n");
+    write_file("wb", "", 0);
+
+    FileSource *source = open_file_source(SourceFile);
+    size_t size;
+
+    assert(source != NULL);
+    assert(source->length == 0 && source->data == NULL);
+
+    write_file("ab", "grew\n", 5);
+    assert(file_source_size(source, &size) == 0 && size == 5);
+    assert(source->length == 0 && "the source keeps the length it was opened with");
+
+    FileRegion region;
+    assert(map_file_region(source, 0, size, &region) == 0);
+    assert(region.length == 5 && !memcmp(region.data, "grew\n", 5));
+    unmap_file_region(&region);
+
+    close_file_source(source);
+    remove(SourceFile);
+}
+
+static void test_missing_file() {
+    printf("=== test_missing_file ===\n");
+    remove(SourceFile);
+
+    assert(open_file_source(SourceFile) == NULL);
+    assert(open_file_source("no_such_directory/file.txt") == NULL);
+    close_file_source(NULL);
+}
+
+// Regions start anywhere, not only on a page boundary
+static void test_regions() {
+    printf("=== test_regions ===\n");
+    size_t length = 3 * 4096 + 100;
+    char *text = malloc(length);
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = (char) ('a' + i % 26);
+    }
+    write_file("wb", text, length);
+
+    FileSource *source = open_file_source(SourceFile);
+    FileRegion region;
+
+    assert(source != NULL);
+    assert(map_file_region(source, 5001, 3000, &region) == 0);
+    assert(region.length == 3000 && !memcmp(region.data, text + 5001, 3000));
+    assert((const char *) region.view <= region.data);
+    unmap_file_region(&region);
+    assert(region.data == NULL && region.view == NULL);
+    unmap_file_region(&region); // twice is harmless
+
+    assert(map_file_region(source, length - 1, 1, &region) == 0);
+    assert(region.data[0] == text[length - 1]);
+    unmap_file_region(&region);
+
+    close_file_source(source);
+    free(text);
+    remove(SourceFile);
+}
+
+static void test_hidden_sibling_path() {
+    printf("=== test_hidden_sibling_path ===\n");
+
+    assert_sibling("notes.txt", ".swp", ".notes.txt.swp");
+    assert_sibling("dir/notes.txt", ".swp", "dir/.notes.txt.swp");
+    assert_sibling("/a/b/notes", ".new", "/a/b/.notes.new");
+    assert_sibling("C:\\dir\\notes.txt", ".swp", "C:\\dir\\.notes.txt.swp");
+    assert_sibling("a/b\\notes", ".swp", "a/b\\.notes.swp");
+    assert_sibling("a\\b/notes", ".swp", "a\\b/.notes.swp");
+    assert_sibling(".hidden", ".swp", "..hidden.swp");
+    assert_sibling("notes", "", ".notes");
+}
+
+int main(void) {
+    printf("FILE SOURCE TEST START\n");
+
+    test_reads_the_file();
+    test_empty_file();
+    test_missing_file();
+    test_regions();
+    test_hidden_sibling_path();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "console.h"
+#include "event_loop.h"
+#include "console/headless.h"
+#include "io/follow.h"
+#include "io/file_source.h"
+#include "structures/piece_table.h"
+
+static const char *FollowFile = "follow_test.log";
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static void start_loop() {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize((Size2s) { 20, 5 });
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+}
+
+static void stop_loop() {
+    killEventLoop();
+    killConsole();
+}
+
+static void write_file(const char *mode, const char *text) {
+    FILE *file = fopen(FollowFile, mode);
+
+    assert(file != NULL);
+    assert(fwrite(text, 1, strlen(text), file) == strlen(text));
+    fclose(file);
+}
+
+static void assert_document(PieceTable *table, const char *want) {
+    size_t length = piece_table_length(table);
+    char *text = malloc(length + 1);
+
+    assert(length == strlen(want));
+    assert(piece_table_read(table, 0, text, length) == length);
+    text[length] = '\0';
+    assert(!strcmp(text, want));
+    free(text);
+}
+
+static size_t count_pieces(PieceTable *table) {
+    RedBlackTreeIterator pieces;
+    size_t count = 0;
+
+    for (redblack_iterator_first(&pieces, table->pieces); pieces.node != NULL; redblack_iterator_next(&pieces)) {
+        count++;
+    }
+
+    return count;
+}
+
+typedef struct {
+    size_t calls;
+    enum FOLLOW_EVENTS event;
+    size_t offset;
+    size_t length;
+} Growth;
+
+static void record_growth(void *data, enum FOLLOW_EVENTS event, size_t offset, size_t length) {
+    Growth *growth = data;
+
+    growth->calls++;
+    growth->event = event;
+    growth->offset = offset;
+    growth->length = length;
+}
+
+// Keeps the headless wait sleeping a millisecond at a time instead of
+// returning at once, so the watching thread's wakeup is what ends it
+static int keep_waiting(void *data) {
+    (void) data;
+    return 1;
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+// Only what the file grew by comes in, all of it as one buffer and one piece
+static void test_catch_up() {
+    printf("=== test_catch_up ===\n");
+    write_file("wb", "one\ntwo\n");
+
+    FileSource *source = open_file_source(FollowFile);
+    PieceTable *table = initialize_lazy_piece_table(source->data, source->length);
+    FileFollower *follower = open_follower(table, source);
+
+    assert(follower != NULL);
+    assert(follower_catch_up(follower) == 0);
+    assert(table->buffers->len == 2 && "nothing came in, nothing is mapped");
+
+    write_file("ab", "three\nfo");
+    assert(follower_catch_up(follower) == 0);
+    assert_document(table, "one\ntwo\nthree\nfo");
+    assert(piece_table_line_count(table) == 4);
+
+    write_file("ab", "ur\nfive\n");
+    assert(follower_catch_up(follower) == 0);
+    assert_document(table, "one\ntwo\nthree\nfour\nfive\n");
+    assert(piece_table_line_count(table) == 6);
+    assert(piece_table_line_start(table, 3) == 14);
+    assert(piece_table_line_at(table, 20) == 4);
+
+    // Many small appends, still one buffer growing and one piece
+    char line[32];
+    char *want = malloc(64 * 1024);
+    strcpy(want, "one\ntwo\nthree\nfour\nfive\n");
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(line, sizeof(line), "entry %d\n", i);
+        strcat(want, line);
+        write_file("ab", line);
+        assert(follower_catch_up(follower) == 0);
+    }
+
+    assert(table->buffers->len == 3);
+    assert(count_pieces(table) == 2);
+    assert(piece_table_line_count(table) == 1006);
+    assert_document(table, want);
+
+    free(want);
+    close_follower(follower);
+    free_piece_table(table);
+    close_file_source(source);
+    remove(FollowFile);
+}
+
+// Following, the editor is told of what comes in without looking for it
+static void test_watch() {
+    printf("=== test_watch ===\n");
+    start_loop();
+    write_file("wb", "start\n");
+
+    FileSource *source = open_file_source(FollowFile);
+    PieceTable *table = initialize_piece_table(source->data, source->length);
+    FileFollower *follower = open_follower(table, source);
+    Growth growth = { 0 };
+    int timer = addTimer(10, keep_waiting, NULL);
+
+    assert(start_following(follower, FollowFile, record_growth, &growth) == 0);
+    assert(follower_watching(follower));
+    assert(growth.calls == 0);
+
+    write_file("ab", "more\n");
+
+    for (int i = 0; i < 500 && growth.calls == 0; i++) {
+        waitForEvents();
+    }
+
+    assert(growth.calls > 0 && growth.event == FOLLOW_GREW && growth.offset == 6 && growth.length == 5);
+    assert_document(table, "start\nmore\n");
+
+    // Stopped, the file is not looked at anymore but what came in stays
+    stop_following(follower);
+    assert(!follower_watching(follower));
+    write_file("ab", "after\n");
+
+    for (int i = 0; i < 5 * 20; i++) {
+        waitForEvents();
+    }
+
+    assert(growth.calls == 1);
+    assert_document(table, "start\nmore\n");
+
+    cancelTimer(timer);
+    close_follower(follower);
+    free_piece_table(table);
+    close_file_source(source);
+    remove(FollowFile);
+    stop_loop();
+}
+
+// A file that got shorter is read again from the start, without a look at
+// what the document held of it: those pages are past the end of the file
+static void test_truncated() {
+    printf("=== test_truncated ===\n");
+    start_loop();
+
+    // Bigger than a page, so the old end is on pages the file no longer has
+    size_t length = 1 << 20;
+    char *text = malloc(length + 1);
+    for (size_t i = 0; i < length; i++) {
+        text[i] = i % 64 == 63 ? '\n' : 'a';
+    }
+    text[length] = '\0';
+    write_file("wb", text);
+
+    FileSource *source = open_file_source(FollowFile);
+    PieceTable *table = initialize_lazy_piece_table(source->data, source->length);
+    FileFollower *follower = open_follower(table, source);
+    Growth growth = { 0 };
+
+    assert(piece_table_enable_history(table) == 0);
+    assert(piece_table_insert(table, 10, "edit", 4) == 0);
+    piece_table_commit(table);
+    assert(start_following(follower, FollowFile, record_growth, &growth) == 0);
+    write_file("ab", "tail\n");
+    assert(follower_catch_up(follower) == 0);
+
+    write_file("wb", "new\n");
+    assert(follower_catch_up(follower) == 0);
+    assert(follower_watching(follower) && "still followed");
+    assert(growth.event == FOLLOW_RELOADED && growth.offset == 0 && growth.length == 4);
+    assert_document(table, "new\n");
+    assert(piece_table_line_count(table) == 2);
+
+    size_t offset;
+    assert(piece_table_undo(table, &offset) != 0 && "nothing to undo onto text that is gone");
+
+    // It keeps growing from there
+    write_file("ab", "more\n");
+    assert(follower_catch_up(follower) == 0);
+    assert(growth.event == FOLLOW_GREW && growth.offset == 4 && growth.length == 5);
+    assert_document(table, "new\nmore\n");
+
+    // Emptied, then written again
+    write_file("wb", "");
+    assert(follower_catch_up(follower) == 0);
+    assert(growth.event == FOLLOW_RELOADED && piece_table_length(table) == 0);
+    write_file("ab", "again\n");
+    assert(follower_catch_up(follower) == 0);
+    assert_document(table, "again\n");
+
+    stop_following(follower);
+
+    // A change it posted before it stopped finds nothing to do
+    for (int i = 0; i < 5; i++) {
+        waitForEvents();
+    }
+
+    close_follower(follower);
+    free_piece_table(table);
+    close_file_source(source);
+    free(text);
+    remove(FollowFile);
+    stop_loop();
+}
+
+#ifdef __linux__
+// Waits for the watching thread to tell of something, at most 5 s
+static void wait_for_call(Growth *growth, size_t calls) {
+    int timer = addTimer(10, keep_waiting, NULL);
+
+    for (int i = 0; i < 500 && growth->calls == calls; i++) {
+        waitForEvents();
+    }
+
+    cancelTimer(timer);
+}
+
+// A file moved away or deleted is not followed anymore, what it grew by
+// before that stays
+static void test_gone() {
+    printf("=== test_gone ===\n");
+    start_loop();
+
+    const char *moved = "follow_test.moved";
+    const char *ways[] = { "moved", "deleted" };
+
+    for (int way = 0; way < 2; way++) {
+        write_file("wb", "start\n");
+
+        FileSource *source = open_file_source(FollowFile);
+        PieceTable *table = initialize_piece_table(source->data, source->length);
+        FileFollower *follower = open_follower(table, source);
+        Growth growth = { 0 };
+
+        printf("%s\n", ways[way]);
+        assert(start_following(follower, FollowFile, record_growth, &growth) == 0);
+        write_file("ab", "more\n");
+        wait_for_call(&growth, 0);
+        assert(growth.event == FOLLOW_GREW);
+
+        size_t calls = growth.calls;
+
+        if (way == 0) {
+            assert(rename(FollowFile, moved) == 0);
+        } else {
+            assert(remove(FollowFile) == 0);
+        }
+
+        wait_for_call(&growth, calls);
+        assert(growth.event == FOLLOW_GONE && growth.offset == 0 && growth.length == 0);
+        assert(!follower_watching(follower));
+        assert_document(table, "start\nmore\n");
+
+        close_follower(follower);
+        free_piece_table(table);
+        close_file_source(source);
+        remove(moved);
+    }
+
+    stop_loop();
+}
+#endif
+
+int main(void) {
+    printf("FOLLOW TEST START\n");
+
+    test_catch_up();
+    test_watch();
+    test_truncated();
+#ifdef __linux__
+    test_gone();
+#endif
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
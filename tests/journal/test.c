@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "console.h"
+#include "event_loop.h"
+#include "console/headless.h"
+#include "io/journal.h"
+#include "structures/piece_table.h"
+
+static const char *JournalFile = "journal_test.swp";
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static void start_loop() {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize((Size2s) { 20, 5 });
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+}
+
+static void stop_loop() {
+    killEventLoop();
+    killConsole();
+}
+
+static char *contents(PieceTable *table) {
+    size_t length = piece_table_length(table);
+    char *text = malloc(length + 1);
+
+    assert(piece_table_read(table, 0, text, length) == length);
+    text[length] = '\0';
+
+    return text;
+}
+
+// What a crash would leave: the journal replayed onto the original
+static void assert_recovers(const char *path, const char *original, size_t length, PieceTable *expected) {
+    PieceTable *recovered = initialize_piece_table(original, length);
+    size_t changes;
+
+    assert(replay_journal(path, recovered, &changes) == 0);
+
+    char *want = contents(expected);
+    char *got = contents(recovered);
+
+    if (strcmp(want, got) != 0) {
+        printf("RECOVERED \"%.60s\", expected \"%.60s\"\n", got, want);
+        assert(0 && "recovered document differs");
+    }
+
+    free(want);
+    free(got);
+    free_piece_table(recovered);
+}
+
+static void random_edit(PieceTable *table) {
+    size_t length = piece_table_length(table);
+    size_t offset = (size_t) rand() % (length + 1);
+    size_t removed = (size_t) rand() % 6;
+    char text[8];
+    size_t textLength = (size_t) rand() % 8;
+
+    for (size_t k = 0; k < textLength; k++) {
+        text[k] = rand() % 6 == 0 ? '\n' : (char) ('a' + rand() % 26);
+    }
+
+    removed = removed > length - offset ? length - offset : removed;
+
+    switch (rand() % 3) {
+        case 0:
+            assert(piece_table_insert(table, offset, text, textLength) == 0);
+            break;
+        case 1:
+            assert(piece_table_delete(table, offset, removed) == 0);
+            break;
+        default: {
+            PieceTableEdit edits[2] = {
+                { .offset = offset, .length = removed / 2, .text = text, .textLength = textLength / 2 },
+                { .offset = offset + removed / 2 + 1, .length = removed - removed / 2 - 1, .text = text, .textLength = textLength }
+            };
+            size_t count = offset + removed / 2 + 1 <= length && removed > removed / 2 ? 2 : 1;
+
+            assert(piece_table_replace(table, edits, count) == 0);
+        } break;
+    }
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_journal_path() {
+    printf("=== test_journal_path ===\n");
+    char *path = journal_path("dir/sub/file.txt");
+
+    assert(!strcmp(path, "dir/sub/.file.txt.swp"));
+    free(path);
+    path = journal_path("file");
+    assert(!strcmp(path, ".file.swp"));
+    free(path);
+}
+
+// Edits, undos and redos reach the file once per turn of the loop, and the
+// journal replayed onto the original is the document at every point
+static void test_replay_after_crash(size_t turns) {
+    printf("=== test_replay_after_crash (turns=%zu) ===\n", turns);
+    srand((unsigned) time(NULL));
+    start_loop();
+
+    const char *original = "first line\nsecond line\n\nfourth line without end";
+    size_t length = strlen(original);
+    PieceTable *table = initialize_piece_table(original, length);
+
+    assert(piece_table_enable_history(table) == 0);
+    Journal *journal = open_journal(JournalFile, table, NULL);
+    assert(journal != NULL);
+    assert_recovers(JournalFile, original, length, table);
+
+    for (size_t turn = 0; turn < turns; turn++) {
+        size_t offset;
+        int edits = 1 + rand() % 4;
+
+        for (int i = 0; i < edits; i++) {
+            random_edit(table);
+        }
+
+        piece_table_commit(table);
+
+        if (rand() % 4 == 0) {
+            piece_table_undo(table, &offset);
+        } else if (rand() % 4 == 0) {
+            piece_table_redo(table, &offset);
+        }
+
+        size_t written = journal_size(journal);
+        runDeferredWork();
+        assert(journal_size(journal) >= written);
+
+        if (turn % 16 == 0) {
+            assert_recovers(JournalFile, original, length, table);
+        }
+    }
+
+    assert_recovers(JournalFile, original, length, table);
+
+    // Quitting removes the journal, nothing is left to recover
+    close_journal(journal, 1);
+    size_t changes;
+    assert(replay_journal(JournalFile, table, &changes) != 0);
+
+    free_piece_table(table);
+    stop_loop();
+}
+
+// A record costs the text it holds, however big the document
+static void test_cost_follows_the_edit() {
+    printf("=== test_cost_follows_the_edit ===\n");
+    start_loop();
+
+    size_t length = 8 << 20;
+    char *original = malloc(length);
+    memset(original, 'a', length);
+
+    PieceTable *table = initialize_piece_table(original, length);
+    Journal *journal = open_journal(JournalFile, table, NULL);
+    size_t empty = journal_size(journal);
+
+    assert(empty < 64 && "an untouched document is a header and an empty snapshot");
+
+    assert(piece_table_enable_history(table) == 0);
+    assert(piece_table_insert(table, length / 2, "x", 1) == 0);
+    piece_table_commit(table);
+    assert(piece_table_delete(table, 10, 1 << 20) == 0);
+    piece_table_commit(table);
+    runDeferredWork();
+    assert(journal_size(journal) - empty < 2 * 64);
+
+    // Undone, the deleted text comes back as where the original has it
+    size_t offset, before = journal_size(journal);
+    assert(piece_table_undo(table, &offset) == 0);
+    runDeferredWork();
+    assert(journal_size(journal) - before < 64);
+    assert_recovers(JournalFile, original, length, table);
+
+    // Typed text in the middle of it is copied, only that
+    assert(piece_table_insert(table, 100, "hello", 5) == 0);
+    piece_table_commit(table);
+    assert(piece_table_delete(table, 50, 1 << 20) == 0);
+    piece_table_commit(table);
+    runDeferredWork();
+    before = journal_size(journal);
+    assert(piece_table_undo(table, &offset) == 0);
+    runDeferredWork();
+    assert(journal_size(journal) - before < 2 * 64);
+    assert_recovers(JournalFile, original, length, table);
+
+    // Another original (same length, other bytes) is not replayed onto
+    close_journal(journal, 0);
+    original[length - 1] = 'b';
+    PieceTable *other = initialize_piece_table(original, length);
+    size_t changes;
+    assert(replay_journal(JournalFile, other, &changes) != 0);
+    original[length - 1] = 'a';
+
+    free_piece_table(other);
+    free_piece_table(table);
+    free(original);
+    remove(JournalFile);
+    stop_loop();
+}
+
+// A write cut short by a crash fails its checksum: what came before is recovered
+static void test_torn_record() {
+    printf("=== test_torn_record ===\n");
+    start_loop();
+
+    const char *original = "one\ntwo\nthree\n";
+    size_t length = strlen(original);
+    PieceTable *table = initialize_piece_table(original, length);
+    PieceTable *before = initialize_piece_table(original, length);
+    Journal *journal = open_journal(JournalFile, table, NULL);
+
+    assert(piece_table_insert(table, 4, "2 ", 2) == 0);
+    assert(piece_table_insert(before, 4, "2 ", 2) == 0);
+    runDeferredWork();
+    assert(piece_table_delete(table, 0, 4) == 0);
+    runDeferredWork();
+    close_journal(journal, 0);
+
+    FILE *file = fopen(JournalFile, "rb");
+    char bytes[512];
+    size_t size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+
+    for (size_t cut = 1; cut <= 29; cut += 7) {
+        file = fopen(JournalFile, "wb");
+        fwrite(bytes, 1, size - cut, file);
+        fclose(file);
+        assert_recovers(JournalFile, original, length, before);
+    }
+
+    // A flipped byte fails it just the same
+    bytes[size - 1] ^= 1;
+    file = fopen(JournalFile, "wb");
+    fwrite(bytes, 1, size, file);
+    fclose(file);
+    assert_recovers(JournalFile, original, length, before);
+
+    size_t changes;
+    PieceTable *recovered = initialize_piece_table(original, length);
+    assert(replay_journal(JournalFile, recovered, &changes) == 0 && changes == 1);
+
+    free_piece_table(recovered);
+    free_piece_table(before);
+    free_piece_table(table);
+    remove(JournalFile);
+    stop_loop();
+}
+
+// Once it is long the journal is rewritten as a snapshot on another thread,
+// edits made meanwhile are kept
+static void test_compaction() {
+    printf("=== test_compaction ===\n");
+    start_loop();
+
+    const char *original = "a line of the original\nanother one\n";
+    size_t length = strlen(original);
+    PieceTable *table = initialize_piece_table(original, length);
+    Journal *journal = open_journal(JournalFile, table, NULL);
+
+    set_journal_compact_size(journal, 4096);
+
+    // Typed and taken back: long journal, short document
+    while (!journal_compacting(journal)) {
+        assert(piece_table_insert(table, 5, "some text", 9) == 0);
+        assert(piece_table_delete(table, 5, 8) == 0);
+        runDeferredWork();
+    }
+
+    size_t longest = journal_size(journal);
+
+    assert(piece_table_insert(table, 0, "meanwhile ", 10) == 0);
+    runDeferredWork();
+
+    for (int i = 0; i < 5000 && journal_compacting(journal); i++) {
+        waitForEvents();
+    }
+
+    assert(!journal_compacting(journal));
+    assert(journal_size(journal) < longest / 4);
+    assert_recovers(JournalFile, original, length, table);
+
+    assert(piece_table_insert(table, piece_table_length(table), "after", 5) == 0);
+    runDeferredWork();
+    assert_recovers(JournalFile, original, length, table);
+
+    close_journal(journal, 1);
+    free_piece_table(table);
+    stop_loop();
+}
+
+// One editor at a time: a second lock is refused and says who holds it,
+// a lock file a dead editor left behind holds nothing
+static void test_lock() {
+    printf("=== test_lock ===\n");
+    start_loop();
+
+    const char *lockFile = "journal_test.swp" JOURNAL_LOCK_SUFFIX;
+    long holder;
+    JournalLock *lock = lock_journal(JournalFile, &holder);
+
+    assert(lock != NULL && holder == 0);
+    assert(lock_journal(JournalFile, &holder) == NULL && holder > 0);
+    unlock_journal(lock);
+    assert(fopen(lockFile, "rb") == NULL && "the lock file goes with the lock");
+
+    FILE *file = fopen(lockFile, "wb");
+    assert(file != NULL);
+    fputs("999999999\n", file);
+    fclose(file);
+
+    lock = lock_journal(JournalFile, &holder);
+    assert(lock != NULL);
+
+    // The journal holds the lock until it is closed
+    PieceTable *table = initialize_piece_table("text", 4);
+    Journal *journal = open_journal(JournalFile, table, lock);
+
+    assert(journal != NULL);
+    assert(lock_journal(JournalFile, &holder) == NULL && holder > 0);
+    close_journal(journal, 1);
+
+    lock = lock_journal(JournalFile, &holder);
+    assert(lock != NULL);
+    unlock_journal(lock);
+
+    free_piece_table(table);
+    stop_loop();
+}
+
+static void count_change(void *data, size_t offset, size_t removed, size_t length) {
+    (void) offset;
+    (void) removed;
+    (void) length;
+    (*(int *) data)++;
+}
+
+// Whoever observed the table before the journal still hears of every change,
+// and is the observer again once the journal is gone
+static void test_observer_chain() {
+    printf("=== test_observer_chain ===\n");
+    start_loop();
+
+    PieceTable *table = initialize_piece_table("one\n", 4);
+    int changes = 0;
+
+    table->observer = count_change;
+    table->observer_data = &changes;
+
+    Journal *journal = open_journal(JournalFile, table, NULL);
+
+    assert(journal != NULL && table->observer != count_change);
+    assert(piece_table_insert(table, 4, "two\n", 4) == 0);
+    assert(piece_table_delete(table, 0, 1) == 0);
+    runDeferredWork();
+    assert(changes == 2);
+    assert(journal_size(journal) > 0);
+
+    close_journal(journal, 1);
+    assert(table->observer == count_change && table->observer_data == &changes);
+    assert(piece_table_insert(table, 0, "o", 1) == 0);
+    assert(changes == 3);
+
+    free_piece_table(table);
+    stop_loop();
+}
+
+int main(void) {
+    printf("JOURNAL TEST START\n");
+
+    test_journal_path();
+    test_replay_after_crash(600);
+    test_cost_follows_the_edit();
+    test_torn_record();
+    test_compaction();
+    test_lock();
+    test_observer_chain();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
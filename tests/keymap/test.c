@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "keymap.h"
+
+// ---------------------------------------------------------
+// A pretend editor: the cursor is a number, motions add to it
+// ---------------------------------------------------------
+
+static size_t cursor = 0;
+static char log_text[256];
+
+static void logf_call(const char *what, KeymapCall *call) {
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%s%s%zu ", what, call->linewise ? "L" : "", call->count);
+    strcat(log_text, entry);
+}
+
+static size_t forward(size_t from, KeymapCall *call) { return from + call->count; }
+static size_t down(size_t from, KeymapCall *call) { return from + 100 * call->count; }
+static size_t to_top(size_t from, KeymapCall *call) { (void) from; (void) call; return 0; }
+
+static int move(KeymapCall *call) {
+    cursor = call->motion(cursor, call);
+    logf_call("move", call);
+    return 0;
+}
+
+static int delete_op(KeymapCall *call) {
+    if (call->motion) {
+        char entry[64];
+        snprintf(entry, sizeof(entry), "d[%zu] ", call->motion(cursor, call) - cursor);
+        strcat(log_text, entry);
+    } else {
+        logf_call("dd", call);
+    }
+    return 0;
+}
+
+static int command_x(KeymapCall *call) { logf_call("x", call); return 0; }
+static int command_g(KeymapCall *call) { logf_call("g", call); return 0; }
+static int command_esc(KeymapCall *call) { logf_call("esc", call); return 0; }
+
+static KeyCode key_of(char c) {
+    if (c == 0x1B) return (KeyCode) { XIM_KEY_ESCAPE, 0x1B };
+    return (KeyCode) { 0, (unsigned char) c };
+}
+
+static enum KEYMAP_RESULTS type(KeymapState *state, Keymap *keymap, const char *keys) {
+    enum KEYMAP_RESULTS result = KEYMAP_HANDLED;
+    for (; *keys; keys++) result = dispatchKey(state, keymap, key_of(*keys));
+    return result;
+}
+
+static void expect_log(const char *expected) {
+    if (strcmp(log_text, expected) != 0) {
+        printf("LOG: got \"%s\", expected \"%s\"\n", log_text, expected);
+        assert(0 && "dispatch differs");
+    }
+    log_text[0] = '\0';
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_sequences_counts_and_operators() {
+    printf("=== test_sequences_counts_and_operators ===\n");
+    assert(initializeKeymaps() == 0);
+
+    Keymap *normal = createKeymap(move, 1);
+    Keymap *pending = createKeymap(NULL, 0);
+    normal->operatorPending = pending;
+
+    bindMotion(normal, "w", forward, 0);
+    bindMotion(pending, "w", forward, 0);
+    bindMotion(normal, "j", down, 1);
+    bindMotion(pending, "j", down, 1);
+    bindMotion(normal, "gg", to_top, 1);
+    bindMotion(pending, "gg", to_top, 1);
+    bindCommand(normal, "g", command_g); // a prefix of gg
+    bindCommand(normal, "x", command_x);
+    bindCommand(normal, "<Esc>", command_esc);
+    bindCommand(normal, "<C-r>", command_x);
+    bindOperator(normal, "d", delete_op);
+
+    KeymapState state = { 0 };
+    resetKeymapState(&state);
+    cursor = 0;
+    log_text[0] = '\0';
+
+    assert(type(&state, normal, "w") == KEYMAP_HANDLED);
+    expect_log("move1 ");
+    assert(cursor == 1);
+
+    assert(type(&state, normal, "3") == KEYMAP_PENDING);
+    assert(type(&state, normal, "0w") == KEYMAP_HANDLED);
+    expect_log("move30 ");
+    assert(cursor == 31);
+
+    // 0 alone is not a count
+    assert(type(&state, normal, "0") == KEYMAP_UNBOUND);
+
+    assert(type(&state, normal, "g") == KEYMAP_PENDING);
+    assert(type(&state, normal, "g") == KEYMAP_HANDLED);
+    expect_log("moveL1 ");
+    assert(cursor == 0);
+
+    // g followed by something else: g runs, the key starts over
+    assert(type(&state, normal, "gx") == KEYMAP_HANDLED);
+    expect_log("g1 x1 ");
+
+    type(&state, normal, "dd");
+    expect_log("ddL1 ");
+    type(&state, normal, "3dd");
+    expect_log("ddL3 ");
+    type(&state, normal, "2d3w");
+    expect_log("d[6] ");
+    type(&state, normal, "d2j");
+    expect_log("d[200] ");
+
+    // An operator waiting for a motion swallows an unbound key and gives up
+    assert(type(&state, normal, "dq") == KEYMAP_HANDLED);
+    assert(type(&state, normal, "x") == KEYMAP_HANDLED);
+    expect_log("x1 ");
+
+    // Keys bound to nothing are left to the caller
+    assert(type(&state, normal, "q") == KEYMAP_UNBOUND);
+    assert(type(&state, normal, "\x1b") == KEYMAP_HANDLED);
+    expect_log("esc1 ");
+
+    // Ctrl+R is the control character, with the letter's key code on Win32
+    assert(type(&state, normal, "2\x12") == KEYMAP_HANDLED);
+    assert(dispatchKey(&state, normal, (KeyCode) { 'R', 0x12 }) == KEYMAP_HANDLED);
+    expect_log("x2 x1 ");
+
+    // Switching tables mid sequence starts over
+    Keymap *other = createKeymap(NULL, 0);
+    bindCommand(other, "x", command_x);
+    assert(type(&state, normal, "5") == KEYMAP_PENDING);
+    assert(type(&state, other, "x") == KEYMAP_HANDLED);
+    expect_log("x1 ");
+
+    killKeymaps();
+}
+
+static int counted = 0;
+static int count_call(KeymapCall *call) { (void) call; counted++; return 0; }
+
+// Time per key with n random 3 key bindings
+static double dispatch_ns(int bindings, int keys) {
+    assert(initializeKeymaps() == 0);
+    Keymap *keymap = createKeymap(NULL, 0);
+    char (*sequences)[4] = malloc(sizeof(*sequences) * (size_t) bindings);
+
+    srand(7);
+    for (int i = 0; i < bindings; ++i) {
+        // The first key stays in a-z so every sequence is 3 keys deep
+        sequences[i][0] = (char) ('a' + i % 26);
+        sequences[i][1] = (char) ('A' + rand() % 26);
+        sequences[i][2] = (char) ('A' + rand() % 26);
+        sequences[i][3] = '\0';
+        bindCommand(keymap, sequences[i], count_call);
+    }
+
+    KeymapState state = { 0 };
+    resetKeymapState(&state);
+    counted = 0;
+
+    clock_t start = clock();
+    for (int i = 0; i < keys / 3; ++i) {
+        type(&state, keymap, sequences[i % bindings]);
+    }
+    double ns = (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / (double) (keys / 3 * 3);
+
+    assert(counted == keys / 3);
+
+    free(sequences);
+    killKeymaps();
+    return ns;
+}
+
+static void test_dispatch_cost_is_flat() {
+    printf("=== test_dispatch_cost_is_flat ===\n");
+    int keys = 3000000;
+
+    double few = dispatch_ns(10, keys);
+    double many = dispatch_ns(600, keys);
+
+    printf("10 bindings: %.1f ns/key, 600 bindings: %.1f ns/key\n", few, many);
+    assert(many < few * 4 + 20 && "dispatch slows down with the number of bindings");
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("KEYMAP TEST START\n");
+
+    test_sequences_counts_and_operators();
+    test_dispatch_cost_is_flat();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "console.h"
+#include "event_loop.h"
+#include "console/headless.h"
+#include "io/loader.h"
+#include "structures/piece_table.h"
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static void start_loop() {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize((Size2s) { 20, 5 });
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+}
+
+static void stop_loop() {
+    killEventLoop();
+    killConsole();
+}
+
+static char *make_text(size_t length, size_t *lines) {
+    char *text = malloc(length);
+
+    *lines = 1;
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = rand() % 50 == 0 ? '\n' : 'a';
+        *lines += text[i] == '\n';
+    }
+
+    return text;
+}
+
+typedef struct {
+    size_t calls;
+    size_t counted;
+    size_t length;
+} Progress;
+
+static void record_progress(void *data, size_t counted, size_t length) {
+    Progress *progress = data;
+
+    assert(counted > progress->counted && "progress only goes forward");
+    assert(counted <= length);
+    progress->calls++;
+    progress->counted = counted;
+    progress->length = length;
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+// The counts reach the table a batch at a time, the lines are known once done
+static void test_counts_reach_the_table() {
+    printf("=== test_counts_reach_the_table ===\n");
+    srand((unsigned) time(NULL));
+    start_loop();
+
+    size_t length = 40 * PIECE_BUFFER_CHUNK_SIZE + 123;
+    size_t lines;
+    char *text = make_text(length, &lines);
+    PieceTable *table = initialize_lazy_piece_table(text, length);
+    Progress progress = { 0 };
+    DocumentLoader *loader = start_loader(table, record_progress, &progress);
+
+    assert(loader != NULL);
+    assert(piece_table_pending(table) == 41 && "nothing is counted before the loop turns");
+
+    for (int i = 0; i < 1000 && !loader_done(loader); i++) {
+        waitForEvents();
+    }
+
+    assert(loader_done(loader));
+    assert(piece_table_pending(table) == 0);
+    assert(progress.calls > 0 && progress.counted == length && progress.length == length);
+    assert(piece_table_line_count(table) == lines);
+
+    stop_loader(loader);
+    free_piece_table(table);
+    free(text);
+    stop_loop();
+}
+
+// Looking far down before the thread got there counts on the spot, the
+// late counts of the thread change nothing
+static void test_lookups_do_not_wait() {
+    printf("=== test_lookups_do_not_wait ===\n");
+    start_loop();
+
+    size_t length = 20 * PIECE_BUFFER_CHUNK_SIZE;
+    size_t lines;
+    char *text = make_text(length, &lines);
+    PieceTable *table = initialize_lazy_piece_table(text, length);
+    DocumentLoader *loader = start_loader(table, NULL, NULL);
+
+    assert(piece_table_line_count(table) == lines);
+    size_t last = piece_table_line_start(table, lines - 1);
+    assert(last <= length && (last == 0 || text[last - 1] == '\n'));
+    assert(piece_table_insert(table, length / 2, "\n", 1) == 0);
+
+    for (int i = 0; i < 1000 && !loader_done(loader); i++) {
+        waitForEvents();
+    }
+
+    assert(piece_table_line_count(table) == lines + 1);
+    assert(piece_table_line_at(table, length + 1) == lines);
+
+    stop_loader(loader);
+    free_piece_table(table);
+    free(text);
+    stop_loop();
+}
+
+// Closing the document stops the count wherever it is
+static void test_stop_early() {
+    printf("=== test_stop_early ===\n");
+    start_loop();
+
+    size_t length = 64 * PIECE_BUFFER_CHUNK_SIZE;
+    size_t lines;
+    char *text = make_text(length, &lines);
+
+    for (int i = 0; i < 20; i++) {
+        PieceTable *table = initialize_lazy_piece_table(text, length);
+        DocumentLoader *loader = start_loader(table, NULL, NULL);
+
+        assert(loader != NULL);
+        stop_loader(loader);
+        assert(piece_table_line_count(table) == lines);
+        free_piece_table(table);
+    }
+
+    free(text);
+    stop_loop();
+}
+
+int main(void) {
+    printf("LOADER TEST START\n");
+
+    test_counts_reach_the_table();
+    test_lookups_do_not_wait();
+    test_stop_early();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
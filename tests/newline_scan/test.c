@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "types.h"
+#include "structures/vector.h"
+#include "text/newline_scan.h"
+
+// ---------------------------------------------------------
+// Reference: one byte at a time
+// ---------------------------------------------------------
+static Vector *naive_line_starts(const char *text, size_t length, size_t base) {
+    Vector *v = initialize_vector("size_t", sizeof(size_t));
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] == '\n') {
+            size_t start = base + i + 1;
+            vec_push_back(v, &start);
+        }
+    }
+    return v;
+}
+
+static void check_against_naive(const char *text, size_t length, size_t base) {
+    Vector *expected = naive_line_starts(text, length, base);
+    Vector *got = initialize_vector("size_t", sizeof(size_t));
+
+    size_t found = scan_line_starts(text, length, base, got);
+
+    assert(found == expected->len && "scanner found a different number of lines");
+    assert(got->len == expected->len);
+    assert(memcmp(got->base, expected->base, got->len * sizeof(size_t)) == 0 &&
+           "scanner line starts differ from the naive scan");
+    assert(count_newlines(text, length) == expected->len && "counter differs from the naive scan");
+
+    free_vector(expected);
+    free_vector(got);
+}
+
+static void test_edges() {
+    printf("=== test_edges (scanner=%d) ===\n", (int) newline_scanner_in_use());
+
+    check_against_naive("", 0, 0);
+    check_against_naive("\n", 1, 0);
+    check_against_naive("abc", 3, 7);
+    check_against_naive("a\nb\nc\n", 6, 100);
+
+    // All newlines, across and around the 64 byte blocks
+    char all[200];
+    memset(all, '\n', sizeof(all));
+    for (size_t len = 0; len <= sizeof(all); ++len) {
+        check_against_naive(all, len, 0);
+    }
+}
+
+static void test_random_alignments(int iters) {
+    printf("=== test_random_alignments (iters=%d) ===\n", iters);
+    srand((unsigned)time(NULL));
+
+    char *buffer = malloc(4096 + 64);
+    for (int it = 0; it < iters; ++it) {
+        size_t len = (size_t)(rand() % 4096);
+        size_t shift = (size_t)(rand() % 64);
+        int density = 1 + rand() % 80;
+
+        for (size_t i = 0; i < len; ++i) {
+            buffer[shift + i] = (rand() % density == 0) ? '\n' : (char)('a' + rand() % 26);
+        }
+
+        check_against_naive(buffer + shift, len, (size_t)rand());
+    }
+    free(buffer);
+}
+
+// The counter sums its lanes every few kilobytes, a lane must never wrap
+static void test_count_long_runs() {
+    printf("=== test_count_long_runs ===\n");
+    size_t length = 1 << 20;
+    char *text = malloc(length);
+
+    memset(text, '\n', length);
+    assert(count_newlines(text, length) == length);
+    assert(count_newlines(text + 3, length - 5) == length - 5);
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = i % 7 == 0 ? '\n' : 'x';
+    }
+
+    assert(count_newlines(text, length) == (length + 6) / 7);
+    free(text);
+}
+
+int main(void) {
+    printf("NEWLINE SCAN TEST START\n");
+
+    test_edges();
+    test_random_alignments(2000);
+    test_count_long_runs();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
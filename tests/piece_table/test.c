@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "types.h"
+#include "structures/vector.h"
+#include "structures/piece_table.h"
+
+// ---------------------------------------------------------
+// Reference document: a plain byte array
+// ---------------------------------------------------------
+typedef struct {
+    char *text;
+    size_t len;
+} Reference;
+
+static size_t ref_line_at(Reference *ref, size_t offset) {
+    size_t line = 0;
+    for (size_t i = 0; i < offset; ++i) {
+        if (ref->text[i] == '\n') line++;
+    }
+    return line;
+}
+
+static size_t ref_line_start(Reference *ref, size_t line) {
+    size_t last = 0, seen = 0;
+    if (line == 0) return 0;
+    for (size_t i = 0; i < ref->len; ++i) {
+        if (ref->text[i] == '\n') {
+            seen++;
+            last = i + 1;
+            if (seen == line) return last;
+        }
+    }
+    return last; // past the end clamps to the last line
+}
+
+static void check_table(PieceTable *t, Reference *ref, const char *phase) {
+    assert(piece_table_length(t) == ref->len && "length differs from reference");
+
+    char *out = malloc(ref->len + 1);
+    assert(piece_table_read(t, 0, out, ref->len) == ref->len);
+    if (memcmp(out, ref->text, ref->len) != 0) {
+        printf("CONTENT MISMATCH during %s\n", phase);
+        assert(0 && "piece table content differs from reference");
+    }
+    free(out);
+
+    assert(piece_table_line_count(t) == ref_line_at(ref, ref->len) + 1);
+
+    for (int k = 0; k < 8; ++k) {
+        size_t offset = (size_t)rand() % (ref->len + 1);
+        assert(piece_table_line_at(t, offset) == ref_line_at(ref, offset) && "offset to line");
+
+        size_t line = (size_t)rand() % (piece_table_line_count(t) + 2);
+        assert(piece_table_line_start(t, line) == ref_line_start(ref, line) && "line to offset");
+    }
+}
+
+static void test_empty_document() {
+    printf("=== test_empty_document ===\n");
+    PieceTable *t = initialize_piece_table(NULL, 0);
+    assert(t);
+    assert(piece_table_length(t) == 0);
+    assert(piece_table_line_count(t) == 1);
+    assert(piece_table_line_start(t, 5) == 0);
+    assert(piece_table_insert(t, 1, "x", 1) != 0 && "insert past the end must fail");
+    assert(piece_table_delete(t, 0, 10) == 0);
+    free_piece_table(t);
+}
+
+static void test_random_edits(size_t n_ops) {
+    printf("=== test_random_edits (n_ops=%zu) ===\n", n_ops);
+    srand((unsigned)time(NULL));
+
+    const char *original = "first line\nsecond line\n\nfourth line without end";
+    Reference ref;
+    ref.len = strlen(original);
+    ref.text = malloc(ref.len + n_ops * 8);
+    memcpy(ref.text, original, ref.len);
+
+    PieceTable *t = initialize_piece_table(original, ref.len);
+    assert(t);
+    check_table(t, &ref, "initial");
+
+    for (size_t i = 0; i < n_ops; ++i) {
+        int op = rand() % 5; // 0..2 insert, 3 delete, 4 typing after the last insert
+        size_t offset = (size_t)rand() % (ref.len + 1);
+
+        if (op == 4 && t->last_insert != NULL) {
+            offset = t->last_insert_end;
+        }
+
+        if (op != 3) {
+            char text[8];
+            size_t len = 1 + (size_t)(rand() % 7);
+            for (size_t k = 0; k < len; ++k) {
+                text[k] = (rand() % 5 == 0) ? '\n' : (char)('a' + rand() % 26);
+            }
+
+            assert(piece_table_insert(t, offset, text, len) == 0);
+            memmove(ref.text + offset + len, ref.text + offset, ref.len - offset);
+            memcpy(ref.text + offset, text, len);
+            ref.len += len;
+        } else {
+            size_t len = (size_t)(rand() % 12);
+            if (len > ref.len - offset) len = ref.len - offset;
+
+            assert(piece_table_delete(t, offset, len) == 0);
+            memmove(ref.text + offset, ref.text + offset + len, ref.len - offset - len);
+            ref.len -= len;
+        }
+
+        check_table(t, &ref, "random edits");
+    }
+
+    free_piece_table(t);
+    free(ref.text);
+}
+
+// Moves random ranges around with cut and paste, after enough typing to
+// spread the document over many pieces
+static void test_cut_and_paste(size_t n_ops) {
+    printf("=== test_cut_and_paste (n_ops=%zu) ===\n", n_ops);
+    srand((unsigned)time(NULL) ^ 0xC07);
+
+    const char *original = "alpha\nbeta\ngamma\ndelta\nepsilon\n";
+    Reference ref;
+    ref.len = strlen(original);
+    ref.text = malloc(ref.len + 2000);
+    memcpy(ref.text, original, ref.len);
+
+    PieceTable *t = initialize_piece_table(original, ref.len);
+    assert(t);
+
+    for (int i = 0; i < 400; ++i) {
+        char c = (rand() % 6 == 0) ? '\n' : (char)('a' + rand() % 26);
+        size_t offset = (size_t)rand() % (ref.len + 1);
+        assert(piece_table_insert(t, offset, &c, 1) == 0);
+        memmove(ref.text + offset + 1, ref.text + offset, ref.len - offset);
+        ref.text[offset] = c;
+        ref.len++;
+    }
+    check_table(t, &ref, "before cut and paste");
+
+    char *moved = malloc(ref.len);
+    for (size_t i = 0; i < n_ops; ++i) {
+        size_t offset = (size_t)rand() % (ref.len + 1);
+        size_t len = (size_t)rand() % (ref.len - offset + 1);
+
+        RedBlackTree *cut = piece_table_cut(t, offset, len);
+        assert(cut && "cut");
+        memcpy(moved, ref.text + offset, len);
+        memmove(ref.text + offset, ref.text + offset + len, ref.len - offset - len);
+        ref.len -= len;
+        check_table(t, &ref, "cut");
+
+        size_t at = (size_t)rand() % (ref.len + 1);
+        assert(piece_table_paste(t, at, cut) == 0 && "paste");
+        memmove(ref.text + at + len, ref.text + at, ref.len - at);
+        memcpy(ref.text + at, moved, len);
+        ref.len += len;
+        check_table(t, &ref, "paste");
+    }
+
+    assert(piece_table_cut(t, ref.len + 1, 1) == NULL && "cut past the end must fail");
+
+    free(moved);
+    free_piece_table(t);
+    free(ref.text);
+}
+
+// Batches of sorted edits, applied at once, against applying them one by one
+// from the last to the first on the reference
+static void test_batched_replace(size_t n_ops) {
+    printf("=== test_batched_replace (n_ops=%zu) ===\n", n_ops);
+    srand((unsigned)time(NULL) ^ 0xED17);
+
+    const char *original = "one\ntwo\nthree\nfour\nfive\nsix\nseven\n";
+    Reference ref;
+    ref.len = strlen(original);
+    ref.text = malloc(ref.len);
+    memcpy(ref.text, original, ref.len);
+
+    PieceTable *t = initialize_piece_table(original, ref.len);
+    assert(t);
+
+    for (size_t i = 0; i < n_ops; ++i) {
+        PieceTableEdit edits[16];
+        char texts[16][6];
+        size_t count = (size_t)rand() % 17;
+        size_t at = 0, grown = 0;
+
+        for (size_t k = 0; k < count; ++k) {
+            size_t offset = at + (size_t)rand() % 5;
+            if (offset > ref.len) offset = ref.len;
+            size_t len = (size_t)rand() % 4;
+            if (len > ref.len - offset) len = ref.len - offset;
+            size_t textLen = (size_t)rand() % 6;
+
+            for (size_t c = 0; c < textLen; ++c) {
+                texts[k][c] = (rand() % 4 == 0) ? '\n' : (char)('a' + rand() % 26);
+            }
+
+            edits[k] = (PieceTableEdit) { .offset = offset, .length = len, .text = texts[k], .textLength = textLen };
+            at = offset + len;
+            grown += textLen;
+        }
+
+        assert(piece_table_replace(t, edits, count) == 0);
+
+        char *next = malloc(ref.len + grown + 1);
+        size_t kept = 0, len = 0;
+        for (size_t k = 0; k < count; ++k) {
+            memcpy(next + len, ref.text + kept, edits[k].offset - kept);
+            len += edits[k].offset - kept;
+            memcpy(next + len, edits[k].text, edits[k].textLength);
+            len += edits[k].textLength;
+            kept = edits[k].offset + edits[k].length;
+        }
+        memcpy(next + len, ref.text + kept, ref.len - kept);
+        len += ref.len - kept;
+
+        free(ref.text);
+        ref.text = next;
+        ref.len = len;
+        check_table(t, &ref, "batched replace");
+    }
+
+    PieceTableEdit overlapping[2] = {
+        { .offset = 0, .length = 2, .text = "x", .textLength = 1 },
+        { .offset = 1, .length = 1, .text = "y", .textLength = 1 }
+    };
+    assert(piece_table_replace(t, overlapping, 2) != 0 && "overlapping edits must fail");
+    PieceTableEdit past[1] = { { .offset = ref.len + 1, .length = 0, .text = "x", .textLength = 1 } };
+    assert(piece_table_replace(t, past, 1) != 0 && "an edit past the end must fail");
+    check_table(t, &ref, "refused edits");
+
+    free_piece_table(t);
+    free(ref.text);
+}
+
+static void ref_splice(Reference *ref, size_t offset, size_t len, const char *text, size_t textLen) {
+    char *next = malloc(ref->len - len + textLen + 1);
+    memcpy(next, ref->text, offset);
+    memcpy(next + offset, text, textLen);
+    memcpy(next + offset + textLen, ref->text + offset + len, ref->len - offset - len);
+    free(ref->text);
+    ref->text = next;
+    ref->len = ref->len - len + textLen;
+}
+
+// Transactions of typing, backspacing and replacing, undone and redone at
+// random against a snapshot of the document after each one
+static void test_undo_redo(size_t n_ops) {
+    printf("=== test_undo_redo (n_ops=%zu) ===\n", n_ops);
+    srand((unsigned)time(NULL) ^ 0x0DD0);
+
+    const char *original = "first line\nsecond line\n\nfourth line without end";
+    Reference ref = { malloc(strlen(original)), strlen(original) };
+    memcpy(ref.text, original, ref.len);
+
+    PieceTable *t = initialize_piece_table(original, ref.len);
+    assert(t);
+    size_t offset;
+    assert(piece_table_undo(t, &offset) != 0 && "no undo without a history");
+    assert(piece_table_enable_history(t) == 0);
+    assert(piece_table_undo(t, &offset) != 0 && piece_table_redo(t, &offset) != 0);
+
+    Reference *snapshots = calloc(n_ops + 1, sizeof(*snapshots));
+    size_t applied = 0, recorded = 0;
+    snapshots[0] = (Reference) { malloc(ref.len), ref.len };
+    memcpy(snapshots[0].text, ref.text, ref.len);
+
+    for (size_t i = 0; i < n_ops; ++i) {
+        int action = rand() % 6;
+
+        if (action == 0 && applied > 0) {
+            assert(piece_table_undo(t, &offset) == 0);
+            applied--;
+        } else if (action == 1 && applied < recorded) {
+            assert(piece_table_redo(t, &offset) == 0);
+            applied++;
+        } else {
+            size_t cursor = (size_t)rand() % (ref.len + 1);
+            int changes = 1 + rand() % 6, changed = 0;
+
+            for (int c = 0; c < changes; ++c) {
+                int op = rand() % 4; // 0 type on, 1 backspace, 2 "x", 3 replace
+                char text[4];
+                size_t textLen = (size_t)(rand() % 4);
+                for (size_t k = 0; k < textLen; ++k) {
+                    text[k] = (rand() % 5 == 0) ? '\n' : (char)('a' + rand() % 26);
+                }
+
+                if (op == 0 && textLen > 0) {
+                    assert(piece_table_insert(t, cursor, text, textLen) == 0);
+                    ref_splice(&ref, cursor, 0, text, textLen);
+                    cursor += textLen;
+                    changed = 1;
+                } else if (op == 1 && cursor > 0) {
+                    cursor--;
+                    assert(piece_table_delete(t, cursor, 1) == 0);
+                    ref_splice(&ref, cursor, 1, "", 0);
+                    changed = 1;
+                } else if (op == 2 && cursor < ref.len) {
+                    assert(piece_table_delete(t, cursor, 1) == 0);
+                    ref_splice(&ref, cursor, 1, "", 0);
+                    changed = 1;
+                } else if (op == 3) {
+                    size_t len = (size_t)(rand() % 5);
+                    if (len > ref.len - cursor) len = ref.len - cursor;
+                    PieceTableEdit edit = { .offset = cursor, .length = len, .text = text, .textLength = textLen };
+                    assert(piece_table_replace(t, &edit, 1) == 0);
+                    ref_splice(&ref, cursor, len, text, textLen);
+                    changed |= len + textLen > 0;
+                }
+            }
+
+            piece_table_commit(t);
+
+            if (!changed) {
+                continue; // nothing recorded, what could be redone still can
+            }
+
+            for (size_t k = applied + 1; k <= recorded; ++k) {
+                free(snapshots[k].text);
+            }
+            applied++;
+            recorded = applied;
+            snapshots[applied] = (Reference) { malloc(ref.len + 1), ref.len };
+            memcpy(snapshots[applied].text, ref.text, ref.len);
+            assert(piece_table_redo(t, &offset) != 0 && "a change drops what could be redone");
+        }
+
+        free(ref.text);
+        ref = (Reference) { malloc(snapshots[applied].len + 1), snapshots[applied].len };
+        memcpy(ref.text, snapshots[applied].text, ref.len);
+        check_table(t, &ref, "undo and redo");
+    }
+
+    while (applied > 0) {
+        assert(piece_table_undo(t, &offset) == 0);
+        applied--;
+    }
+    assert(piece_table_undo(t, &offset) != 0);
+    check_table(t, &snapshots[0], "undone to the start");
+
+    for (size_t k = 0; k <= recorded; ++k) {
+        free(snapshots[k].text);
+    }
+    free(snapshots);
+    free(ref.text);
+    free_piece_table(t);
+}
+
+// A substitution over every line is undone by swapping its pieces back: the
+// document is the untouched original again, not a copy of it
+static void test_undo_large_replace(size_t lines) {
+    printf("=== test_undo_large_replace (lines=%zu) ===\n", lines);
+
+    size_t length = lines * 8;
+    char *original = malloc(length);
+    for (size_t i = 0; i < lines; ++i) {
+        memcpy(original + i * 8, "line xx\n", 8);
+    }
+
+    PieceTable *t = initialize_piece_table(original, length);
+    assert(t && piece_table_enable_history(t) == 0);
+
+    PieceTableEdit *edits = malloc(lines * sizeof(*edits));
+    for (size_t i = 0; i < lines; ++i) {
+        edits[i] = (PieceTableEdit) { .offset = i * 8 + 5, .length = 2, .text = "yy", .textLength = 2 };
+    }
+    assert(piece_table_replace(t, edits, lines) == 0);
+    piece_table_commit(t);
+
+    const char *text;
+    char line[8];
+    assert(piece_table_read(t, (lines - 1) * 8, line, 8) == 8 && !memcmp(line, "line yy\n", 8));
+
+    size_t offset;
+    assert(piece_table_undo(t, &offset) == 0 && offset == 5);
+    for (size_t at = 0, chunk; at < length; at += chunk) {
+        chunk = piece_table_chunk_at(t, at, &text);
+        assert(chunk > 0 && text == original + at && "the original's own bytes, not a copy");
+    }
+
+    assert(piece_table_redo(t, &offset) == 0 && offset == 5);
+    assert(piece_table_length(t) == length);
+    assert(piece_table_read(t, 8, line, 8) == 8 && !memcmp(line, "line yy\n", 8));
+
+    free(edits);
+    free_piece_table(t);
+    free(original);
+}
+
+// Line lookups against the reference's own line starts, for documents too
+// long to count from the start on every lookup
+static void check_lines(PieceTable *t, Reference *ref, int lookups) {
+    size_t *starts = malloc((ref->len + 1) * sizeof(*starts));
+    size_t lines = 1;
+
+    starts[0] = 0;
+    for (size_t i = 0; i < ref->len; ++i) {
+        if (ref->text[i] == '\n') starts[lines++] = i + 1;
+    }
+
+    for (int k = 0; k < lookups; ++k) {
+        size_t offset = (size_t)rand() % (ref->len + 1);
+        size_t low = 0, high = lines;
+        while (low + 1 < high) {
+            size_t mid = (low + high) / 2;
+            if (starts[mid] <= offset) low = mid; else high = mid;
+        }
+        assert(piece_table_line_at(t, offset) == low && "offset to line");
+
+        size_t line = (size_t)rand() % (lines + 2);
+        assert(piece_table_line_start(t, line) == starts[line < lines ? line : lines - 1] && "line to offset");
+    }
+
+    assert(piece_table_line_count(t) == lines);
+    free(starts);
+}
+
+// A lazily indexed original reads nothing up front: lookups count only the
+// chunks in front of what they look for, edits scan only the chunks they cut
+static void test_lazy_index() {
+    printf("=== test_lazy_index ===\n");
+    srand((unsigned)time(NULL) ^ 0x1A2);
+
+    size_t chunks = 6;
+    size_t length = chunks * PIECE_BUFFER_CHUNK_SIZE - PIECE_BUFFER_CHUNK_SIZE / 2;
+    char *original = malloc(length);
+    for (size_t i = 0; i < length; ++i) {
+        original[i] = rand() % 40 == 0 ? '\n' : 'a';
+    }
+    // A line running over a whole chunk and both its ends
+    memset(original + 2 * PIECE_BUFFER_CHUNK_SIZE - 100, 'b', PIECE_BUFFER_CHUNK_SIZE + 200);
+
+    Reference ref = { malloc(length), length };
+    memcpy(ref.text, original, length);
+
+    PieceTable *t = initialize_lazy_piece_table(original, length);
+    assert(t && piece_table_pending(t) == chunks);
+    PieceBuffer *buffer = piece_table_buffer(t, PIECE_BUFFER_ORIGINAL);
+
+    // Near the top only the first chunk is looked at
+    assert(piece_table_line_at(t, 100) == ref_line_at(&ref, 100));
+    assert(piece_table_line_start(t, 3) == ref_line_start(&ref, 3));
+    assert(piece_table_pending(t) == chunks - 1);
+    assert(buffer->chunks[1].newlines == PIECE_BUFFER_UNCOUNTED && buffer->chunks[1].lineStarts == NULL);
+
+    // Counts from elsewhere settle their pieces, lookups past them do not count again
+    size_t counts[2];
+    for (size_t c = 0; c < 2; ++c) {
+        Reference chunk = { original + (2 + c) * PIECE_BUFFER_CHUNK_SIZE, PIECE_BUFFER_CHUNK_SIZE };
+        counts[c] = ref_line_at(&chunk, chunk.len);
+    }
+    piece_table_set_chunk_newlines(t, 2, counts, 2);
+    assert(piece_table_pending(t) == chunks - 3);
+
+    size_t deep = 4 * PIECE_BUFFER_CHUNK_SIZE + 10;
+    assert(piece_table_line_at(t, deep) == ref_line_at(&ref, deep));
+    assert(piece_table_pending(t) == 1 && buffer->chunks[2].lineStarts == NULL && "counted, not scanned");
+    check_lines(t, &ref, 64);
+    assert(piece_table_pending(t) == 0);
+    free_piece_table(t);
+
+    // Edits on a table nothing was counted in, undone and redone
+    t = initialize_lazy_piece_table(original, length);
+    assert(t && piece_table_enable_history(t) == 0);
+    size_t offset;
+
+    assert(piece_table_insert(t, 3 * PIECE_BUFFER_CHUNK_SIZE + 5, "x\ny", 3) == 0);
+    ref_splice(&ref, 3 * PIECE_BUFFER_CHUNK_SIZE + 5, 0, "x\ny", 3);
+    assert(piece_table_pending(t) == chunks - 1);
+    assert(piece_table_delete(t, PIECE_BUFFER_CHUNK_SIZE - 7, 2 * PIECE_BUFFER_CHUNK_SIZE) == 0);
+    ref_splice(&ref, PIECE_BUFFER_CHUNK_SIZE - 7, 2 * PIECE_BUFFER_CHUNK_SIZE, "", 0);
+    PieceTableEdit edits[2] = {
+        { .offset = 10, .length = 3, .text = "\n\n", .textLength = 2 },
+        { .offset = ref.len - 4, .length = 4, .text = "end", .textLength = 3 }
+    };
+    assert(piece_table_replace(t, edits, 2) == 0);
+    ref_splice(&ref, ref.len - 4, 4, "end", 3);
+    ref_splice(&ref, 10, 3, "\n\n", 2);
+    piece_table_commit(t);
+    check_table(t, &ref, "lazy edits");
+
+    assert(piece_table_delete(t, 0, ref.len) == 0);
+    piece_table_commit(t);
+    assert(piece_table_line_count(t) == 1);
+    assert(piece_table_undo(t, &offset) == 0);
+    check_lines(t, &ref, 64);
+
+    free_piece_table(t);
+    free(ref.text);
+    free(original);
+}
+
+// Text coming in at the end from a buffer the table only references, which
+// grows (moves) as more comes: one piece keeps growing, undo does not see it
+static void test_appended_buffer() {
+    printf("=== test_appended_buffer ===\n");
+    srand((unsigned)time(NULL) ^ 0x5F3);
+
+    const char *original = "first\nline";
+    Reference ref = { malloc(strlen(original)), strlen(original) };
+    memcpy(ref.text, original, ref.len);
+
+    PieceTable *t = initialize_piece_table(original, strlen(original));
+    assert(t && piece_table_enable_history(t) == 0);
+
+    char *grown = NULL;
+    size_t grownLength = 0;
+    unsigned int buffer = 0;
+
+    for (int round = 0; round < 200; ++round) {
+        size_t more = 1 + (size_t)rand() % 300;
+        char *moved = malloc(grownLength + more);
+
+        if (grownLength > 0) memcpy(moved, grown, grownLength);
+        for (size_t i = 0; i < more; ++i) {
+            moved[grownLength + i] = rand() % 10 == 0 ? '\n' : 'x';
+        }
+
+        if (grown == NULL) {
+            assert(piece_table_add_buffer(t, moved, grownLength + more, &buffer) == 0);
+            assert(buffer == PIECE_BUFFER_ADDED + 1);
+        } else {
+            assert(piece_table_grow_buffer(t, buffer, moved, grownLength + more) == 0);
+        }
+
+        // The old copy goes once the table points into the new one
+        free(grown);
+        grown = moved;
+
+        assert(piece_table_append(t, buffer, grownLength, more) == 0);
+        ref_splice(&ref, ref.len, 0, grown + grownLength, more);
+        grownLength += more;
+    }
+
+    RedBlackTreeIterator pieces;
+    size_t count = 0;
+    for (redblack_iterator_first(&pieces, t->pieces); pieces.node != NULL; redblack_iterator_next(&pieces)) count++;
+    assert(count == 2 && "the original and one growing piece");
+    check_table(t, &ref, "appended");
+
+    size_t offset;
+    assert(piece_table_undo(t, &offset) != 0 && "nothing was edited");
+
+    // Edits go around the appended text like any other
+    assert(piece_table_insert(t, 3, "\nnew\n", 5) == 0);
+    ref_splice(&ref, 3, 0, "\nnew\n", 5);
+    assert(piece_table_delete(t, ref.len - 50, 20) == 0);
+    ref_splice(&ref, ref.len - 50, 20, "", 0);
+    piece_table_commit(t);
+    check_lines(t, &ref, 64);
+    assert(piece_table_undo(t, &offset) == 0);
+
+    free_piece_table(t);
+    free(grown);
+    free(ref.text);
+}
+
+// The memory a buffer pointed into goes after the table took its own copy:
+// the document, its lines and its undo only read the copy
+static void test_own_buffer() {
+    printf("=== test_own_buffer ===\n");
+    srand((unsigned)time(NULL) ^ 0x0B1);
+    size_t length = 3 * PIECE_BUFFER_CHUNK_SIZE / 2;
+    char *original = malloc(length);
+
+    for (size_t i = 0; i < length; ++i) {
+        original[i] = i % 37 == 36 ? '\n' : (char)('a' + i % 26);
+    }
+
+    Reference ref = { malloc(length), length };
+    Reference whole = { malloc(length), length };
+    memcpy(ref.text, original, length);
+    memcpy(whole.text, original, length);
+
+    PieceTable *t = initialize_lazy_piece_table(original, length);
+    assert(t && piece_table_enable_history(t) == 0);
+    assert(piece_table_delete(t, 100, 5000) == 0);
+    ref_splice(&ref, 100, 5000, "", 0);
+    piece_table_commit(t);
+
+    assert(piece_table_own_buffer(t, PIECE_BUFFER_ORIGINAL) == 0);
+    assert(piece_table_own_buffer(t, PIECE_BUFFER_ADDED) == 0 && "already its own");
+    assert(piece_table_buffer(t, PIECE_BUFFER_ORIGINAL)->size == length);
+    memset(original, '?', length);
+    free(original);
+
+    check_table(t, &ref, "read from the copy");
+    check_lines(t, &ref, 64);
+
+    size_t offset;
+    assert(piece_table_undo(t, &offset) == 0 && offset == 100);
+    check_table(t, &whole, "undone from the copy");
+    free(ref.text);
+    ref = whole;
+
+    // Edits still go in the added buffer
+    assert(piece_table_insert(t, 7, "x\ny", 3) == 0);
+    ref_splice(&ref, 7, 0, "x\ny", 3);
+    check_lines(t, &ref, 64);
+
+    free_piece_table(t);
+    free(ref.text);
+}
+
+int main(void) {
+    printf("PIECE TABLE TEST START\n");
+
+    test_empty_document();
+    test_random_edits(4000);
+    test_cut_and_paste(500);
+    test_batched_replace(2000);
+    test_undo_redo(3000);
+    test_undo_large_replace(200000);
+    test_lazy_index();
+    test_appended_buffer();
+    test_own_buffer();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
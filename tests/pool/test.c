@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "structures/pool.h"
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static size_t count_slabs(NodePool *pool) {
+    size_t count = 0;
+
+    for (NodePoolSlab *slab = pool->slabs; slab != NULL; slab = slab->next) {
+        count++;
+    }
+
+    return count;
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+// Blocks are aligned, at least a pointer big, and never overlap
+static void test_block_size() {
+    printf("=== test_block_size ===\n");
+
+    NodePool *tiny = initialize_node_pool(1);
+    NodePool *odd = initialize_node_pool(NODE_POOL_ALIGNMENT + 1);
+
+    assert(tiny != NULL && odd != NULL);
+    assert(tiny->block_size >= sizeof(void *) && tiny->block_size % NODE_POOL_ALIGNMENT == 0);
+    assert(odd->block_size == 2 * NODE_POOL_ALIGNMENT);
+
+    char *first = pool_alloc(odd);
+    char *second = pool_alloc(odd);
+
+    assert((uintptr_t) first % NODE_POOL_ALIGNMENT == 0 && (uintptr_t) second % NODE_POOL_ALIGNMENT == 0);
+    assert(second - first == (ptrdiff_t) odd->block_size);
+
+    free_node_pool(tiny);
+    free_node_pool(odd);
+}
+
+// Slabs double up to a cap, so a million blocks take a handful of them
+static void test_slab_growth() {
+    printf("=== test_slab_growth ===\n");
+    NodePool *pool = initialize_node_pool(24);
+    size_t count = 1000000;
+    void **blocks = malloc(count * sizeof(*blocks));
+
+    assert(pool != NULL && pool_alloc(NULL) == NULL);
+    assert(count_slabs(pool) == 0 && "nothing is allocated before the first block");
+
+    for (size_t i = 0; i < count; i++) {
+        blocks[i] = pool_alloc(pool);
+        assert(blocks[i] != NULL);
+        memset(blocks[i], (int) (i & 0xFF), 24);
+    }
+
+    size_t first = 64; // NODE_POOL_FIRST_SLAB_BLOCKS
+    assert(count_slabs(pool) > 1 && count_slabs(pool) < 32);
+    assert(pool->slab_blocks > first && pool->slab_blocks <= (1 << 16) && "growth stops at the cap");
+
+    // Nothing handed out twice: every block still holds what was written to it
+    for (size_t i = 0; i < count; i++) {
+        unsigned char *block = blocks[i];
+
+        assert(block[0] == (unsigned char) (i & 0xFF) && block[23] == (unsigned char) (i & 0xFF));
+    }
+
+    free(blocks);
+    free_node_pool(pool);
+}
+
+// Released blocks come back last in first out before any new one is carved
+static void test_reuse_after_free() {
+    printf("=== test_reuse_after_free ===\n");
+    NodePool *pool = initialize_node_pool(32);
+    void *a = pool_alloc(pool);
+    void *b = pool_alloc(pool);
+    void *c = pool_alloc(pool);
+    char *cursor = pool->cursor;
+
+    pool_release(pool, a);
+    pool_release(pool, c);
+    pool_release(pool, NULL);
+    pool_release(NULL, b);
+
+    assert(pool_alloc(pool) == c);
+    assert(pool_alloc(pool) == a);
+    assert(pool->cursor == cursor && "reused blocks carve nothing new");
+
+    void *d = pool_alloc(pool);
+    assert(d != a && d != b && d != c && pool->cursor == cursor + pool->block_size);
+
+    free_node_pool(pool);
+}
+
+// Every owner drops its reference, the last one frees the slabs
+static void test_shared_references() {
+    printf("=== test_shared_references ===\n");
+    NodePool *pool = initialize_node_pool(16);
+
+    assert(pool->references == 1);
+    assert(retain_node_pool(pool) == pool && retain_node_pool(pool) == pool);
+    assert(pool->references == 3);
+    assert(retain_node_pool(NULL) == NULL);
+
+    void *block = pool_alloc(pool);
+    free_node_pool(pool);
+    free_node_pool(pool);
+    assert(pool->references == 1);
+
+    // Still usable by the last owner
+    pool_release(pool, block);
+    assert(pool_alloc(pool) == block);
+
+    free_node_pool(pool);
+    free_node_pool(NULL);
+}
+
+int main(void) {
+    printf("POOL TEST START\n");
+
+    test_block_size();
+    test_slab_growth();
+    test_reuse_after_free();
+    test_shared_references();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -545,6 +545,385 @@ static void test_random_stress(int n, int iters) {
     }
 }
 
+// ---------------------------------------------------------
+// Iterators
+// ---------------------------------------------------------
+
+static void test_iterators_against_inorder(int n, int iters) {
+    printf("=== test_iterators_against_inorder (n=%d, iters=%d) ===\n", n, iters);
+    srand((unsigned)time(NULL) ^ 0x17E4);
+
+    for (int it = 0; it < iters; ++it) {
+        RedBlackTree *t = initialize_redblack_tree("int", sizeof(int), int_compare);
+        for (int i = 0; i < n; ++i) {
+            int v = rand() % (n * 4);
+            push_to_redblack_tree(t, &v);
+        }
+
+        Vector *v = initialize_vector("int", sizeof(int));
+        inorder_collect(t, v);
+        int *arr = (int *)v->base;
+
+        // forward
+        RedBlackTreeIterator iterator;
+        size_t i = 0;
+        for (redblack_iterator_first(&iterator, t); iterator.node; redblack_iterator_next(&iterator)) {
+            assert(*(int *)iterator.node->value == arr[i++] && "forward iterator order");
+        }
+        assert(i == v->len);
+
+        // backward
+        for (redblack_iterator_last(&iterator, t); iterator.node; redblack_iterator_prev(&iterator)) {
+            assert(*(int *)iterator.node->value == arr[--i] && "backward iterator order");
+        }
+        assert(i == 0);
+
+        // seek = lower bound
+        for (int k = 0; k < 50; ++k) {
+            int key = rand() % (n * 4 + 2) - 1;
+            size_t lower = 0;
+            while (lower < v->len && arr[lower] < key) lower++;
+
+            redblack_iterator_seek(&iterator, t, &key);
+            if (lower == v->len) {
+                assert(iterator.node == NULL && "seek past every value");
+            } else {
+                assert(iterator.node && *(int *)iterator.node->value == arr[lower] && "seek lower bound");
+            }
+        }
+
+        free_vector(v);
+        free_redblack_tree(t);
+    }
+}
+
+// ---------------------------------------------------------
+// Measured (positional) trees and their subtree aggregates
+// ---------------------------------------------------------
+
+typedef struct {
+    size_t length;
+    size_t newlines;
+    int id;
+} Span;
+
+static void measure_span(void *value, RedBlackTreeAggregate *aggregate) {
+    aggregate->length = ((Span *)value)->length;
+    aggregate->newlines = ((Span *)value)->newlines;
+}
+
+// Recomputes every subtree sum from scratch and compares it to the stored one
+static RedBlackTreeAggregate check_aggregates(RedBlackTreeNode *node) {
+    RedBlackTreeAggregate sum = {0};
+    if (!node) return sum;
+
+    RedBlackTreeAggregate left = check_aggregates(node->left);
+    RedBlackTreeAggregate right = check_aggregates(node->right);
+    Span *span = (Span *)node->value;
+
+    sum.length = left.length + right.length + span->length;
+    sum.newlines = left.newlines + right.newlines + span->newlines;
+    sum.nodes = left.nodes + right.nodes + 1;
+
+    assert(node->aggregate.length == sum.length && "stale length aggregate");
+    assert(node->aggregate.newlines == sum.newlines && "stale newline aggregate");
+    assert(node->aggregate.nodes == sum.nodes && "stale node count aggregate");
+
+    if (node->left) assert(node->left->parent == node);
+    if (node->right) assert(node->right->parent == node);
+
+    return sum;
+}
+
+static void check_measured_against_reference(RedBlackTree *t, Span *ref, size_t n) {
+    if (t->root != NULL) {
+        assert(t->root->color == RBT_COLOR_BLACK && "Root is not black");
+    }
+    check_no_red_red(t->root);
+    assert(check_black_height(t->root) >= 0 && "Black height mismatch on some path");
+    check_aggregates(t->root);
+    assert(t->size == n);
+
+    // In-order walk must match the reference order, and the offset/newline
+    // lookups must land on the same spans with the same prefix sums
+    RedBlackTreeNode *node = redblack_tree_first(t);
+    size_t offset = 0, newlines = 0;
+    for (size_t i = 0; i < n; ++i) {
+        assert(node != NULL);
+        assert(((Span *)node->value)->id == ref[i].id && "in-order walk differs from reference");
+
+        RedBlackTreeAggregate before;
+        size_t probe = offset + (size_t)rand() % ref[i].length;
+        assert(find_redblack_node_by_offset(t, probe, &before) == node);
+        assert(before.length == offset && before.newlines == newlines);
+
+        if (ref[i].newlines > 0) {
+            size_t nth = newlines + 1 + (size_t)rand() % ref[i].newlines;
+            assert(find_redblack_node_by_newline(t, nth, &before) == node);
+            assert(before.length == offset && before.newlines == newlines);
+        }
+
+        offset += ref[i].length;
+        newlines += ref[i].newlines;
+        node = redblack_node_successor(node);
+    }
+    assert(node == NULL);
+    assert(find_redblack_node_by_offset(t, offset, NULL) == NULL);
+    assert(find_redblack_node_by_newline(t, newlines + 1, NULL) == NULL);
+
+    // Iterators keep the aggregate in front of their node in both directions
+    RedBlackTreeIterator iterator;
+    size_t k = n;
+    for (redblack_iterator_last(&iterator, t); iterator.node; redblack_iterator_prev(&iterator)) {
+        offset -= ref[--k].length;
+        newlines -= ref[k].newlines;
+        assert(iterator.before.length == offset && iterator.before.newlines == newlines);
+    }
+    assert(k == 0);
+}
+
+static void test_measured_tree_with_reference(int n_ops) {
+    printf("=== test_measured_tree_with_reference (n_ops=%d) ===\n", n_ops);
+    srand((unsigned)time(NULL) ^ 0x0FF5E7);
+
+    RedBlackTree *t = initialize_measured_redblack_tree("struct", sizeof(Span), measure_span);
+    assert(t);
+
+    Span *ref = malloc(sizeof(Span) * (size_t)n_ops);
+    size_t n = 0;
+    int next_id = 0;
+
+    for (int i = 0; i < n_ops; ++i) {
+        int op = rand() % 4; // 0,1=insert 2=delete 3=resize in place
+
+        if (n == 0 || op < 2) {
+            Span span = { 1 + (size_t)(rand() % 50), (size_t)(rand() % 4), next_id++ };
+            size_t at = n ? (size_t)rand() % (n + 1) : 0;
+
+            // insert before the span currently at index `at` (NULL = append)
+            RedBlackTreeNode *anchor = NULL;
+            if (at < n) {
+                size_t offset = 0;
+                for (size_t k = 0; k < at; ++k) offset += ref[k].length;
+                anchor = find_redblack_node_by_offset(t, offset, NULL);
+            }
+            if (rand() % 2 || anchor == NULL) {
+                insert_redblack_node_before(t, anchor, &span);
+            } else {
+                insert_redblack_node_after(t, redblack_node_predecessor(anchor), &span);
+            }
+
+            memmove(&ref[at + 1], &ref[at], sizeof(Span) * (n - at));
+            ref[at] = span;
+            n++;
+        } else {
+            size_t at = (size_t)rand() % n;
+            size_t offset = 0;
+            for (size_t k = 0; k < at; ++k) offset += ref[k].length;
+            RedBlackTreeNode *node = find_redblack_node_by_offset(t, offset, NULL);
+            assert(node && ((Span *)node->value)->id == ref[at].id);
+
+            if (op == 2) {
+                delete_redblack_node(t, node);
+                memmove(&ref[at], &ref[at + 1], sizeof(Span) * (n - at - 1));
+                n--;
+            } else {
+                Span *span = (Span *)node->value;
+                span->length = 1 + (size_t)(rand() % 50);
+                span->newlines = (size_t)(rand() % 4);
+                update_redblack_node_aggregates(t, node);
+                ref[at] = *span;
+            }
+        }
+
+        check_measured_against_reference(t, ref, n);
+    }
+
+    free(ref);
+    free_redblack_tree(t);
+}
+
+// ---------------------------------------------------------
+// Split and join
+// ---------------------------------------------------------
+
+static void test_split_and_join_values(int n, int iters) {
+    printf("=== test_split_and_join_values (n=%d, iters=%d) ===\n", n, iters);
+    srand((unsigned)time(NULL) ^ 0x5B1D);
+
+    for (int it = 0; it < iters; ++it) {
+        RedBlackTree *t = initialize_redblack_tree("int", sizeof(int), int_compare);
+        int count = rand() % n;
+        for (int i = 0; i < count; ++i) {
+            int v = rand() % (n * 2);
+            push_to_redblack_tree(t, &v);
+        }
+
+        Vector *before = initialize_vector("int", sizeof(int));
+        inorder_collect(t, before);
+
+        int key = rand() % (n * 2 + 2) - 1;
+        RedBlackTree *right = split_redblack_tree_at_value(t, &key);
+        assert(right);
+
+        check_rbt(t, "split: left part");
+        check_rbt(right, "split: right part");
+        assert(t->size + right->size == before->len);
+
+        Vector *left_values = initialize_vector("int", sizeof(int));
+        Vector *right_values = initialize_vector("int", sizeof(int));
+        inorder_collect(t, left_values);
+        inorder_collect(right, right_values);
+        for (size_t i = 0; i < left_values->len; ++i) {
+            assert(((int *)left_values->base)[i] < key && "value left of the split point");
+        }
+        for (size_t i = 0; i < right_values->len; ++i) {
+            assert(((int *)right_values->base)[i] >= key && "value right of the split point");
+        }
+
+        // Both halves keep working as trees on their own
+        for (int k = 0; k < 20; ++k) {
+            int v = rand() % (key > 0 ? key : 1) - 1;
+            int w = key + rand() % n;
+            if (v < key) push_to_redblack_tree(t, &v);
+            push_to_redblack_tree(right, &w);
+        }
+        check_rbt(t, "split: left part after inserts");
+        check_rbt(right, "split: right part after inserts");
+
+        size_t total = t->size + right->size;
+        join_redblack_trees(t, right);
+        check_rbt(t, "join");
+        assert(t->size == total);
+
+        free_vector(before);
+        free_vector(left_values);
+        free_vector(right_values);
+        free_redblack_tree(t);
+    }
+}
+
+// Cuts random ranges out of a positional tree and pastes them elsewhere,
+// the way the piece table moves text around
+static void test_split_and_join_measured(int n_ops) {
+    printf("=== test_split_and_join_measured (n_ops=%d) ===\n", n_ops);
+    srand((unsigned)time(NULL) ^ 0xC0FFEE);
+
+    size_t n = 500;
+    Span *ref = malloc(sizeof(Span) * n);
+    Span *scratch = malloc(sizeof(Span) * n);
+    RedBlackTree *t = initialize_measured_redblack_tree("struct", sizeof(Span), measure_span);
+
+    for (size_t i = 0; i < n; ++i) {
+        ref[i] = (Span) { 1 + (size_t)(rand() % 50), (size_t)(rand() % 4), (int)i };
+        insert_redblack_node_before(t, NULL, &ref[i]);
+    }
+    check_measured_against_reference(t, ref, n);
+
+    for (int op = 0; op < n_ops; ++op) {
+        size_t from = (size_t)rand() % (n + 1);
+        size_t to = from + (size_t)rand() % (n - from + 1);
+
+        size_t from_offset = 0, to_offset = 0;
+        for (size_t k = 0; k < to; ++k) {
+            if (k < from) from_offset += ref[k].length;
+            to_offset += ref[k].length;
+        }
+
+        // t = [0, from) + [to, n), cut = [from, to)
+        RedBlackTree *cut = split_redblack_tree_at_offset(t, from_offset);
+        RedBlackTree *after = split_redblack_tree_at_offset(cut, to_offset - from_offset);
+        check_measured_against_reference(t, ref, from);
+        check_measured_against_reference(cut, ref + from, to - from);
+        check_measured_against_reference(after, ref + to, n - to);
+        join_redblack_trees(t, after);
+
+        size_t rest = n - (to - from);
+        memcpy(scratch, ref, sizeof(Span) * from);
+        memcpy(scratch + from, ref + to, sizeof(Span) * (n - to));
+        check_measured_against_reference(t, scratch, rest);
+
+        // Paste the cut back at a random place of what is left
+        size_t at = (size_t)rand() % (rest + 1);
+        size_t at_offset = 0;
+        for (size_t k = 0; k < at; ++k) at_offset += scratch[k].length;
+
+        after = split_redblack_tree_at_offset(t, at_offset);
+        join_redblack_trees(t, cut);
+        join_redblack_trees(t, after);
+
+        memcpy(scratch + rest, ref + from, sizeof(Span) * (to - from));
+        memcpy(ref, scratch, sizeof(Span) * at);
+        memcpy(ref + at, scratch + rest, sizeof(Span) * (to - from));
+        memcpy(ref + at + (to - from), scratch + at, sizeof(Span) * (rest - at));
+        check_measured_against_reference(t, ref, n);
+    }
+
+    free(ref);
+    free(scratch);
+    free_redblack_tree(t);
+}
+
+// ---------------------------------------------------------
+// Bulk construction
+// ---------------------------------------------------------
+
+static void test_build_from_sorted(int max_n) {
+    printf("=== test_build_from_sorted (max_n=%d) ===\n", max_n);
+    srand((unsigned)time(NULL) ^ 0xB17D);
+
+    // Every size up to max_n, so each shape of partial last level shows up
+    for (int n = 0; n <= max_n; ++n) {
+        Vector *values = initialize_vector("int", sizeof(int));
+        int v = 0;
+        for (int i = 0; i < n; ++i) {
+            v += rand() % 3; // duplicates included
+            vec_push_back(values, &v);
+        }
+
+        RedBlackTree *t = build_redblack_tree_from_sorted("int", sizeof(int), int_compare, values);
+        assert(t);
+        check_no_red_red(t->root);
+        assert(check_black_height(t->root) >= 0 && "Black height mismatch on some path");
+        if (t->root) assert(t->root->color == RBT_COLOR_BLACK && "Root is not black");
+        assert(t->size == (size_t)n);
+
+        Vector *out = initialize_vector("int", sizeof(int));
+        inorder_collect(t, out);
+        assert(out->len == values->len);
+        assert(memcmp(out->base, values->base, sizeof(int) * values->len) == 0 && "built tree lost the order");
+
+        // A built tree is a normal tree afterwards
+        for (int k = 0; k < 10; ++k) {
+            int x = rand() % (v + 2);
+            push_to_redblack_tree(t, &x);
+        }
+        if (n > 0) {
+            int first = ((int *)values->base)[0];
+            free(remove_by_value_redblack_tree(t, &first));
+        }
+        if (n % 50 == 0) {
+            check_rbt(t, "build then edit");
+        }
+
+        free_vector(out);
+        free_vector(values);
+        free_redblack_tree(t);
+    }
+
+    // Measured trees are filled in sequence order, with their aggregates
+    Vector *spans = initialize_vector("struct", sizeof(Span));
+    for (int i = 0; i < 5000; ++i) {
+        Span span = { 1 + (size_t)(rand() % 50), (size_t)(rand() % 4), i };
+        vec_push_back(spans, &span);
+    }
+    RedBlackTree *m = initialize_measured_redblack_tree("struct", sizeof(Span), measure_span);
+    assert(fill_redblack_tree_from_sorted(m, spans) == 0);
+    check_measured_against_reference(m, (Span *)spans->base, spans->len);
+    free_vector(spans);
+    free_redblack_tree(m);
+}
+
 // ---------------------------------------------------------
 // main
 // ---------------------------------------------------------
@@ -573,6 +952,19 @@ int main(void) {
     // Big random stress
     test_random_stress(200, 20);
 
+    // In-order iterators
+    test_iterators_against_inorder(300, 20);
+
+    // Positional trees with length/newline aggregates
+    test_measured_tree_with_reference(3000);
+
+    // O(log n) split and join
+    test_split_and_join_values(400, 200);
+    test_split_and_join_measured(300);
+
+    // O(n) construction from sorted input
+    test_build_from_sorted(600);
+
     printf("ALL TESTS PASSED\n");
     return 0;
 }
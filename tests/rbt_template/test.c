@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "types.h"
+#include "structures/rbt.h"
+#include "structures/rbt_template.h"
+
+RBT_DEFINE(IntTree, int, (a > b) - (a < b))
+VECTOR_DEFINE(IntVector, int)
+
+typedef struct {
+    size_t offset;
+    int mark;
+} Mark;
+
+RBT_DEFINE(MarkTree, Mark, (a.offset > b.offset) - (a.offset < b.offset))
+
+static short int_compare(void *a, void *b) {
+    int ia = *(int *)a;
+    int ib = *(int *)b;
+    if (ia < ib) return -1;
+    if (ia > ib) return 1;
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Invariant checking helpers
+// ---------------------------------------------------------
+
+// Returns the black height, asserts on red-red edges and broken parents
+static int check_links(RbtLinks *node, RbtLinks *parent) {
+    if (!node) return 1;
+
+    assert(node->parent == parent && "broken parent pointer");
+    if (node->color == RBT_LINKS_RED) {
+        assert((!node->left || node->left->color == RBT_LINKS_BLACK) && "Red node has red left child");
+        assert((!node->right || node->right->color == RBT_LINKS_BLACK) && "Red node has red right child");
+    }
+
+    int left = check_links(node->left, node);
+    int right = check_links(node->right, node);
+    assert(left == right && "Black height mismatch on some path");
+
+    return left + (node->color == RBT_LINKS_BLACK);
+}
+
+static void check_against_reference(IntTree *t, IntVector *ref) {
+    if (t->root) assert(t->root->color == RBT_LINKS_BLACK && "Root is not black");
+    check_links(t->root, NULL);
+    assert(t->size == ref->len);
+
+    size_t i = 0;
+    for (IntTreeNode *node = IntTree_first(t); node; node = IntTree_next(node)) {
+        assert(node->value == ref->base[i++] && "in-order walk differs from reference");
+    }
+    assert(i == ref->len);
+
+    for (IntTreeNode *node = IntTree_last(t); node; node = IntTree_prev(node)) {
+        assert(node->value == ref->base[--i] && "backward walk differs from reference");
+    }
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_mixed_operations_with_reference(int n_ops, int key_range) {
+    printf("=== test_mixed_operations_with_reference (n_ops=%d, key_range=%d) ===\n", n_ops, key_range);
+    srand((unsigned)time(NULL) ^ 0x7E3);
+
+    IntTree t;
+    IntVector ref;
+    assert(IntTree_initialize(&t) == 0);
+    IntVector_initialize(&ref);
+
+    for (int i = 0; i < n_ops; ++i) {
+        int key = rand() % key_range;
+
+        // Sorted position of key in the reference, after equal keys
+        size_t at = 0;
+        while (at < ref.len && ref.base[at] <= key) at++;
+
+        if (rand() % 3 != 0) {
+            assert(IntTree_insert(&t, key));
+            assert(IntVector_push_back(&ref, 0) == 0);
+            memmove(&ref.base[at + 1], &ref.base[at], sizeof(int) * (ref.len - 1 - at));
+            ref.base[at] = key;
+        } else {
+            IntTreeNode *node = IntTree_search(&t, key);
+            if (at == 0 || ref.base[at - 1] != key) {
+                assert(node == NULL && "found a key that is not there");
+                continue;
+            }
+
+            assert(node && node->value == key);
+            IntTree_remove(&t, node);
+            memmove(&ref.base[at - 1], &ref.base[at], sizeof(int) * (ref.len - at));
+            ref.len--;
+        }
+
+        int probe = rand() % (key_range + 2) - 1;
+        size_t lower = 0;
+        while (lower < ref.len && ref.base[lower] < probe) lower++;
+        IntTreeNode *bound = IntTree_lower_bound(&t, probe);
+        if (lower == ref.len) {
+            assert(bound == NULL && "lower bound past every key");
+        } else {
+            assert(bound && bound->value == ref.base[lower] && "lower bound");
+        }
+
+        check_against_reference(&t, &ref);
+    }
+
+    while (t.root) {
+        IntTree_remove(&t, IntTree_first(&t));
+        check_links(t.root, NULL);
+    }
+    assert(t.size == 0);
+
+    IntVector_free(&ref);
+    IntTree_free(&t);
+}
+
+static void test_struct_keys() {
+    printf("=== test_struct_keys ===\n");
+
+    MarkTree t;
+    assert(MarkTree_initialize(&t) == 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        Mark mark = { (size_t)((i * 7919) % 1000), i };
+        assert(MarkTree_insert(&t, mark));
+    }
+
+    size_t expected = 0;
+    for (MarkTreeNode *node = MarkTree_first(&t); node; node = MarkTree_next(node)) {
+        assert(node->value.offset == expected++);
+        assert((size_t)((node->value.mark * 7919) % 1000) == node->value.offset);
+    }
+
+    Mark probe = { 500, 0 };
+    assert(MarkTree_search(&t, probe)->value.offset == 500);
+
+    MarkTree_free(&t);
+}
+
+// Same workload on the generic tree and on an instantiation
+static void bench_against_generic(int n) {
+    printf("=== bench_against_generic (n=%d) ===\n", n);
+    srand(1234);
+
+    int *keys = malloc(sizeof(int) * (size_t)n);
+    for (int i = 0; i < n; ++i) keys[i] = rand();
+
+    clock_t start = clock();
+    RedBlackTree *generic = initialize_redblack_tree("int", sizeof(int), int_compare);
+    for (int i = 0; i < n; ++i) push_to_redblack_tree(generic, &keys[i]);
+    size_t found = 0;
+    for (int i = 0; i < n; ++i) found += search_redblack_tree(generic, generic->root, &keys[i]) != NULL;
+    double genericSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    assert(found == (size_t)n);
+    free_redblack_tree(generic);
+
+    start = clock();
+    IntTree specialized;
+    IntTree_initialize(&specialized);
+    for (int i = 0; i < n; ++i) IntTree_insert(&specialized, keys[i]);
+    found = 0;
+    for (int i = 0; i < n; ++i) found += IntTree_search(&specialized, keys[i]) != NULL;
+    double specializedSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    assert(found == (size_t)n);
+    IntTree_free(&specialized);
+
+    printf("generic: %.3fs, specialized: %.3fs\n", genericSeconds, specializedSeconds);
+    free(keys);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("RED-BLACK TREE TEMPLATE TEST START\n");
+
+    test_mixed_operations_with_reference(4000, 300);
+    test_struct_keys();
+    bench_against_generic(500000);
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#ifndef _WIN32
+#include <regex.h>
+#endif
+
+#include "structures/piece_table.h"
+#include "text/regex.h"
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static Regex *compile(const char *pattern) {
+    const char *error = NULL;
+    Regex *regex = compile_regex(pattern, strlen(pattern), &error);
+
+    if (regex == NULL) {
+        printf("PATTERN \"%s\": %s\n", pattern, error);
+        assert(0 && "pattern did not compile");
+    }
+
+    return regex;
+}
+
+static void assert_compile_error(const char *pattern, const char *error) {
+    const char *got = NULL;
+
+    assert(compile_regex(pattern, strlen(pattern), &got) == NULL);
+
+    if (strncmp(got, error, strlen(error)) != 0) {
+        printf("PATTERN \"%s\": got \"%s\", expected \"%s\"\n", pattern, got, error);
+        assert(0 && "wrong error");
+    }
+}
+
+// The first match in text from from on, as "start,end" or "none"
+static void assert_first(const char *pattern, const char *text, size_t from, const char *expected) {
+    Regex *regex = compile(pattern);
+    PieceTable *table = initialize_piece_table(text, strlen(text));
+    RegexMatch match;
+    char got[64] = "none";
+
+    if (!regex_search_piece_table(regex, table, from, &match)) {
+        snprintf(got, sizeof(got), "%zu,%zu", match.start, match.end);
+    }
+
+    if (strcmp(got, expected) != 0) {
+        printf("PATTERN \"%s\" IN \"%s\": got %s, expected %s\n", pattern, text, got, expected);
+        assert(0 && "first match differs");
+    }
+
+    free_piece_table(table);
+    free_regex(regex);
+}
+
+// Every match of one line, as ":s/pattern/.../g" takes them
+static void assert_all(const char *pattern, const char *line, const char *expected) {
+    Regex *regex = compile(pattern);
+    Vector *matches = initialize_vector("struct", sizeof(RegexMatch));
+    char got[256] = "";
+
+    assert(regex_line_matches(regex, line, strlen(line), REGEX_EDGE, REGEX_EDGE, 1, matches) == 0);
+
+    for (size_t i = 0; i < matches->len; i++) {
+        RegexMatch *match = (RegexMatch *) matches->base + i;
+
+        snprintf(got + strlen(got), sizeof(got) - strlen(got), "%s%zu,%zu", i > 0 ? " " : "", match->start, match->end);
+    }
+
+    if (strcmp(got, expected) != 0) {
+        printf("PATTERN \"%s\" IN \"%s\": got \"%s\", expected \"%s\"\n", pattern, line, got, expected);
+        assert(0 && "matches differ");
+    }
+
+    free_vector(matches);
+    free_regex(regex);
+}
+
+static void random_text(char *text, size_t length, const char *alphabet) {
+    size_t size = strlen(alphabet);
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = alphabet[(size_t) rand() % size];
+    }
+}
+
+// Small inserts spread the document over many short pieces
+static PieceTable *scattered_table(const char *text, size_t length) {
+    PieceTable *table = initialize_piece_table(NULL, 0);
+
+    for (size_t at = 0; at < length;) {
+        size_t size = 1 + (size_t) rand() % 4;
+
+        if (size > length - at) {
+            size = length - at;
+        }
+
+        assert(piece_table_insert(table, at, text + at, size) == 0);
+        at += size;
+    }
+
+    return table;
+}
+
+// ---------------------------------------------------------
+// Random patterns, written both in vim's syntax and as POSIX EREs
+// ---------------------------------------------------------
+
+typedef struct {
+    char vim[512];
+    char ere[512];
+    int full; // a pattern too long for the buffers is thrown away
+} Pattern;
+
+static void append(Pattern *pattern, const char *vim, const char *ere) {
+    if (strlen(pattern->vim) + strlen(vim) >= sizeof(pattern->vim)) {
+        pattern->full = 1;
+        return;
+    }
+
+    strcat(pattern->vim, vim);
+    strcat(pattern->ere, ere);
+}
+
+static void random_alternation(Pattern *pattern, int depth);
+
+static void random_piece(Pattern *pattern, int depth) {
+    static const char *atoms[][2] = {
+        { "a", "a" }, { "b", "b" }, { "c", "c" }, { " ", " " }, { ".", "." },
+        { "[ab]", "[ab]" }, { "[^a]", "[^a]" }, { "[b-c]", "[b-c]" },
+    };
+    static const char *multis[][2] = {
+        { "*", "*" }, { "\\+", "+" }, { "\\=", "?" }, { "\\{1,2}", "{1,2}" }, { "\\{2}", "{2}" }, { "\\{0,1}", "{0,1}" },
+    };
+    int kind = rand() % 10;
+
+    if (kind == 0 && depth == 2) {
+        // The same in both syntaxes, glibc knows the word boundaries too
+        const char *boundary = rand() % 2 ? "\\<" : "\\>";
+
+        append(pattern, boundary, boundary);
+        return;
+    }
+
+    if (kind <= 2 && depth > 0) {
+        append(pattern, "\\(", "(");
+        random_alternation(pattern, depth - 1);
+        append(pattern, "\\)", ")");
+    } else {
+        int atom = rand() % (int) (sizeof(atoms) / sizeof(atoms[0]));
+
+        append(pattern, atoms[atom][0], atoms[atom][1]);
+    }
+
+    if (rand() % 3 == 0) {
+        int multi = rand() % (int) (sizeof(multis) / sizeof(multis[0]));
+
+        append(pattern, multis[multi][0], multis[multi][1]);
+    }
+}
+
+// glibc gets anchors and word boundaries wrong inside repeated groups, they
+// are only put at the top level
+static void random_branch(Pattern *pattern, int depth) {
+    int pieces = 1 + rand() % 3;
+    int top = depth == 2;
+
+    if (top && rand() % 6 == 0) {
+        append(pattern, "^", "^");
+    }
+
+    for (int i = 0; i < pieces; i++) {
+        random_piece(pattern, depth);
+    }
+
+    if (top && rand() % 6 == 0) {
+        append(pattern, "$", "$");
+    }
+}
+
+static void random_alternation(Pattern *pattern, int depth) {
+    random_branch(pattern, depth);
+
+    while (rand() % 4 == 0) {
+        append(pattern, "\\|", "|");
+        random_branch(pattern, depth);
+    }
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_syntax() {
+    printf("=== test_syntax ===\n");
+
+    assert_first("two", "one two", 0, "4,7");
+    assert_first("t.o", "one two", 0, "4,7");
+    assert_first("o\\+", "foo", 0, "1,3");
+    assert_first("fo*", "ffoo", 0, "0,1");
+    assert_first("x\\=y", "axy", 0, "1,3");
+    assert_first("a\\{2,3}", "aaaa", 0, "0,3");
+    assert_first("a\\{2}", "a aa", 0, "2,4");
+    assert_first("\\(ab\\)\\+c", "xababc", 0, "1,6");
+    assert_first("cat\\|dog", "hotdog cat", 0, "3,6");
+    assert_first("\\%(x\\|y\\)z", "xyz", 0, "1,3");
+    assert_first("[0-9]\\+", "abc 1234 x", 0, "4,8");
+    assert_first("\\d\\+", "abc 1234 x", 0, "4,8");
+    assert_first("\\a\\+", "12 xy3", 0, "3,5");
+    assert_first("\\u\\l", "abCdE", 0, "2,4");
+    assert_first("[^ ]\\+", "  ab ", 0, "2,4");
+    assert_first("[]x]", "a]", 0, "1,2");
+    assert_first("[a-c-]", "x-", 0, "1,2");
+    assert_first("a[", "a[", 0, "0,2"); // no "]": a plain "["
+    assert_first("\\s\\S", "ab c", 0, "2,4");
+    assert_first("\\w\\W", "ab c", 0, "1,3");
+    assert_first("\\x\\X", "fg", 0, "0,2");
+    assert_first("\\.", "a.b", 0, "1,2");
+    assert_first("a\\*", "aa*", 0, "1,3");
+    assert_first("*a", "b*a", 0, "1,3"); // "*" with nothing before it is itself
+    assert_first("\\t", "a\tb", 0, "1,2");
+
+    // Anchors and word boundaries
+    assert_first("^b", "ab\nbc", 0, "3,4");
+    assert_first("b$", "bab\nc", 0, "2,3");
+    assert_first("a^", "a^", 0, "0,2"); // only special at the start of a branch
+    assert_first("$a", "$a", 0, "0,2");
+    assert_first("x\\|^y", "ay\ny", 0, "3,4");
+    assert_first("\\<is\\>", "this is", 0, "5,7");
+    assert_first("\\<t", "at t", 0, "3,4");
+    assert_first("o\\>", "foo oo", 0, "2,3");
+    assert_first("^", "ab\ncd", 1, "3,3");
+    assert_first("$", "ab\ncd", 0, "2,2");
+    assert_first("^$", "ab\n\ncd", 0, "3,3");
+
+    // Leftmost, then longest
+    assert_first("abcd\\|c", "abcd", 0, "0,4");
+    assert_first("a\\|ab\\|abc", "xabcd", 0, "1,4");
+    assert_first("\\(a\\|ab\\)\\(c\\|bcd\\)", "abcd", 0, "0,4");
+    assert_first("x*", "aaxx", 0, "0,0");
+    assert_first("b\\+", "abbb", 2, "2,4");
+
+    // Matches stay inside a line
+    assert_first("a.b", "a\nb", 0, "none");
+    assert_first("a[^x]b", "a\nb", 0, "none");
+
+    // Context before from counts for the anchors
+    assert_first("^b", "ab", 1, "none");
+    assert_first("\\<b", "ab b", 1, "3,4");
+}
+
+static void test_errors() {
+    printf("=== test_errors ===\n");
+
+    assert_compile_error("\\(a", "E54");
+    assert_compile_error("a\\)", "E55");
+    assert_compile_error("a**", "E61");
+    assert_compile_error("a*\\+", "E61");
+    assert_compile_error("\\+a", "E64");
+    assert_compile_error("a\\{1,2", "E554");
+    assert_compile_error("a\\{-1,}", "E554");
+    assert_compile_error("[z-a]", "E944");
+    assert_compile_error("a\\nb", "E383");
+    assert_compile_error("\\%[ab]", "E383");
+    assert_compile_error("a\\{5000}", "E339");
+    assert_compile_error("\\(abcdefgh\\)\\{600}", "E339");
+
+    char deep[512] = "";
+    for (int i = 0; i < 100; i++) {
+        strcat(deep, "\\(");
+    }
+    assert_compile_error(deep, "E339");
+}
+
+static void test_all_matches_of_a_line() {
+    printf("=== test_all_matches_of_a_line ===\n");
+
+    assert_all("o", "foo boo", "1,2 2,3 5,6 6,7");
+    assert_all("o\\+", "foo boo", "1,3 5,7");
+    assert_all("x*", "abc", "0,0 1,1 2,2 3,3");
+    // No empty match right where the last one ended
+    assert_all("x*", "xxa", "0,2 3,3");
+    assert_all("\\<", "ab cd", "0,0 3,3");
+    assert_all("^\\|$", "ab", "0,0 2,2");
+    assert_all("a\\|ab", "abab", "0,2 2,4");
+    assert_all("zz", "abab", "");
+}
+
+// Random patterns against glibc's POSIX matcher, which is leftmost-longest
+// too, over documents cut into many pieces
+static void test_against_posix(int iters) {
+#ifdef _WIN32
+    (void) iters;
+    printf("=== test_against_posix: no POSIX regex here, skipped ===\n");
+#else
+    printf("=== test_against_posix ===\n");
+    srand((unsigned) time(NULL));
+
+    int compared = 0;
+
+    for (int it = 0; it < iters; it++) {
+        Pattern pattern = { "", "", 0 };
+        regex_t posix;
+
+        random_alternation(&pattern, 2);
+
+        if (pattern.full || regcomp(&posix, pattern.ere, REG_EXTENDED | REG_NEWLINE) != 0) {
+            continue;
+        }
+
+        Regex *regex = compile(pattern.vim);
+        char text[96];
+        size_t length = (size_t) rand() % (sizeof(text) - 1);
+
+        random_text(text, length, "abcc  \n");
+        text[length] = '\0';
+
+        PieceTable *table = scattered_table(text, length);
+
+        // Only from where glibc sees the same context: the start of the
+        // text or of a line, or after a blank
+        for (size_t from = 0; from <= length; from++) {
+            if (from > 0 && text[from - 1] != '\n' && text[from - 1] != ' ') {
+                continue;
+            }
+
+            regmatch_t expected;
+            int eflags = from > 0 && text[from - 1] != '\n' ? REG_NOTBOL : 0;
+            int expectedMissing = regexec(&posix, text + from, 1, &expected, eflags) != 0;
+            RegexMatch match;
+            int missing = regex_search_piece_table(regex, table, from, &match);
+
+            if (missing != expectedMissing ||
+                (!missing && (match.start != from + (size_t) expected.rm_so || match.end != from + (size_t) expected.rm_eo))) {
+                printf("PATTERN \"%s\" (ERE \"%s\") FROM %zu IN \"%s\"\n", pattern.vim, pattern.ere, from, text);
+                printf("got %d %zu,%zu expected %d %zu,%zu\n", missing, missing ? 0 : match.start, missing ? 0 : match.end,
+                       expectedMissing, expectedMissing ? 0 : from + (size_t) expected.rm_so,
+                       expectedMissing ? 0 : from + (size_t) expected.rm_eo);
+                assert(0 && "match differs from POSIX");
+            }
+
+            compared++;
+        }
+
+        free_piece_table(table);
+        free_regex(regex);
+        regfree(&posix);
+    }
+
+    printf("%d searches compared\n", compared);
+#endif
+}
+
+// The reverse search finds the last start before before, which the forward
+// search (checked above) confirms position by position
+static void test_reverse_search(int iters) {
+    printf("=== test_reverse_search ===\n");
+
+    for (int it = 0; it < iters; it++) {
+        Pattern pattern = { "", "", 0 };
+
+        random_alternation(&pattern, 2);
+
+        if (pattern.full) {
+            continue;
+        }
+
+        Regex *regex = compile(pattern.vim);
+        char text[96];
+        size_t length = (size_t) rand() % sizeof(text);
+
+        random_text(text, length, "abcc  \n");
+        PieceTable *table = scattered_table(text, length);
+
+        for (size_t before = 0; before <= length; before++) {
+            long expected = -1;
+            RegexMatch match, forward;
+
+            for (size_t start = before; start-- > 0;) {
+                if (!regex_search_piece_table(regex, table, start, &forward) && forward.start == start) {
+                    expected = (long) start;
+                    break;
+                }
+            }
+
+            int missing = regex_search_piece_table_reverse(regex, table, before, &match);
+
+            if (missing != (expected < 0) || (!missing && (long) match.start != expected)) {
+                printf("PATTERN \"%s\" BEFORE %zu IN \"%.*s\": got %d %zu, expected %ld\n",
+                       pattern.vim, before, (int) length, text, missing, missing ? 0 : match.start, expected);
+                assert(0 && "reverse search differs");
+            }
+
+            if (!missing) {
+                assert(!regex_search_piece_table(regex, table, match.start, &forward) && forward.end == match.end);
+            }
+        }
+
+        free_piece_table(table);
+        free_regex(regex);
+    }
+}
+
+// A pattern whose DFA has thousands of states runs in a cache with room for
+// a few, which is dropped and built again as it goes. Same answers.
+static void test_bounded_cache() {
+    printf("=== test_bounded_cache ===\n");
+    const char *pattern = "\\(a\\|b\\)*a\\(a\\|b\\)\\{10}c";
+    size_t length = 200000;
+    char *text = malloc(length + 1);
+
+    random_text(text, length, "ab");
+    memcpy(text + length - 40, "aabababbbaac", 12);
+    text[length] = '\0';
+
+    PieceTable *table = initialize_piece_table(text, length);
+    Regex *unbounded = compile(pattern);
+    Regex *bounded = compile(pattern);
+    RegexMatch expected, match;
+
+    set_regex_cache_limit(bounded, 8 << 10);
+
+    assert(regex_search_piece_table(unbounded, table, 0, &expected) == 0);
+    assert(regex_search_piece_table(bounded, table, 0, &match) == 0);
+    assert(match.start == expected.start && match.end == expected.end);
+    assert(expected.start == 0 && expected.end == length - 28);
+    assert(regex_cache_flushes(unbounded) == 0);
+    printf("%zu cache flushes\n", regex_cache_flushes(bounded));
+    assert(regex_cache_flushes(bounded) > 0 && "the small cache had to be dropped");
+
+    free_regex(unbounded);
+    free_regex(bounded);
+    free_piece_table(table);
+    free(text);
+}
+
+// Patterns a backtracking matcher takes exponential time on: the automata
+// look at each byte a bounded number of times
+static void test_linear_time() {
+    printf("=== test_linear_time ===\n");
+    const char *patterns[] = { "\\(a*\\)*b", "\\(a\\|aa\\)*c", "\\(a\\+\\)\\+$x", "a\\{0,30}a\\{30}b" };
+    size_t length = (size_t) 1 << 20;
+    char *text = malloc(length);
+
+    memset(text, 'a', length);
+
+    PieceTable *table = initialize_piece_table(text, length);
+
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Regex *regex = compile(patterns[i]);
+        RegexMatch match;
+        clock_t start = clock();
+        int missing = regex_search_piece_table(regex, table, 0, &match);
+        double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        printf("\"%s\" over 1 MB of \"a\": %.1f ms\n", patterns[i], seconds * 1000);
+        assert(missing);
+        assert(seconds < 2.0 && "no pattern may take more than linear time");
+
+        free_regex(regex);
+    }
+
+    free_piece_table(table);
+    free(text);
+}
+
+static void test_streaming_scanner() {
+    printf("=== test_streaming_scanner ===\n");
+    Regex *regex = compile("b\\+c");
+    RegexScanner scanner;
+    int matched;
+
+    // One byte at a time: the match ends after the "c"
+    const char *text = "abbbcx";
+    regex_scanner_start(&scanner, regex, 0, 100, REGEX_EDGE);
+
+    for (size_t i = 0; i < 4; i++) {
+        assert(regex_scanner_feed(&scanner, text + i, 1, &matched) == 1 && !matched);
+    }
+
+    assert(regex_scanner_feed(&scanner, text + 4, 2, &matched) == 2 && matched && scanner.match == 105);
+    assert(scanner.offset == 106);
+
+    // At the end of what was fed, seen once the byte after it is known
+    regex_scanner_start(&scanner, regex, 0, 0, REGEX_EDGE);
+    assert(regex_scanner_feed(&scanner, "bc", 2, &matched) == 2 && !matched);
+    assert(regex_scanner_finish(&scanner, REGEX_EDGE) && scanner.match == 2);
+
+    // Reversed, the matches are where they start
+    regex_scanner_start(&scanner, regex, 1, 6, REGEX_EDGE);
+    assert(regex_scanner_feed(&scanner, text, 6, &matched) == 4 && matched && scanner.match == 3);
+    assert(regex_scanner_feed(&scanner, text, 2, &matched) == 1 && matched && scanner.match == 2);
+
+    free_regex(regex);
+}
+
+// A line of a table listed a few bytes of work at a time lists what
+// regex_line_matches does for the same line
+static void test_line_scan(int iters) {
+    printf("=== test_line_scan ===\n");
+    Vector *expected = initialize_vector("struct", sizeof(RegexMatch));
+    Vector *got = initialize_vector("struct", sizeof(RegexMatch));
+    size_t lines = 0;
+
+    for (int it = 0; it < iters; it++) {
+        Pattern pattern = { "", "", 0 };
+
+        random_alternation(&pattern, 2);
+
+        if (pattern.full) {
+            continue;
+        }
+
+        Regex *regex = compile(pattern.vim);
+        char text[96];
+        size_t length = (size_t) rand() % (sizeof(text) - 1);
+
+        random_text(text, length, "abcc  \n");
+        text[length] = '\0';
+
+        PieceTable *table = scattered_table(text, length);
+
+        for (size_t start = 0; start <= length;) {
+            const char *newline = memchr(text + start, '\n', length - start);
+            size_t end = newline != NULL ? (size_t) (newline - text) : length;
+            size_t budget = 1 + (size_t) rand() % 8;
+            RegexLineScan scan;
+            int done = 0;
+
+            vec_clear(expected);
+            vec_clear(got);
+            assert(!regex_line_matches(regex, text + start, end - start, start > 0 ? '\n' : REGEX_EDGE,
+                                       end < length ? '\n' : REGEX_EDGE, 1, expected));
+            assert(!regex_line_scan_start(&scan, regex, table, start, end));
+
+            while (!done) {
+                assert(regex_line_scan_step(&scan, budget, got, &done) <= budget && "A STEP WENT OVER ITS BUDGET");
+            }
+
+            regex_line_scan_stop(&scan);
+            assert(got->len == expected->len && "LINE SCAN LISTED OTHER MATCHES");
+
+            for (size_t i = 0; i < got->len; i++) {
+                RegexMatch want = ((RegexMatch *) expected->base)[i];
+                RegexMatch match = ((RegexMatch *) got->base)[i];
+
+                assert(match.start == start + want.start && match.end == start + want.end && "LINE SCAN LISTED OTHER MATCHES");
+            }
+
+            lines++;
+            start = end + 1;
+        }
+
+        free_piece_table(table);
+        free_regex(regex);
+    }
+
+    free_vector(expected);
+    free_vector(got);
+    printf("%zu lines compared\n", lines);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("REGEX TEST START\n");
+
+    test_syntax();
+    test_errors();
+    test_all_matches_of_a_line();
+    test_against_posix(3000);
+    test_reverse_search(300);
+    test_bounded_cache();
+    test_linear_time();
+    test_streaming_scanner();
+    test_line_scan(2000);
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
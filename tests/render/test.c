@@ -0,0 +1,1137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "xim.h"
+#include "console/headless.h"
+
+// ---------------------------------------------------------
+// Driving the editor through the headless console
+// ---------------------------------------------------------
+
+static void start_editor(Size2s size) {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize(size);
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+    assert(initVirtualBuffer() == 0);
+}
+
+static void stop_editor() {
+    killVirtualBuffer();
+    killEventLoop();
+    killConsole();
+}
+
+// Plays the script until it runs out (or until :q), stats cover only it
+static HeadlessConsoleStats run_script(const char *script) {
+    // Whatever was drawn before the script is not part of its cost
+    flushConsole();
+    resetHeadlessConsoleStats();
+
+    assert(queueHeadlessText(script) == 0);
+    Xim.signal = NOP_SIGNAL;
+    initializeXim();
+    flushConsole();
+
+    return headlessConsoleStats();
+}
+
+static void screen_row(int row, char *out) {
+    Cell *cells = headlessConsoleCells();
+    int width = console.state.Size.width;
+
+    for (int i = 0; i < width; i++) {
+        out[i] = cells[row * width + i].character;
+    }
+
+    // trailing blanks do not matter
+    int end = width;
+    while (end > 0 && out[end - 1] == ' ') end--;
+    out[end] = '\0';
+}
+
+static void assert_row(int row, const char *expected) {
+    char line[1024];
+    screen_row(row, line);
+
+    if (strcmp(line, expected) != 0) {
+        printf("ROW %d: got \"%s\", expected \"%s\"\n", row, line, expected);
+        assert(0 && "screen row differs");
+    }
+}
+
+static int highlighted(int row, int column) {
+    Cell *cell = headlessConsoleCells() + row * console.state.Size.width + column;
+
+    return (cell->attributes & (CELL_BACKGROUND_RED | CELL_BACKGROUND_GREEN)) != 0;
+}
+
+// The search count at the right end of the command line, as drawn so far
+static void search_count(char *out) {
+    char line[1024];
+    int width = console.state.Size.width;
+
+    renderVirtualBuffer(0);
+    screen_row(console.state.Size.height - 1, line);
+
+    const char *count = strrchr(line, '[');
+
+    strcpy(out, count != NULL && strlen(line) == (size_t) width ? count : "");
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_typing_reaches_the_screen() {
+    printf("=== test_typing_reaches_the_screen ===\n");
+    start_editor((Size2s) { 40, 10 });
+
+    run_script("ihello\nworld\x1b");
+    assert_row(0, "hello");
+    assert_row(1, "world");
+    assert_row(9, "");
+    assert(headlessConsoleCursor().x == 5 && headlessConsoleCursor().y == 1);
+
+    // Backspace joins the lines again
+    run_script("i\x08\x08\x08\x08\x08\x08");
+    assert_row(0, "hello");
+    assert_row(1, "");
+
+    run_script(":q\r");
+    assert(Xim.signal == EXIT_SIGNAL);
+
+    stop_editor();
+}
+
+static void test_scrolling_follows_the_cursor() {
+    printf("=== test_scrolling_follows_the_cursor ===\n");
+    start_editor((Size2s) { 30, 6 });
+
+    char script[2048] = "i";
+    for (int line = 0; line < 40; ++line) {
+        char text[32];
+        snprintf(text, sizeof(text), "line %d\n", line);
+        strcat(script, text);
+    }
+    strcat(script, "end");
+    run_script(script);
+
+    // 5 editor rows, the cursor sits on the last one
+    assert_row(0, "line 36");
+    assert_row(3, "line 39");
+    assert_row(4, "end");
+    assert(headlessConsoleCursor().y == 4);
+
+    stop_editor();
+}
+
+static void test_resize_repaints() {
+    printf("=== test_resize_repaints ===\n");
+    start_editor((Size2s) { 20, 5 });
+    run_script("iabc\ndef");
+
+    assert(queueHeadlessResize((Size2s) { 60, 12 }) == 0);
+    HeadlessConsoleStats stats = run_script("");
+    assert(console.state.Size.width == 60 && console.state.Size.height == 12);
+    assert(stats.cellsWritten >= 60 * 12 && "a resize repaints the whole screen");
+    assert_row(0, "abc");
+    assert_row(1, "def");
+
+    stop_editor();
+}
+
+// The cost of a keystroke must follow the edit, not the terminal size
+static HeadlessConsoleStats typing_cost(Size2s size, int keys) {
+    start_editor(size);
+    run_script("ifirst line\nsecond line\n");
+
+    char script[256];
+    for (int i = 0; i < keys; ++i) script[i] = (char)('a' + i % 26);
+    script[keys] = '\0';
+
+    HeadlessConsoleStats stats = run_script(script);
+    HeadlessConsoleStats worst = headlessConsoleMaxFrame();
+
+    printf("%4dx%-4d %d keys: %zu frames, %zu writes, %zu cells, %zu bytes, %.2f bytes/key (worst frame %zu bytes)\n",
+        size.width, size.height, keys, stats.frames, stats.writeCalls, stats.cellsWritten, stats.bytesWritten,
+        (double) stats.bytesWritten / (double) stats.keys, worst.bytesWritten);
+
+    stop_editor();
+    return stats;
+}
+
+static void test_keystroke_cost_is_independent_of_size() {
+    printf("=== test_keystroke_cost_is_independent_of_size ===\n");
+
+    int keys = 100;
+    HeadlessConsoleStats small = typing_cost((Size2s) { 80, 24 }, keys);
+    HeadlessConsoleStats large = typing_cost((Size2s) { 300, 100 }, keys);
+
+    assert(small.cellsWritten == large.cellsWritten && "keystroke cost depends on the terminal size");
+    assert(small.writeCalls == large.writeCalls);
+    // Each key changes one cell, plus the cursor move
+    assert(small.cellsWritten <= (size_t) keys * 2);
+    // Typing after the cursor needs no cursor motion or color changes
+    assert(small.bytesWritten <= small.keys * 2 && large.bytesWritten <= large.keys * 2);
+}
+
+static double elapsed_ms(clock_t start) {
+    return (double) (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// A paste is a few batches, each one insert and one frame, whatever its size
+static void test_paste_is_batched() {
+    printf("=== test_paste_is_batched ===\n");
+    start_editor((Size2s) { 80, 24 });
+
+    size_t length = 100 * 1024;
+    char *text = malloc(length + 1);
+
+    for (size_t i = 0; i < length; ++i) {
+        text[i] = (i % 64 == 63) ? '\n' : (char) ('a' + i % 26);
+    }
+    text[length] = '\0';
+
+    run_script("i");
+    flushConsole();
+    resetHeadlessConsoleStats();
+    assert(queueHeadlessPaste(text) == 0);
+
+    clock_t start = clock();
+    Xim.signal = NOP_SIGNAL;
+    initializeXim();
+    flushConsole();
+    double ms = elapsed_ms(start);
+
+    HeadlessConsoleStats stats = headlessConsoleStats();
+    printf("100 KB paste: %zu frames, %zu bytes out, %.2f ms\n", stats.frames, stats.bytesWritten, ms);
+
+    assert(piece_table_length(Xim.document) == length);
+    assert(stats.frames <= length / CONSOLE_INPUT_BATCH + 2);
+
+    char *document = malloc(length);
+    assert(piece_table_read(Xim.document, 0, document, length) == length);
+    assert(memcmp(document, text, length) == 0);
+
+    // The view follows the cursor to the end of the pasted text
+    assert_row(22, "");
+    assert(headlessConsoleCursor().x == 0 && headlessConsoleCursor().y == 22);
+
+    free(document);
+    free(text);
+    stop_editor();
+}
+
+// Pasted text never runs commands, even outside insert mode
+static void test_paste_outside_insert_mode() {
+    printf("=== test_paste_outside_insert_mode ===\n");
+    start_editor((Size2s) { 40, 6 });
+
+    assert(queueHeadlessPaste("i:q\nx") == 0);
+    run_script("");
+    assert(Xim.mode == NO_MODE);
+    assert(piece_table_length(Xim.document) == strlen("i:q\nx"));
+    assert_row(0, "i:q");
+    assert_row(1, "x");
+
+    stop_editor();
+}
+
+// Keys typed ahead of the editor are handled in order within one batch
+static void test_typed_ahead_keys() {
+    printf("=== test_typed_ahead_keys ===\n");
+    start_editor((Size2s) { 40, 10 });
+    setHeadlessInputBatch(CONSOLE_INPUT_BATCH);
+
+    HeadlessConsoleStats stats = run_script("ihello\nworld\x08\x08\x08ld\x1b:q!\r");
+    assert(stats.frames <= 2 && "one frame for the batch, one for the final flush");
+    assert_row(0, "hello");
+    assert_row(1, "wold");
+    assert(Xim.signal == EXIT_SIGNAL);
+
+    setHeadlessInputBatch(1);
+    stop_editor();
+}
+
+// Normal mode commands with counts, operators and multi key sequences
+static void test_normal_mode_commands() {
+    printf("=== test_normal_mode_commands ===\n");
+    start_editor((Size2s) { 40, 10 });
+
+    run_script("ione two three four\nsecond\nthird\x1b");
+    assert(Xim.mode == NO_MODE);
+
+    // gg goes to the top, 2dw deletes two words
+    run_script("gg0" "2dw");
+    assert_row(0, "three four");
+    assert(headlessConsoleCursor().x == 0 && headlessConsoleCursor().y == 0);
+
+    run_script("3x");
+    assert_row(0, "ee four");
+
+    // dd takes the whole line
+    run_script("jdd");
+    assert_row(0, "ee four");
+    assert_row(1, "third");
+    assert_row(2, "");
+
+    // G goes to the last line, o opens one below it
+    run_script("Goend\x1b" "ggOtop\x1b");
+    assert_row(0, "top");
+    assert_row(1, "ee four");
+    assert_row(2, "third");
+    assert_row(3, "end");
+
+    // An unbound key does nothing outside insert mode
+    run_script("q");
+    assert_row(0, "top");
+
+    // Backspace over the ':' leaves ex mode
+    run_script(":\x08");
+    assert(Xim.mode == NO_MODE);
+    run_script(":q\r");
+    assert(Xim.signal == EXIT_SIGNAL);
+
+    stop_editor();
+}
+
+// Ex commands change the document and errors show on the command line
+static void test_ex_commands() {
+    printf("=== test_ex_commands ===\n");
+    start_editor((Size2s) { 40, 8 });
+
+    run_script("ione\ntwo\nthree\nfour\x1b");
+    run_script(":2,3d\r");
+    assert_row(0, "one");
+    assert_row(1, "four");
+    assert(headlessConsoleCursor().y == 1);
+
+    run_script("ggmaj:'a,.j\r");
+    assert_row(0, "one four");
+    assert_row(1, "");
+
+    run_script(":frobnicate\r");
+    assert(Xim.mode == NO_MODE);
+    assert_row(7, "E492: Not an editor command");
+
+    // The next command line starts clean
+    run_script(":");
+    assert_row(7, ":");
+    run_script("\x1b");
+
+    // An empty pattern is the last search, ":s" alone the last substitution
+    run_script("/o\r" ":s//0/\r");
+    assert_row(0, "0ne four");
+    run_script(":s\r");
+    assert_row(0, "0ne f0ur");
+
+    stop_editor();
+}
+
+// A mark stays on its line as lines come and go above it, the journal
+// still hears of every change
+static void test_marks_follow_lines() {
+    printf("=== test_marks_follow_lines ===\n");
+    const char *path = "marks_test.txt";
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("one\ntwo\nthree\n", file);
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+
+    run_script("jjmagg" "Ozero\x1b" "gg'a");
+    assert_row(3, "three");
+    assert(headlessConsoleCursor().y == 3);
+
+    run_script("ggjdd" "gg'a");
+    assert_row(1, "two");
+    assert_row(2, "three");
+    assert(headlessConsoleCursor().y == 2);
+
+    run_script(":'ad\r");
+    assert_row(2, "");
+
+    close_journal(Xim.journal, 0);
+    Xim.journal = NULL;
+    stop_editor();
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    renderVirtualBuffer(0);
+    assert_row(0, "zero");
+    assert_row(1, "two");
+    assert_row(2, "");
+
+    // The marks were the other document's
+    run_script(":'a\r");
+    assert_row(7, "E20: Mark not set");
+    run_script("u");
+    assert_row(0, "one");
+
+    stop_editor();
+    remove(path);
+}
+
+// "/" and "?" move to the next match, n and N repeat, wrapping at the ends
+static void test_search() {
+    printf("=== test_search ===\n");
+    start_editor((Size2s) { 40, 8 });
+
+    run_script("ione two\nthree two\nfour\x1bgg0");
+    run_script("/two\r");
+    assert(headlessConsoleCursor().x == 4 && headlessConsoleCursor().y == 0);
+    run_script("n");
+    assert(headlessConsoleCursor().x == 6 && headlessConsoleCursor().y == 1);
+    run_script("n");
+    assert(headlessConsoleCursor().x == 4 && headlessConsoleCursor().y == 0);
+    assert_row(7, "search hit BOTTOM, continuing at TOP");
+    run_script("N");
+    assert(headlessConsoleCursor().x == 6 && headlessConsoleCursor().y == 1);
+
+    run_script("?our\r");
+    assert(headlessConsoleCursor().x == 1 && headlessConsoleCursor().y == 2);
+
+    run_script("/nowhere\r");
+    assert_row(7, "E486: Pattern not found");
+    assert(headlessConsoleCursor().y == 2);
+
+    // Patterns in ranges use the same search
+    run_script("gg:/thr/d\r");
+    assert_row(0, "one two");
+    assert_row(1, "four");
+
+    // Patterns are regular expressions, the bad ones are refused
+    run_script("gg0/\\<t\\w*o\\>\r");
+    assert(headlessConsoleCursor().x == 4 && headlessConsoleCursor().y == 0);
+    run_script("/\\(o\r");
+    assert_row(7, "E54: Unmatched \\(");
+    run_script("n");
+    assert(headlessConsoleCursor().x == 4 && headlessConsoleCursor().y == 0);
+
+    run_script(":%s/o\\+/0/g\r");
+    assert_row(0, "0ne tw0");
+    assert_row(1, "f0ur");
+    assert(headlessConsoleCursor().y == 1);
+
+    stop_editor();
+}
+
+// u takes back a whole insert or command, <C-r> brings it back
+static void test_undo_redo() {
+    printf("=== test_undo_redo ===\n");
+    start_editor((Size2s) { 40, 8 });
+
+    run_script("ione two\x1b" "othree\x08\x08\x08" "ee\x1b" "gg0x");
+    assert_row(0, "ne two");
+    assert_row(1, "thee");
+
+    run_script("u");
+    assert_row(0, "one two");
+    assert(headlessConsoleCursor().x == 0 && headlessConsoleCursor().y == 0);
+
+    // The whole insert, backspaces included, is one change
+    run_script("u");
+    assert_row(0, "one two");
+    assert_row(1, "");
+    assert(headlessConsoleCursor().y == 0);
+
+    run_script("\x12");
+    assert_row(1, "thee");
+    assert(headlessConsoleCursor().y == 0);
+
+    run_script(":%s/e/E/g\r");
+    assert_row(0, "onE two");
+    assert_row(1, "thEE");
+    run_script("u");
+    assert_row(0, "one two");
+    assert_row(1, "thee");
+
+    run_script("5u");
+    assert_row(0, "");
+    run_script("u");
+    assert_row(7, "Already at oldest change");
+
+    // A change after undoing drops what could be redone
+    run_script("2\x12" "ddu\x12\x12");
+    assert_row(0, "thee");
+    assert_row(7, "Already at newest change");
+
+    stop_editor();
+}
+
+// Edits made to a file come back when it is opened after a crash
+static void test_recovery_after_crash() {
+    printf("=== test_recovery_after_crash ===\n");
+    const char *path = "recovery_test.txt";
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("first\nsecond\n", file);
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    run_script("ddinew \x1b");
+    assert_row(0, "new second");
+
+    // Dying leaves the journal behind, quitting would remove it
+    close_journal(Xim.journal, 0);
+    Xim.journal = NULL;
+    stop_editor();
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    renderVirtualBuffer(0);
+    assert_row(0, "new second");
+    char line[64];
+    screen_row(7, line);
+    assert(!strncmp(line, "Recovered ", 10));
+
+    // One undo goes back to the file as it is on disk
+    run_script("u");
+    assert_row(0, "first");
+    assert_row(1, "second");
+
+    stop_editor();
+    remove(path);
+}
+
+// Another xim has the file open: its journal is not replayed as a crash's,
+// nor written over, this one goes without
+static void test_journal_held_elsewhere() {
+    printf("=== test_journal_held_elsewhere ===\n");
+    const char *path = "held_test.txt";
+    char *journal = journal_path(path);
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("first\nsecond\n", file);
+    fclose(file);
+
+    // The other one's changes, in its live journal
+    PieceTable *other = initialize_piece_table("first\nsecond\n", 13);
+    long holder;
+    JournalLock *lock = lock_journal(journal, &holder);
+
+    start_editor((Size2s) { 70, 8 });
+    Journal *live = open_journal(journal, other, lock);
+    assert(live != NULL);
+    assert(piece_table_delete(other, 0, 6) == 0);
+    runDeferredWork();
+
+    file = fopen(journal, "rb");
+    assert(file != NULL);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+
+    assert(openDocument(path) == 0);
+    renderVirtualBuffer(0);
+    assert_row(0, "first");
+    char line[80];
+    screen_row(7, line);
+    assert(!strncmp(line, "E325: Journal in use by process ", 32));
+    assert(Xim.journal == NULL);
+
+    run_script("ddinew \x1b");
+    assert_row(0, "new second");
+    run_script(":q!\r");
+
+    file = fopen(journal, "rb");
+    assert(file != NULL);
+    fseek(file, 0, SEEK_END);
+    assert(ftell(file) == size && "the other journal is left as it was");
+    fclose(file);
+
+    close_journal(live, 1);
+    free_piece_table(other);
+    stop_editor();
+    free(journal);
+    remove(path);
+}
+
+static void assert_file(const char *path, const char *expected) {
+    char text[256];
+    FILE *file = fopen(path, "rb");
+
+    assert(file != NULL);
+    text[fread(text, 1, sizeof(text) - 1, file)] = '\0';
+    fclose(file);
+    assert(!strcmp(text, expected));
+}
+
+// :w writes the document, naming the file the first time
+static void test_write_document() {
+    printf("=== test_write_document ===\n");
+    const char *path = "write_test.txt";
+    remove(path);
+    start_editor((Size2s) { 40, 8 });
+
+    run_script(":w\r");
+    assert_row(7, "E32: No file name");
+
+    run_script("ione\ntwo\x1b:w write_test.txt\r");
+    assert_row(7, "\"write_test.txt\" 2L, 7B written");
+    assert_file(path, "one\ntwo");
+    assert(Xim.path != NULL && Xim.journal != NULL);
+
+    run_script("ggdd:w\r");
+    assert_row(7, "\"write_test.txt\" 1L, 3B written");
+    assert_file(path, "two");
+
+    stop_editor();
+    remove(path);
+}
+
+// A big file is on screen before its lines are counted, the command line
+// follows the count, a jump to the end does not wait for it
+static void test_open_big_file() {
+    printf("=== test_open_big_file ===\n");
+    const char *path = "big_test.txt";
+    size_t lines = 4 << 20;
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    for (size_t i = 0; i < lines; i++) {
+        fprintf(file, "line %08zu\n", i);
+    }
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    clock_t start = clock();
+    assert(openDocument(path) == 0);
+    renderVirtualBuffer(0);
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    printf("first paint of %zu lines: %.2f ms\n", lines, seconds * 1000);
+    assert(!loader_done(Xim.loader) && "the first screen does not wait for the whole file");
+    assert_row(0, "line 00000000");
+    assert_row(6, "line 00000006");
+    char line[64];
+    screen_row(7, line);
+    assert(!strncmp(line, "\"big_test.txt\" ", 15) && line[strlen(line) - 1] == '%');
+
+    // The file ends in a newline, the last line is the empty one after it
+    run_script("G");
+    assert_row(5, "line 04194303");
+    assert_row(6, "");
+
+    for (int i = 0; i < 1000 && !loader_done(Xim.loader); i++) {
+        waitForEvents();
+    }
+
+    renderVirtualBuffer(0);
+    assert_row(7, "\"big_test.txt\" 4194304L, 58720256B");
+
+    stop_editor();
+    remove(path);
+}
+
+// A line wrapping into far more rows than the screen has is not scrolled
+// through a row at a time: the view starts right where the cursor shows on
+// its last row. '\r' takes no cell, the rows land the same with them.
+static void test_long_line_jump() {
+    printf("=== test_long_line_jump ===\n");
+    const char *path = "long_line.txt";
+    size_t cells = 10 << 20, width = 40;
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    for (size_t cell = 0; cell < cells; cell++) {
+        if (cell % 1000 == 999) {
+            fputc('\r', file);
+        }
+
+        fputc('a' + (int) (cell / width % 26), file);
+    }
+    fputs("\nend", file);
+    fclose(file);
+
+    start_editor((Size2s) { (short) width, 6 });
+    assert(openDocument(path) == 0);
+
+    clock_t start = clock();
+    run_script("G");
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("G below a line of %zu rows: %.2f ms\n", cells / width, seconds * 1000);
+
+    // The line's last rows, then the row its line break takes, then the cursor's
+    size_t rows = cells / width;
+    char row[64];
+
+    for (int i = 0; i < 3; i++) {
+        memset(row, 'a' + (int) ((rows - 3 + i) % 26), width);
+        row[width] = '\0';
+        assert_row(i, row);
+    }
+
+    assert_row(3, "");
+    assert_row(4, "end");
+    assert(headlessConsoleCursor().y == 4);
+
+    // From its top to its line break, on the row after its last cells
+    run_script("gg$");
+    memset(row, 'a' + (int) ((rows - 1) % 26), width);
+    assert_row(3, row);
+    assert_row(4, "");
+    assert(headlessConsoleCursor().y == 4 && headlessConsoleCursor().x == 0);
+
+    stop_editor();
+    remove(path);
+}
+
+// Matches light up while the pattern is typed, the cursor goes to the one a
+// search would and back on <Esc>
+static void test_incremental_search() {
+    printf("=== test_incremental_search ===\n");
+    start_editor((Size2s) { 40, 8 });
+    char count[64];
+
+    run_script("ione two\nthree two\nfour\x1bgg0");
+    run_script("/tw");
+    assert(Xim.mode == EX_MODE);
+    assert(highlighted(0, 4) && highlighted(0, 5) && !highlighted(0, 6));
+    assert(highlighted(1, 6) && highlighted(1, 7) && !highlighted(0, 0));
+    assert(Xim.documentCursor == 4);
+    assert(headlessConsoleCursor().x == 3 && headlessConsoleCursor().y == 7);
+    search_count(count);
+    assert(!strcmp(count, "[1/2]"));
+
+    run_script("x");
+    assert(!highlighted(0, 4) && Xim.documentCursor == 0);
+    search_count(count);
+    assert(!strcmp(count, "[0/0]"));
+
+    run_script("\x08");
+    assert(highlighted(0, 4) && Xim.documentCursor == 4);
+
+    // A pattern that does not compile yet shows nothing
+    run_script("\\(");
+    assert(!highlighted(0, 4) && Xim.documentCursor == 0);
+    search_count(count);
+    assert(!strcmp(count, ""));
+
+    run_script("\x1b");
+    assert(Xim.mode == NO_MODE && !highlighted(0, 4));
+    assert(headlessConsoleCursor().x == 0 && headlessConsoleCursor().y == 0);
+
+    // "?" takes the last match above the cursor, <CR> searches from the cursor
+    // the prompt opened on and ends up there too
+    run_script("j0?o");
+    assert(Xim.documentCursor == 6);
+    search_count(count);
+    assert(!strcmp(count, "[2/4]"));
+    run_script("\r");
+    assert(!highlighted(0, 6));
+    assert(headlessConsoleCursor().x == 6 && headlessConsoleCursor().y == 0);
+
+    // Nothing above it, it wraps around to the last one
+    run_script("gg0?o");
+    assert(Xim.documentCursor == 19);
+    search_count(count);
+    assert(!strcmp(count, "[4/4]"));
+    run_script("\x1b");
+
+    stop_editor();
+}
+
+// A big document is counted a slice at a time between keys: a key only
+// redraws the view, the count comes in over later turns of the loop
+static void test_incremental_search_is_lazy() {
+    printf("=== test_incremental_search_is_lazy ===\n");
+    const char *path = "incremental_search_test.txt";
+    size_t lines = 1 << 17;
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+
+    for (size_t i = 0; i < lines; i++) {
+        fprintf(file, "%06zu some text to fill the line up with%s\n", i, i % 100 == 99 ? " needle" : "");
+    }
+
+    fclose(file);
+    start_editor((Size2s) { 60, 10 });
+    assert(openDocument(path) == 0);
+
+    run_script("/needl");
+    char count[64];
+    char expected[64];
+
+    snprintf(expected, sizeof(expected), "[1/%zu]", lines / 100);
+    search_count(count);
+    assert(!strcmp(count, expected));
+
+    char key = 'e';
+    size_t turns = 0;
+
+    vec_push_back(Xim.writtenCommand, &key);
+    assert(updateIncrementalSearch() == 0);
+    search_count(count);
+    assert(!strncmp(count, "[?/>", 4) && "the key does not wait for the count");
+
+    while (strstr(count, "/>") != NULL && turns < 1000) {
+        runDeferredWork();
+        search_count(count);
+        turns++;
+    }
+
+    printf("counted in %zu turns\n", turns);
+    assert(turns > 4 && !strcmp(count, expected));
+    assert(Xim.documentCursor == piece_table_line_start(Xim.document, 99) + 42);
+
+    run_script("\x1b");
+    assert(Xim.documentCursor == 0);
+
+    stop_editor();
+    remove(path);
+}
+
+// A line of megabytes is no more than a slice either: its matches are
+// listed over several turns, the key after it is taken in between
+static void test_incremental_search_long_line() {
+    printf("=== test_incremental_search_long_line ===\n");
+    const char *path = "incremental_search_line.txt";
+    size_t needles = 1 << 14;
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+
+    for (size_t i = 0; i < needles; i++) {
+        fprintf(file, "%06zu some text to fill the line up with needle ", i);
+    }
+
+    fprintf(file, "\n");
+    fclose(file);
+    start_editor((Size2s) { 60, 10 });
+    assert(openDocument(path) == 0);
+
+    run_script("/needl");
+    char count[64];
+    char expected[64];
+    char key = 'e';
+    size_t turns = 0;
+
+    snprintf(expected, sizeof(expected), "[1/%zu]", needles);
+    search_count(count);
+    assert(!strcmp(count, expected));
+
+    vec_push_back(Xim.writtenCommand, &key);
+    assert(updateIncrementalSearch() == 0);
+    runDeferredWork();
+    search_count(count);
+    assert(!strncmp(count, "[?/>", 4) && "one slice does not list the whole line");
+
+    while (strstr(count, "/>") != NULL && turns < 100000) {
+        runDeferredWork();
+        search_count(count);
+        turns++;
+    }
+
+    printf("listed in %zu turns\n", turns);
+    assert(turns > 4 && !strcmp(count, expected));
+    assert(Xim.documentCursor == 42);
+
+    run_script("\x1b");
+    stop_editor();
+    remove(path);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+// Keeps the headless wait sleeping instead of returning at once, so what
+// another thread posts is what ends it
+static int keep_waiting(void *data) {
+    (void) data;
+    return 1;
+}
+
+// "F" keeps the view at the end of a growing file, the next key stops it
+static void test_follow_file() {
+    printf("=== test_follow_file ===\n");
+    const char *path = "follow_render.log";
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    for (int i = 0; i < 10; i++) {
+        fprintf(file, "log %d\n", i);
+    }
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    run_script("F");
+    assert_row(0, "log 4");
+    assert_row(5, "log 9");
+    assert_row(6, "");
+    assert_row(7, "Waiting for data... (any key stops)");
+    assert(follower_watching(Xim.follower) && Xim.journal != NULL);
+
+    file = fopen(path, "ab");
+    fprintf(file, "log 10\nlog 11\n");
+    fclose(file);
+
+    int timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) < 74; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    renderVirtualBuffer(0);
+    assert(piece_table_length(Xim.document) == 74);
+    assert_row(0, "log 6");
+    assert_row(5, "log 11");
+    assert_row(6, "");
+
+    // Truncated (a log rotated by copying), the file is read again
+    file = fopen(path, "wb");
+    fprintf(file, "fresh\n");
+    fclose(file);
+
+    timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) != 6; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    renderVirtualBuffer(0);
+    assert_row(0, "fresh");
+    assert_row(1, "");
+    assert_row(7, "File truncated, read again");
+
+    file = fopen(path, "ab");
+    fprintf(file, "log 10\nlog 11\n");
+    fclose(file);
+
+    timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) < 20; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+    renderVirtualBuffer(0);
+    assert_row(2, "log 11");
+
+    // The key only stops the following, the document is left as it is
+    run_script("x");
+    assert(!follower_watching(Xim.follower));
+    assert(piece_table_length(Xim.document) == 20);
+    assert_row(7, "");
+
+    run_script("ggx");
+    assert_row(0, "resh");
+    run_script(":q!\r");
+
+    stop_editor();
+    remove(path);
+}
+
+// What came in while following is the file's: edits after it are
+// recovered onto the longer file, writing and quitting removes the journal.
+// Changes that were not written are never followed, a file that got
+// shorter would take them with it.
+static void test_follow_keeps_the_journal() {
+    printf("=== test_follow_keeps_the_journal ===\n");
+    const char *path = "follow_journal.log";
+    char *journal = journal_path(path);
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("one\ntwo\n", file);
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    run_script("F");
+
+    file = fopen(path, "ab");
+    fputs("three\nfour\n", file);
+    fclose(file);
+
+    int timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) < 19; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    run_script("xggiX\x1b");
+    assert_row(0, "Xone");
+    assert_row(3, "four");
+
+    // Going without a quit keeps what was not written
+    stop_editor();
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    renderVirtualBuffer(0);
+    assert_row(0, "Xone");
+    assert_row(2, "three");
+    assert_row(3, "four");
+    char line[64];
+    screen_row(7, line);
+    assert(!strncmp(line, "Recovered ", 10));
+
+    // The recovered changes are not written, they are not followed
+    run_script("F");
+    assert(Xim.follower == NULL || !follower_watching(Xim.follower));
+    assert_row(7, "E37: No write since last change");
+
+    // Written and quit, nothing is left behind
+    run_script("x:x\r");
+    assert(Xim.signal == EXIT_SIGNAL);
+    stop_editor();
+    assert(fopen(journal, "rb") == NULL);
+
+    char written[32] = { 0 };
+    file = fopen(path, "rb");
+    assert(fread(written, 1, sizeof(written) - 1, file) == 19);
+    fclose(file);
+    assert(!strcmp(written, "one\ntwo\nthree\nfour\n"));
+
+    free(journal);
+    remove(path);
+}
+
+// Written over, the file is a new one: what is appended to it comes in,
+// after what was written and what came in before
+static void test_follow_after_write() {
+    printf("=== test_follow_after_write ===\n");
+    const char *path = "follow_write.log";
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("one\n", file);
+    fclose(file);
+
+    start_editor((Size2s) { 40, 8 });
+    assert(openDocument(path) == 0);
+    run_script("F");
+
+    file = fopen(path, "ab");
+    fputs("two\n", file);
+    fclose(file);
+
+    int timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) < 8; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    run_script("xggiX\x1b:w\r");
+    run_script("F");
+    assert(follower_watching(Xim.follower));
+
+    file = fopen(path, "ab");
+    fputs("three\n", file);
+    fclose(file);
+
+    timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && piece_table_length(Xim.document) < 15; i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    renderVirtualBuffer(0);
+    assert(piece_table_length(Xim.document) == 15);
+    assert_row(0, "Xone");
+    assert_row(1, "two");
+    assert_row(2, "three");
+
+    // Stopped and written once more, the edit before is still undone right
+    run_script("xu");
+    assert_row(0, "one");
+    run_script(":x\r");
+    assert(Xim.signal == EXIT_SIGNAL);
+    stop_editor();
+
+    char written[32] = { 0 };
+    file = fopen(path, "rb");
+    assert(fread(written, 1, sizeof(written) - 1, file) == 14);
+    fclose(file);
+    assert(!strcmp(written, "one\ntwo\nthree\n"));
+
+    remove(path);
+}
+
+#ifdef __linux__
+// A followed file that is moved away stops the following by itself, keys
+// are keys again
+static void test_follow_gone() {
+    printf("=== test_follow_gone ===\n");
+    const char *path = "follow_gone.log";
+    const char *moved = "follow_gone.moved";
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    fputs("one\n", file);
+    fclose(file);
+
+    start_editor((Size2s) { 50, 6 });
+    assert(openDocument(path) == 0);
+    run_script("F");
+
+    file = fopen(path, "ab");
+    fputs("two\n", file);
+    fclose(file);
+    assert(rename(path, moved) == 0);
+
+    int timer = addTimer(10, keep_waiting, NULL);
+    for (int i = 0; i < 500 && follower_watching(Xim.follower); i++) {
+        waitForEvents();
+    }
+    cancelTimer(timer);
+
+    renderVirtualBuffer(0);
+    assert(!follower_watching(Xim.follower));
+    assert_row(1, "two");
+    assert_row(5, "File moved or deleted, not followed anymore");
+
+    run_script("ggx");
+    assert_row(0, "ne");
+    run_script(":q!\r");
+
+    stop_editor();
+    remove(moved);
+}
+#endif
+
+int main(void) {
+    printf("RENDER TEST START\n");
+
+    test_typing_reaches_the_screen();
+    test_scrolling_follows_the_cursor();
+    test_resize_repaints();
+    test_keystroke_cost_is_independent_of_size();
+    test_paste_is_batched();
+    test_paste_outside_insert_mode();
+    test_typed_ahead_keys();
+    test_normal_mode_commands();
+    test_ex_commands();
+    test_marks_follow_lines();
+    test_search();
+    test_undo_redo();
+    test_recovery_after_crash();
+    test_journal_held_elsewhere();
+    test_write_document();
+    test_open_big_file();
+    test_long_line_jump();
+    test_incremental_search();
+    test_incremental_search_is_lazy();
+    test_incremental_search_long_line();
+    test_follow_file();
+    test_follow_keeps_the_journal();
+    test_follow_after_write();
+#ifdef __linux__
+    test_follow_gone();
+#endif
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
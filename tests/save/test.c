@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "console.h"
+#include "event_loop.h"
+#include "console/headless.h"
+#include "io/save.h"
+#include "io/journal.h"
+#include "io/file_source.h"
+#include "structures/piece_table.h"
+
+static const char *SaveFile = "save_test.txt";
+static const char *JournalFile = ".save_test.txt.swp";
+
+// ---------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------
+
+static void start_loop() {
+    console.backend = &headlessConsoleBackend;
+    setHeadlessConsoleSize((Size2s) { 20, 5 });
+    assert(initializeConsole() == 0);
+    assert(initializeEventLoop() == 0);
+}
+
+static void stop_loop() {
+    killEventLoop();
+    killConsole();
+}
+
+static void write_file(const char *path, const char *text, size_t length) {
+    FILE *file = fopen(path, "wb");
+
+    assert(file != NULL);
+    assert(fwrite(text, 1, length, file) == length);
+    fclose(file);
+}
+
+static char *contents(PieceTable *table) {
+    size_t length = piece_table_length(table);
+    char *text = malloc(length + 1);
+
+    assert(piece_table_read(table, 0, text, length) == length);
+    text[length] = '\0';
+
+    return text;
+}
+
+// The file on disk is the document, byte for byte
+static void assert_saved(const char *path, PieceTable *table) {
+    FileSource *source = open_file_source(path);
+    char *want = contents(table);
+
+    assert(source != NULL);
+    assert(source->length == piece_table_length(table));
+    assert(source->length == 0 || memcmp(source->data, want, source->length) == 0);
+
+    free(want);
+    close_file_source(source);
+}
+
+static int exists(const char *path) {
+    struct stat info;
+
+    return stat(path, &info) == 0;
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+// Many small pieces go out in batches, what is written is the document
+static void test_save_pieces(size_t edits) {
+    printf("=== test_save_pieces (edits=%zu) ===\n", edits);
+    srand((unsigned) time(NULL));
+
+    const char *original = "the original text\nof the document\n";
+    PieceTable *table = initialize_piece_table(original, strlen(original));
+
+    for (size_t i = 0; i < edits; i++) {
+        size_t length = piece_table_length(table);
+        char text[2] = { (char) ('a' + rand() % 26), '\n' };
+
+        if (rand() % 4 == 0 && length > 0) {
+            assert(piece_table_delete(table, (size_t) rand() % length, 1) == 0);
+        } else {
+            assert(piece_table_insert(table, (size_t) rand() % (length + 1), text, 1 + (size_t) (rand() % 2)) == 0);
+        }
+    }
+
+    remove(SaveFile);
+    assert(save_piece_table(table, SaveFile, NULL) == 0);
+    assert_saved(SaveFile, table);
+
+    // Emptied, the file is too
+    assert(piece_table_delete(table, 0, piece_table_length(table)) == 0);
+    assert(save_piece_table(table, SaveFile, NULL) == 0);
+    assert_saved(SaveFile, table);
+
+    char *temporary = hidden_sibling_path(SaveFile, ".new");
+    assert(!exists(temporary) && "the file being written was renamed in");
+    free(temporary);
+
+    free_piece_table(table);
+    remove(SaveFile);
+}
+
+// Saving over the file the original is mapped from: long spans of it are
+// copied file to file, the mapping stays readable, the permissions stay
+static void test_save_over_original() {
+    printf("=== test_save_over_original ===\n");
+    size_t length = 8 << 20;
+    char *text = malloc(length);
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = i % 64 == 63 ? '\n' : (char) ('a' + i % 26);
+    }
+
+    write_file(SaveFile, text, length);
+    assert(chmod(SaveFile, 0640) == 0);
+
+    FileSource *source = open_file_source(SaveFile);
+    PieceTable *table = initialize_piece_table(source->data, source->length);
+
+    assert(piece_table_insert(table, length / 2, "inserted", 8) == 0);
+    assert(piece_table_delete(table, 100, 1000) == 0);
+    assert(piece_table_insert(table, 0, "start\n", 6) == 0);
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert_saved(SaveFile, table);
+
+    // The old file is still what the table reads
+    assert(!memcmp(source->data, text, length));
+
+    struct stat info;
+    assert(stat(SaveFile, &info) == 0);
+    assert((info.st_mode & 07777) == 0640);
+
+    // Saved twice, the second time from the same (now replaced) original
+    assert(piece_table_delete(table, 0, 6) == 0);
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert_saved(SaveFile, table);
+
+    free_piece_table(table);
+    close_file_source(source);
+    free(text);
+    remove(SaveFile);
+}
+
+// Written over the file the table was opened from, then opened again the
+// way the next session would: it is the document. The first table still
+// reads what it did, wherever its original lives now.
+static void test_save_and_reopen() {
+    printf("=== test_save_and_reopen ===\n");
+    const char *original = "first line\nsecond line\n";
+    write_file(SaveFile, original, strlen(original));
+
+    FileSource *source = open_file_source(SaveFile);
+    PieceTable *table = initialize_piece_table(source->data, source->length);
+
+    assert(piece_table_enable_history(table) == 0);
+    assert(piece_table_insert(table, 11, "new\n", 4) == 0);
+    assert(piece_table_delete(table, 0, 6) == 0);
+    piece_table_commit(table);
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert_saved(SaveFile, table);
+
+    char *want = contents(table);
+    assert(!strcmp(want, "line\nnew\nsecond line\n"));
+
+    FileSource *reopened = open_file_source(SaveFile);
+    PieceTable *again = initialize_piece_table(reopened->data, reopened->length);
+    char *got = contents(again);
+    assert(!strcmp(got, want));
+    free(got);
+
+    // Saved over once more from the reopened file
+    assert(piece_table_insert(again, 0, "top\n", 4) == 0);
+    assert(save_piece_table(again, SaveFile, reopened) == 0);
+    assert_saved(SaveFile, again);
+
+    // And again from the first table, its undo reads the first original
+    size_t offset;
+    assert(piece_table_undo(table, &offset) == 0);
+    got = contents(table);
+    assert(!strcmp(got, original));
+    free(got);
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert_saved(SaveFile, table);
+
+    free(want);
+    free_piece_table(again);
+    free_piece_table(table);
+    close_file_source(reopened);
+    close_file_source(source);
+    remove(SaveFile);
+}
+
+#ifndef _WIN32
+// What names the file keeps naming it: a symbolic link stays a link to the
+// file written, every hard link sees the new text, the owner stays
+static void test_save_keeps_links() {
+    printf("=== test_save_keeps_links ===\n");
+    const char *symbolic = "save_test.link";
+    const char *other = "save_test.other";
+    const char *original = "linked text\n";
+    struct stat info;
+
+    remove(symbolic);
+    remove(other);
+    write_file(SaveFile, original, strlen(original));
+    assert(symlink(SaveFile, symbolic) == 0);
+
+    PieceTable *table = initialize_piece_table(original, strlen(original));
+    assert(piece_table_insert(table, 0, "more ", 5) == 0);
+    assert(save_piece_table(table, symbolic, NULL) == 0);
+    assert(lstat(symbolic, &info) == 0 && S_ISLNK(info.st_mode));
+    assert_saved(SaveFile, table);
+    free_piece_table(table);
+
+    // Given away (where we may), the file is still theirs after a save
+    int chowned = chown(SaveFile, 4321, 4321) == 0;
+    table = initialize_piece_table(original, strlen(original));
+    assert(save_piece_table(table, SaveFile, NULL) == 0);
+    assert(stat(SaveFile, &info) == 0);
+    assert(!chowned || (info.st_uid == 4321 && info.st_gid == 4321));
+    free_piece_table(table);
+
+    // Hard linked and saved from its own mapping: written in place, the
+    // table still reads the text it had
+    assert(link(SaveFile, other) == 0);
+    FileSource *source = open_file_source(SaveFile);
+    table = initialize_piece_table(source->data, source->length);
+    assert(piece_table_enable_history(table) == 0);
+    assert(piece_table_delete(table, 0, 7) == 0);
+    assert(piece_table_insert(table, 0, "some longer ", 12) == 0);
+    piece_table_commit(table);
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert_saved(SaveFile, table);
+    assert_saved(other, table);
+
+    size_t offset;
+    assert(piece_table_undo(table, &offset) == 0);
+    char *got = contents(table);
+    assert(!strcmp(got, original));
+    free(got);
+    assert(save_piece_table(table, other, source) == 0);
+    assert_saved(SaveFile, table);
+
+    free_piece_table(table);
+    close_file_source(source);
+    remove(symbolic);
+    remove(other);
+    remove(SaveFile);
+}
+#endif
+
+// A file that can't be written leaves nothing behind
+static void test_save_fails() {
+    printf("=== test_save_fails ===\n");
+    PieceTable *table = initialize_piece_table("text", 4);
+
+    assert(save_piece_table(table, "no_such_directory/file.txt", NULL) != 0);
+    assert(!exists("no_such_directory"));
+
+    free_piece_table(table);
+}
+
+// After a save the journal is replayed onto the saved file, not the old one
+static void test_journal_after_save() {
+    printf("=== test_journal_after_save ===\n");
+    start_loop();
+
+    const char *original = "one\ntwo\nthree\n";
+    write_file(SaveFile, original, strlen(original));
+
+    FileSource *source = open_file_source(SaveFile);
+    PieceTable *table = initialize_piece_table(source->data, source->length);
+    Journal *journal = open_journal(JournalFile, table, NULL);
+
+    assert(piece_table_enable_history(table) == 0);
+    assert(piece_table_insert(table, 4, "2 ", 2) == 0);
+    assert(piece_table_delete(table, 0, 4) == 0);
+    runDeferredWork();
+
+    assert(save_piece_table(table, SaveFile, source) == 0);
+    assert(journal_rebase(journal) == 0);
+    assert(piece_table_insert(table, piece_table_length(table), "four\n", 5) == 0);
+    runDeferredWork();
+
+    // Edits before the save are in the file, the ones after in the journal
+    FileSource *saved = open_file_source(SaveFile);
+    PieceTable *recovered = initialize_piece_table(saved->data, saved->length);
+    size_t changes;
+    char *want = contents(table);
+
+    assert(replay_journal(JournalFile, recovered, &changes) == 0 && changes == 1);
+    char *got = contents(recovered);
+    assert(!strcmp(want, got));
+    free(got);
+    free_piece_table(recovered);
+
+    // Compacted, the snapshot is of the saved file as well
+    set_journal_compact_size(journal, 1024);
+
+    while (!journal_compacting(journal)) {
+        assert(piece_table_insert(table, 2, "some text", 9) == 0);
+        assert(piece_table_delete(table, 2, 9) == 0);
+        runDeferredWork();
+    }
+
+    for (int i = 0; i < 5000 && journal_compacting(journal); i++) {
+        waitForEvents();
+    }
+
+    assert(!journal_compacting(journal));
+    recovered = initialize_piece_table(saved->data, saved->length);
+    assert(replay_journal(JournalFile, recovered, &changes) == 0);
+    got = contents(recovered);
+    assert(!strcmp(want, got));
+
+    free(got);
+    free(want);
+    free_piece_table(recovered);
+    close_journal(journal, 1);
+    free_piece_table(table);
+    close_file_source(saved);
+    close_file_source(source);
+    remove(SaveFile);
+    stop_loop();
+}
+
+int main(void) {
+    printf("SAVE TEST START\n");
+
+    test_save_pieces(2000);
+    test_save_over_original();
+    test_save_and_reopen();
+#ifndef _WIN32
+    test_save_keeps_links();
+#endif
+    test_save_fails();
+    test_journal_after_save();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "structures/piece_table.h"
+#include "text/search.h"
+
+// ---------------------------------------------------------
+// Reference: every position in turn
+// ---------------------------------------------------------
+
+static long naive_find(const char *text, size_t length, const char *needle, size_t needleLength, size_t from) {
+    for (size_t i = from; i + needleLength <= length; ++i) {
+        if (!memcmp(text + i, needle, needleLength)) {
+            return (long) i;
+        }
+    }
+
+    return -1;
+}
+
+static long naive_find_reverse(const char *text, size_t length, const char *needle, size_t needleLength, size_t before) {
+    for (size_t i = before; i-- > 0;) {
+        if (i + needleLength <= length && !memcmp(text + i, needle, needleLength)) {
+            return (long) i;
+        }
+    }
+
+    return -1;
+}
+
+static void random_text(char *text, size_t length, int alphabet) {
+    for (size_t i = 0; i < length; ++i) {
+        text[i] = (char) ('a' + rand() % alphabet);
+    }
+}
+
+// A needle cut out of the text most of the time, so there is something to find
+static size_t random_needle(const char *text, size_t length, char *needle, size_t maxLength, int alphabet) {
+    size_t needleLength = 1 + (size_t) rand() % maxLength;
+
+    if (length >= needleLength && rand() % 4 != 0) {
+        memcpy(needle, text + (size_t) rand() % (length - needleLength + 1), needleLength);
+    } else {
+        random_text(needle, needleLength, alphabet);
+    }
+
+    return needleLength;
+}
+
+// ---------------------------------------------------------
+// Tests
+// ---------------------------------------------------------
+
+static void test_kernels_against_naive(int iters) {
+    printf("=== test_kernels_against_naive (searcher=%d) ===\n", (int) substring_searcher_in_use());
+    srand((unsigned) time(NULL));
+
+    char *buffer = malloc(400 + 64);
+    char needle[96];
+
+    assert(find_substring("abc", 3, "", 0) != NULL);
+    assert(find_substring("", 0, "a", 1) == NULL);
+    assert(find_substring_reverse("ab", 2, "abc", 3) == NULL);
+
+    for (int it = 0; it < iters; ++it) {
+        size_t length = (size_t) (rand() % 400);
+        size_t shift = (size_t) (rand() % 64);
+        int alphabet = 1 + rand() % 4 * 8;
+        char *text = buffer + shift;
+
+        random_text(text, length, alphabet);
+        size_t needleLength = random_needle(text, length, needle, sizeof(needle), alphabet);
+
+        const char *first = find_substring(text, length, needle, needleLength);
+        const char *last = find_substring_reverse(text, length, needle, needleLength);
+        long expectedFirst = naive_find(text, length, needle, needleLength, 0);
+        long expectedLast = naive_find_reverse(text, length, needle, needleLength, length);
+
+        assert((first ? first - text : -1) == expectedFirst && "forward search differs from the naive one");
+        assert((last ? last - text : -1) == expectedLast && "reverse search differs from the naive one");
+    }
+
+    free(buffer);
+}
+
+// Lots of small inserts cut the document into short pieces, so most matches
+// cross a boundary or several
+static void test_matches_across_pieces(int iters) {
+    printf("=== test_matches_across_pieces ===\n");
+
+    for (int it = 0; it < iters; ++it) {
+        int alphabet = 2 + rand() % 3;
+        char original[512];
+        size_t length = (size_t) (rand() % sizeof(original));
+
+        random_text(original, length, alphabet);
+        PieceTable *table = initialize_piece_table(original, length);
+        assert(table != NULL);
+
+        int inserts = rand() % 120;
+        for (int i = 0; i < inserts; ++i) {
+            char piece[4];
+            size_t pieceLength = 1 + (size_t) rand() % sizeof(piece);
+
+            random_text(piece, pieceLength, alphabet);
+            assert(piece_table_insert(table, (size_t) rand() % (piece_table_length(table) + 1), piece, pieceLength) == 0);
+        }
+
+        size_t total = piece_table_length(table);
+        char *document = malloc(total + 1);
+        assert(piece_table_read(table, 0, document, total) == total);
+
+        for (int query = 0; query < 20; ++query) {
+            char needle[24];
+            size_t needleLength = random_needle(document, total, needle, sizeof(needle), alphabet);
+            size_t from = (size_t) rand() % (total + 2);
+            size_t found;
+
+            long expected = naive_find(document, total, needle, needleLength, from);
+            int missing = search_piece_table(table, from, needle, needleLength, &found);
+            assert(missing == (expected < 0));
+            assert(missing || (long) found == expected);
+
+            expected = naive_find_reverse(document, total, needle, needleLength, from < total ? from : total);
+            missing = search_piece_table_reverse(table, from, needle, needleLength, &found);
+            assert(missing == (expected < 0));
+            assert(missing || (long) found == expected);
+        }
+
+        free(document);
+        free_piece_table(table);
+    }
+}
+
+// A rare word at the very end of a big document: the time is the scan
+static void test_throughput() {
+    printf("=== test_throughput ===\n");
+    size_t length = (size_t) 64 << 20;
+    char *text = malloc(length);
+    const char *token = "XIM-7f3a-needle";
+
+    for (size_t i = 0; i < length; ++i) {
+        text[i] = i % 80 == 79 ? '\n' : (char) ('a' + (i * 7 + i / 13) % 26);
+    }
+
+    memcpy(text + length - strlen(token) - 1, token, strlen(token));
+
+    PieceTable *table = initialize_piece_table(text, length);
+    assert(table != NULL);
+
+    // Split the document once near the middle so the search crosses pieces
+    assert(piece_table_insert(table, length / 2, "\n", 1) == 0);
+
+    size_t found = 0;
+    clock_t start = clock();
+    int rounds = 5;
+    int missing = 0;
+
+    for (int i = 0; i < rounds; ++i) {
+        missing |= search_piece_table(table, 0, token, strlen(token), &found);
+    }
+
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC / rounds;
+    double gigabytes = (double) length / (1 << 30);
+
+    printf("64 MB searched in %.2f ms, %.2f GB/s\n", seconds * 1000, gigabytes / seconds);
+    assert(!missing && found == length - strlen(token));
+
+    size_t back;
+    assert(search_piece_table_reverse(table, length + 1, token, strlen(token), &back) == 0 && back == found);
+
+    free_piece_table(table);
+    free(text);
+}
+
+// ---------------------------------------------------------
+// main
+// ---------------------------------------------------------
+
+int main(void) {
+    printf("SEARCH TEST START\n");
+
+    test_kernels_against_naive(20000);
+    test_matches_across_pieces(300);
+    test_throughput();
+
+    printf("ALL TESTS PASSED\n");
+    return 0;
+}